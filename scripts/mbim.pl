@@ -10,6 +10,7 @@ use Encode;
 use Devel::SimpleTrace;
 use UUID::Tiny ':std';
 use Net::IP;
+use Socket;
 
 # default, will be overridden by ioctl if supported
 my $maxctrl = 4096;
@@ -44,7 +45,7 @@ Usage: $0 [options]  open|caps|pin|close|connect|disconnect|attach|detach|getreg
 
 Where [options] are
 
-  --device=<cdc-wdm> (defaults to $mgmt)
+  --device=<cdc-wdm|mbim-proxy socket> (defaults to $mgmt)
   --pin=<code>
   --apn=<apn>
   --session=<id>
@@ -1488,6 +1489,7 @@ sub decode_mbim {
 
 	my ($cid, $status, $infolen) = unpack("VVV", substr($msg, 36));
 	my $info = substr($msg, 48);
+	$info = substr($info, 0, $infolen) if (length($info) > $infolen); # padding
 	print &cid_to_string($service, $cid), " ($cid)\n";
 	if ($type == 0x80000003) {
 	    print &status_to_string($status), " ($status)\n";
@@ -1497,7 +1499,7 @@ sub decode_mbim {
 	print "InformationBuffer [$infolen]:\n";
 
 	if ($infolen != length($info)) {
-	    print "Fragmented data is not yet supported\n";
+	    print "Truncated InformationBuffer: ", length($info), " < $infolen\n";
 	} elsif (exists($decoder{$service})) {
 	    $decoder{$service}($cid, $info, $type == 0x00000003 && $status) if $infolen; # Only on success!
 	} else {
@@ -1532,13 +1534,14 @@ sub decode_mbim {
 
 	my ($cid, $infolen) = unpack("VV", substr($msg, 36));
 	my $info = substr($msg, 44);
+	$info = substr($info, 0, $infolen) if (length($info) > $infolen); # padding
 	print &cid_to_string($service, $cid), " ($cid)\n";
 
 	print "InformationBuffer [$infolen]:\n";
 	##print "InformationBuffer:\t$info\n";
 
 	if ($infolen != length($info)) {
-	    print "Fragmented data is not yet supported\n";
+	    print "Truncated InformationBuffer: ", length($info), " < $infolen\n";
 	} elsif (exists($decoder{$service})) {
 	    $decoder{$service}($cid, $info);
 	} else {
@@ -1547,7 +1550,7 @@ sub decode_mbim {
     }
 }
 
-# read from F until timeout
+# read from F until timeout, or until the reply to transaction $match
 sub read_mbim {
     my $match = shift;
     my $timeout = shift || 0;
@@ -1560,13 +1563,12 @@ sub read_mbim {
 	my $msglen = 0;
 	alarm $timeout;
 	do {
-	    my $len = 0;
-	    if ($len < 3 || $len < $msglen) {
+	    # keep any unused data from the previous read
+	    if (length($raw) < 12 || length($raw) < $msglen) {
 		my $tmp;
 		my $n = sysread(F, $tmp, $maxctrl);
 		if ($n) {
-		    $len = $n;
-		    $raw = $tmp;
+		    $raw .= $tmp;
 		    warn("[" . localtime . "] read $n bytes from $mgmt\n") if $debug;
 		    print "\n---\n" if $debug;
 		    printf "%02x " x $n, unpack("C*", $tmp) if $debug;
@@ -1577,15 +1579,22 @@ sub read_mbim {
 	    }
 
 	    # get expected message length
-	    $msglen = unpack("V", substr($raw, 4, 4));
+	    $msglen = length($raw) >= 8 ? unpack("V", substr($raw, 4, 4)) : 0;
 
-	    if ($len >= $msglen) {
-		$len -= $msglen;
+	    if (length($raw) >= 8 && $msglen < 12) {
+		warn "invalid message length $msglen - dropping " . length($raw) . " bytes\n";
+		$raw = '';
+		$msglen = 0;
+	    } elsif ($msglen && length($raw) >= $msglen) {
+		# *_DONE or MBIM_FUNCTION_ERROR_MSG, and the last fragment
+		my ($type, $len, $rtid, $total, $current) = unpack("VVVVV", $raw . "\0" x 20);
 		&decode_mbim(substr($raw, 0, $msglen));
+		$found = 1 if (defined($match) && $rtid == $match && ($type & 0x80000000) && $type != 0x80000007 &&
+			       ($type != 0x80000003 || $current + 1 >= $total));
 		$raw = substr($raw, $msglen);
 		$msglen = 0;
-	    } else {
-		warn "$len < $msglen\n";
+	    } elsif ($debug) {
+		warn length($raw) . " < $msglen\n";
 	    }
 	} while (!$found);
 	alarm 0;
@@ -1702,8 +1711,15 @@ if ($cmd eq "offline") {
     exit(0);
 }
 
-# open it now and keep it open until exit
-open(F, "+<", $mgmt) || die "open $mgmt: $!\n";
+# open it now and keep it open until exit.  The device may be shared
+# by mbim-proxy, using a SOCK_SEQPACKET socket with one message per packet
+my $proxy = -S $mgmt;
+if ($proxy) {
+    socket(F, PF_UNIX, SOCK_SEQPACKET, 0) || die "socket: $!\n";
+    connect(F, pack_sockaddr_un($mgmt)) || die "connect $mgmt: $!\n";
+} else {
+    open(F, "+<", $mgmt) || die "open $mgmt: $!\n";
+}
 autoflush F 1;
 
 # check message size
@@ -1718,6 +1734,8 @@ if ($r) {
 }
 print "MaxMessageSize=$maxctrl\n"  if $debug;
 
+# the transaction id of the command we send, if any
+my $sent = $tid;
 
 if ($cmd eq "open") {
     print F &mk_open_msg;
@@ -1773,6 +1791,9 @@ if ($cmd eq "open") {
     &usage;
 }
 
+# mbim-proxy only sends the reply to us, so we cannot leave it to a monitor
+&read_mbim($sent, 2) if ($proxy && $cmd ne "monitor" && $tid != $sent);
+
 # close device
 close(F);
 
@@ -0,0 +1,42 @@
+#!/usr/bin/perl
+# Copyright (c) 2013  Bjørn Mork <bjorn@mork.no>
+# GPLv2
+#
+# Build a Sierra Wireless SPKG image of CWE images filled with random
+# data, for testing cwe-index and swi-download without real firmware.
+#
+# usage: mkcwe.pl out.spk <type>:<size>[:<version>]...
+#
+#   mkcwe.pl test.spk MODM:3000000:05.05.16.02 APPL:1000000
+#
+# The version is the rest of the argument, and may have spaces and
+# colons like a real one: "MODM:3000000:SWI9X15C_05.05.16.02 r20040 ..."
+#
+# The header layout is described in src/cwe.h
+
+use strict;
+use warnings;
+use Compress::Zlib qw(crc32);
+
+my $out = shift;
+die "usage: $0 out.spk <type>:<size>[:<version>]...\n" unless ($out && @ARGV);
+
+# hdrcrc is the CRC-32 of the (empty) psb
+sub cwe {
+    my ($type, $data, $version) = @_;
+    my $psb = "\0" x 256;
+    return pack("a256 N N N a4 a4 N N a84 a8 N a20", $psb, crc32($psb), 3, 0, $type, '9X15',
+		length($data), crc32($data), $version || '', '01/01/13', 0, '') . $data;
+}
+
+my $images = '';
+foreach (@ARGV) {
+    my ($type, $size, $version) = split(/:/, $_, 3);
+    die "$_: bad image\n" unless ($type =~ /^[A-Z0-9]{4}$/ && $size && $size =~ /^\d+$/);
+    $images .= &cwe($type, pack("C*", map { int(rand(256)) } 1 .. $size), $version);
+}
+
+open(my $fh, '>', $out) || die "$out: $!\n";
+binmode($fh);
+print $fh &cwe('SPKG', $images);
+close($fh) || die "$out: $!\n";
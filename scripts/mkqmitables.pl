@@ -0,0 +1,220 @@
+#!/usr/bin/perl
+# Copyright (c) 2013  Bjørn Mork <bjorn@mork.no>
+# GPLv2
+#
+# Generate C decode tables from the message, TLV and value tables in
+# qmi.pl, so that the qmidecode pretty-printer always knows the same
+# messages as the Perl decoder.
+#
+# usage: mkqmitables.pl qmi.pl outbase
+#
+# writes outbase.h and outbase.c.  A TLV decoder given as \&tlv_foo
+# in qmi.pl maps to a C function named tlv_foo, an anonymous sub maps
+# to <svc>_<msgid>_<tlv> (e.g. nas_0024_1c), and 'sub { return '' }'
+# maps to NULL (default handling).  All decoders are implemented in
+# src/qmiprint.c, and a missing one will fail at link time.  Message
+# entries must be written out in the nested form, one key per line,
+# or as "0x0020 => { name => 'XXX', %tlvs }," reusing the TLVs of a
+# "my %tlvs = (0x10 => { ... }, ...)" table in the same package.
+# Anything else in a %msg table is an error.
+#
+# Flat "my %xxx_map = (key => 'string', ...)" tables are exported as
+# <svc>_xxx_map.  A two level map is flattened using outer << 16 | inner
+# as key.
+
+use strict;
+use warnings;
+
+my ($in, $out) = @ARGV;
+die "usage: $0 qmi.pl outbase\n" unless ($in && $out);
+
+open(F, "<", $in) || die "$in: $!\n";
+my @lines = <F>;
+close(F);
+
+my %sysname;		# number => "QMI_XXX"
+my %err;		# number => "QMI_ERR_XXX"
+my @msgs;		# { svc, msgid, name, tlvs => [ { type, name, decode } ] }
+my %maps;		# "svc_name_map" => { key => string }
+my %decoders;		# all decoder function names
+my %tlvsets;		# "svc tlvs" => [ { type, name, decode } ], shared by messages
+
+my $pkg = '';		# current QMI::XXX package, lower cased
+my $table = '';		# current top level hash
+my ($msg, $tlv, $outer);
+
+# keys are numbers or simple expressions like 1<<15
+sub num {
+    my $k = shift;
+    die "$in: unexpected key '$k'\n" unless ($k =~ /^[0-9a-fA-Fx<\s]+$/);
+    return eval $k;
+}
+
+sub cstr {
+    my $s = shift;
+    $s =~ s/(["\\])/\\$1/g;
+    return "\"$s\"";
+}
+
+my %sysnum;
+my $lineno = 0;
+foreach (@lines) {
+    $lineno++;
+    if (/^package QMI::(\w+);/) {
+	$pkg = lc($1);
+    } elsif (/^package main;/) {
+	$pkg = '';
+    }
+
+    # start of a top level table?
+    if (/^my %(\w+) = \(/) {
+	$table = $1;
+	$table = "${pkg}_$table" if ($table =~ /_map$/);
+	$outer = undef;
+	$msg = undef;
+	$tlv = undef;
+
+	# any other table in a package is TLVs shared by messages
+	if ($pkg && $table ne 'msg' && $table !~ /_map$/) {
+	    $msg = { set => $table, tlvs => [] };
+	    $tlvsets{"$pkg $table"} = $msg->{tlvs};
+	}
+	next;
+    }
+    if ($table && /^\s*\);/) {
+	$table = '';
+	next;
+    }
+    next unless $table;
+    next if /^\s*#/;
+
+    if ($table eq 'sysname' && /^\s*(0x[0-9a-f]+)\s*=>\s*"(\w+)"/) {
+	$sysname{hex($1)} = $2;
+	$sysnum{lc(substr($2, 4))} = hex($1);
+    } elsif ($table eq 'err' && /^\s*(0x[0-9a-fA-F]+)\s*=>\s*"([^"]+)"/) {
+	$err{hex($1)} = $2;
+    } elsif ($pkg && $table !~ /_map$/) {
+	if ($table eq 'msg' && /^\s*(0x[0-9a-f]{4})\s*=>\s*\{\s*$/) {
+	    $msg = { svc => $pkg, msgid => hex($1), tlvs => [] };
+	    $tlv = undef;
+	    push(@msgs, $msg);
+	} elsif ($table eq 'msg' && /^\s*(0x[0-9a-f]{4})\s*=>\s*\{\s*name\s*=>\s*'([^']*)',\s*%(\w+)\s*\},?\s*$/) {
+	    push(@msgs, { svc => $pkg, msgid => hex($1), name => $2, set => $3, tlvs => [] });
+	    $msg = undef;
+	    $tlv = undef;
+	} elsif (/^\s*(0x[0-9a-f]{2})\s*=>\s*\{\s*$/) {
+	    die "$in:$lineno: TLV outside a message\n" unless $msg;
+	    $tlv = { type => hex($1) };
+	    push(@{$msg->{tlvs}}, $tlv);
+	} elsif (/^\s*name\s*=>\s*'([^']*)'/) {
+	    die "$in:$lineno: name outside a message\n" unless $msg;
+	    if ($tlv) {
+		$tlv->{name} = $1;
+	    } else {
+		$msg->{name} = $1;
+	    }
+	} elsif (/^\s*decode\s*=>\s*(.*)$/) {
+	    my $d = $1;
+	    die "$in:$lineno: decoder outside a TLV\n" unless $tlv;
+	    if ($d =~ /^\\&(\w+)/) {
+		$tlv->{decode} = $1;
+	    } elsif ($d =~ /^sub\s*\{\s*return\s*''\s*\}/) {
+		$tlv->{decode} = 'NULL';
+	    } elsif ($msg->{set}) {
+		$tlv->{decode} = sprintf "%s_%s_%02x", $pkg, $msg->{set}, $tlv->{type};
+	    } else {
+		$tlv->{decode} = sprintf "%s_%04x_%02x", $pkg, $msg->{msgid}, $tlv->{type};
+	    }
+	    $decoders{$tlv->{decode}} = 1 unless ($tlv->{decode} eq 'NULL');
+	} elsif (!/^\s*\},?\s*$/ && !/^\s*$/) {
+	    die "$in:$lineno: cannot parse message table entry: $_";
+	}
+    } elsif ($table =~ /_map$/) {
+	if (/^\s*([^#=]+?)\s*=>\s*\{/) {
+	    $outer = &num($1);
+	} elsif (/^\s*\},/) {
+	    $outer = undef;
+	} elsif (/^\s*([^#=]+?)\s*=>\s*'([^']*)'/) {
+	    my $k = &num($1);
+	    $k |= $outer << 16 if defined($outer);
+	    $maps{$table}{$k} = $2;
+	}
+    }
+}
+
+die "$in: no message tables found\n" unless @msgs;
+foreach my $m (@msgs) {
+    my $id = sprintf "%s 0x%04x", $m->{svc}, $m->{msgid};
+    if ($m->{set}) {
+	my $set = $tlvsets{"$m->{svc} $m->{set}"};
+	die "$in: $id uses unknown TLV table %$m->{set}\n" unless $set;
+	$m->{tlvs} = [ @$set ];
+    }
+    die "$in: $id has no name\n" unless $m->{name};
+    die "$in: $id has no TLVs\n" unless @{$m->{tlvs}};
+    foreach (@{$m->{tlvs}}) {
+	die sprintf("%s: %s TLV 0x%02x has no name or decoder\n", $in, $id, $_->{type})
+	    unless ($_->{name} && $_->{decode});
+    }
+}
+
+open(H, ">", "$out.h") || die "$out.h: $!\n";
+open(C, ">", "$out.c") || die "$out.c: $!\n";
+
+my $hdr = "/* generated by mkqmitables.pl from qmi.pl - do not edit */\n\n";
+print H $hdr, "#ifndef _QMITABLES_H\n#define _QMITABLES_H\n\n#include \"qmiprint.h\"\n\n";
+print C $hdr, "#include <stddef.h>\n#include \"$out.h\"\n\n";
+
+# value maps, sorted for bsearch
+foreach my $m (sort keys %maps) {
+    print H "extern const struct qmi_map $m;\n";
+    print C "static const struct qmi_val ${m}_v[] = {\n";
+    foreach my $k (sort { $a <=> $b } keys %{$maps{$m}}) {
+	printf C "\t{ %#x, %s },\n", $k, &cstr($maps{$m}{$k});
+    }
+    print C "};\n";
+    printf C "const struct qmi_map $m = { ${m}_v, %u };\n\n", scalar(keys %{$maps{$m}});
+}
+print H "\n";
+
+# decoder prototypes
+foreach my $d (sort keys %decoders) {
+    print H "int $d(char *buf, size_t buflen, const __u8 *data, size_t len);\n";
+}
+
+# messages, sorted by service and msgid
+my $n = 0;
+foreach my $m (sort { $sysnum{$a->{svc}} <=> $sysnum{$b->{svc}} || $a->{msgid} <=> $b->{msgid} } @msgs) {
+    die "$in: unknown service $m->{svc}\n" unless exists($sysnum{$m->{svc}});
+    $m->{sort} = $n++;
+    printf C "static const struct qmi_tlv_desc %s_%04x[] = {\n", $m->{svc}, $m->{msgid};
+    foreach my $t (sort { $a->{type} <=> $b->{type} } @{$m->{tlvs}}) {
+	printf C "\t{ 0x%02x, %s, %s },\n", $t->{type}, &cstr($t->{name} || ''), $t->{decode} || 'NULL';
+    }
+    print C "};\n\n";
+}
+print C "const struct qmi_msg_desc qmi_msgs[] = {\n";
+foreach my $m (sort { $a->{sort} <=> $b->{sort} } @msgs) {
+    printf C "\t{ 0x%02x, 0x%04x, %s, %s_%04x, %u },\n", $sysnum{$m->{svc}}, $m->{msgid}, &cstr($m->{name} || ''),
+	$m->{svc}, $m->{msgid}, scalar(@{$m->{tlvs}});
+}
+print C "};\n";
+printf C "const int qmi_nmsgs = %u;\n\n", scalar(@msgs);
+
+print C "const char *const qmi_sysname[256] = {\n";
+printf C "\t[0x%02x] = %s,\n", $_, &cstr($sysname{$_}) foreach (sort { $a <=> $b } keys %sysname);
+print C "};\n\n";
+
+my $maxerr = (sort { $b <=> $a } keys %err)[0];
+printf H "\n#define QMI_ERR_MAX %#06x\n", $maxerr;
+print H "extern const struct qmi_msg_desc qmi_msgs[];\n";
+print H "extern const int qmi_nmsgs;\n";
+print H "extern const char *const qmi_sysname[256];\n";
+print H "extern const char *const qmi_errname[QMI_ERR_MAX + 1];\n";
+print C "const char *const qmi_errname[QMI_ERR_MAX + 1] = {\n";
+printf C "\t[0x%04x] = %s,\n", $_, &cstr($err{$_}) foreach (sort { $a <=> $b } keys %err);
+print C "};\n";
+
+print H "\n#endif /* _QMITABLES_H */\n";
+close(H);
+close(C);
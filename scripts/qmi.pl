@@ -1006,12 +1006,124 @@ sub tlv {
 }
 1; # eof QMI::PDS;
 
+
+package QMI::WDA;
+use strict;
+use warnings;
+use vars qw(@ISA);
+@ISA = qw(QMI);
+{
+my %llp_map = (
+    1 => '802.3',
+    2 => 'raw-ip',
+    );
+
+my %agg_map = (
+    0 => 'disabled',
+    1 => 'tlp',
+    2 => 'qc-ncm',
+    3 => 'mbim',
+    4 => 'rndis',
+    5 => 'qmap',
+    8 => 'qmapv4',
+    9 => 'qmapv5',
+    );
+
+# GET_DATA_FORMAT replies with the same TLVs as SET_DATA_FORMAT
+my %format = (
+    0x10 => {
+	name => 'QoS Format',
+	decode => \&tlv_qos_format,
+    },
+    0x11 => {
+	name => 'Link Layer Protocol',
+	decode => \&tlv_llp,
+    },
+    0x12 => {
+	name => 'Uplink Data Aggregation Protocol',
+	decode => \&tlv_agg,
+    },
+    0x13 => {
+	name => 'Downlink Data Aggregation Protocol',
+	decode => \&tlv_agg,
+    },
+    0x15 => {
+	name => 'Downlink Data Aggregation Max Datagrams',
+	decode => \&tlv_u32,
+    },
+    0x16 => {
+	name => 'Downlink Data Aggregation Max Size',
+	decode => \&tlv_u32,
+    },
+    0x17 => {
+	name => 'Uplink Data Aggregation Max Datagrams',
+	decode => \&tlv_u32,
+    },
+    0x18 => {
+	name => 'Uplink Data Aggregation Max Size',
+	decode => \&tlv_u32,
+    },
+    );
+
+my %msg = (
+    0x0020 => { name => 'SET_DATA_FORMAT', %format },
+    0x0021 => { name => 'GET_DATA_FORMAT', %format },
+    );
+
+sub tlv_qos_format {
+    return sprintf "%u", $_[0]->[0];
+}
+
+sub tlv_u32 {
+    return sprintf "%u", unpack("V", pack("C*", @{shift()}));
+}
+
+sub tlv_enum {
+    my ($names, $data) = @_;
+    my $v = unpack("V", pack("C*", @$data));
+    return $names->{$v} || "unknown [$v]";
+}
+
+sub tlv_llp { return &tlv_enum(\%llp_map, @_); }
+sub tlv_agg { return &tlv_enum(\%agg_map, @_); }
+
+# numbers for names like "raw-ip" or "qmap", for building requests
+sub llp_num {
+    my $name = lc(shift);
+    $name =~ s/^rawip$/raw-ip/;
+    my ($n) = grep { $llp_map{$_} eq $name } keys %llp_map;
+    return $n;
+}
+
+sub agg_num {
+    my $name = lc(shift);
+    return $name if ($name =~ /^\d+$/);
+    my ($n) = grep { $agg_map{$_} eq $name } keys %agg_map;
+    return $n;
+}
+
+sub llp_name { return $llp_map{$_[0]} || "unknown [$_[0]]"; }
+sub agg_name { return $agg_map{$_[0]} || "unknown [$_[0]]"; }
+
+sub tlv {
+    my ($msgid, $tlv, $data) = @_;
+    
+    if (exists($msg{$msgid}) && exists($msg{$msgid}->{$tlv})) {
+	return &{$msg{$msgid}->{$tlv}{decode}}($data);
+    }
+    return ''; # => default handling
+}
+
+}
+1; # eof QMI::WDA;
+
 package main;
 use strict;
 use warnings;
 use Getopt::Long;
 use LWP::Simple;
 use Socket;
+use Time::HiRes qw(time);
 
 # recreated using
 #
@@ -1067,6 +1179,9 @@ my %sysname = (
 	0xe1 => "QMI_RMS",	# Remote management service
     );
 
+# set while the daemon runs a client request, which must not exit
+my $in_request = 0;
+
 ### functions used during enviroment variable parsing ###
 sub usage {
     print STDERR <<EOH
@@ -1076,6 +1191,7 @@ Where [options] are
 
   --proxy
   --family=<4|6>
+  --[no]dualstack
   --pin=<code>
   --apn=<apn>
   --user=<user>
@@ -1085,6 +1201,26 @@ Where [options] are
   --system=<sysname|number>
   --cid=<cid> (not released)
   --monitor
+  --daemon
+  --socket=<path>
+
+With --system=wda, "format" shows the data format, and e.g.
+"format raw-ip dl=qmap dgrams=32 size=16384" sets it, along with the
+matching qmi_wwan raw_ip and MTU.
+
+With --dualstack, start also connects the other address family on a
+second QMI_WDS client, and stop disconnects both.
+
+With --daemon, the device is kept open and CIDs allocated until
+killed, running commands received on the unix socket at <path>.
+Later runs with the same --device send their command to the daemon
+instead of opening the device.  The socket takes the same options
+and command as the command line, separated by NUL or newline, e.g.
+
+  printf '--system=nas\n0x0024\n' | socat - UNIX-CONNECT:/var/run/qmi.pl-wwan0
+
+Indications received between commands are dropped, and the daemon
+refuses "monitor".  The daemon exits if the device goes away.
 
 Command is either a hex command number or an alias
 
@@ -1094,6 +1230,7 @@ i.e a stream of TLVs starting with 0x followed by the raw contents, all encoded
 
 EOH
     ;
+    die "usage\n" if $in_request;
     &release_cids;
     exit;
 }
@@ -1104,6 +1241,21 @@ sub strip_quotes {
     return $x;
 }
 
+# accept system as number, hex number or name
+sub parse_system {
+    my $sys = shift;
+
+    if ($sys =~ s/^0x//) {
+	$sys = hex($sys);
+    }
+    if ($sys !~ /^\d+$/) {
+	$sys = uc($sys);
+	$sys = "QMI_$sys" unless ($sys =~ /^QMI_/);
+	($sys) = grep { $sysname{$_} eq $sys } keys %sysname;
+    }
+    return $sys;
+}
+
 ### global variables ###
 
 ## set defaults based on environment
@@ -1115,6 +1267,7 @@ my %pin; $pin{1} = &strip_quotes($ENV{'IF_WWAN_PIN'}) if $ENV{'IF_WWAN_PIN'};
 my $apn =  &strip_quotes($ENV{'IF_WWAN_APN'});
 my $user = &strip_quotes($ENV{'IF_WWAN_USER'});
 my $pw = &strip_quotes($ENV{'IF_WWAN_PW'});
+my $dualstack = $ENV{'IF_WWAN_DUALSTACK'};
 
 # output levels
 my $verbose = 1;
@@ -1132,11 +1285,16 @@ my $monitor = 0;
 # use qmi-proxy
 my $proxy = 0;
 
+# run as daemon, listening on a unix socket
+my $daemon = 0;
+my $sock;
+
 ## let command line override defaults
 GetOptions(
     'proxy!' => \$proxy,
     'device=s' => \$netdev,
     'family=s' => \$family,
+    'dualstack!' => \$dualstack,
     'pin=s' => \$pin{1},
     'apn=s' => \$apn,
     'user=s' => \$user,
@@ -1146,6 +1304,8 @@ GetOptions(
     'system=s' => \$system,
     'cid=i' => \$xcid,
     'monitor!' => \$monitor,
+    'daemon!' => \$daemon,
+    'socket=s' => \$sock,
     ) || &usage;
 
 # the rest of the command line is left for the actual command to run
@@ -1158,14 +1318,9 @@ $family =~ s/^inet//;
 $family =~ s/^ipv//i;
 
 # postprocess system
-if ($system =~ s/^0x//) {
-    $system = hex($system);
-}
-if ($system !~ /^\d+$/) {
-    $system = uc($system);
-    $system = "QMI_$system" unless ($system =~ /^QMI_/);
-    ($system) = grep { $sysname{$_} eq $system } keys %sysname;
-}
+$system = &parse_system($system);
+
+$sock ||= "/var/run/qmi.pl-$netdev";
 
 # state keeping file
 my $state = "/etc/network/run/qmistate.$netdev";
@@ -1178,6 +1333,16 @@ my $dev = $ENV{MGMT} || '';		# management device
 my @cid;		# array of allocated CIDs
 my $tid = 1;		# transaction id
 my $wds_handle;		# connection handle
+my $cid2;		# QMI_WDS CID for the other family with --dualstack
+my $wds_handle2;	# and its connection handle
+
+# a read may return more than one packet, or part of one, so input is
+# buffered.  Replies are matched to requests by the pending table, and
+# anything else is queued for read_match
+my $rxbuf = '';		# unparsed input
+my %pending;		# "sys/cid/tid/msgid" => reply, undef until received
+my @rxq;		# unsolicited messages, oldest first
+my $maxq = 64;		# dropping the oldest when full
 
 $cid[$system] = $xcid if $xcid;
 
@@ -1296,12 +1461,33 @@ my %err = (
 #  drwxr-xr-x 3 root root 0 Jan 21 22:18 cdc-wdm0
 
 
+# look up $netdev in the index of cdc-wdm devices, using wdm-lookup
+# which keeps it cached until the next uevent.  Returns undef if not
+# found, or if wdm-lookup is not installed
+sub wdm_index_lookup {
+    my $netdev = shift;
+
+    return undef unless ($netdev =~ /^[\w.:-]+$/);
+    my ($line) = `wdm-lookup $netdev 2>/dev/null`;
+    return undef unless ($? == 0 && $line);
+    my ($wdm) = split(/ /, $line);
+    return "/dev/$wdm";
+}
+
 sub get_mgmt_dev {
     my $ret = '';
 
     # no IFACE environment variable?
     return $ret if (!$netdev);
 
+    # the index is much faster with many devices
+    $ret = &wdm_index_lookup($netdev);
+    if (defined($ret)) {
+	warn "$netdev: will use $ret for management\n" if $verbose;
+	return $ret;
+    }
+    $ret = '';
+
     my $usbif = readlink("/sys/class/net/$netdev/device"); # ../../../2-1:1.4
     return $ret if (!$usbif);
     $usbif =~ s!.*/!!;                                  # 2-1:1.4
@@ -1336,6 +1522,13 @@ sub get_mgmt_dev {
 
 ### QMI helpers ###
 
+# the next transaction id, 1..$max.  0 is never used
+sub next_tid {
+    my $max = shift;
+    $tid = 1 if ($tid < 1 || $tid > $max);
+    return $tid++;
+}
+
 # $tlvs = { type1 => packdata, type2 => packdata, .. 
 sub mk_qmi {
     my ($sys, $cid, $msgid, $tlvs) = @_;
@@ -1347,9 +1540,9 @@ sub mk_qmi {
     }
     my $tlvlen = length($tlvbytes);
     if ($sys != QMI_CTL) {
-	return pack("CvCCCCvvv", 1, 12 + $tlvlen, 0, $sys, $cid, 0, $tid++, $msgid, $tlvlen) . $tlvbytes;
+	return pack("CvCCCCvvv", 1, 12 + $tlvlen, 0, $sys, $cid, 0, &next_tid(65535), $msgid, $tlvlen) . $tlvbytes;
     } else {
-	return pack("CvCCCCCvv", 1, 11 + $tlvlen, 0, QMI_CTL, 0, 0, $tid++, $msgid, $tlvlen) . $tlvbytes;
+	return pack("CvCCCCCvv", 1, 11 + $tlvlen, 0, QMI_CTL, 0, 0, &next_tid(255), $msgid, $tlvlen) . $tlvbytes;
     }
 }
     
@@ -1420,6 +1613,8 @@ sub pretty_print_qmi {
 	    $txt = QMI::NAS::tlv($qmi->{msgid}, $k, $v);
 	} elsif ($qmi->{sys} == QMI_PDS) {
 	    $txt = QMI::PDS::tlv($qmi->{msgid}, $k, $v);
+	} elsif ($qmi->{sys} == QMI_WDA) {
+	    $txt = QMI::WDA::tlv($qmi->{msgid}, $k, $v);
 	}
 	$txt ||= mk_ascii($v);
 
@@ -1437,56 +1632,71 @@ sub qmi_match {
     return 1;
 }
 
-# read from F until match or timeout
+# key matching a reply to its request
+sub qmi_key {
+    my $qmi = shift;
+    return join('/', map { defined($_) ? $_ : '' } @$qmi{'sys','cid','tid','msgid'});
+}
+
+# wait up to $timeout seconds (forever if undef) for input, and sort
+# the complete packets.  Returns false on timeout, EOF or error
+sub read_qmi {
+    my $timeout = shift;
+
+    my $rin = '';
+    vec($rin, fileno(F), 1) = 1;
+    return 0 if (select($rin, undef, undef, $timeout) <= 0);
+
+    my $raw;
+    my $len = sysread(F, $raw, 4096);
+    return 0 unless $len;
+    warn("[" . localtime . "] read $len bytes from $dev\n") if $debug;
+    $rxbuf .= $raw;
+
+    while (length($rxbuf) >= 3) {
+	my ($tf, $qlen) = unpack("Cv", $rxbuf);
+	if ($tf != 1) {
+	    warn "$netdev: dropping " . length($rxbuf) . " bytes of garbage\n" if $verbose;
+	    $rxbuf = '';
+	    last;
+	}
+	last if (length($rxbuf) < $qlen + 1);
+
+	my $qmi_in = decode_qmi(substr($rxbuf, 0, $qlen + 1));
+	$rxbuf = substr($rxbuf, $qlen + 1);
+	pretty_print_qmi($qmi_in) if $debug;
+
+	# reply to a pending request?
+	my $key = &qmi_key($qmi_in);
+	my $resp = $qmi_in->{sys} ? 0x02 : 0x01;
+	if ($qmi_in->{flags} == $resp && exists($pending{$key}) && !$pending{$key}) {
+	    $pending{$key} = $qmi_in;
+	} else {
+	    push(@rxq, $qmi_in);
+	    shift(@rxq) if (@rxq > $maxq);
+	}
+    }
+    return 1;
+}
+
+# read until a message matching $match is queued, or timeout.  A zero
+# timeout waits forever
 sub read_match {
     my $match = shift;
     my $timeout = shift;
 
-    my $qmi_in = {};
     warn("reading from $dev\n") if $debug;
-    eval {
-	local $SIG{ALRM} = sub { die "alarm\n" }; # NB: \n required
-	my $raw;
-	my $found;
-	alarm $timeout;
-	do {
-	    my $len = 0;
-	    if (!$raw) {
-		if ($proxy) {
-		    recv(F, $raw, 512, 0);
-		    $len = length($raw);
-		} else {
-		    $len = sysread(F, $raw, 512);
-		}
-		warn("[" . localtime . "] read $len bytes from $dev\n") if ($debug && $len);
-	    } else {
-		$len = length($raw);
-		warn "$netdev: last read return multiple packets\n" if $verbose;
-	    }
-
-	    $qmi_in = decode_qmi($raw);
-
-	    # a single read may return more than one packet!
-	    if ($qmi_in->{tf}) {
-		$raw = substr($raw, $qmi_in->{len} + 1);
-	    } else {
-		$raw = '';
-	    }
-
-	    # matching reply?
-	    $found = !$len || &qmi_match($match, $qmi_in);
-	    if (!$found && $debug) {
-		warn "skipping unrelated message\n";
- 	    }
-	    pretty_print_qmi($qmi_in) if $debug;
-	} while (!$found);
-	alarm 0;
-	warn "got match!\n" if ($found && $debug);
-    };
-    if ($@) {
-	die unless $@ eq "alarm\n";   # propagate unexpected errors
+    my $end = time + $timeout;
+    while (1) {
+	for (my $i = 0; $i < @rxq; $i++) {
+	    next unless &qmi_match($match, $rxq[$i]);
+	    warn "got match!\n" if $debug;
+	    return splice(@rxq, $i, 1);
+	}
+	my $left = $timeout ? $end - time : undef;
+	return {} if (defined($left) && $left <= 0);
+	return {} unless &read_qmi($left);
     }
-    return  $qmi_in;
 }
 
 # infinite timeout and impossible match => read forever
@@ -1494,15 +1704,15 @@ sub monitor {
     &read_match({}, 0);
 }
 
-sub send_and_recv {
+# send a request without waiting, returning the key to wait for
+sub qmi_send {
     my $cmd = shift;
-    my $timeout = shift || 5;
-    
-    return {} if (!$cmd);
+
+    return undef if (!$cmd);
 
     # get cached device, or lookup and cache
     $dev ||= get_mgmt_dev($netdev);
-    return {} unless $dev;
+    return undef unless $dev;
 
     warn("sending to $dev:\n") if $debug;
 
@@ -1514,21 +1724,41 @@ sub send_and_recv {
     } else {
 	print F $cmd;
     }
-    
-    # set up for matching
-    $qmi_out->{flags} = $qmi_out->{sys} ? 0x02 : 0x01; # response
-    $qmi_out->{ctrl} = 0x80;  # service
 
-    # work around bug in libqmi qmi-proxy implementation
-    if ($proxy && $qmi_out->{'cid'} == 0 && $qmi_out->{'msgid'} == 0xff00) {
-	$qmi_out->{ctrl} = 0x00;
+    my $key = &qmi_key($qmi_out);
+    $pending{$key} = undef;
+    return $key;
+}
+
+# wait until all requests are answered or timeout, returning the
+# replies in the same order.  A missing reply is an empty hash
+sub qmi_wait {
+    my $timeout = shift;
+    my @keys = @_;
+
+    my $end = time + $timeout;
+    while (grep { defined($_) && !$pending{$_} } @keys) {
+	my $left = $end - time;
+	last if ($left <= 0 || !&read_qmi($left));
     }
+    return map { (defined($_) && delete($pending{$_})) || {} } @keys;
+}
 
-    my $qmi_in = read_match($qmi_out, $timeout);
- 
+sub send_and_recv {
+    my $cmd = shift;
+    my $timeout = shift || 5;
+
+    my ($qmi_in) = &qmi_wait($timeout, &qmi_send($cmd));
     return $qmi_in;
 }
 
+# send independent requests at once, and wait for all the replies
+sub send_and_recv_all {
+    my $timeout = shift || 5;
+
+    return &qmi_wait($timeout, map { &qmi_send($_) } @_);
+}
+
 sub verify_status {
     my $qmi = shift;
     return 1 if ((ref($qmi) ne "HASH") || !exists($qmi->{tf}));
@@ -1546,6 +1776,8 @@ sub ctl_sync {
 	# reset all cached state as it is now invalid
 	@cid = ();
 	$wds_handle = 0;
+	$cid2 = 0;
+	$wds_handle2 = 0;
     }
     return $status;
 }
@@ -1609,6 +1841,20 @@ restart:
     return $cid[$sys];
 }
 
+# the second QMI_WDS client, for the other family with --dualstack
+sub get_cid2 {
+    return $cid2 if $cid2;
+
+    my $ret = send_and_recv(mk_qmi(0, 0, 0x0022, {0x01 => pack("C*", QMI_WDS)}));
+    my $status = verify_status($ret);
+    if (!$status && $ret->{tlvs}{0x01}[0] == QMI_WDS) {
+	$cid2 = $ret->{tlvs}{0x01}[1];
+    } else {
+	warn "$netdev: CID request for $sysname{QMI_WDS()} failed: $err{$status}\n";
+    }
+    return $cid2;
+}
+
 # release all CIDs with the possible exception of QMI_WDS if we started a connection
 sub release_cids {
     for (my $sys = 0; $sys < scalar @cid; $sys++) {
@@ -1624,6 +1870,15 @@ sub release_cids {
 	    $cid[$sys] = 0;
 	}
     }
+    if ($cid2) {
+	if ($wds_handle2) {
+	    warn "$netdev: not releasing QMI_WDS cid=$cid2 while connected\n" if $verbose;
+	} else {
+	    my $ret = send_and_recv(mk_qmi(0, 0, 0x0023, {0x01 => pack("C*", QMI_WDS, $cid2)}));
+	    warn "$netdev: released $sysname{QMI_WDS()} cid=$cid2 with status=" . verify_status($ret) . "\n" if $verbose;
+	    $cid2 = 0;
+	}
+    }
 }
 
 sub mk_wds {
@@ -1665,6 +1920,13 @@ sub mk_uim {
     return undef if (!$cid);
     return &mk_qmi(QMI_UIM, $cid, @_);
 }
+
+# QMI Wireless Data Administrative Service (QMI_WDA)
+sub mk_wda {
+    my $cid = &get_cid(QMI_WDA);
+    return undef if (!$cid);
+    return &mk_qmi(QMI_WDA, $cid, @_);
+}
     
 my %srvc_status = (
     1 => "DISCONNECTED",
@@ -1673,8 +1935,7 @@ my %srvc_status = (
     4 => "AUTHENTICATING",
 );
 sub wds_get_pkt_srvc_status {
-    my $req = mk_wds(0x0022); # QMI_WDS_GET_PKT_SRVC_STATUS
-    my $ret = send_and_recv($req, 2); # short timeout
+    my $ret = shift || send_and_recv(mk_wds(0x0022), 2); # QMI_WDS_GET_PKT_SRVC_STATUS, short timeout
     my $status = verify_status($ret);
     if ($status) {
 	warn "wds_get_pkt_srvc_status: $err{$status}\n";
@@ -1685,14 +1946,22 @@ sub wds_get_pkt_srvc_status {
 }
 
 sub wds_stop_network_interface {
-    if (!$wds_handle) {
+    if (!$wds_handle && !$wds_handle2) {
 	warn "$netdev: unable to disconnect without a valid handle\n";
 	return 'FAILED';
     }
-    my $req = mk_wds(0x0021, { 0x01 => pack("V", $wds_handle) } ); # QMI_WDS_STOP_NETWORK_INTERFACE
-    my $ret = send_and_recv($req);
-    $wds_handle = 0; # reset handle to allow releasing the CID
-    return $err{&verify_status($ret)};
+
+    # QMI_WDS_STOP_NETWORK_INTERFACE, for both sessions at once
+    my @ret = &send_and_recv_all(5,
+				 $wds_handle ? mk_wds(0x0021, { 0x01 => pack("V", $wds_handle) }) : undef,
+				 $wds_handle2 ? mk_qmi(QMI_WDS, $cid2, 0x0021, { 0x01 => pack("V", $wds_handle2) }) : undef);
+
+    # reset handles to allow releasing the CIDs
+    my $status = $wds_handle ? verify_status($ret[0]) : 0;
+    $status ||= verify_status($ret[1]) if $wds_handle2;
+    $wds_handle = 0;
+    $wds_handle2 = 0;
+    return $err{$status};
 }
 
 sub call_end_reason {
@@ -1714,27 +1983,50 @@ sub wds_start_network_interface {
     $tlv{0x14} = $apn if $apn;
     $tlv{0x17} = $user if $user;
     $tlv{0x18} = $pw if $pw;
+
+    # with --dualstack, the other family is started at once on a
+    # second client.  A given handle only applies to the first
+    my $dual = $dualstack && !$handle && &get_cid2;
+    my $family2 = $family == 6 ? 4 : 6;
+
 ## TEST: Set default family pref instead
 ##    $tlv{0x19} = pack("C", $family) if $family;
-    printf STDERR "Setting default family to $family: %s\n", &verify_status(&send_and_recv(&mk_wds(0x004d, {0x01 => pack("C", $family)}))) if $family;
-
-    my $req = mk_wds(0x0020, \%tlv); # QMI_WDS_START_NETWORK_INTERFACE
+    my @ret = &send_and_recv_all(5,
+				 $family ? &mk_wds(0x004d, {0x01 => pack("C", $family)}) : undef,
+				 $dual ? &mk_qmi(QMI_WDS, $cid2, 0x004d, {0x01 => pack("C", $family2)}) : undef);
+    printf STDERR "Setting default family to $family: %s\n", &verify_status($ret[0]) if $family;
+    printf STDERR "Setting default family to $family2: %s\n", &verify_status($ret[1]) if $dual;
 
     warn "$netdev: connecting...\n" if $verbose;
     # need to save handle (and WMS CID!!!) for disconnect
-    my $ret = send_and_recv($req, 60);
+    @ret = &send_and_recv_all(60,
+			      mk_wds(0x0020, \%tlv), # QMI_WDS_START_NETWORK_INTERFACE
+			      $dual ? mk_qmi(QMI_WDS, $cid2, 0x0020, \%tlv) : undef);
+    my $status;
+    ($status, $wds_handle) = &start_result($ret[0]);
+    if ($dual) {
+	my $status2;
+	($status2, $wds_handle2) = &start_result($ret[1]);
+	$status ||= $status2;
+    }
+    return $status;
+}
+
+# the status and handle from a QMI_WDS_START_NETWORK_INTERFACE reply
+sub start_result {
+    my $ret = shift;
+
     my $status = verify_status($ret);
     if ($status) {
 	warn "Connection failed: status=$err{$status}, reason=", call_end_reason($ret), "\n";
 #	pretty_print_qmi($ret);
-	return $status;
+	return ($status, 0);
     }
 
     my $v = $ret->{tlvs}{0x01};
-    $wds_handle = unpack("V*", pack("C*", @$v)); # save as a 32bit integer
-    printf STDERR "$netdev: got QMI_WDS handle 0x%08x\n", $wds_handle;
-
-    return $status;
+    my $handle = unpack("V*", pack("C*", @$v)); # save as a 32bit integer
+    printf STDERR "$netdev: got QMI_WDS handle 0x%08x\n", $handle;
+    return (0, $handle);
 }
 
 sub wds_set_client_ip_family_pref {
@@ -1863,8 +2155,7 @@ sub dms_dump_msg {
 }
 
 sub wds_get_current_channel_rate {
-    my $req = mk_wds(0x0023); # QMI_WDS_GET_CURRENT_CHANNEL_RATE
-    my $ret = send_and_recv($req);
+    my $ret = shift || send_and_recv(mk_wds(0x0023)); # QMI_WDS_GET_CURRENT_CHANNEL_RATE
 
     return [ ('unknown') x 4 ] if (verify_status($ret));
 
@@ -1883,28 +2174,25 @@ sub format_ms {
 }
 
 sub wds_get_call_duration {
-    my $req = mk_wds(0x0035); # QMI_WDS_GET_CALL_DURATION
-    if ($req) {
-	my $ret = send_and_recv($req);
-#	pretty_print_qmi($ret);
+    my $ret = shift || send_and_recv(mk_wds(0x0035)); # QMI_WDS_GET_CALL_DURATION
+#   pretty_print_qmi($ret);
 
-	my %r;
-	return  \%r if (verify_status($ret));
-
-	my %calltypes = (
-	    0x01 => 'call',
-	    0x10 => 'last call',
-	    0x11 => 'call active', 
-	    0x12 => 'last call active',
-	    );
-	for my $tlv (keys %calltypes) {
-	    my $v = $ret->{tlvs}{$tlv};
-	    if ($v) {
-		$r{$calltypes{$tlv}} = format_ms(unpack("Q<", pack("C*", @$v)));
-	    }
+    my %r;
+    return  \%r if (verify_status($ret));
+
+    my %calltypes = (
+	0x01 => 'call',
+	0x10 => 'last call',
+	0x11 => 'call active', 
+	0x12 => 'last call active',
+	);
+    for my $tlv (keys %calltypes) {
+	my $v = $ret->{tlvs}{$tlv};
+	if ($v) {
+	    $r{$calltypes{$tlv}} = format_ms(unpack("Q<", pack("C*", @$v)));
 	}
-	return \%r;
     }
+    return \%r;
 }
 
 my %data_bearer = (
@@ -1926,8 +2214,7 @@ my %data_bearer = (
 );
 
 sub wds_get_data_bearer_technology {
-    my $req = mk_wds(0x0037); # QMI_WDS_GET_DATA_BEARER_TECHNOLOGY
-    my $ret = send_and_recv($req);
+    my $ret = shift || send_and_recv(mk_wds(0x0037)); # QMI_WDS_GET_DATA_BEARER_TECHNOLOGY
 	
     return $data_bearer{0xff} if (verify_status($ret));
 
@@ -1947,6 +2234,7 @@ sub tlv01_ascii {
 sub wds_reset {
     my $ret = &send_and_recv(&mk_wds(0x0000)); # QMI_WDS_RESET
     $wds_handle = 0; # all WDS variables will be reset, but client IDs are still valid
+    $wds_handle2 = 0;
     return &verify_status($ret);
 }
 
@@ -1954,13 +2242,18 @@ sub wds_reset {
 sub save_wds_state {
     printf STDERR "$netdev: saving state to \"$state\"\n" if $verbose;
     if (open(X, ">$state")) {
-	if ($wds_handle) {
-	    printf X "%u %u\n", $cid[QMI_WDS], $wds_handle;
+	# one record, so that both sessions with --dualstack are
+	# stopped together
+	if ($wds_handle || $wds_handle2) {
+	    printf X "%u %u", $wds_handle ? $cid[QMI_WDS] : 0, $wds_handle || 0;
+	    printf X " %u %u", $cid2, $wds_handle2 if $wds_handle2;
+	    print X "\n";
 	}
 	close X;
     } else {
 	warn "$netdev: FATAL: cannot open \"$state\": $!\n";
 	$wds_handle = 0; # will cause disconnect when CID is released
+	$wds_handle2 = 0;
     }
 }
 
@@ -1976,16 +2269,25 @@ sub get_wds_state {
     }
     my $x = <X>;
     close X;
-    ($cid[QMI_WDS], $wds_handle) = split(/ /, $x) if $x;
+    ($cid[QMI_WDS], $wds_handle, $cid2, $wds_handle2) = split(' ', $x) if $x;
 
-    # verify that the state is valid
-    my $conn = &wds_get_pkt_srvc_status;
+    # verify that the state is valid, both sessions at once
+    my @ret = &send_and_recv_all(2, # short timeout
+				 mk_wds(0x0022), # QMI_WDS_GET_PKT_SRVC_STATUS
+				 $cid2 ? mk_qmi(QMI_WDS, $cid2, 0x0022) : undef);
+    my $conn = &wds_get_pkt_srvc_status($ret[0]);
     if (!$conn || $conn ne 'CONNECTED') { # handle is invalid
 	$wds_handle = 0;
     }
     if (!$conn) { # CID is invalid
 	$cid[QMI_WDS] = 0;
     }
+    if ($cid2) {
+	$conn = &wds_get_pkt_srvc_status($ret[1]);
+	$wds_handle2 = 0 if (!$conn || $conn ne 'CONNECTED');
+	$cid2 = 0 if !$conn;
+	printf STDERR "$netdev: QMI_WDS cid=%u, wds_handle=0x%08x\n", $cid2, $wds_handle2 || 0 if $verbose;
+    }
     $tid ||= 1;
     printf STDERR "$netdev: QMI_WDS cid=%u, wds_handle=0x%08x\n", $cid[QMI_WDS], $wds_handle if $verbose;
 }
@@ -1998,8 +2300,7 @@ sub device_info {
 
 # detect whether device management interface talks QMI
 sub is_qmi {
-   my $req = mk_dms(0x0020);	# QMI_DMS_GET_DEVICE_CAP
-   my $ret = send_and_recv($req, 1);	# 1 second timeout
+   my $ret = shift || send_and_recv(mk_dms(0x0020), 1);	# QMI_DMS_GET_DEVICE_CAP, 1 second timeout
    return undef if !exists($ret->{tf});
 
    # report capabilities
@@ -2052,18 +2353,21 @@ sub is_at {
 
 
 sub status {
-    warn "$netdev: capabilities: ", &is_qmi, "\n";
+    # the queries are independent, so send them all at once
+    my ($cap, $srvc) = &send_and_recv_all(2, &mk_dms(0x0020), &mk_wds(0x0022));
+    warn "$netdev: capabilities: ", &is_qmi($cap), "\n";
 
-    my $conn = &wds_get_pkt_srvc_status || 'unknown';
+    my $conn = &wds_get_pkt_srvc_status($srvc) || 'unknown';
     warn "$netdev: $conn\n";
     return unless ($conn eq 'CONNECTED');
 
-    warn "$netdev: current data bearer: ", &wds_get_data_bearer_technology, "\n";
-    my $rate = &wds_get_current_channel_rate;
+    my ($bearer, $rate, $call) = &send_and_recv_all(5, &mk_wds(0x0037), &mk_wds(0x0023), &mk_wds(0x0035));
+    warn "$netdev: current data bearer: ", &wds_get_data_bearer_technology($bearer), "\n";
+    $rate = &wds_get_current_channel_rate($rate);
     warn "$netdev: current tx/rx = $rate->[0]/$rate->[1]\n";
     warn "$netdev: max tx/rx = $rate->[2]/$rate->[3]\n";
     
-    my $call = &wds_get_call_duration;
+    $call = &wds_get_call_duration($call);
     map { warn "$netdev: $_: $call->{$_}\n" } keys %$call;
 }
 
@@ -2144,8 +2448,457 @@ sub ctl_set_data_format {
     return &verify_status($ret);
 }
 
+## WDA
+
+# QMI_WDA_SET_DATA_FORMAT TLVs from a format like
+#   raw-ip dl=qmap dgrams=32 size=16384
+sub wda_format_tlvs {
+    my %tlv;
+    foreach my $arg (map { split } @_) {
+	my $n;
+	if (defined($n = QMI::WDA::llp_num($arg))) {
+	    $tlv{0x11} = pack("V", $n);
+	} elsif ($arg =~ /^(ul|dl)=(.+)$/i && defined($n = QMI::WDA::agg_num($2))) {
+	    $tlv{lc($1) eq 'ul' ? 0x12 : 0x13} = pack("V", $n);
+	} elsif ($arg =~ /^dgrams=(\d+)$/) {
+	    $tlv{0x15} = pack("V", $1);
+	} elsif ($arg =~ /^size=(\d+)$/) {
+	    $tlv{0x16} = pack("V", $1);
+	} else {
+	    warn "$netdev: unknown data format \"$arg\"\n";
+	    return undef;
+	}
+    }
+    return \%tlv;
+}
+
+# the data format from a QMI_WDA_GET_DATA_FORMAT or SET_DATA_FORMAT reply
+sub wda_data_format {
+    my $ret = shift;
+    my %name = (
+	0x11 => 'llp',
+	0x12 => 'ul',
+	0x13 => 'dl',
+	0x15 => 'dgrams',
+	0x16 => 'size',
+	);
+    my %fmt;
+    foreach my $t (keys %name) {
+	my $v = $ret->{tlvs}{$t};
+	$fmt{$name{$t}} = unpack("V", pack("C*", @$v)) if ($v && @$v >= 4);
+    }
+    return \%fmt;
+}
+
+sub wda_format_string {
+    my $fmt = shift;
+    my @s;
+    push(@s, QMI::WDA::llp_name($fmt->{llp})) if defined($fmt->{llp});
+    push(@s, "ul=" . QMI::WDA::agg_name($fmt->{ul})) if defined($fmt->{ul});
+    push(@s, "dl=" . QMI::WDA::agg_name($fmt->{dl})) if defined($fmt->{dl});
+    push(@s, "dgrams=$fmt->{dgrams}") if $fmt->{dl};
+    push(@s, "size=$fmt->{size}") if $fmt->{dl};
+    return join(' ', @s) || 'unknown';
+}
+
+sub write_sysfs {
+    my ($file, $val) = @_;
+
+    open(my $fh, ">", $file) || return 0;
+    my $ok = print $fh "$val\n";
+    return close($fh) && $ok;
+}
+
+# make qmi_wwan match the data format. It must frame the link layer
+# protocol the same way, and its rx URBs must hold a whole downlink
+# aggregate.  usbnet sizes the URBs by the MTU.  Neither can be changed
+# while the netdev is up
+sub wda_apply_format {
+    my $fmt = shift;
+    my $sys = "/sys/class/net/$netdev";
+
+    if (defined($fmt->{llp})) {
+	my $raw = $fmt->{llp} == 2 ? 'Y' : 'N';
+	if (!-e "$sys/qmi/raw_ip") {
+	    warn "$netdev: qmi_wwan does not support raw-ip\n" if ($raw eq 'Y');
+	} elsif (!&write_sysfs("$sys/qmi/raw_ip", $raw)) {
+	    warn "$netdev: cannot set raw_ip=$raw: $!\n";
+	}
+    }
+    if ($fmt->{dl} && $fmt->{size} && !&write_sysfs("$sys/mtu", $fmt->{size})) {
+	warn "$netdev: cannot set mtu $fmt->{size} for downlink aggregation: $!\n";
+    }
+}
+
+sub wda_get_data_format {
+    my $ret = &send_and_recv(&mk_wda(0x0021)); # QMI_WDA_GET_DATA_FORMAT
+    my $status = verify_status($ret);
+    if ($status) {
+	warn "$netdev: get data format failed: $err{$status}\n";
+	return undef;
+    }
+    return &wda_data_format($ret);
+}
+
+# set the data format, and qmi_wwan to what the modem accepted
+sub wda_set_data_format {
+    my $tlv = &wda_format_tlvs(@_) || return 1;
+    my $ret = &send_and_recv(&mk_wda(0x0020, $tlv)); # QMI_WDA_SET_DATA_FORMAT
+    my $status = verify_status($ret);
+    if ($status) {
+	warn "$netdev: set data format failed: $err{$status}\n";
+	return $status;
+    }
+    my $fmt = &wda_data_format($ret);
+    warn "$netdev: data format: ", &wda_format_string($fmt), "\n";
+    &wda_apply_format($fmt);
+    return 0;
+}
+
+# pass the command to a running daemon, which has the device open
+# and the CIDs allocated already.  Returns false if there is none
+sub daemon_client {
+    return 0 unless (-S $sock);
+    socket(F, PF_UNIX, SOCK_STREAM, 0) || return 0;
+    connect(F, sockaddr_un($sock)) || return 0;
+
+    my @req = ("--system=$system", "--family=$family",
+	       $dualstack ? "--dualstack" : "--nodualstack",
+	       $verbose ? "--verbose" : "--noverbose",
+	       $debug ? "--debug" : "--nodebug");
+    push(@req, "--pin=$pin{1}") if $pin{1};
+    push(@req, "--apn=$apn") if $apn;
+    push(@req, "--user=$user") if $user;
+    push(@req, "--pw=$pw") if $pw;
+    push(@req, grep { defined } @_);
+
+    warn "$netdev: sending command to daemon on $sock\n" if $debug;
+    syswrite(F, join("\n", @req) . "\n");
+    shutdown(F, 1);
+    my $buf;
+    while (sysread(F, $buf, 4096)) {
+	print $buf;
+    }
+    close(F);
+    return 1;
+}
+
+# run a command read from a daemon client, using the daemon settings
+# as defaults
+sub daemon_request {
+    my @args = @_;
+    my ($sys, $fam) = ($system, $family);
+    my ($v, $d, $p, $a, $u, $w, $ds) = ($verbose, $debug, $pin{1}, $apn, $user, $pw, $dualstack);
+
+    if (Getopt::Long::GetOptionsFromArray(\@args,
+					  'system=s' => \$system,
+					  'family=s' => \$family,
+					  'dualstack!' => \$dualstack,
+					  'verbose!' => \$verbose,
+					  'debug!' => \$debug,
+					  'pin=s' => \$pin{1},
+					  'apn=s' => \$apn,
+					  'user=s' => \$user,
+					  'pw=s' => \$pw,
+	)) {
+	$system = &parse_system($system);
+	$family =~ s/^inet//;
+	$family =~ s/^ipv//i;
+
+	# the state and the QMI_WDS CID are per family
+	if ($family != $fam) {
+	    warn "$netdev: this daemon serves IPv$fam only\n";
+	} elsif (!defined($system)) {
+	    warn "$netdev: unknown system\n";
+	} elsif ($system == QMI_WDS && ($args[0] || '') eq 'monitor') {
+	    # the daemon drops indications while idle, and would have
+	    # to stop serving others to stream them
+	    warn "$netdev: cannot monitor through the daemon - stop it first\n";
+	} else {
+	    eval { &run_cmd(@args); };
+	    &save_wds_state;
+	}
+    }
+
+    ($system, $family) = ($sys, $fam);
+    ($verbose, $debug, $pin{1}, $apn, $user, $pw, $dualstack) = ($v, $d, $p, $a, $u, $w, $ds);
+    die $@ if $@;
+}
+
+# serve commands on the unix socket until killed.  Output to STDOUT and
+# STDERR goes to the client while a command runs.  Indications received
+# while idle are dropped, so they are not mistaken for replies later
+sub daemon {
+    my $done = 0;
+
+    unlink($sock);
+    socket(S, PF_UNIX, SOCK_STREAM, 0) || die "socket: $!\n";
+    bind(S, sockaddr_un($sock)) || die "bind $sock: $!\n";
+    listen(S, 5) || die "listen: $!\n";
+    warn "$netdev: daemon listening on $sock\n" if $verbose;
+
+    local $SIG{TERM} = sub { $done = 1; };
+    local $SIG{INT} = sub { $done = 1; };
+    while (!$done) {
+	my $rin = '';
+	vec($rin, fileno(S), 1) = 1;
+	vec($rin, fileno(F), 1) = 1;
+	next if (select(my $rout = $rin, undef, undef, undef) <= 0);
+	if (vec($rout, fileno(F), 1)) {
+	    if (!&read_qmi(0)) {
+		warn "$netdev: $dev closed\n";
+		last;
+	    }
+	    @rxq = ();
+	    next unless vec($rout, fileno(S), 1);
+	}
+	accept(C, S) || next;
+
+	# the request ends when the client shuts down its write side
+	my $req = '';
+	eval {
+	    local $SIG{ALRM} = sub { die "alarm\n" };
+	    alarm 5;
+	    my $buf;
+	    while (sysread(C, $buf, 4096)) {
+		$req .= $buf;
+	    }
+	    alarm 0;
+	};
+
+	open(my $stdout, ">&", \*STDOUT) || die "dup: $!\n";
+	open(my $stderr, ">&", \*STDERR) || die "dup: $!\n";
+	open(STDOUT, ">&", \*C);
+	open(STDERR, ">&", \*C);
+	autoflush STDOUT 1;
+
+	$in_request = 1;
+	@rxq = ();
+	eval { &daemon_request(grep { length } split(/[\0\n]/, $req)); };
+	$in_request = 0;
+	warn $@ if ($@ && $@ ne "usage\n");
+
+	open(STDOUT, ">&", $stdout);
+	open(STDERR, ">&", $stderr);
+	close(C);
+    }
+
+    close(S);
+    unlink($sock);
+}
+
+# run one command, possibly on behalf of a daemon client
+sub run_cmd {
+    my $cmd = shift;
+
+    # special command alias handling per system
+    if ($system == QMI_WDS) {
+	# get and verify cached data, so we can reuse the QMI_WDS CID at least
+	&get_wds_state unless ($daemon && $cid[QMI_WDS]);
+
+	# start interface?
+	if ($cmd eq 'start') {
+    #	if (&dms_verify_pin) {
+		my $handle = shift;
+		&wds_start_network_interface($handle);
+    #	} else {
+    #	    warn "$netdev: cannot start without PIN verification\n";
+    #	}
+
+	# stop interface?
+	} elsif ($cmd eq 'stop') {
+	    &wds_stop_network_interface;
+ 
+	# or just print status?
+	} elsif ($cmd eq 'status') {
+	    &status;
+	} elsif ($cmd eq 'profile') {
+	    my $profile = shift;
+	    warn "Modifying profile #$profile: ", $err{&wds_modify_profile($profile)}, "\n";
+	} elsif ($cmd eq 'monitor') {
+	    &send_and_recv(&mk_wds(0x0001, {0x10 => pack("C", 1), # Current Channel Rate Indicator
+					    0x15 => pack("C", 1), # Current Data Bearer Technology Indicator
+					    0x17 => pack("C", 1), # Data Call Status Change Indicator
+				   }));
+
+	    # monitor QMI_NAS changes as well, regisering interest in band notifications
+	    &send_and_recv(&mk_nas(0x0003, {0x13 => pack("C", 1), # Serving System Events
+					    0x20 => pack("C", 1), # RF Band Information
+				   }));
+	    $monitor = 1;
+	}
+    } elsif ($system == QMI_NAS) {
+	if (!$cmd) {
+	    &nas_set_system_selection_preference; # force new scan
+	} elsif ($cmd eq 'lte') {
+	    &nas_set_system_selection_preference(1<<4); # force LTE only
+	} elsif ($cmd eq 'register') {
+	    &nas_initiate_network_register;
+	} elsif ($cmd eq 'scan') {
+	    &nas_perform_network_scan;
+	}
+    } elsif ($system == QMI_WMS) {
+	unless ($cmd) {
+	    &wms_list_messages;
+	    &wms_raw_read(0,0);
+	}
+    } elsif ($system == QMI_CTL) {
+	if ($cmd eq 'sync') {
+	    warn "Resetting device state: ", $err{&ctl_sync}, "\n";
+	} elsif ($cmd eq 'mode') {
+	    my $mode = shift;
+	    if ($mode == 1 || $mode == 2 || $mode == 3 ) {
+		&ctl_set_data_format($mode, shift);
+	    }
+	}
+    } elsif ($system == QMI_WDA) {
+	if ($cmd eq 'format' && @_) {
+	    &wda_set_data_format(@_);
+	} elsif ($cmd eq 'format') {
+	    my $fmt = &wda_get_data_format;
+	    warn "$netdev: data format: ", &wda_format_string($fmt), "\n" if $fmt;
+	}
+    } elsif ($system == QMI_UIM) {
+	if ($cmd eq 'pin') {
+	    &uim_verify_pin(1);
+	}
+    } elsif ($system == QMI_PDS) {
+	if ($cmd eq 'xtra') {
+	    my $old = $debug;
+	    $debug = 1;
+
+	    # 1. setup event report
+	    &send_and_recv(&mk_pds(0x0001, {
+    #	    0x10 => pack("C", 1), # Report NMEA data
+		0x23 => pack("C", 1), # Report *extended* external XTRA data requests
+				   }));
+
+	    # 2. wait with infinite timeout and matching on PDS Event Report indications
+	    my @urls = ();
+	    my $maxsize = 0;
+
+	    my $match = {
+		tf => 1,
+		sys => QMI_PDS,
+		cid => &get_cid(QMI_PDS),
+		flags => 0x04,
+		ctrl => 0x80,
+		msgid => 0x0001,
+	    };
+
+	    my $qmi_in;
+	    do {
+		$qmi_in = &read_match($match, 0);
+
+		# TLV 0x14 is "External XTRA Database Request" - too small max file size!
+		# TLV 0x26 is "Extended External XTRA Database Request"
+		if ($qmi_in->{tlvs}{0x26}) {
+		    my $data = pack("C*", @{$qmi_in->{tlvs}{0x26}});
+		    my $num;
+		    ($maxsize, $num) = unpack("VC", $data);
+		    warn "xtra: got $num urls and max file size = $maxsize\n";
+		    $data = substr($data, 5);
+		    for (my $i = 0; $i < $num; $i++) {
+			last unless $data; # failsafe
+			my $len = unpack("C", $data);
+			push(@urls, substr($data, 1, $len));
+			$data = substr($data, $len + 1);
+		    } 
+
+		}
+	    } while (!@urls && exists($qmi_in->{tf}));
+
+	    # 3. download file
+	    print Dumper(\@urls);
+
+	    my $content;
+	    foreach my $url (@urls) {
+		$content = get($url);
+		last if $content;
+	    }
+
+	    # 4. upload file in pieces within 90 seconds from event
+	    my $seq = 0;
+	    my $total = $content ? length($content) : 0;
+	    warn "will upload $total bytes\n";
+	    while (($total < $maxsize) && $content) {
+		my $chunk = substr($content, 0, 1536 );
+		$content = substr($content, 1536);
+
+		# QMI_PDS_INJECT_XTRA_DATA
+		my $ret = &send_and_recv(&mk_pds(0x0037,
+						 {0x01 => pack("Cvv", $seq, $total, length($chunk)) . $chunk
+						 }), 30); # need longer read timeout than default?
+		my $status = verify_status($ret);
+		if ($status) {
+		    warn "seq=$seq returned $err{$status} ($status)\n";
+		    last;
+		}
+		$seq++;
+	    }
+
+	    $debug = $old;
+
+	}
+    }
+
+    # default common command number handling
+    if ($cmd && $cmd =~ s/^0x//) {
+	my $msgid = hex($cmd);
+	my $cid = $system == QMI_CTL ? 0 : &get_cid($system);
+
+	# need to temporarily override debug output to force any useful output at all
+	my $olddebug = $debug;
+	$debug = 1;
+	if (defined($cid)) {
+	    # anything else is considered TLV contents
+	    #  e.g:  0x01 00 0x10 01 0f => { 0x01 => 0, 0x10 => 0x0f01 }
+	    my $tlv;
+	    my @data;
+	    my %msg = ();
+	    foreach my $arg (@_) {
+		# anything starting with 0x is considered a new TLV number
+		if ($arg =~ s/^0x([0-9a-f]{1,2})$/$1/i) {
+		    if ($tlv) {
+			# all TLVs need some data
+			&usage unless @data;
+			$msg{$tlv} = pack("C*", @data);
+			@data = ();
+		    }
+		    $tlv = hex($arg);
+		} elsif ($tlv && $arg =~ /^[0-9a-f]{1,2}$/i) {
+		    push(@data, hex($arg));
+		} else {
+		    &usage;
+		}
+	    }
+	    if ($tlv) {
+		# all TLVs need some data
+		&usage unless @data;
+		$msg{$tlv} = pack("C*", @data);
+	    }
+	    &send_and_recv(&mk_qmi($system, $cid, $msgid, \%msg));
+	}
+	$debug = $olddebug;
+    }
+}
+
 ### main ###
 
+# get the command
+my $cmd = shift;
+
+# let network scripts override everything
+if (exists $ENV{'PHASE'}) {
+    $cmd = $ENV{'PHASE'};
+    $cmd =~ s/^pre-up$/start/;
+    $cmd =~ s/^post-down$/stop/;
+    $system = QMI_WDS;
+}
+
+# a daemon already has the device open
+exit if (!$daemon && !$proxy && !defined($xcid) && !$monitor && &daemon_client($cmd, @ARGV));
+
 # look up management character device
 $dev ||= &get_mgmt_dev($netdev);
 if (!$dev) {
@@ -2181,202 +2934,16 @@ if ($proxy) {
 $SIG{TERM} = \&release_cids;
 $SIG{INT} = \&release_cids;
 
-##&device_info if $verbose;
-
-# get the command
-my $cmd = shift;
-
-# let network scripts override everything
-if (exists $ENV{'PHASE'}) {
-    $cmd = $ENV{'PHASE'};
-    $cmd =~ s/^pre-up$/start/;
-    $cmd =~ s/^post-down$/stop/;
-    $system = QMI_WDS;
-}
-
-# special command alias handling per system
-if ($system == QMI_WDS) {
-    # get and verify cached data, so we can reuse the QMI_WDS CID at least
-    &get_wds_state;
-
-    # start interface?
-    if ($cmd eq 'start') {
-#	if (&dms_verify_pin) {
-	    my $handle = shift;
-	    &wds_start_network_interface($handle);
-#	} else {
-#	    warn "$netdev: cannot start without PIN verification\n";
-#	}
-
-    # stop interface?
-    } elsif ($cmd eq 'stop') {
-	&wds_stop_network_interface;
- 
-    # or just print status?
-    } elsif ($cmd eq 'status') {
-	&status;
-    } elsif ($cmd eq 'profile') {
-	my $profile = shift;
-	warn "Modifying profile #$profile: ", $err{&wds_modify_profile($profile)}, "\n";
-    } elsif ($cmd eq 'monitor') {
-	&send_and_recv(&mk_wds(0x0001, {0x10 => pack("C", 1), # Current Channel Rate Indicator
-					0x15 => pack("C", 1), # Current Data Bearer Technology Indicator
-					0x17 => pack("C", 1), # Data Call Status Change Indicator
-			       }));
-
-	# monitor QMI_NAS changes as well, regisering interest in band notifications
-	&send_and_recv(&mk_nas(0x0003, {0x13 => pack("C", 1), # Serving System Events
-					0x20 => pack("C", 1), # RF Band Information
-			       }));
-	$monitor = 1;
-    }
-} elsif ($system == QMI_NAS) {
-    if (!$cmd) {
-	&nas_set_system_selection_preference; # force new scan
-    } elsif ($cmd eq 'lte') {
-	&nas_set_system_selection_preference(1<<4); # force LTE only
-    } elsif ($cmd eq 'register') {
-	&nas_initiate_network_register;
-    } elsif ($cmd eq 'scan') {
-	&nas_perform_network_scan;
-    }
-} elsif ($system == QMI_WMS) {
-    unless ($cmd) {
-	&wms_list_messages;
-	&wms_raw_read(0,0);
-    }
-} elsif ($system == QMI_CTL) {
-    if ($cmd eq 'sync') {
-	warn "Resetting device state: ", $err{&ctl_sync}, "\n";
-    } elsif ($cmd eq 'mode') {
-	my $mode = shift;
-	if ($mode == 1 || $mode == 2 || $mode == 3 ) {
-	    &ctl_set_data_format($mode, shift);
-	}
-    }
-} elsif ($system == QMI_UIM) {
-    if ($cmd eq 'pin') {
-	&uim_verify_pin(1);
-    }
-} elsif ($system == QMI_PDS) {
-    if ($cmd eq 'xtra') {
-	my $old = $debug;
-	$debug = 1;
-
-	# 1. setup event report
-	&send_and_recv(&mk_pds(0x0001, {
-#	    0x10 => pack("C", 1), # Report NMEA data
-	    0x23 => pack("C", 1), # Report *extended* external XTRA data requests
-			       }));
-
-	# 2. wait with infinite timeout and matching on PDS Event Report indications
-	my @urls = ();
-	my $maxsize = 0;
-
-	my $match = {
-	    tf => 1,
-	    sys => QMI_PDS,
-	    cid => &get_cid(QMI_PDS),
-	    flags => 0x04,
-	    ctrl => 0x80,
-	    msgid => 0x0001,
-	};
-
-	my $qmi_in;
-	do {
-	    $qmi_in = &read_match($match, 0);
-
-	    # TLV 0x14 is "External XTRA Database Request" - too small max file size!
-	    # TLV 0x26 is "Extended External XTRA Database Request"
-	    if ($qmi_in->{tlvs}{0x26}) {
-		my $data = pack("C*", @{$qmi_in->{tlvs}{0x26}});
-		my $num;
-		($maxsize, $num) = unpack("VC", $data);
-		warn "xtra: got $num urls and max file size = $maxsize\n";
-		$data = substr($data, 5);
-		for (my $i = 0; $i < $num; $i++) {
-		    last unless $data; # failsafe
-		    my $len = unpack("C", $data);
-		    push(@urls, substr($data, 1, $len));
-		    $data = substr($data, $len + 1);
-		} 
-
-	    }
-	} while (!@urls && exists($qmi_in->{tf}));
-
-	# 3. download file
-	print Dumper(\@urls);
-
-	my $content;
-	foreach my $url (@urls) {
-	    $content = get($url);
-	    last if $content;
-	}
-
-	# 4. upload file in pieces within 90 seconds from event
-	my $seq = 0;
-	my $total = $content ? length($content) : 0;
-	warn "will upload $total bytes\n";
-	while (($total < $maxsize) && $content) {
-	    my $chunk = substr($content, 0, 1536 );
-	    $content = substr($content, 1536);
-
-	    # QMI_PDS_INJECT_XTRA_DATA
-	    my $ret = &send_and_recv(&mk_pds(0x0037,
-					     {0x01 => pack("Cvv", $seq, $total, length($chunk)) . $chunk
-					     }), 30); # need longer read timeout than default?
-	    my $status = verify_status($ret);
-	    if ($status) {
-		warn "seq=$seq returned $err{$status} ($status)\n";
-		last;
-	    }
-	    $seq++;
-	}
-
-	$debug = $old;
-
-    }
+if ($daemon) {
+    &daemon;
+    &release_cids;
+    close(F);
+    exit;
 }
 
-# default common command number handling
-if ($cmd && $cmd =~ s/^0x//) {
-    my $msgid = hex($cmd);
-    my $cid = $system == QMI_CTL ? 0 : &get_cid($system);
+##&device_info if $verbose;
 
-    # need to temporarily override debug output to force any useful output at all
-    my $olddebug = $debug;
-    $debug = 1;
-    if (defined($cid)) {
-	# anything else is considered TLV contents
-	#  e.g:  0x01 00 0x10 01 0f => { 0x01 => 0, 0x10 => 0x0f01 }
-	my $tlv;
-	my @data;
-	my %msg = ();
-	foreach my $arg (@ARGV) {
-	    # anything starting with 0x is considered a new TLV number
-	    if ($arg =~ s/^0x([0-9a-f]{1,2})$/$1/i) {
-		if ($tlv) {
-		    # all TLVs need some data
-		    &usage unless @data;
-		    $msg{$tlv} = pack("C*", @data);
-		    @data = ();
-		}
-		$tlv = hex($arg);
-	    } elsif ($tlv && $arg =~ /^[0-9a-f]{1,2}$/i) {
-		push(@data, hex($arg));
-	    } else {
-		&usage;
-	    }
-	}
-	if ($tlv) {
-	    # all TLVs need some data
-	    &usage unless @data;
-	    $msg{$tlv} = pack("C*", @data);
-	}
-	&send_and_recv(&mk_qmi($system, $cid, $msgid, \%msg));
-    }
-    $debug = $olddebug;
-}
+&run_cmd($cmd, @ARGV);
 
 # save state for next run
 &save_wds_state;
@@ -0,0 +1,333 @@
+/*
+ * atcmd.c - AT command engine for modem management ports
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include "atcmd.h"
+
+static const struct {
+	const char *str;
+	int result;
+} final[] = {
+	{ "OK", AT_OK },
+	{ "ERROR", AT_ERROR },
+	{ "NO CARRIER", AT_NO_CARRIER },
+	{ "BUSY", AT_BUSY },
+	{ "NO ANSWER", AT_NO_ANSWER },
+	{ "NO DIALTONE", AT_NO_DIALTONE },
+};
+
+static const char *const result_str[] = {
+	[AT_OK] = "OK",
+	[AT_CONNECT] = "CONNECT",
+	[AT_ERROR] = "ERROR",
+	[AT_CME_ERROR] = "+CME ERROR",
+	[AT_CMS_ERROR] = "+CMS ERROR",
+	[AT_NO_CARRIER] = "NO CARRIER",
+	[AT_BUSY] = "BUSY",
+	[AT_NO_ANSWER] = "NO ANSWER",
+	[AT_NO_DIALTONE] = "NO DIALTONE",
+};
+
+const char *at_result_str(int result)
+{
+	if (result < 0)
+		return strerror(-result);
+	if (result >= (int)(sizeof(result_str) / sizeof(result_str[0])))
+		return "unknown";
+	return result_str[result];
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void at_init(struct at_chan *at, int fd)
+{
+	memset(at, 0, sizeof(*at));
+	at->fd = fd;
+}
+
+/* read whatever is available within timeout_ms.  Returns bytes read, 0 or -errno */
+static int fill(struct at_chan *at, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = at->fd, .events = POLLIN };
+	ssize_t n;
+	int rc;
+
+	rc = poll(&pfd, 1, timeout_ms < 0 ? 0 : timeout_ms);
+	if (rc < 0)
+		return errno == EINTR ? 0 : -errno;
+	if (!rc)
+		return 0;
+	n = read(at->fd, at->in + at->inlen, sizeof(at->in) - at->inlen);
+	if (n < 0)
+		return (errno == EINTR || errno == EAGAIN) ? 0 : -errno;
+	if (!n)
+		return -EPIPE;
+	at->inlen += n;
+	return n;
+}
+
+/* the next non-empty line, if complete.  Returns its length or 0 */
+static int next_line(struct at_chan *at, char *line)
+{
+	size_t i, len;
+
+	while (at->inlen) {
+		for (i = 0; i < at->inlen && at->in[i] != '\r' && at->in[i] != '\n'; i++)
+			;
+		if (i == at->inlen && i < sizeof(at->in))
+			return 0;
+
+		/* a line filling the buffer is truncated, and the rest discarded */
+		len = at->skip ? 0 : i;
+		if (len == sizeof(at->in))
+			len--;
+		memcpy(line, at->in, len);
+		line[len] = 0;
+
+		if (i == at->inlen) {
+			at->inlen = 0;
+			at->skip = 1;
+		} else {
+			memmove(at->in, at->in + i + 1, at->inlen - i - 1);
+			at->inlen -= i + 1;
+			at->skip = 0;
+		}
+		if (len) {
+			if (at->debug)
+				fprintf(stderr, "< %s\n", line);
+			return len;
+		}
+	}
+	return 0;
+}
+
+static void queue_urc(struct at_chan *at, const char *line)
+{
+	if (at->urc_n == AT_URC_MAX) {
+		at->urc_first = (at->urc_first + 1) % AT_URC_MAX;
+		at->urc_n--;
+		at->urc_dropped++;
+	}
+	strcpy(at->urc[(at->urc_first + at->urc_n++) % AT_URC_MAX], line);
+}
+
+/* the enum at_result of a final result code, or -1 */
+static int final_result(const char *line, int *err)
+{
+	size_t i;
+
+	*err = -1;
+	for (i = 0; i < sizeof(final) / sizeof(final[0]); i++)
+		if (!strcmp(line, final[i].str))
+			return final[i].result;
+	if (!strncmp(line, "CONNECT", 7) && (!line[7] || line[7] == ' '))
+		return AT_CONNECT;
+
+	/* the error is text with AT+CMEE=2 */
+	if (!strncmp(line, "+CME ERROR:", 11)) {
+		if (isdigit(line[strspn(line + 11, " ") + 11]))
+			*err = atoi(line + 11);
+		return AT_CME_ERROR;
+	}
+	if (!strncmp(line, "+CMS ERROR:", 11)) {
+		if (isdigit(line[strspn(line + 11, " ") + 11]))
+			*err = atoi(line + 11);
+		return AT_CMS_ERROR;
+	}
+	return -1;
+}
+
+/* "AT+CPIN?" => "+CPIN" */
+static void cmd_prefix(const char *cmd, char *pfx, size_t size)
+{
+	size_t n = 0;
+
+	if (!strncasecmp(cmd, "AT", 2))
+		cmd += 2;
+	while (*cmd && !strchr("=?;", *cmd) && n < size - 1)
+		pfx[n++] = toupper(*cmd++);
+	pfx[n] = 0;
+}
+
+static int is_urc(const char *line, const char *pfx)
+{
+	size_t n;
+
+	if (!line[0] || !strchr("+*^%", line[0]))
+		return 0;
+	n = strcspn(line, ":");
+	return strlen(pfx) != n || strncasecmp(line, pfx, n);
+}
+
+/* whole lines only, so that a truncated response is still parseable */
+static void append(struct at_resp *resp, const char *line)
+{
+	size_t len = strlen(line);
+
+	if (!resp || !resp->buf)
+		return;
+	if (resp->len + len + 2 > resp->size) {
+		resp->truncated = 1;
+		return;
+	}
+	memcpy(resp->buf + resp->len, line, len);
+	resp->len += len;
+	resp->buf[resp->len++] = '\n';
+	resp->buf[resp->len] = 0;
+}
+
+static int write_all(struct at_chan *at, const char *buf, size_t len, long long deadline)
+{
+	struct pollfd pfd = { .fd = at->fd, .events = POLLOUT };
+	ssize_t n;
+	int rc;
+
+	while (len) {
+		rc = poll(&pfd, 1, deadline - now_ms() > 0 ? deadline - now_ms() : 0);
+		if (rc < 0 && errno != EINTR)
+			return -errno;
+		if (!rc)
+			return -ETIMEDOUT;
+		if (rc < 0)
+			continue;
+		n = write(at->fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int at_poll(struct at_chan *at)
+{
+	char line[AT_LINE_MAX];
+	int rc;
+
+	do {
+		while (next_line(at, line) > 0)
+			queue_urc(at, line);
+		rc = fill(at, 0);
+	} while (rc > 0);
+	return rc < 0 ? rc : at->urc_n;
+}
+
+int at_cmd(struct at_chan *at, const char *cmd, struct at_resp *resp, int timeout_ms)
+{
+	char line[AT_LINE_MAX], out[AT_LINE_MAX + 1], pfx[32];
+	long long deadline = now_ms() + timeout_ms;
+	int len, rc, result, err;
+
+	if (resp) {
+		resp->len = 0;
+		resp->truncated = 0;
+		resp->result = -1;
+		resp->err = -1;
+		if (resp->buf && resp->size)
+			resp->buf[0] = 0;
+	}
+
+	/* anything received before the command is unsolicited */
+	rc = at_poll(at);
+	if (rc < 0)
+		return rc;
+
+	len = snprintf(out, sizeof(out), "%s\r", cmd);
+	if (len >= (int)sizeof(out))
+		return -EINVAL;
+	if (at->debug)
+		fprintf(stderr, "> %s\n", cmd);
+	rc = write_all(at, out, len, deadline);
+	if (rc < 0)
+		return rc;
+
+	cmd_prefix(cmd, pfx, sizeof(pfx));
+	while (1) {
+		if (!next_line(at, line)) {
+			rc = fill(at, deadline - now_ms());
+			if (rc < 0)
+				return rc;
+			if (!rc && now_ms() >= deadline)
+				return -ETIMEDOUT;
+			continue;
+		}
+		if (!strcasecmp(line, cmd))	/* echo */
+			continue;
+		result = final_result(line, &err);
+		if (result >= 0) {
+			if (resp) {
+				resp->result = result;
+				resp->err = err;
+			}
+			return result;
+		}
+		if (is_urc(line, pfx))
+			queue_urc(at, line);
+		else
+			append(resp, line);
+	}
+}
+
+int at_sequence(struct at_chan *at, const char *const cmds[], int n, struct at_resp resps[], int timeout_ms)
+{
+	int i, rc;
+
+	/* one round trip each, the next sent as soon as the final result is parsed */
+	for (i = 0; i < n; i++) {
+		rc = at_cmd(at, cmds[i], resps ? &resps[i] : NULL, timeout_ms);
+		if (rc != AT_OK) {
+			if (resps)
+				resps[i].result = rc;
+			break;
+		}
+	}
+	return i;
+}
+
+int at_urc(struct at_chan *at, char *line, size_t size, int timeout_ms)
+{
+	long long deadline = now_ms() + timeout_ms;
+	int rc;
+
+	while (1) {
+		rc = at_poll(at);
+		if (rc < 0)
+			return rc;
+		if (at->urc_n)
+			break;
+		if (deadline - now_ms() <= 0)
+			return 0;
+		rc = fill(at, deadline - now_ms());
+		if (rc < 0)
+			return rc;
+	}
+
+	snprintf(line, size, "%s", at->urc[at->urc_first]);
+	at->urc_first = (at->urc_first + 1) % AT_URC_MAX;
+	at->urc_n--;
+	return strlen(line);
+}
@@ -0,0 +1,104 @@
+/*
+ * atcmd.h - AT command engine for modem management ports
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Input is split into lines.  While a command is pending, a line is
+ * either part of its response, its final result code, or an
+ * unsolicited result code (URC) like "*E2NAP: 1" or "+CREG: 1".  URCs
+ * are queued separately, so they are neither mixed into responses nor
+ * lost.  Any line received while no command is pending is a URC.
+ *
+ * A line is taken as a URC during a command if it starts with one of
+ * "+*^%" and has another prefix than the command.  The prefix of
+ * "AT+CPIN?" is "+CPIN", so "+CPIN: READY" is part of its response
+ * while "+CREG: 1" is not.
+ *
+ * Lines longer than AT_LINE_MAX are truncated.  Nothing is allocated.
+ */
+
+#ifndef _ATCMD_H
+#define _ATCMD_H
+
+#include <stddef.h>
+
+#define AT_LINE_MAX	512
+#define AT_URC_MAX	16	/* queued URCs, dropping the oldest when full */
+
+/* final result codes */
+enum at_result {
+	AT_OK = 0,
+	AT_CONNECT,
+	AT_ERROR,
+	AT_CME_ERROR,		/* +CME ERROR: <err> */
+	AT_CMS_ERROR,		/* +CMS ERROR: <err> */
+	AT_NO_CARRIER,
+	AT_BUSY,
+	AT_NO_ANSWER,
+	AT_NO_DIALTONE,
+};
+
+struct at_resp {
+	char *buf;		/* information text, '\n' terminated lines */
+	size_t size;
+	size_t len;
+	int truncated;		/* did not fit in buf */
+	int result;		/* enum at_result */
+	int err;		/* +CME/+CMS ERROR code, or -1 */
+};
+
+struct at_chan {
+	int fd;
+	int debug;
+	char in[AT_LINE_MAX];	/* unprocessed input */
+	size_t inlen;
+	int skip;		/* discarding the rest of a long line */
+	char urc[AT_URC_MAX][AT_LINE_MAX];
+	int urc_first;
+	int urc_n;
+	unsigned long urc_dropped;
+};
+
+void at_init(struct at_chan *at, int fd);
+
+/*
+ * Send "cmd" and wait up to timeout_ms for its final result code.
+ * The information text goes to resp, which may be NULL.  Returns the
+ * enum at_result, or -ETIMEDOUT or another -errno
+ */
+int at_cmd(struct at_chan *at, const char *cmd, struct at_resp *resp, int timeout_ms);
+
+/*
+ * Run cmds[0..n-1] one at a time, in order, stopping at the first one
+ * not returning AT_OK.  This is not pipelining: a V.250 modem may
+ * ignore input until the final result code, so each command costs a
+ * round trip, and is sent the moment its predecessor completes.  The
+ * responses could only be kept apart in a single "AT+A;+B" command
+ * line if every command had its own prefix, which "ATI" does not.
+ * The response to cmds[i] goes to resps[i], if resps is not NULL.
+ * Returns the number of commands completed with AT_OK.  If less than
+ * n, the result of the failed command, or -errno, is in its
+ * resps[].result
+ */
+int at_sequence(struct at_chan *at, const char *const cmds[], int n, struct at_resp resps[], int timeout_ms);
+
+/*
+ * Get the oldest URC, waiting up to timeout_ms for one.  Returns the
+ * line length, 0 on timeout or -errno
+ */
+int at_urc(struct at_chan *at, char *line, size_t size, int timeout_ms);
+
+/*
+ * Queue the URCs in any input available now, without blocking.  For
+ * event loops polling at->fd.  Returns the number of queued URCs or
+ * -errno
+ */
+int at_poll(struct at_chan *at);
+
+const char *at_result_str(int result);
+
+#endif /* _ATCMD_H */
@@ -22,7 +22,17 @@
  * See the file COPYING.
  *
  * Building it:
- *   gcc -Wall `pkg-config fuse --cflags --libs` -lpthread cuseqmi.c -o cuseqmi
+ *   gcc -Wall `pkg-config fuse libusb-1.0 --cflags --libs` -lpthread cuseqmi.c qmux.c mbim.c pcapng.c wdmdev.c probecache.c usbwdm.c -o cuseqmi
+ *
+ * The modem can be a QMI mode cdc-wdm device, or an MBIM mode one
+ * supporting the EXT_QMUX service.  QMUX frames are then sent in
+ * MBIM_COMMAND_MSG and received in MBIM_COMMAND_DONE and
+ * MBIM_INDICATE_STATUS_MSG messages.  The MBIM device can be shared
+ * with other users by giving an mbim-proxy socket as the device.
+ *
+ * A QMI interface which is not bound to any driver can be used
+ * directly with libusb, by giving "usb:vid:pid[:interface]" as the
+ * device.
  *
  *
  
@@ -46,8 +56,23 @@ TODO:
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
 #include <linux/types.h>
+#include <linux/usb/cdc-wdm.h>
+#include "qmux.h"
+#include "mbim.h"
+#include "pcapng.h"
+#include "wdmdev.h"
+#include "probecache.h"
+#include "usbwdm.h"
 
 
 /* -- from qcqmi.c --- */
@@ -62,113 +87,20 @@ do {									\
 	fprintf(stderr, "%s: " fmt "\n", __func__, ##arg);		\
 } while (0)
 
-struct qmux {
-	__u8 tf;	/* always 1 */
-	__u16 len;
-	__u8 ctrl;
-	__u8 service;
-	__u8 qmicid;
-} __attribute__((__packed__));
-
-const size_t qmux_size = sizeof(struct qmux);
-
-struct qmictl {
-	struct qmux h;
-	__u8 req;
-	__u8 tid;
-	__u16 msgid;
-	__u16 tlvsize;
-	__u8 tlv[];
-} __attribute__((__packed__));
-
-struct qmiany {
-	struct qmux h;
-	__u8 req;
-	__u16 tid;
-	__u16 msgid;
-	__u16 tlvsize;
-	__u8 tlv[];
-} __attribute__((__packed__));
-
-struct qmitlv {
-	__u8 type;
-	__u16 len;
-	__u8 data[];
-} __attribute__((__packed__));
-
-size_t hexdump(char *buf, size_t buflen, unsigned char *data, size_t len)
-{
-	int i;
-	size_t max = 3 * len;
- 
-	if (max >= buflen)
-		return 0;
-	for (i = 0; i < len; i++)
-		sprintf(buf + i * 3, " %02hhx", data[i]);
-	return max;
-}
-
-size_t asciidump(char *buf, size_t buflen, unsigned char *data, size_t len)
-{
-	int i;
-	size_t max = len + 1;
- 
-	if (max >= buflen)
-		return 0;
-	buf[0] = '\t';
-	for (i = 0; i < len; i++)
-		if (data[i] >= ' ' && data[i] <= 127)
-			buf[i + 1] = data[i];
-		else
-			buf[i + 1] = '.';
-	buf[max + 1] = 0;
-	return max;
-}
-
-int formatqmux(char *buf, size_t buflen, const char *qmux)
-{
-	struct qmux *h = (void *)qmux;
-	struct qmictl *ctl = (void *)qmux;
-	struct qmiany *msg = (void *)qmux;
-	struct qmitlv *tlv;
-	__u8 *tlvdata;
-	int ret, tlvlen;
-
-	ret = snprintf(buf, buflen, ".tf=%u\n.len=%u\n.ctrl=%#04hhx\n.service=%#04hhx\n.cid=%#04hhx\n",
-		h->tf, h->len, h->ctrl, h->service, h->qmicid);
-
-	if (!h->service) {
-		tlvdata = ctl->tlv;
-		tlvlen = ctl->tlvsize;
-		ret += snprintf(buf + ret, buflen - ret, ".req=0x%02hhx\n.tid=%hhu\n.msgid=0x%04hx\n.tlvsize=%hu",
-			ctl->req, ctl->tid, ctl->msgid, tlvlen);
-	} else {
-		tlvdata = msg->tlv;
-		tlvlen = msg->tlvsize;
-		ret += snprintf(buf + ret, buflen - ret, ".req=0x%02hhx\n.tid=%hu\n.msgid=0x%04hx\n.tlvsize=%hu",
-			msg->req, msg->tid, msg->msgid, tlvlen);
-	}
-	tlv = (void *)tlvdata;
-	while ((__u8 *)tlv < tlvdata + tlvlen) {
-//		printf("tlv=%p, tlvdata=%p, tlvlen=%u\n", tlv, tlvdata, tlvlen);
-		ret += snprintf(buf + ret, buflen - ret, "\n[%02hhx] (%hu)", tlv->type, tlv->len);
-		ret += hexdump(buf + ret, buflen - ret, tlv->data, tlv->len);
-		ret += asciidump(buf + ret, buflen - ret, tlv->data, tlv->len);
-		tlv = (struct qmitlv *)((char *)tlv + tlv->len + sizeof(*tlv));
-		
-	}
-	ret += snprintf(buf + ret, buflen - ret, "\n\n");
-	return ret;
-}
+/* --tap capture of all QMUX frames */
+static struct pcapng *tap;
+static int tap_if;
 
-static char dbgbuf[4096];
 #define IN 0
 #define OUT 1
-int dbgdump(char *data, int dir)
+static void dbgdump(const void *data, size_t len, int dir)
 {
-	formatqmux(dbgbuf, sizeof(dbgbuf), data);
-	fprintf(stderr, "%s\n%s", dir ? ">>>>" : "<<<<", dbgbuf);
-	return 0;
+	if (tap)
+		pcapng_write(tap, tap_if, dir ? PCAPNG_OUT : PCAPNG_IN, data, len);
+
+	fprintf(stderr, "%s\n", dir ? ">>>>" : "<<<<");
+	dump_qmux(data, len);
+	fprintf(stderr, "\n");
 }
 
 /* -- eof from qcqmi.c --- */
@@ -179,21 +111,412 @@ int dbgdump(char *data, int dir)
 /* /dev/cdc-wdmX: */
 static int fd;                               /* handle */
 static int bufsz = 4096;                     /* message size */
-static char filename[] = "/dev/cdc-wdm0";    /* filename */
+static const char *filename = "/dev/cdc-wdm0"; /* filename */
 static pthread_mutex_t wr_mutex = PTHREAD_MUTEX_INITIALIZER; /* write lock */
 static int vidpid; /* USB vid:pid */
 #define MEIDLEN 14
 static char meid[MEIDLEN] = "0123456789abcd"; /* meid */
 
-/* usbmisc class name - was previously "usb" */
-static const char usbmisc[] = "usbmisc";
+
+/* transport to the modem - the frames passed are always complete QMUX */
+struct transport {
+	const char *name;
+	int (*open)(const char *path);
+	int (*write)(const void *buf, size_t len);	/* one frame, wr_mutex held */
+	ssize_t (*read)(void *buf, size_t size);	/* one or more frames */
+	void (*close)(void);
+};
+
+static const struct transport *tp;
+
+/* QMI mode cdc-wdm: QMUX is written and read as is */
+static int qmi_open(const char *path)
+{
+	__u16 max;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	/* use the new ioctl to get the message size, falling back to
+	 * static default if it fails
+	 */
+	if (!ioctl(fd, IOCTL_WDM_MAX_COMMAND, &max))
+		bufsz = max;
+	return 0;
+}
+
+static int qmi_write(const void *buf, size_t len)
+{
+	ssize_t n = write(fd, buf, len);
+
+	return n < 0 ? -errno : n;
+}
+
+static ssize_t qmi_read(void *buf, size_t size)
+{
+	ssize_t n = read(fd, buf, size);
+
+	return n < 0 ? -errno : n;
+}
+
+static void qmi_close(void)
+{
+	close(fd);
+}
+
+static const struct transport qmi_transport = {
+	.name	= "qmi",
+	.open	= qmi_open,
+	.write	= qmi_write,
+	.read	= qmi_read,
+	.close	= qmi_close,
+};
+
+/* MBIM mode cdc-wdm or mbim-proxy: QMUX wrapped in EXT_QMUX messages */
+static __u32 mbim_maxctrl = MBIM_MAX_CTRL;
+static __u32 mbim_tid;
+static __u8 *mbim_rbuf;
+static struct mbim_reasm mbim_reasm;
+
+static __u32 mbim_next_tid(void)
+{
+	/* tid 0 is reserved for unsolicited messages */
+	if (!++mbim_tid)
+		mbim_tid++;
+	return mbim_tid;
+}
+
+/* send a complete MBIM message, fragmented as needed */
+static int mbim_send(const void *msg, size_t len)
+{
+	__u8 *frag = malloc(mbim_maxctrl);
+	__u32 n;
+	int rc;
+
+	if (!frag)
+		return -ENOMEM;
+	for (n = 0; (rc = mbim_fragment(frag, mbim_maxctrl, msg, len, n)) > 0; n++)
+		if (write(fd, frag, rc) != rc) {
+			rc = -EIO;
+			break;
+		}
+	free(frag);
+	return rc;
+}
+
+static int mbim_send_open(void)
+{
+	__u8 buf[MBIM_HDR_LEN + 4];
+
+	mbim_encode_open(buf, sizeof(buf), mbim_next_tid(), mbim_maxctrl);
+	return mbim_send(buf, sizeof(buf));
+}
+
+static int mbim_open(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct pollfd pfd;
+	struct mbim_msg msg;
+	struct stat st;
+	__u16 max;
+	ssize_t n;
+	int rc;
+
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+		strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			return -errno;
+	} else {
+		fd = open(path, O_RDWR);
+		if (fd < 0)
+			return -errno;
+		if (!ioctl(fd, IOCTL_WDM_MAX_COMMAND, &max))
+			mbim_maxctrl = max;
+	}
+
+	mbim_rbuf = malloc(mbim_maxctrl);
+	if (!mbim_rbuf)
+		return -ENOMEM;
+
+	rc = mbim_send_open();
+	if (rc < 0)
+		return rc;
+
+	/* the reader thread is not running yet */
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 5000) > 0) {
+		n = read(fd, mbim_rbuf, mbim_maxctrl);
+		if (n <= 0)
+			break;
+		if (mbim_decode(&msg, mbim_rbuf, n) < 0 || msg.type != MBIM_OPEN_DONE)
+			continue;
+		DBG("MBIM_OPEN_DONE: %s", mbim_status_name(msg.status));
+		return msg.status ? -EIO : 0;
+	}
+	return -ETIMEDOUT;
+}
+
+static int mbim_write(const void *buf, size_t len)
+{
+	size_t size = MBIM_COMMAND_HDR_LEN + len;
+	__u8 *msg = malloc(size);
+	int rc;
+
+	if (!msg)
+		return -ENOMEM;
+	rc = mbim_encode_command(msg, size, mbim_next_tid(), MBIM_SERVICE_EXT_QMUX,
+				 MBIM_CID_QMI, MBIM_CMD_SET, buf, len);
+	if (rc > 0)
+		rc = mbim_send(msg, rc);
+	free(msg);
+	return rc < 0 ? rc : len;
+}
+
+/* unwrap QMUX from MBIM messages until we have at least one frame */
+static ssize_t mbim_read(void *buf, size_t size)
+{
+	struct mbim_msg msg;
+	const __u8 *full;
+	size_t fulllen, ret = 0;
+	ssize_t n, off;
+	int len;
+
+	do {
+		n = read(fd, mbim_rbuf, mbim_maxctrl);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n ? -errno : -ENODEV;
+
+		for (off = 0; off < n; off += len) {
+			len = mbim_decode(&msg, mbim_rbuf + off, n - off);
+			if (len < 0) {
+				DBG("dropping %zd bytes: %s", n - off, strerror(-len));
+				break;
+			}
+			if (mbim_reassemble(&mbim_reasm, mbim_rbuf + off, len, &full, &fulllen) <= 0)
+				continue;
+			mbim_decode(&msg, full, fulllen);
+
+			switch (msg.type) {
+			case MBIM_COMMAND_DONE:
+				if (msg.status)
+					DBG("%s: %s", mbim_cid_name(msg.service, msg.cid),
+					    mbim_status_name(msg.status));
+				/* fall through */
+			case MBIM_INDICATE_STATUS_MSG:
+				if (msg.service != MBIM_SERVICE_EXT_QMUX || msg.cid != MBIM_CID_QMI ||
+				    !msg.infolen)
+					break;
+				if (ret + msg.infolen > size) {
+					DBG("dropping %u bytes of QMUX", msg.infolen);
+					break;
+				}
+				memcpy((__u8 *)buf + ret, msg.info, msg.infolen);
+				ret += msg.infolen;
+				break;
+			case MBIM_FUNCTION_ERROR_MSG:
+				DBG("%s", mbim_error_name(msg.status));
+				/* someone else closed our session */
+				if (msg.status == MBIM_ERROR_NOT_OPENED) {
+					pthread_mutex_lock(&wr_mutex);
+					mbim_send_open();
+					pthread_mutex_unlock(&wr_mutex);
+				}
+				break;
+			case MBIM_OPEN_DONE:
+				DBG("MBIM_OPEN_DONE: %s", mbim_status_name(msg.status));
+				break;
+			}
+		}
+	} while (!ret);
+	return ret;
+}
+
+static void mbim_close(void)
+{
+	__u8 buf[MBIM_HDR_LEN];
+
+	mbim_encode_close(buf, sizeof(buf), mbim_next_tid());
+	mbim_send(buf, sizeof(buf));
+	close(fd);
+	mbim_reasm_free(&mbim_reasm);
+	free(mbim_rbuf);
+}
+
+static const struct transport mbim_transport = {
+	.name	= "mbim",
+	.open	= mbim_open,
+	.write	= mbim_write,
+	.read	= mbim_read,
+	.close	= mbim_close,
+};
+
+/*
+ * QMI interface not bound to any driver: "usb:vid:pid[:interface]".
+ * usbwdm does what cdc-wdm would, with an event thread running the
+ * callbacks.  Each received message is one SOCK_SEQPACKET packet
+ */
+#define USB_PREFIX	"usb:"
+#define USB_GETS	4		/* GETs in flight */
+
+static struct usbwdm usb_wdm;
+static libusb_device_handle *usb_handle;
+static int usb_sk[2] = { -1, -1 };
+static pthread_t usb_thread;
+static volatile int usb_stop;
+
+static int usb_errno(int err)
+{
+	switch (err) {
+	case LIBUSB_ERROR_NO_MEM:
+		return -ENOMEM;
+	case LIBUSB_ERROR_NO_DEVICE:
+		return -ENODEV;
+	case LIBUSB_ERROR_NOT_FOUND:
+		return -ENOENT;
+	case LIBUSB_ERROR_BUSY:
+		return -EBUSY;
+	case LIBUSB_ERROR_ACCESS:
+		return -EACCES;
+	default:
+		return -EIO;
+	}
+}
+
+static void usb_rx(struct usbwdm *w, const void *buf, size_t len)
+{
+	(void)w;
+	if (send(usb_sk[1], buf, len, MSG_DONTWAIT) < 0)
+		DBG("dropping %zu bytes: %s", len, strerror(errno));
+}
+
+static void *usb_events(void *arg)
+{
+	struct timeval tv;
+
+	(void)arg;
+	while (!usb_stop) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 100 * 1000;
+		libusb_handle_events_timeout(NULL, &tv);
+	}
+	return NULL;
+}
+
+/* the first vendor specific interface with an interrupt endpoint */
+static int usb_find_intf(libusb_device_handle *handle)
+{
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt;
+	int i, size, ifnum = -1;
+
+	if (libusb_get_active_config_descriptor(libusb_get_device(handle), &cfg))
+		return -1;
+	for (i = 0; i < cfg->bNumInterfaces && ifnum < 0; i++) {
+		alt = &cfg->interface[i].altsetting[0];
+		if (alt->bInterfaceClass == LIBUSB_CLASS_VENDOR_SPEC && usbwdm_find_ep(alt, &size) >= 0 &&
+		    libusb_kernel_driver_active(handle, alt->bInterfaceNumber) != 1)
+			ifnum = alt->bInterfaceNumber;
+	}
+	libusb_free_config_descriptor(cfg);
+	return ifnum;
+}
+
+static int usb_open(const char *path)
+{
+	__u16 vid, pid;
+	int ifnum = -1, rc;
+
+	if (strncmp(path, USB_PREFIX, strlen(USB_PREFIX)) ||
+	    sscanf(path + strlen(USB_PREFIX), "%hx:%hx:%d", &vid, &pid, &ifnum) < 2)
+		return -EINVAL;
+	vidpid = vid << 16 | pid;
+
+	rc = libusb_init(NULL);
+	if (rc)
+		return usb_errno(rc);
+	usb_handle = libusb_open_device_with_vid_pid(NULL, vid, pid);
+	if (!usb_handle) {
+		rc = -ENODEV;
+		goto err_exit;
+	}
+	if (ifnum < 0)
+		ifnum = usb_find_intf(usb_handle);
+	rc = usbwdm_open(&usb_wdm, usb_handle, ifnum, USB_GETS, usb_rx, NULL);
+	if (rc) {
+		rc = usb_errno(rc);
+		goto err_close;
+	}
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, usb_sk) < 0) {
+		rc = -errno;
+		goto err_wdm;
+	}
+	bufsz = USBWDM_MSG_SIZE;
+
+	/*
+	 * anything queued before we started listening.  Before the event
+	 * thread, as only usbwdm_send() may run beside the callbacks
+	 */
+	usbwdm_fetch(&usb_wdm);
+	rc = -pthread_create(&usb_thread, NULL, usb_events, NULL);
+	if (rc)
+		goto err_sk;
+	return 0;
+
+err_sk:
+	close(usb_sk[0]);
+	close(usb_sk[1]);
+err_wdm:
+	usbwdm_close(&usb_wdm);
+err_close:
+	libusb_close(usb_handle);
+err_exit:
+	libusb_exit(NULL);
+	return rc;
+}
+
+static int usb_write(const void *buf, size_t len)
+{
+	int rc = usbwdm_send(&usb_wdm, buf, len);
+
+	return rc ? usb_errno(rc) : (int)len;
+}
+
+static ssize_t usb_read(void *buf, size_t size)
+{
+	ssize_t n = read(usb_sk[0], buf, size);
+
+	return n < 0 ? -errno : n;
+}
+
+static void usb_close(void)
+{
+	usb_stop = 1;
+	pthread_join(usb_thread, NULL);
+	usbwdm_close(&usb_wdm);
+	libusb_close(usb_handle);
+	libusb_exit(NULL);
+	close(usb_sk[0]);
+	close(usb_sk[1]);
+}
+
+static const struct transport usb_transport = {
+	.name	= "usb",
+	.open	= usb_open,
+	.write	= usb_write,
+	.read	= usb_read,
+	.close	= usb_close,
+};
 
 /* defining a QMI reply or indication message */
 struct qmimsg {
 	struct qmimsg *next; /* next message */
-	size_t len;     /* length of msg */
-	struct qmux h;  /* header, which will be stripped when sending to client */
-	char msg[];
+	size_t len;     /* length of frame */
+	__u8 frame[];   /* QMUX header is stripped when sending to client */
 };
 
 /* defining a client */
@@ -264,117 +587,138 @@ void destroy_client(struct qclient *client)
 
 /* format and send qmi */
 
-/* predefined QMI_CTL get versions message */
-static char get_ver_msg[] = { 0x01, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x21, 0x00, 0x04, 0x00, 0x01, 0x01, 0x00, 0xff };
+static __u8 ctl_tid; /* last used QMI_CTL transaction id, wr_mutex held */
 
-/* predefined QMI_CTL alloc CID message */
-static char alloc_cid_msg[] = { 0x01, 0x0f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x22, 0x00, 0x04, 0x00, 0x01, 0x01, 0x00, 0x00 };
+/* start a QMI_CTL request in buf, returning the header length.  The
+ * transaction id is set by do_ctl()
+ */
+static int mk_ctl(char *buf, size_t buflen, __u16 msgid)
+{
+	struct qmi_msg req = {
+		.service = QMI_CTL,
+		.msgid = msgid,
+	};
 
-/* predefined QMI_CTL release CID message */
-static char release_cid_msg[] = {  0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x23, 0x00, 0x05, 0x00, 0x01, 0x02, 0x00, 0x00, 0x00 };
+	return qmux_encode(buf, buflen, &req);
+}
 
-/* check if msg is a reply to a "msgid" QMI_CTL message */
-static int is_match(struct qmimsg *msg, __u16 msgid)
+/* check if msg is a reply to the QMI_CTL request "req" */
+static int is_match(struct qmimsg *msg, const struct qmi_msg *req, struct qmi_msg *reply)
 {
-	struct qmictl *ctl = (struct qmictl *)&msg->h;
-	return (ctl->h.ctrl == 0x80 &&
-		ctl->h.service == 0 && 
-		ctl->h.qmicid == 0 &&
-		ctl->msgid == msgid);
+	if (qmux_decode(reply, msg->frame, msg->len) < 0)
+		return 0;
+	return (reply->ctrl == QMUX_CTRL_SERVICE &&
+		reply->service == QMI_CTL &&
+		reply->msgid == req->msgid &&
+		reply->tid == req->tid);
 }
 
-/* send a QMI_CTL message and wait until timeout for the reply */
+/* send a QMI_CTL message and wait until timeout (ms) for the reply */
 static int do_ctl(char *buf, size_t buflen, int timeout)
 {
-	int rc = 0;
-	int retry = 5;
+	int rc = 0, wait = 0;
 	struct qclient *client = new_client(0); /* QMI_CTL */
-	struct qmictl *ctl;
-	__u16 msgid;
-	struct qmimsg *msg;
+	struct qmi_msg req, reply;
+	struct qmimsg *msg = NULL;
+	struct timespec deadline;
 
 	DBG("");
 	if (!client)
 		return -ENOMEM;
 
 	/* set up matching key */
-	ctl = (struct qmictl *)buf;
-	msgid = ctl->msgid;
-
-	dbgdump(buf, OUT);
+	rc = qmux_decode(&req, buf, buflen);
+	if (rc < 0)
+		goto out;
 
-	/* take the write lock - no one are allowed to write anything while we run this! */
+	/* take the write lock - no one are allowed to write anything while we run this!
+	 * It also makes the transaction id unique.  tid 0 is reserved
+	 */
 	pthread_mutex_lock(&wr_mutex);
-	rc = write(fd, buf, buf[1] + 1); /* assuming that we always construct valid QMUX... */
+	if (!++ctl_tid)
+		ctl_tid++;
+	req.tid = ctl_tid;
+	buf[QMUX_HDR_LEN + 1] = ctl_tid;
+	dbgdump(buf, req.len, OUT);
+	rc = tp->write(buf, req.len);
 	pthread_mutex_unlock(&wr_mutex);
+	if (rc < 0)
+		goto out;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
 
 	pthread_mutex_lock(&client->rqlock);
-retry:
-	if (!client->rq)
-		pthread_cond_wait(&client->ready, &client->rqlock);
-
-	/* check the new message(s) and retry if not matching */
-	do {
-		msg = client->rq;
-		if (msg)
+	while (1) {
+		/* check the new message(s), dropping any not matching */
+		while ((msg = client->rq)) {
 			client->rq = msg->next;
-	} while (msg && !is_match(msg, msgid));
-	if (!msg && retry--)
-		goto retry;
-
+			if (is_match(msg, &req, &reply))
+				break;
+			free(msg);
+		}
+		if (msg || wait == ETIMEDOUT)
+			break;
+		wait = pthread_cond_timedwait(&client->ready, &client->rqlock, &deadline);
+	}
 	pthread_mutex_unlock(&client->rqlock);
-
+out:
 	/* destroy temporary client */
 	destroy_client(client);
 
 	/* may have timed out */
 	if (!msg)
-		return -ETIMEDOUT;
+		return rc < 0 ? rc : -ETIMEDOUT;
 
-	if (msg->h.len < buflen)
-		memcpy(buf, &msg->h, msg->h.len + 1);
-	else
+	if (msg->len <= buflen) {
+		memcpy(buf, msg->frame, msg->len);
+		rc = msg->len;
+	} else {
 		rc = -EINVAL;
+	}
 
 	free(msg);
 	return rc;
 }
 
-static int get_ver(void)
+/* log the supported services, saving them in e if not NULL */
+static int get_ver(struct probe_entry *e)
 {
-	int rc;
+	int rc, n, i;
 	char *buf = malloc(bufsz);
+	struct qmi_msg reply;
+	const __u8 *data;
+	__u8 all = 0xff;
 
 	if (!buf)
 		return -ENOMEM;
 
-	/* initialize buf with default message */
-	memcpy(buf, get_ver_msg, sizeof(get_ver_msg));
+	mk_ctl(buf, bufsz, QMI_CTL_GET_VERSION_INFO);
+	qmux_add_tlv(buf, bufsz, 0x01, &all, 1);
 	rc = do_ctl(buf, bufsz, 5000);
-
-	/* the reply will have two TLVs: Status + result
-
-    # decode the list of supported systems in TLV 0x01
-    my $data = $ret->{'tlvs'}{0x01};
-    my $n = unpack("C", $data);
-    $data = substr($data, 1);
-    print "supports $n QMI subsystems:\n";
-    for (my $i = 0; $i < $n; $i++) {
-	my ($sys, $maj, $min) = unpack("Cvv", $data);
-	my $system = $sysname{$sys} || sprintf("%#04x", $sys);
-	print "  $system ($maj.$min)\n";
-	$data = substr($data, 5);
-    }
-	*/
-
-/*	n = buf[];
-	for (i = 0; i < n; i++) {
-		sys = buf[ + i * 5];
-		maj = le16_to_cpu(*
-		DBG("%02x: %u.%u", sys, maj, min);
+	if (rc < 0)
+		goto out;
+
+	/* TLV 0x01 is a list of supported systems: n, n * (sys, major, minor) */
+	qmux_decode(&reply, buf, rc);
+	n = qmi_tlv_get(&reply, 0x01, &data);
+	if (n < 1 || n < 1 + data[0] * 5) {
+		rc = -EIO;
+		goto out;
 	}
-*/
-
+	for (i = 0; i < data[0]; i++)
+		DBG("%02x: %u.%u", data[1 + i * 5], get_le16(data + 2 + i * 5), get_le16(data + 4 + i * 5));
+	for (i = 0; e && i < data[0] && i < PROBECACHE_MAX_VER; i++, e->nver++) {
+		e->ver[i].sys = data[1 + i * 5];
+		e->ver[i].major = get_le16(data + 2 + i * 5);
+		e->ver[i].minor = get_le16(data + 4 + i * 5);
+	}
+out:
 	free(buf);
 	return rc;
 }
@@ -383,28 +727,29 @@ static int alloc_cid(struct qclient *client, __u8 system)
 {
 	int rc;
 	char *buf = malloc(bufsz);
+	struct qmi_msg reply;
+	const __u8 *data = NULL;
 
 	if (!buf)
 		return -ENOMEM;
 
-	/* initialize buf with default message */
-	memcpy(buf, alloc_cid_msg, sizeof(alloc_cid_msg));
+	mk_ctl(buf, bufsz, QMI_CTL_GET_CLIENT_ID);
+	qmux_add_tlv(buf, bufsz, 0x01, &system, 1);
 
-	/* the last byte is the requested system */
-	buf[sizeof(alloc_cid_msg) - 1] = system;
-	
 	/* send it */
 	rc = do_ctl(buf, bufsz, 5000);
 
-	/* the reply will have two TLVs: Status + result
-	 *  01 17 00 80 00 00 01 01 22 00 0c 00 02 04 00 00 00 00 00 01 02 00 02 01
-	 * we'll just blindly assume that the last byte is the wanted one
- 	 */
+	/* the reply will have two TLVs: Status + result [system, cid] */
+	if (rc >= 0) {
+		qmux_decode(&reply, buf, rc);
+		if (qmi_status(&reply) || qmi_tlv_get(&reply, 0x01, &data) < 2 || data[0] != system)
+			rc = -EIO;
+	}
 	pthread_mutex_lock(&cl_mutex);
 	if (rc < 0)
 		client->cid = (__u16)-1;
 	else
-		client->cid = system << 8 | buf[0x17];
+		client->cid = system << 8 | data[1];
 	pthread_mutex_unlock(&cl_mutex);
 
 	free(buf);
@@ -414,12 +759,12 @@ static int alloc_cid(struct qclient *client, __u8 system)
 static int release_cid(struct qclient *client)
 {
 	int rc;
-	__u8 system, cid;
+	__u8 tlv[2];
 	char *buf;
 
 	DBG("client=%p, cid=%04x", client, client->cid);
-	system = client->cid >> 8 & 0xff;
-	cid = client->cid & 0xff;
+	tlv[0] = client->cid >> 8 & 0xff;	/* system */
+	tlv[1] = client->cid & 0xff;		/* cid */
 
 	/* invalidate now */
 	pthread_mutex_lock(&cl_mutex);
@@ -430,10 +775,8 @@ static int release_cid(struct qclient *client)
 	if (!buf)
 		return -ENOMEM;
 
-	/* initialize buf with default message */
-	memcpy(buf, release_cid_msg, sizeof(release_cid_msg));
-	buf[sizeof(release_cid_msg) - 2] = system;
-	buf[sizeof(release_cid_msg) - 1] = cid;
+	mk_ctl(buf, bufsz, QMI_CTL_RELEASE_CLIENT_ID);
+	qmux_add_tlv(buf, bufsz, 0x01, tlv, sizeof(tlv));
 
 	/* send it */
 	rc = do_ctl(buf, bufsz, 5000);
@@ -452,6 +795,10 @@ static const char *usage =
 "    --maj=MAJ|-M MAJ      device major number\n"
 "    --min=MIN|-m MIN      device minor number\n"
 "    --name=NAME|-n NAME   device name (mandatory)\n"
+"    --device=DEV          cdc-wdm device, mbim-proxy socket or usb:vid:pid[:interface]\n"
+"                          (default /dev/cdc-wdm0)\n"
+"    --transport=qmi|mbim|usb  modem protocol (default: guessed from the driver)\n"
+"    --tap=FILE            append all QMUX frames to a pcapng file\n"
 "\n";
 
 static void cuseqmi_open(fuse_req_t req, struct fuse_file_info *fi)
@@ -483,6 +830,10 @@ static void cuseqmi_release(fuse_req_t req, struct fuse_file_info *fi)
 	fprintf(stderr, "%s: client=%p\n", __func__, client);
 	fi->fh = (uint64_t)NULL;
 	destroy_client(client);
+
+	/* a good time to save the capture */
+	if (tap)
+		pcapng_flush(tap);
 	fuse_reply_err(req, 0);
 }
 
@@ -503,28 +854,17 @@ static void cuseqmi_read(fuse_req_t req, size_t size, off_t off, struct fuse_fil
 
 	/* fixme:  verify that msg->len <= size */
 	if (msg) {
-		fuse_reply_buf(req, msg->msg, msg->len);
+		fuse_reply_buf(req, (char *)msg->frame + QMUX_HDR_LEN, msg->len - QMUX_HDR_LEN);
 		free(msg);
 	} else {
 		fuse_reply_err(req, EAGAIN);
 	}
 }
 
-static void qmuxify(char *buf, int cid, int len)
-{
-	struct qmux *q = (void *)buf;
-
-	q->tf = 1;
-	q->len = len + qmux_size - 1;
-	q->ctrl = 0;
-	q->service = cid >> 8 & 0xff;
-	q->qmicid = cid & 0xff;
-}
-
 static void cuseqmi_write(fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
 	char *wbuf;
-	int status = 0;
+	int status = 0, len;
 	struct qclient *client = (void *)fi->fh;
 
 	fprintf(stderr, "%s\n", __func__);
@@ -538,23 +878,28 @@ static void cuseqmi_write(fuse_req_t req, const char *buf, size_t size, off_t of
 		status = -EBADR;
 		goto err;
 	}
-	wbuf = malloc(size + qmux_size);
+	wbuf = malloc(size + QMUX_HDR_LEN);
 	if (!wbuf) {
 		status = -ENOMEM;
 		goto err;
 	}
-	memcpy(wbuf + qmux_size, buf, size);
-	qmuxify(wbuf, client->cid, size);
+	memcpy(wbuf + QMUX_HDR_LEN, buf, size);
+	len = qmux_wrap(wbuf, size + QMUX_HDR_LEN, client->cid >> 8, client->cid & 0xff, size);
+	if (len < 0) {
+		free(wbuf);
+		status = -EINVAL;
+		goto err;
+	}
 
-	dbgdump(wbuf, OUT);
+	dbgdump(wbuf, len, OUT);
 
 	/* lock for write */
 	pthread_mutex_lock(&wr_mutex);
-	status = write(fd, wbuf, size + qmux_size);
+	status = tp->write(wbuf, len);
 	pthread_mutex_unlock(&wr_mutex);
 
-	if (status > qmux_size)
-		status -= qmux_size;
+	if (status > QMUX_HDR_LEN)
+		status -= QMUX_HDR_LEN;
 	else
 		status = -EIO;
 	free(wbuf);
@@ -654,6 +999,9 @@ struct cuseqmi_param {
 	unsigned		major;
 	unsigned		minor;
 	char			*dev_name;
+	char			*device;
+	char			*transport;
+	char			*tap;
 	int			is_help;
 };
 
@@ -666,6 +1014,9 @@ static const struct fuse_opt cuseqmi_opts[] = {
 	CUSEQMI_OPT("--min=%u",		minor),
 	CUSEQMI_OPT("-n %s",		dev_name),
 	CUSEQMI_OPT("--name=%s",	dev_name),
+	CUSEQMI_OPT("--device=%s",	device),
+	CUSEQMI_OPT("--transport=%s",	transport),
+	CUSEQMI_OPT("--tap=%s",		tap),
 	FUSE_OPT_KEY("-h",		0),
 	FUSE_OPT_KEY("--help",		0),
 	FUSE_OPT_END
@@ -699,13 +1050,13 @@ static void add_msg_to_client(struct qclient *client, char *buf, int len)
 	DBG("client=%p", client);
 
 	/* allocate a new message entry */
-	new = malloc(sizeof(struct qmimsg) + len - qmux_size);
+	new = malloc(sizeof(struct qmimsg) + len);
 	if (!new)
 		return; /* FIMXE: warn about this */
 
 	new->next = NULL; /* always at the end */
-	new->len = len - qmux_size;
-	memcpy(&new->h, buf, len);
+	new->len = len;
+	memcpy(new->frame, buf, len);
 
 	/* get the client lock */
 	pthread_mutex_lock(&client->rqlock);
@@ -719,33 +1070,24 @@ static void add_msg_to_client(struct qclient *client, char *buf, int len)
 	pthread_cond_signal(&client->ready);
 }
 
-/* allocate a copy of the QMUX in buf for every client that should receive it */
-static void copy_msg_to_clients(char *buf, int len)
+/* allocate a copy of the QMUX frame in buf for every client that should receive it */
+static void copy_msg_to_clients(const struct qmi_msg *msg, char *buf)
 {
 	struct qclient *p;
-	struct qmux *q;
 	int mask = 0, val = 0;
-	__u8 flags;
 
 	DBG("");
-	
-	/* analyze the QMI message first */
-	if (len < sizeof(struct qmux) + 1)
-		return;
 
-	dbgdump(buf, IN);
+	dbgdump(buf, msg->len, IN);
 
-	q = (struct qmux *)buf;
-	flags = buf[qmux_size]; /* the first byte after the QMUX */
-
-	if (q->service == 0) { /* QMI_CTL */
-		if (flags == 0x01) /* QMI_CTL response */
+	if (msg->service == QMI_CTL) {
+		if (msg->flags == QMI_CTL_FLAG_RESPONSE)
 			mask = 0xffff;
 	} else { /* clients with this service */
-		val = q->service << 8;
+		val = msg->service << 8;
 		mask = 0xff << 8;
-		if (q->qmicid != 0xff) { /* only address clients with this cid */
-			val |= q->qmicid;
+		if (msg->cid != 0xff) { /* only address clients with this cid */
+			val |= msg->cid;
 			mask |= 0xff;
 		}
 	}
@@ -755,7 +1097,7 @@ static void copy_msg_to_clients(char *buf, int len)
 	pthread_mutex_lock(&cl_mutex);
 	for (p = clients; p; p= p->next)
 		if ((p->cid & mask) == val)
-			add_msg_to_client(p, buf, len);
+			add_msg_to_client(p, buf, msg->len);
 	pthread_mutex_unlock(&cl_mutex);
 }
 
@@ -763,64 +1105,138 @@ static void copy_msg_to_clients(char *buf, int len)
 /* ==== reader thread ===== */
 void *readcdcwdm(void *tmp)
 {
-   int n;
-   char *buf = malloc(bufsz);
+   int n, off, len;
+   char *buf = malloc(QMUX_MAX_LEN);
+   struct qmi_msg msg;
 
    printf("Hello World! It's me\n");
    do {
-	   n = read(fd, buf, bufsz);
+	   n = tp->read(buf, QMUX_MAX_LEN);
 	   printf("%s: read %d bytes\n", __func__, n);
 
-	   /* find matching client(s) and link a copy into the rq */
-	   if (n > 0)
-		   copy_msg_to_clients(buf, n);
-	   
+	   /* find matching client(s) and link a copy of each frame into the rq */
+	   for (off = 0; off < n; off += len) {
+		   len = qmux_decode(&msg, buf + off, n - off);
+		   if (len < 0) {
+			   DBG("dropping %d bytes: %s", n - off, strerror(-len));
+			   break;
+		   }
+		   copy_msg_to_clients(&msg, buf + off);
+	   }
    } while (n >= 0);
    free(buf);
-   perror("reader exiting:");
+   fprintf(stderr, "reader exiting: %s\n", strerror(-n));
    pthread_exit(NULL);
 }
 
 
+/* the index entry of filename, if it is a cdc-wdm device */
+static const struct wdmdev *find_wdmdev(const char *filename)
+{
+	static struct wdmdev_index idx;
+	static int loaded;
+
+	if (!loaded && wdmdev_load(&idx) >= 0)
+		loaded = 1;
+	return wdmdev_find(&idx, filename);
+}
+
 /* verify that filename is a usbmisc device and return vid+pid */
 int vidpidfromsysfs(const char *filename)
 {
-	char buf[128];
-	char *devname;
-	int rc;
-	unsigned int vid, pid;
-	FILE *s;
+	const struct wdmdev *d = find_wdmdev(filename);
 
-	devname = strrchr(filename, '/');
-	if (!devname)
+	if (!d) {
+		fprintf(stderr, "%s: %s is not a cdc-wdm device\n", __func__, filename);
 		return -ENODEV;
+	}
+	fprintf(stderr, "found %04x:%04x\n", d->vid, d->pid);
+	return d->vid << 16 | d->pid;
+}
 
-	if (snprintf(buf, sizeof(buf), "/sys/class/%s/%s/device/../idProduct", usbmisc, devname) >= sizeof(buf))
-		return -ENODEV;
-	s = fopen(buf, "r");
-	if (!s) {
-		perror(__func__);
-		return -ENODEV;
+/* the driver bound to filename, i.e. "qmi_wwan" or "cdc_mbim" */
+static const char *driverfromsysfs(const char *filename)
+{
+	const struct wdmdev *d = find_wdmdev(filename);
+
+	return d ? d->driver : NULL;
+}
+
+/* probe results of known hardware */
+static struct probe_cache cache;
+static struct probe_key cache_key;
+
+/* the probe cache entry of filename, if it is a cdc-wdm device */
+static const struct probe_entry *find_probe(const char *filename)
+{
+	const struct wdmdev *d = find_wdmdev(filename);
+	static int loaded;
+
+	if (!d || probecache_key(d->usbdev, &cache_key) < 0)
+		return NULL;
+	if (!loaded)
+		loaded = probecache_load(&cache) >= 0;
+	return probecache_find(&cache, &cache_key, d->intf);
+}
+
+static const struct transport *find_transport(const char *name, const char *filename)
+{
+	const struct probe_entry *e;
+	struct stat st;
+	const char *driver;
+
+	if (name) {
+		if (!strcmp(name, qmi_transport.name))
+			return &qmi_transport;
+		if (!strcmp(name, mbim_transport.name))
+			return &mbim_transport;
+		if (!strcmp(name, usb_transport.name))
+			return &usb_transport;
+		return NULL;
 	}
-	rc = fscanf(s,"%x", &pid);
-	fclose(s);
-	if (rc != 1)
-		return -ENODEV;
 
-	if (snprintf(buf, sizeof(buf), "/sys/class/%s/%s/device/../idVendor", usbmisc, devname) >= sizeof(buf))
-		return -ENODEV;
-	s = fopen(buf, "r");
-	if (!s) {
-		perror(__func__);
-		return -ENODEV;
+	if (!strncmp(filename, USB_PREFIX, strlen(USB_PREFIX)))
+		return &usb_transport;
+
+	/* an mbim-proxy socket */
+	if (!stat(filename, &st) && S_ISSOCK(st.st_mode))
+		return &mbim_transport;
+
+	/* known hardware */
+	e = find_probe(filename);
+	if (e && e->type == PROBE_TYPE_MBIM)
+		return &mbim_transport;
+	if (e && e->type == PROBE_TYPE_QMI)
+		return &qmi_transport;
+
+	driver = driverfromsysfs(filename);
+	if (driver && !strcmp(driver, "cdc_mbim"))
+		return &mbim_transport;
+	return &qmi_transport;
+}
+
+/* log the cached QMI service versions, or probe and cache them */
+static void ver_probe(const char *filename)
+{
+	const struct probe_entry *e = find_probe(filename);
+	const struct wdmdev *d;
+	struct probe_entry *new;
+	int i;
+
+	if (e && e->nver) {
+		for (i = 0; i < e->nver; i++)
+			DBG("%02x: %u.%u (cached)", e->ver[i].sys, e->ver[i].major, e->ver[i].minor);
+		return;
 	}
-	rc = fscanf(s,"%x", &vid);
-	fclose(s);
-	if (rc != 1)
-		return -ENODEV;
 
-	fprintf(stderr, "found %04x:%04x\n", vid, pid);
-	return vid << 16 | pid;
+	d = find_wdmdev(filename);
+	if (!d || !cache_key.vid) {
+		get_ver(NULL);
+		return;
+	}
+	new = probecache_add(&cache, &cache_key, d->intf, tp == &mbim_transport ? PROBE_TYPE_MBIM : PROBE_TYPE_QMI);
+	if (new && get_ver(new) >= 0 && new->nver)
+		probecache_save(&cache);	/* fails unless root, which is fine */
 }
 
 static const struct cuse_lowlevel_ops cuseqmi_clop = {
@@ -835,12 +1251,13 @@ static const struct cuse_lowlevel_ops cuseqmi_clop = {
 int main(int argc, char **argv)
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-	struct cuseqmi_param param = { 0, 0, NULL, 0 };
+	struct cuseqmi_param param = { 0, 0, NULL, NULL, NULL, NULL, 0 };
 	char dev_name[128] = "DEVNAME=";
 	const char *dev_info_argv[] = { dev_name };
 	struct cuse_info ci;
 	pthread_t readthread;
 	pthread_attr_t attr;
+	struct stat st;
 	void *status;
 	int rc;
 
@@ -857,21 +1274,43 @@ int main(int argc, char **argv)
 		strncat(dev_name, param.dev_name, sizeof(dev_name) - 9);
 	}
 
-	/* verify that filename is a usbmisc device and save vid+pid */
-	vidpid = vidpidfromsysfs(filename);
-	if (vidpid <= 0)
-		return vidpid;
-	
+	if (param.device)
+		filename = param.device;
+
+	tp = find_transport(param.transport, filename);
+	if (!tp) {
+		fprintf(stderr, "Error: unknown transport '%s'\n", param.transport);
+		return 1;
+	}
+
 	/* open QMI device */
-	fd = open(filename, O_RDWR);
-	if (fd < 0) {
-		perror("Error in open");
+	rc = tp->open(filename);
+	if (rc < 0) {
+		fprintf(stderr, "Error in open: %s: %s\n", filename, strerror(-rc));
 		return -1;
 	}
 
-	/* use the new ioctl to get the message size, falling back to
-	 * static default if it fails
+	/* verify that filename is a usbmisc device and save vid+pid.
+	 * There is no USB device behind an mbim-proxy socket or a tty,
+	 * like the qmi-replay --simulate pty, and usb_open() sets it
 	 */
+	if (tp != &usb_transport && (fstat(fd, &st) || !S_ISSOCK(st.st_mode)) && !isatty(fd)) {
+		vidpid = vidpidfromsysfs(filename);
+		if (vidpid <= 0) {
+			tp->close();
+			return vidpid;
+		}
+	}
+	fprintf(stderr, "using %s transport on %s\n", tp->name, filename);
+
+	if (param.tap) {
+		tap = pcapng_open(param.tap);
+		if (!tap) {
+			perror(param.tap);
+			return -1;
+		}
+		tap_if = pcapng_add_interface(tap, filename, PCAPNG_LINKTYPE_QMUX);
+	}
 
 	/* create reader thread */
 	pthread_attr_init(&attr);
@@ -884,7 +1323,8 @@ int main(int argc, char **argv)
 	}
 	pthread_attr_destroy(&attr);
 
-	/* run QMI_CTL get version, serial numbers etc */
+	/* run QMI_CTL get version, unless already known */
+	ver_probe(filename);
 
 	/* create qcqmi device */
 	memset(&ci, 0, sizeof(ci));
@@ -905,6 +1345,7 @@ int main(int argc, char **argv)
 	else
 		printf("status=%ld\n", (long)status);
 
-	close(fd);
+	tp->close();
+	pcapng_close(tap);
 	return rc;
 }
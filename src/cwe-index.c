@@ -0,0 +1,223 @@
+/*
+ * cwe-index - index and verify Sierra Wireless CWE/SPK/NVU firmware images
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Prints one line for every image in the files, nested images
+ * following their container:
+ *
+ *   <file> <depth> <offset> <type> <product> <size> <date> <crc> <version>
+ *
+ * where <crc> is "ok", "BAD" or "-" if not checked.  Only the CRCs of
+ * the outermost images are checked, as they cover the nested images,
+ * unless --deep is given.
+ *
+ * With --modems, the versions are compared with the output of
+ * swi-firmware instead, printing how many of the images of each file
+ * every modem is running:
+ *
+ *   $ swi-firmware | cwe-index --modems - *.spk
+ *   9X15C_05.05.16.02.spk cdc-wdm0 2/2
+ *
+ * Exits with 1 if any file is not a valid CWE image, or has CRC errors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include "cwe.h"
+
+#define MAX_MODEMS	64
+#define MAX_VERSIONS	32
+
+/* the version strings reported by a modem */
+struct modem {
+	char name[32];
+	int n;
+	char ver[MAX_VERSIONS][128];
+};
+
+static struct modem modem[MAX_MODEMS];
+static int nmodems;
+
+struct index {
+	const char *file;
+	int bad;		/* CRC errors */
+	int images;		/* with a version, not containers */
+	int running[MAX_MODEMS];
+};
+
+static int quiet;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static struct modem *find_modem(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nmodems; i++)
+		if (!strcmp(modem[i].name, name))
+			return &modem[i];
+	if (nmodems == MAX_MODEMS)
+		return NULL;
+	snprintf(modem[nmodems].name, sizeof(modem[0].name), "%s", name);
+	return &modem[nmodems++];
+}
+
+/*
+ * "cdc-wdm0: fw SWI9X15C_05.05.16.02 pri 002.009_000 ..." and
+ * "cdc-wdm0: image 0 (modem) id 05.05.16.02 build SWI9X15C_05.05.16.02".
+ * Any word may be a version.  The values may have more words after
+ * the version, like "fw SWI9X15C_05.05.16.02 r20040 carmd-fwbuild1 ...",
+ * but these are never compared with anything but the first word of
+ * an image version
+ */
+static int read_modems(const char *path)
+{
+	char line[1024], *name, *word;
+	struct modem *m;
+	FILE *f;
+
+	f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f)
+		return -errno;
+	while (fgets(line, sizeof(line), f)) {
+		name = strtok(line, ": \n");
+		if (!name || !(m = find_modem(name)))
+			continue;
+		while ((word = strtok(NULL, " \n")) && m->n < MAX_VERSIONS)
+			snprintf(m->ver[m->n++], sizeof(m->ver[0]), "%s", word);
+	}
+	if (f != stdin)
+		fclose(f);
+	return nmodems;
+}
+
+/*
+ * only the first word of the image version is compared, as it is
+ * usually followed by build info: "SWI9X15C_05.05.16.02 r20040 ..."
+ */
+static int has_version(const struct modem *m, const char *ver)
+{
+	size_t len = strcspn(ver, " ");
+	int i;
+
+	for (i = 0; i < m->n; i++)
+		if (strlen(m->ver[i]) == len && !strncmp(m->ver[i], ver, len))
+			return 1;
+	return 0;
+}
+
+static void index_image(const struct cwe_image *img, void *priv)
+{
+	struct index *idx = priv;
+	int i;
+
+	if (!img->crc_ok)
+		idx->bad++;
+	if (!quiet && !nmodems)
+		printf("%s %d %zu %s %s %u %s %s %s\n", idx->file, img->depth, img->offset,
+		       img->type, img->product[0] ? img->product : "-", img->size,
+		       img->date[0] ? img->date : "-",
+		       img->crc_ok < 0 ? "-" : img->crc_ok ? "ok" : "BAD",
+		       img->version[0] ? img->version : "-");
+
+	if (img->nested || !img->version[0])
+		return;
+	idx->images++;
+	for (i = 0; i < nmodems; i++)
+		idx->running[i] += has_version(&modem[i], img->version);
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "deep",	0, 0, 'd' },
+	{ "modems",	1, 0, 'm' },
+	{ "quiet",	0, 0, 'q' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--deep] [--modems <file>|-] [--quiet] [--verbose] <image>...\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct cwe_file f;
+	struct index idx;
+	int i, j, n, opt, check = 1, verbose = 0, rc = 0;
+	unsigned long long bytes = 0;
+	long long start;
+
+	while ((opt = getopt_long(argc, argv, "hdm:qv", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			check = CWE_MAX_DEPTH;
+			break;
+		case 'm':
+			if (read_modems(optarg) < 0) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	start = now_us();
+	for (i = optind; i < argc; i++) {
+		n = cwe_map(&f, argv[i]);
+		if (n < 0) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(-n));
+			rc = 1;
+			continue;
+		}
+		memset(&idx, 0, sizeof(idx));
+		idx.file = argv[i];
+		n = cwe_walk(f.buf, f.len, check, index_image, &idx);
+		bytes += f.len;
+		cwe_unmap(&f);
+		if (n < 0) {
+			fprintf(stderr, "%s: not a CWE image\n", argv[i]);
+			rc = 1;
+			continue;
+		}
+		if (idx.bad) {
+			fprintf(stderr, "%s: %d CRC errors\n", argv[i], idx.bad);
+			rc = 1;
+		}
+		for (j = 0; j < nmodems; j++)
+			printf("%s %s %d/%d\n", argv[i], modem[j].name, idx.running[j], idx.images);
+	}
+	if (verbose)
+		fprintf(stderr, "%d files, %llu MB in %lld ms\n", argc - optind, bytes >> 20,
+			(now_us() - start) / 1000);
+	return rc;
+}
@@ -0,0 +1,187 @@
+/*
+ * cwe.c - Sierra Wireless CWE firmware image parsing
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cwe.h"
+
+/* header offsets */
+#define CWE_REV		0x104
+#define CWE_TYPE	0x10c
+#define CWE_PRODUCT	0x110
+#define CWE_SIZE	0x114
+#define CWE_CRC		0x118
+#define CWE_VERSION	0x11c
+#define CWE_DATE	0x170
+
+static __u32 get_be32(const __u8 *b)
+{
+	return (__u32)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+/* slicing-by-8: eight bytes per step, from eight 1 kB tables */
+static __u32 crc_tab[8][256];
+
+static void crc_init(void)
+{
+	__u32 c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_tab[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc_tab[j][i] = crc_tab[0][crc_tab[j - 1][i] & 0xff] ^ (crc_tab[j - 1][i] >> 8);
+}
+
+__u32 cwe_crc32(__u32 crc, const void *buf, size_t len)
+{
+	const __u8 *p = buf;
+	__u32 lo, hi;
+
+	if (!crc_tab[0][1])
+		crc_init();
+
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		lo = (p[0] | p[1] << 8 | p[2] << 16 | (__u32)p[3] << 24) ^ crc;
+		hi = p[4] | p[5] << 8 | p[6] << 16 | (__u32)p[7] << 24;
+		crc = crc_tab[7][lo & 0xff] ^ crc_tab[6][(lo >> 8) & 0xff] ^
+			crc_tab[5][(lo >> 16) & 0xff] ^ crc_tab[4][lo >> 24] ^
+			crc_tab[3][hi & 0xff] ^ crc_tab[2][(hi >> 8) & 0xff] ^
+			crc_tab[1][(hi >> 16) & 0xff] ^ crc_tab[0][hi >> 24];
+	}
+	while (len--)
+		crc = crc_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+int cwe_map(struct cwe_file *f, const char *path)
+{
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	memset(f, 0, sizeof(*f));
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+	if (st.st_size < CWE_HDR_LEN) {
+		close(fd);
+		return -EINVAL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	rc = -errno;
+	close(fd);
+	if (map == MAP_FAILED)
+		return rc;
+
+	/* read once, front to back.  The advice is a value, not flags */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	madvise(map, st.st_size, MADV_WILLNEED);
+	f->buf = map;
+	f->len = st.st_size;
+	return 0;
+}
+
+void cwe_unmap(struct cwe_file *f)
+{
+	if (f->buf)
+		munmap((void *)f->buf, f->len);
+	f->buf = NULL;
+}
+
+/* four upper case letters or digits */
+static int valid_type(const __u8 *t)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (!((t[i] >= 'A' && t[i] <= 'Z') || (t[i] >= '0' && t[i] <= '9')))
+			return 0;
+	return 1;
+}
+
+/* does buf hold complete CWE images back to back, and nothing else? */
+static int is_sequence(const __u8 *buf, size_t len)
+{
+	size_t off = 0, size;
+
+	while (off < len) {
+		if (len - off < CWE_HDR_LEN || !valid_type(buf + off + CWE_TYPE))
+			return 0;
+		size = get_be32(buf + off + CWE_SIZE);
+		if (size > len - off - CWE_HDR_LEN)
+			return 0;
+		off += CWE_HDR_LEN + size;
+	}
+	return len > 0;
+}
+
+static void copy_str(char *dst, const __u8 *src, size_t len)
+{
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+static int walk(const __u8 *base, size_t start, size_t len, int depth, int check,
+		cwe_fn fn, void *priv)
+{
+	const __u8 *h;
+	struct cwe_image img;
+	size_t off = start;
+	int n = 0;
+
+	while (off < start + len) {
+		h = base + off;
+		memset(&img, 0, sizeof(img));
+		img.offset = off;
+		img.data = h + CWE_HDR_LEN;
+		img.size = get_be32(h + CWE_SIZE);
+		img.crc = get_be32(h + CWE_CRC);
+		img.rev = get_be32(h + CWE_REV);
+		copy_str(img.type, h + CWE_TYPE, 4);
+		copy_str(img.product, h + CWE_PRODUCT, 4);
+		copy_str(img.version, h + CWE_VERSION, 84);
+		copy_str(img.date, h + CWE_DATE, 8);
+		img.depth = depth;
+		img.nested = depth + 1 < CWE_MAX_DEPTH && is_sequence(img.data, img.size);
+		img.crc_ok = depth < check ? cwe_crc32(0, img.data, img.size) == img.crc : -1;
+		n++;
+
+		if (fn)
+			fn(&img, priv);
+		if (img.nested)
+			n += walk(base, off + CWE_HDR_LEN, img.size, depth + 1, check, fn, priv);
+		off += CWE_HDR_LEN + img.size;
+	}
+	return n;
+}
+
+int cwe_walk(const void *buf, size_t len, int check, cwe_fn fn, void *priv)
+{
+	if (!is_sequence(buf, len))
+		return -EINVAL;
+	return walk(buf, 0, len, 0, check, fn, priv);
+}
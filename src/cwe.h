@@ -0,0 +1,75 @@
+/*
+ * cwe.h - Sierra Wireless CWE firmware image parsing
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * A CWE image is a 400 byte header followed by the image data:
+ *
+ *   psb(256) hdrcrc(4) rev(4) val(4) type(4) product(4)
+ *   size(4) crc(4) version(84) date(8) compat(4) reserved(20)
+ *
+ * with big endian numbers and NUL padded strings.  "size" is the
+ * length of the data, and "crc" its CRC-32.  "hdrcrc" is not checked:
+ * it covers the psb only, not the fields after it, and the CRC variant
+ * Sierra uses for it is unknown, so real images could be refused.  The
+ * other header fields are sanity checked instead, as every "type" must
+ * be valid and every "size" must add up.  The data of a container
+ * like SPKG is a sequence of complete CWE images, so the .cwe, .spk
+ * and .nvu files are all trees of CWE images.
+ *
+ * The file is mapped, and nothing is copied but the header strings.
+ */
+
+#ifndef _CWE_H
+#define _CWE_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#define CWE_HDR_LEN		400
+#define CWE_MAX_DEPTH		4
+
+struct cwe_image {
+	size_t offset;		/* of the header, in the file */
+	const __u8 *data;	/* points into the mapping */
+	__u32 size;
+	__u32 crc;
+	__u32 rev;
+	char type[5];		/* "SPKG", "MODM", "APPL", "NVUP", .. */
+	char product[5];	/* "9X15", .. */
+	char version[85];
+	char date[9];
+	int depth;		/* 0 is the file itself */
+	int nested;		/* the data is more CWE images */
+	int crc_ok;		/* 1, 0, or -1 if not checked */
+};
+
+/* called for each image, parents before children */
+typedef void (*cwe_fn)(const struct cwe_image *img, void *priv);
+
+struct cwe_file {
+	const __u8 *buf;
+	size_t len;
+};
+
+/* map a file read only.  Returns 0 or -errno */
+int cwe_map(struct cwe_file *f, const char *path);
+
+void cwe_unmap(struct cwe_file *f);
+
+/*
+ * Walk all images in buf.  The CRC of the images at depth < check is
+ * verified, so 1 checks the outermost images, which cover everything.
+ * Returns the number of images, or -EINVAL if buf is not a sequence
+ * of CWE images
+ */
+int cwe_walk(const void *buf, size_t len, int check, cwe_fn fn, void *priv);
+
+/* CRC-32 as in IEEE 802.3 and zlib.  Start with crc = 0 */
+__u32 cwe_crc32(__u32 crc, const void *buf, size_t len);
+
+#endif /* _CWE_H */
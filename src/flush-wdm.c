@@ -4,6 +4,14 @@
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
  *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Flushes the pending messages of every QMI or MBIM control interface
+ * of all devices matching vid:pid.  All interfaces are flushed
+ * concurrently using the asynchronous transport in usbwdm.c: a
+ * response is fetched once up front, and then only when the device
+ * sends a CDC RESPONSE_AVAILABLE notification on the interrupt
+ * endpoint.  An interface is flushed when it has been quiet for
+ * --timeout ms.
  */
 
 #include <stdio.h>
@@ -12,8 +20,33 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include <libusb.h>
 #include <linux/types.h>
+#include "qmux.h"
+#include "usbwdm.h"
+
+#define MAX_INTF	32
+
+struct wdm_intf {
+	struct usbwdm w;
+	int count;			/* flushed messages */
+	long long last;			/* last activity */
+	int done;
+};
+
+static struct wdm_intf intf[MAX_INTF];
+static int nintf;
+static int verbose;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 /* dump device info */
 static void print_usb_device(libusb_device_handle *handle)
@@ -34,57 +67,150 @@ static void print_usb_device(libusb_device_handle *handle)
 		desc.bLength, desc.bDescriptorType, desc.bDeviceClass, desc.idVendor, desc.idProduct);
 }
 
-/* open the given device */
-static libusb_device_handle *open_device(char *device)
+static void rx(struct usbwdm *w, const void *buf, size_t len)
+{
+	struct wdm_intf *i = w->priv;
+	const unsigned char *msg = buf;
+
+	i->count++;
+	i->last = now_ms();
+	if (verbose)
+		fprintf(stderr, "%s: interface %d: %zu bytes\n", __FUNCTION__, w->ifnum, len);
+	if (len >= QMUX_HDR_LEN && msg[0] == 1)
+		dump_qmux(msg, len);
+}
+
+/* QMI is vendor specific, MBIM is CDC subclass 0x0e */
+static int is_control(const struct libusb_interface_descriptor *alt)
+{
+	return alt->bInterfaceClass == LIBUSB_CLASS_VENDOR_SPEC ||
+		(alt->bInterfaceClass == LIBUSB_CLASS_COMM && alt->bInterfaceSubClass == 0x0e);
+}
+
+/* claim and start listening on every control interface of the device */
+static int add_device(libusb_device_handle *handle, int only, int gets)
+{
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt;
+	struct wdm_intf *w;
+	int i, size, ret, n = 0;
+
+	ret = libusb_get_active_config_descriptor(libusb_get_device(handle), &cfg);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < cfg->bNumInterfaces && nintf < MAX_INTF; i++) {
+		alt = &cfg->interface[i].altsetting[0];
+		if (only >= 0 && alt->bInterfaceNumber != only)
+			continue;
+		if (!is_control(alt) || usbwdm_find_ep(alt, &size) < 0)
+			continue;
+
+		w = &intf[nintf];
+		memset(w, 0, sizeof(*w));
+		ret = usbwdm_open(&w->w, handle, alt->bInterfaceNumber, gets, rx, w);
+		if (ret) {
+			fprintf(stderr, "interface %d: usbwdm_open() failed: %s\n", alt->bInterfaceNumber, libusb_error_name(ret));
+			continue;
+		}
+		w->last = now_ms();
+
+		/* anything queued before we started listening */
+		usbwdm_fetch(&w->w);
+		nintf++;
+		n++;
+	}
+	libusb_free_config_descriptor(cfg);
+	return n;
+}
+
+/* open every device matching vid:pid.  Returns the number of devices */
+static int open_devices(char *device, int only, int gets)
 {
 	uint16_t vendor_id = 0, product_id = 0;
+	struct libusb_device_descriptor desc;
+	libusb_device **list, *dev;
+	libusb_device_handle *handle;
+	ssize_t cnt, i;
+	int ret, n = 0;
 
 	if ((sscanf(device, " %hx : %hx ", &vendor_id, &product_id) != 2) || (vendor_id == 0) || (product_id == 0))
-		return NULL;
+		return 0;
 
-	return libusb_open_device_with_vid_pid(NULL, vendor_id, product_id);
+	cnt = libusb_get_device_list(NULL, &list);
+	for (i = 0; i < cnt; i++) {
+		dev = list[i];
+		if (libusb_get_device_descriptor(dev, &desc) ||
+		    desc.idVendor != vendor_id || desc.idProduct != product_id)
+			continue;
+		ret = libusb_open(dev, &handle);
+		if (ret) {
+			fprintf(stderr, "%03d/%03d: libusb_open() failed: %s\n",
+				libusb_get_bus_number(dev), libusb_get_device_address(dev), libusb_error_name(ret));
+			continue;
+		}
+		print_usb_device(handle);
+		if (add_device(handle, only, gets) <= 0) {
+			libusb_close(handle);
+			continue;
+		}
+		n++;
+	}
+	if (cnt >= 0)
+		libusb_free_device_list(list, 1);
+	return n;
 }
 
-static int read_reply(libusb_device_handle *handle, int interface, unsigned char *buf, int size)
+/* run until every interface has been quiet for idle ms */
+static void flush_all(int idle)
 {
-	int ret;
-
-        ret = libusb_control_transfer(handle, 
-				LIBUSB_ENDPOINT_IN + LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE,  /* 0xa1 */
-				1, /* CDC GET_ENCAPSULATED_RESPONSE */
-				0, /* zero */
-				interface, /* wIndex = interface */
-				buf,
-				size,
-				1000);
-
-	fprintf(stderr, "%s: libusb_control_transfer() returned %d\n",  __FUNCTION__, ret);
-	return ret;
+	struct timeval tv;
+	long long now;
+	int i, busy;
+
+	do {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10 * 1000;
+		libusb_handle_events_timeout(NULL, &tv);
+
+		now = now_ms();
+		busy = 0;
+		for (i = 0; i < nintf; i++) {
+			if (intf[i].done)
+				continue;
+			if (!usbwdm_idle(&intf[i].w))
+				intf[i].last = now;
+			else if (now - intf[i].last >= idle)
+				intf[i].done = 1;
+			busy += !intf[i].done;
+		}
+	} while (busy);
 }
 
 static struct option main_options[] = {
 	{ "help",	0, 0, 'h' },
 	{ "device",     1, 0, 'd' },
 	{ "interface",  1, 0, 'i' },
+	{ "timeout",    1, 0, 't' },
+	{ "gets",       1, 0, 'g' },
+	{ "verbose",    0, 0, 'v' },
 	{ 0, 0, 0, 0 }
 };
 
 
 void usage(char *prog)
 {
-	fprintf(stderr, "Usage: %s --device vid:pid [--interface N]\n\n", prog);
+	fprintf(stderr, "Usage: %s --device vid:pid [--interface N] [--timeout ms] [--gets N] [--verbose]\n\n", prog);
 }
 
 int main(int argc, char *argv[])
 {
 	char *prog, *device = NULL;
-	int i, opt, ret, interface = 0;
-	libusb_device_handle *handle;
-	unsigned char buf[500];
-	int size = sizeof(buf);
+	int i, opt, ret, interface = -1, idle = 50, gets = 4;
+	long long start;
 
 	prog = argv[0];
-	while ((opt = getopt_long(argc, argv, "d:i:h", main_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "d:i:t:g:vh", main_options, NULL)) != -1) {
 		switch(opt) {
 		case 'd':
 			device = strdup(optarg);
@@ -92,6 +218,15 @@ int main(int argc, char *argv[])
 		case 'i':
 			interface = atoi(optarg);
 			break;
+		case 't':
+			idle = atoi(optarg);
+			break;
+		case 'g':
+			gets = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
 		case 'h':
 			usage(prog);
 			exit(0);
@@ -107,20 +242,25 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "libusb_init() failed: %d\n", ret);
 		exit(1);
 	}
-	
-	if ((handle = open_device(device))) {
-		print_usb_device(handle);
-		ret = libusb_claim_interface (handle, interface);
 
-		/* flush pending messages */
-		i = 1;
-		while (i > 0)
-			i = read_reply(handle, interface, buf, size);
-		ret = libusb_release_interface(handle, interface);
+	start = now_ms();
+	if (open_devices(device, interface, gets)) {
+		flush_all(idle);
+		for (i = 0; i < nintf; i++) {
+			printf("interface %d: flushed %d messages\n", intf[i].w.ifnum, intf[i].count);
+			usbwdm_close(&intf[i].w);
+
+			/* the last interface of each device */
+			if (i == nintf - 1 || intf[i + 1].w.handle != intf[i].w.handle)
+				libusb_close(intf[i].w.handle);
+		}
+		printf("flushed %d interfaces in %lld ms\n", nintf, now_ms() - start);
+		ret = 0;
 	} else {
-		fprintf(stderr, "failed to open device \"%s\"\n", device);
+		fprintf(stderr, "no control interface found on \"%s\"\n", device);
+		ret = 1;
 	}
-		
+
 	libusb_exit(NULL);
 
 	return ret;
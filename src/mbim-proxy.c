@@ -0,0 +1,802 @@
+/*
+ * mbim-proxy - share one MBIM session between many clients
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Opens the MBIM cdc-wdm device and keeps an MBIM session open until
+ * killed.  Clients connect to a SOCK_SEQPACKET unix socket and talk
+ * MBIM as if it was the cdc-wdm device, one message per packet:
+ *
+ *  - OPEN and CLOSE are answered by the proxy.  A client may send
+ *    commands without opening, as the session is always open
+ *  - COMMAND transaction ids are rewritten to make them unique on the
+ *    device, and the COMMAND_DONE is routed back to the client with
+ *    its own transaction id
+ *  - INDICATE_STATUS is copied to every client subscribed to it.  A
+ *    client which has not set MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST
+ *    gets all indications.  The device subscription is the union of
+ *    all client subscriptions, and of the default subscription to all
+ *    services of the MBIM specification while any client has not set
+ *    a list
+ *
+ * Fragmented messages are reassembled in both directions, and sent
+ * fragmented using the MaxControlTransfer of the receiver.
+ *
+ *   mbim-proxy /dev/cdc-wdm0 &
+ *   mbim.pl --device=/var/run/mbim-proxy-cdc-wdm0 caps
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/types.h>
+#include <linux/usb/cdc-wdm.h>
+#include "qmux.h"
+#include "mbim.h"
+
+#define DBG(fmt, arg...)						\
+do {									\
+	if (verbose)							\
+		fprintf(stderr, "%s: " fmt "\n", __func__, ##arg);	\
+} while (0)
+
+#define MAX_CLIENTS	64
+#define MAX_PENDING	256	/* outstanding commands */
+#define PENDING_TIMEOUT	60	/* seconds before a lost command is forgotten */
+#define MAX_SUBS	32	/* services in a subscribe list */
+#define MAX_SUB_CIDS	64
+
+#define MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST	19
+
+/* the largest message we accept from a client */
+#define MAX_MSG		(1 << 16)
+
+static int verbose;
+static volatile sig_atomic_t done;
+
+/* one entry of a subscribe list */
+struct sub {
+	__u8 uuid[MBIM_UUID_LEN];
+	int ncids;		/* 0 means all */
+	__u32 cids[MAX_SUB_CIDS];
+};
+
+struct client {
+	int fd;
+	__u32 maxctrl;		/* from the client OPEN */
+	struct mbim_reasm reasm;
+	int nsubs;		/* -1 if not subscribed, i.e. everything */
+	struct sub subs[MAX_SUBS];
+	__u8 *sublist;		/* the client info buffer, echoed in the reply */
+	size_t sublistlen;
+	struct client *next;
+};
+
+/* a command forwarded to the device */
+struct pending {
+	__u32 tid;		/* on the device, 0 if unused */
+	__u32 ctid;		/* client transaction id */
+	struct client *client;	/* NULL if nobody wants the reply */
+	int subscribe;		/* reply with the client subscribe list */
+	time_t sent;
+};
+
+static struct {
+	const char *name;
+	int fd;
+	__u32 maxctrl;
+	__u32 tid;
+	struct mbim_reasm reasm;
+	int opened;
+} dev;
+
+static struct client *clients;
+static int nclients;
+static struct pending pending[MAX_PENDING];
+
+/* write a complete message to the device, fragmented if necessary */
+static int dev_write(const __u8 *msg, size_t len)
+{
+	__u8 frag[MAX_MSG];
+	__u32 n;
+	int rc;
+
+	for (n = 0; (rc = mbim_fragment(frag, dev.maxctrl, msg, len, n)) > 0; n++)
+		if (write(dev.fd, frag, rc) != rc) {
+			fprintf(stderr, "%s: %s\n", __func__, strerror(errno));
+			return -EIO;
+		}
+	return rc;
+}
+
+/* send a complete message to a client, fragmented if necessary.  Never blocks */
+static void client_send(struct client *c, const __u8 *msg, size_t len)
+{
+	__u8 frag[MAX_MSG];
+	__u32 n;
+	int rc;
+
+	for (n = 0; (rc = mbim_fragment(frag, c->maxctrl, msg, len, n)) > 0; n++)
+		if (send(c->fd, frag, rc, MSG_DONTWAIT | MSG_NOSIGNAL) != rc) {
+			fprintf(stderr, "%s: dropping message to client %d: %s\n",
+				__func__, c->fd, strerror(errno));
+			return;
+		}
+}
+
+/* a COMMAND_DONE, for replies generated by the proxy */
+static int encode_done(__u8 *buf, size_t size, __u32 tid, const __u8 *uuid, __u32 cid,
+		       __u32 status, const void *info, size_t infolen)
+{
+	size_t len = MBIM_COMMAND_HDR_LEN + infolen;
+	__u8 *b = buf;
+
+	if (len > size)
+		return -EMSGSIZE;
+	put_le32(b, MBIM_COMMAND_DONE);
+	put_le32(b + 4, len);
+	put_le32(b + 8, tid);
+	put_le32(b + 12, 1);
+	put_le32(b + 16, 0);
+	b += MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN;
+	memcpy(b, uuid, MBIM_UUID_LEN);
+	put_le32(b + 16, cid);
+	put_le32(b + 20, status);
+	put_le32(b + 24, infolen);
+	if (infolen)
+		memcpy(b + 28, info, infolen);
+	return len;
+}
+
+/* OPEN_DONE, CLOSE_DONE and FUNCTION_ERROR */
+static void client_status(struct client *c, __u32 type, __u32 tid, __u32 status)
+{
+	__u8 buf[MBIM_HDR_LEN + 4];
+
+	put_le32(buf, type);
+	put_le32(buf + 4, sizeof(buf));
+	put_le32(buf + 8, tid);
+	put_le32(buf + 12, status);
+	client_send(c, buf, sizeof(buf));
+}
+
+static struct pending *new_pending(struct client *c, __u32 ctid)
+{
+	time_t now = time(NULL);
+	struct pending *p;
+	int i;
+
+	for (i = 0; i < MAX_PENDING; i++) {
+		/* tid 0 is reserved for unsolicited messages */
+		if (!++dev.tid)
+			dev.tid++;
+		p = &pending[dev.tid % MAX_PENDING];
+		if (p->tid && now - p->sent < PENDING_TIMEOUT)
+			continue;
+		if (p->tid)
+			DBG("forgetting lost transaction %u", p->tid);
+		p->tid = dev.tid;
+		p->ctid = ctid;
+		p->client = c;
+		p->subscribe = 0;
+		p->sent = now;
+		return p;
+	}
+	return NULL;
+}
+
+static struct pending *find_pending(__u32 tid)
+{
+	struct pending *p = &pending[tid % MAX_PENDING];
+
+	return tid && p->tid == tid ? p : NULL;
+}
+
+/* parse a MBIM_DEVICE_SERVICE_SUBSCRIBE_LIST info buffer */
+static int parse_sublist(struct sub *subs, const __u8 *info, size_t len)
+{
+	__u32 i, j, n, off, elen;
+	const __u8 *e;
+
+	if (len < 4)
+		return -EINVAL;
+	n = get_le32(info);
+	if (n > MAX_SUBS || 4 + 8 * (size_t)n > len)
+		return -EINVAL;
+	for (i = 0; i < n; i++) {
+		off = get_le32(info + 4 + 8 * i);
+		elen = get_le32(info + 8 + 8 * i);
+		if (off > len || elen > len - off || elen < MBIM_UUID_LEN + 4)
+			return -EINVAL;
+		e = info + off;
+		memcpy(subs[i].uuid, e, MBIM_UUID_LEN);
+		subs[i].ncids = get_le32(e + MBIM_UUID_LEN);
+		if (subs[i].ncids > MAX_SUB_CIDS || MBIM_UUID_LEN + 4 + 4 * (size_t)subs[i].ncids > elen)
+			return -EINVAL;
+		for (j = 0; j < subs[i].ncids; j++)
+			subs[i].cids[j] = get_le32(e + MBIM_UUID_LEN + 4 + 4 * j);
+	}
+	return n;
+}
+
+/* add sub to the list, merging cids with an existing entry for the same service */
+static int merge_sub(struct sub *list, int n, const struct sub *sub)
+{
+	struct sub *s;
+	int i, j;
+
+	for (i = 0; i < n; i++)
+		if (!memcmp(list[i].uuid, sub->uuid, MBIM_UUID_LEN))
+			break;
+	if (i == n) {
+		if (n == MAX_SUBS)
+			return n;
+		list[n] = *sub;
+		return n + 1;
+	}
+
+	s = &list[i];
+	if (!s->ncids)
+		return n;
+	if (!sub->ncids) {
+		s->ncids = 0;
+		return n;
+	}
+	for (j = 0; j < sub->ncids; j++) {
+		for (i = 0; i < s->ncids; i++)
+			if (s->cids[i] == sub->cids[j])
+				break;
+		if (i == s->ncids && s->ncids < MAX_SUB_CIDS)
+			s->cids[s->ncids++] = sub->cids[j];
+	}
+	return n;
+}
+
+/* build the info buffer for a subscribe list */
+static size_t encode_sublist(__u8 *buf, const struct sub *list, int n)
+{
+	size_t off = 4 + 8 * n, elen;
+	int i, j;
+
+	put_le32(buf, n);
+	for (i = 0; i < n; i++) {
+		elen = MBIM_UUID_LEN + 4 + 4 * list[i].ncids;
+		put_le32(buf + 4 + 8 * i, off);
+		put_le32(buf + 8 + 8 * i, elen);
+		memcpy(buf + off, list[i].uuid, MBIM_UUID_LEN);
+		put_le32(buf + off + MBIM_UUID_LEN, list[i].ncids);
+		for (j = 0; j < list[i].ncids; j++)
+			put_le32(buf + off + MBIM_UUID_LEN + 4 + 4 * j, list[i].cids[j]);
+		off += elen;
+	}
+	return off;
+}
+
+/* is any client subscribed, or any not? */
+static int have_clients(int subscribed)
+{
+	struct client *c;
+
+	for (c = clients; c; c = c->next)
+		if ((c->nsubs >= 0) == subscribed)
+			return 1;
+	return 0;
+}
+
+/*
+ * set the union of all client subscriptions on the device, including
+ * the default all CIDs of the services in the MBIM specification if
+ * some client has not set a list
+ */
+static int update_subscriptions(struct client *from, __u32 ctid)
+{
+	static __u8 info[4 + MAX_SUBS * (8 + MBIM_UUID_LEN + 4 + 4 * MAX_SUB_CIDS)];
+	__u8 msg[MBIM_COMMAND_HDR_LEN + sizeof(info)];
+	struct sub list[MAX_SUBS], def;
+	struct pending *p;
+	struct client *c;
+	int i, n = 0, len;
+
+	if (have_clients(0)) {
+		memset(&def, 0, sizeof(def));
+		for (i = MBIM_SERVICE_BASIC_CONNECT; i <= MBIM_SERVICE_DSS; i++) {
+			memcpy(def.uuid, mbim_services[i].uuid, MBIM_UUID_LEN);
+			n = merge_sub(list, n, &def);
+		}
+	}
+	for (c = clients; c; c = c->next)
+		for (i = 0; i < c->nsubs; i++)
+			n = merge_sub(list, n, &c->subs[i]);
+
+	p = new_pending(from, ctid);
+	if (!p)
+		return -EBUSY;
+	p->subscribe = 1;
+
+	DBG("subscribing to %d services", n);
+	len = mbim_encode_command(msg, sizeof(msg), p->tid, MBIM_SERVICE_BASIC_CONNECT,
+				  MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST, MBIM_CMD_SET,
+				  info, encode_sublist(info, list, n));
+	if (len < 0)
+		return len;
+	return dev_write(msg, len);
+}
+
+static int is_subscribed(const struct client *c, const struct mbim_msg *msg)
+{
+	int i, j;
+
+	if (c->nsubs < 0)
+		return 1;
+	for (i = 0; i < c->nsubs; i++) {
+		if (memcmp(c->subs[i].uuid, msg->uuid, MBIM_UUID_LEN))
+			continue;
+		if (!c->subs[i].ncids)
+			return 1;
+		for (j = 0; j < c->subs[i].ncids; j++)
+			if (c->subs[i].cids[j] == msg->cid)
+				return 1;
+	}
+	return 0;
+}
+
+static void set_client_subs(struct client *c, __u32 ctid, const struct mbim_msg *msg)
+{
+	__u8 buf[MBIM_COMMAND_HDR_LEN];
+	struct sub subs[MAX_SUBS];
+	int n, rc;
+
+	n = parse_sublist(subs, msg->info, msg->infolen);
+	if (n < 0) {
+		rc = MBIM_STATUS_INVALID_PARAMETERS;
+		goto err;
+	}
+
+	free(c->sublist);
+	c->sublist = malloc(msg->infolen);
+	if (!c->sublist) {
+		c->nsubs = -1;
+		rc = MBIM_STATUS_FAILURE;
+		goto err;
+	}
+	memcpy(c->sublist, msg->info, msg->infolen);
+	c->sublistlen = msg->infolen;
+	memcpy(c->subs, subs, n * sizeof(subs[0]));
+	c->nsubs = n;
+
+	if (update_subscriptions(c, ctid) >= 0)
+		return;
+	rc = MBIM_STATUS_BUSY;
+err:
+	encode_done(buf, sizeof(buf), ctid, msg->uuid, msg->cid, rc, NULL, 0);
+	client_send(c, buf, sizeof(buf));
+}
+
+/* a complete COMMAND from a client */
+static void client_command(struct client *c, __u8 *buf, size_t len)
+{
+	__u8 reply[MBIM_COMMAND_HDR_LEN];
+	struct mbim_msg msg;
+	struct pending *p;
+
+	if (mbim_decode(&msg, buf, len) < 0)
+		return;
+
+	if (msg.service == MBIM_SERVICE_BASIC_CONNECT &&
+	    msg.cid == MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST && msg.status == MBIM_CMD_SET) {
+		set_client_subs(c, msg.tid, &msg);
+		return;
+	}
+
+	p = new_pending(c, msg.tid);
+	if (!p) {
+		encode_done(reply, sizeof(reply), msg.tid, msg.uuid, msg.cid, MBIM_STATUS_BUSY, NULL, 0);
+		client_send(c, reply, sizeof(reply));
+		return;
+	}
+	DBG("client %d: %s %u => tid %u", c->fd, mbim_cid_name(msg.service, msg.cid), msg.tid, p->tid);
+	mbim_set_tid(buf, p->tid);
+	dev_write(buf, len);
+}
+
+static void client_msg(struct client *c, __u8 *buf, size_t len)
+{
+	const __u8 *full;
+	size_t fulllen;
+	struct mbim_msg msg;
+	struct pending *p;
+	int i, rc;
+
+	rc = mbim_decode(&msg, buf, len);
+	if (rc < 0) {
+		DBG("client %d: bad message: %s", c->fd, strerror(-rc));
+		return;
+	}
+
+	switch (msg.type) {
+	case MBIM_OPEN_MSG:
+		c->maxctrl = msg.status < MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN + 4 ? MBIM_MAX_CTRL : msg.status;
+		client_status(c, MBIM_OPEN_DONE, msg.tid, 0);
+		break;
+	case MBIM_CLOSE_MSG:
+		client_status(c, MBIM_CLOSE_DONE, msg.tid, 0);
+		break;
+	case MBIM_COMMAND_MSG:
+		rc = mbim_reassemble(&c->reasm, buf, len, &full, &fulllen);
+		if (rc == -EPROTO)
+			client_status(c, MBIM_FUNCTION_ERROR_MSG, msg.tid, MBIM_ERROR_FRAGMENT_OUT_OF_SEQUENCE);
+		if (rc > 0)
+			client_command(c, (__u8 *)full, fulllen);
+		break;
+	case MBIM_HOST_ERROR_MSG:
+		/* pass on if it is about a pending command */
+		for (i = 0; i < MAX_PENDING; i++) {
+			p = &pending[i];
+			if (p->tid && p->client == c && p->ctid == msg.tid) {
+				mbim_set_tid(buf, p->tid);
+				dev_write(buf, len);
+				p->tid = 0;
+			}
+		}
+		break;
+	default:
+		DBG("client %d: ignoring %s", c->fd, mbim_type_name(msg.type));
+	}
+}
+
+static void dev_open(void)
+{
+	__u8 buf[MBIM_HDR_LEN + 4];
+	int len;
+
+	len = mbim_encode_open(buf, sizeof(buf), 1, dev.maxctrl);
+	if (write(dev.fd, buf, len) != len)
+		fprintf(stderr, "%s: %s\n", __func__, strerror(errno));
+	dev.opened = 0;
+}
+
+static void dev_close(void)
+{
+	__u8 buf[MBIM_HDR_LEN];
+	int len;
+
+	len = mbim_encode_close(buf, sizeof(buf), 1);
+	if (write(dev.fd, buf, len) != len)
+		fprintf(stderr, "%s: %s\n", __func__, strerror(errno));
+}
+
+/* a complete message from the device */
+static void dev_msg(const __u8 *buf, size_t len)
+{
+	struct mbim_msg msg;
+	struct pending *p;
+	struct client *c;
+	__u8 *copy;
+
+	if (mbim_decode(&msg, buf, len) < 0)
+		return;
+
+	switch (msg.type) {
+	case MBIM_OPEN_DONE:
+		fprintf(stderr, "%s: MBIM_OPEN_DONE: %s\n", dev.name, mbim_status_name(msg.status));
+		dev.opened = !msg.status;
+		return;
+	case MBIM_CLOSE_DONE:
+		dev.opened = 0;
+		return;
+	case MBIM_INDICATE_STATUS_MSG:
+		for (c = clients; c; c = c->next)
+			if (is_subscribed(c, &msg))
+				client_send(c, buf, len);
+		return;
+	case MBIM_COMMAND_DONE:
+	case MBIM_FUNCTION_ERROR_MSG:
+		break;
+	default:
+		DBG("ignoring %s", mbim_type_name(msg.type));
+		return;
+	}
+
+	/* the device lost our session, e.g. after a reset */
+	if (msg.type == MBIM_FUNCTION_ERROR_MSG && msg.status == MBIM_ERROR_NOT_OPENED) {
+		fprintf(stderr, "%s: session closed by device - reopening\n", dev.name);
+		dev_open();
+	}
+
+	p = find_pending(msg.tid);
+	if (!p) {
+		DBG("no client waiting for tid %u", msg.tid);
+		return;
+	}
+	c = p->client;
+	p->tid = 0;
+	if (!c)
+		return;
+
+	if (p->subscribe && msg.type == MBIM_COMMAND_DONE && !msg.status) {
+		__u8 *reply = malloc(MBIM_COMMAND_HDR_LEN + c->sublistlen);
+		int n;
+
+		if (!reply)
+			return;
+		n = encode_done(reply, MBIM_COMMAND_HDR_LEN + c->sublistlen, p->ctid, msg.uuid,
+				msg.cid, 0, c->sublist, c->sublistlen);
+		client_send(c, reply, n);
+		free(reply);
+		return;
+	}
+
+	copy = malloc(len);
+	if (!copy)
+		return;
+	memcpy(copy, buf, len);
+	mbim_set_tid(copy, p->ctid);
+	client_send(c, copy, len);
+	free(copy);
+}
+
+static void dev_read(void)
+{
+	static __u8 buf[MAX_MSG];
+	const __u8 *full;
+	size_t fulllen, off;
+	ssize_t n;
+	int len, rc;
+
+	n = read(dev.fd, buf, sizeof(buf));
+	if (n <= 0) {
+		if (n < 0 && errno == EINTR)
+			return;
+		fprintf(stderr, "%s: %s\n", dev.name, n ? strerror(errno) : "EOF");
+		done = 1;
+		return;
+	}
+
+	for (off = 0; off < n; off += len) {
+		len = mbim_decode(&(struct mbim_msg){ 0 }, buf + off, n - off);
+		if (len < 0) {
+			fprintf(stderr, "%s: dropping %zu bytes: %s\n", dev.name, n - off, strerror(-len));
+			return;
+		}
+		rc = mbim_reassemble(&dev.reasm, buf + off, len, &full, &fulllen);
+		if (rc > 0)
+			dev_msg(full, fulllen);
+		else if (rc < 0)
+			DBG("%s", strerror(-rc));
+	}
+}
+
+static void new_client(int lfd)
+{
+	struct client *c;
+	int fd, limited;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+	if (nclients == MAX_CLIENTS) {
+		fprintf(stderr, "%s: too many clients\n", __func__);
+		close(fd);
+		return;
+	}
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		close(fd);
+		return;
+	}
+	c->fd = fd;
+	c->maxctrl = MBIM_MAX_CTRL;
+	c->nsubs = -1;
+
+	/* the device may be limited to the lists of the other clients */
+	limited = have_clients(1) && !have_clients(0);
+	c->next = clients;
+	clients = c;
+	nclients++;
+	DBG("client %d connected", fd);
+	if (limited)
+		update_subscriptions(NULL, 0);
+}
+
+static void destroy_client(struct client *c)
+{
+	struct client **pp;
+	int i, subscribed = c->nsubs >= 0;
+
+	for (pp = &clients; *pp; pp = &(*pp)->next)
+		if (*pp == c) {
+			*pp = c->next;
+			break;
+		}
+	nclients--;
+
+	/* nobody wants these replies anymore */
+	for (i = 0; i < MAX_PENDING; i++)
+		if (pending[i].client == c)
+			pending[i].client = NULL;
+
+	DBG("client %d disconnected", c->fd);
+	close(c->fd);
+	mbim_reasm_free(&c->reasm);
+	free(c->sublist);
+	free(c);
+
+	/* the device keeps the last list when the last client leaves */
+	if (subscribed && clients)
+		update_subscriptions(NULL, 0);
+}
+
+static void client_read(struct client *c)
+{
+	static __u8 buf[MAX_MSG];
+	ssize_t n;
+
+	n = recv(c->fd, buf, sizeof(buf), MSG_TRUNC);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return;
+	if (n <= 0) {
+		destroy_client(c);
+		return;
+	}
+	if (n > sizeof(buf)) {
+		DBG("client %d: dropping %zd byte message", c->fd, n);
+		return;
+	}
+	client_msg(c, buf, n);
+}
+
+static int listen_socket(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	chmod(path, 0660);
+	return fd;
+}
+
+static void sighandler(int sig)
+{
+	done = 1;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "socket",	1, 0, 's' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--verbose] [--socket=<path>] <cdc-wdm device>\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pollfd pfd[2 + MAX_CLIENTS];
+	struct client *c, *next;
+	char *path = NULL;
+	const char *base;
+	__u16 maxctrl;
+	int opt, lfd, n, i;
+
+	while ((opt = getopt_long(argc, argv, "hs:v", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+	dev.name = argv[optind];
+
+	dev.fd = open(dev.name, O_RDWR);
+	if (dev.fd < 0) {
+		perror(dev.name);
+		exit(1);
+	}
+	if (ioctl(dev.fd, IOCTL_WDM_MAX_COMMAND, &maxctrl) < 0)
+		maxctrl = MBIM_MAX_CTRL;
+	dev.maxctrl = maxctrl;
+	DBG("MaxControlTransfer=%u", dev.maxctrl);
+
+	if (!path) {
+		base = strrchr(dev.name, '/');
+		base = base ? base + 1 : dev.name;
+		path = malloc(strlen(base) + sizeof("/var/run/mbim-proxy-"));
+		if (!path)
+			exit(1);
+		sprintf(path, "/var/run/mbim-proxy-%s", base);
+	}
+	lfd = listen_socket(path);
+	if (lfd < 0)
+		exit(1);
+
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	dev_open();
+	fprintf(stderr, "%s: listening on %s\n", dev.name, path);
+
+	while (!done) {
+		pfd[0].fd = dev.fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = lfd;
+		pfd[1].events = POLLIN;
+		for (n = 2, c = clients; c; c = c->next, n++) {
+			pfd[n].fd = c->fd;
+			pfd[n].events = POLLIN;
+		}
+
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (pfd[0].revents)
+			dev_read();
+		if (pfd[1].revents & POLLIN)
+			new_client(lfd);
+
+		/* clients may go away while we walk the list */
+		for (i = 2, c = clients; c && i < n; c = next, i++) {
+			next = c->next;
+			if (pfd[i].fd == c->fd && pfd[i].revents)
+				client_read(c);
+		}
+	}
+
+	if (dev.opened)
+		dev_close();
+	while (clients)
+		destroy_client(clients);
+	close(lfd);
+	unlink(path);
+	close(dev.fd);
+	mbim_reasm_free(&dev.reasm);
+	return 0;
+}
@@ -0,0 +1,538 @@
+/*
+ * mbim.c - MBIM control message framing and fragment reassembly
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "qmux.h"
+#include "mbim.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Table 10-4: Defined CIDs, and the "well known" vendor specific ones */
+static const char *const basic_connect_cids[] = {
+	[1] = "MBIM_CID_DEVICE_CAPS",
+	[2] = "MBIM_CID_SUBSCRIBER_READY_STATUS",
+	[3] = "MBIM_CID_RADIO_STATE",
+	[4] = "MBIM_CID_PIN",
+	[5] = "MBIM_CID_PIN_LIST",
+	[6] = "MBIM_CID_HOME_PROVIDER",
+	[7] = "MBIM_CID_PREFERRED_PROVIDERS",
+	[8] = "MBIM_CID_VISIBLE_PROVIDERS",
+	[9] = "MBIM_CID_REGISTER_STATE",
+	[10] = "MBIM_CID_PACKET_SERVICE",
+	[11] = "MBIM_CID_SIGNAL_STATE",
+	[12] = "MBIM_CID_CONNECT",
+	[13] = "MBIM_CID_PROVISIONED_CONTEXTS",
+	[14] = "MBIM_CID_SERVICE_ACTIVATION",
+	[15] = "MBIM_CID_IP_CONFIGURATION",
+	[16] = "MBIM_CID_DEVICE_SERVICES",
+	[19] = "MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST",
+	[20] = "MBIM_CID_PACKET_STATISTICS",
+	[21] = "MBIM_CID_NETWORK_IDLE_HINT",
+	[22] = "MBIM_CID_EMERGENCY_MODE",
+	[23] = "MBIM_CID_IP_PACKET_FILTERS",
+	[24] = "MBIM_CID_MULTICARRIER_PROVIDERS",
+};
+
+static const char *const sms_cids[] = {
+	[1] = "MBIM_CID_SMS_CONFIGURATION",
+	[2] = "MBIM_CID_SMS_READ",
+	[3] = "MBIM_CID_SMS_SEND",
+	[4] = "MBIM_CID_SMS_DELETE",
+	[5] = "MBIM_CID_SMS_MESSAGE_STORE_STATUS",
+};
+
+static const char *const ussd_cids[] = {
+	[1] = "MBIM_CID_USSD",
+};
+
+static const char *const phonebook_cids[] = {
+	[1] = "MBIM_CID_PHONEBOOK_CONFIGURATION",
+	[2] = "MBIM_CID_PHONEBOOK_READ",
+	[3] = "MBIM_CID_PHONEBOOK_DELETE",
+	[4] = "MBIM_CID_PHONEBOOK_WRITE",
+};
+
+static const char *const stk_cids[] = {
+	[1] = "MBIM_CID_STK_PAC",
+	[2] = "MBIM_CID_STK_TERMINAL_RESPONSE",
+	[3] = "MBIM_CID_STK_ENVELOPE",
+};
+
+static const char *const auth_cids[] = {
+	[1] = "MBIM_CID_AKA_AUTH",
+	[2] = "MBIM_CID_AKAP_AUTH",
+	[3] = "MBIM_CID_SIM_AUTH",
+};
+
+static const char *const dss_cids[] = {
+	[1] = "MBIM_CID_DSS_CONNECT",
+};
+
+static const char *const ext_qmux_cids[] = {
+	[1] = "MBIM_CID_QMI",
+};
+
+static const char *const multicarrier_cids[] = {
+	[1] = "MBIM_CID_MULTICARRIER_CAPABILITIES",
+	[2] = "MBIM_CID_LOCATION_INFO",
+	[3] = "MBIM_CID_MULTICARRIER_CURRENT_CID_LIST",
+};
+
+static const char *const msfwid_cids[] = {
+	[1] = "MBIM_CID_MSFWID_FIRMWAREID",
+};
+
+static const char *const ms_hostshutdown_cids[] = {
+	[1] = "MBIM_CID_MS HOSTSHUTDOWN",
+};
+
+#define SERVICE(id, n, ...) \
+	[MBIM_SERVICE_##id] = { #id, { __VA_ARGS__ }, n##_cids, ARRAY_SIZE(n##_cids) }
+
+/* Table 10-3: Services Defined by MBIM */
+const struct mbim_service_desc mbim_services[MBIM_SERVICE_MAX] = {
+	[MBIM_SERVICE_UNKNOWN] = { "UNKNOWN" },
+	SERVICE(BASIC_CONNECT, basic_connect,
+		0xa2, 0x89, 0xcc, 0x33, 0xbc, 0xbb, 0x8b, 0x4f, 0xb6, 0xb0, 0x13, 0x3e, 0xc2, 0xaa, 0xe6, 0xdf),
+	SERVICE(SMS, sms,
+		0x53, 0x3f, 0xbe, 0xeb, 0x14, 0xfe, 0x44, 0x67, 0x9f, 0x90, 0x33, 0xa2, 0x23, 0xe5, 0x6c, 0x3f),
+	SERVICE(USSD, ussd,
+		0xe5, 0x50, 0xa0, 0xc8, 0x5e, 0x82, 0x47, 0x9e, 0x82, 0xf7, 0x10, 0xab, 0xf4, 0xc3, 0x35, 0x1f),
+	SERVICE(PHONEBOOK, phonebook,
+		0x4b, 0xf3, 0x84, 0x76, 0x1e, 0x6a, 0x41, 0xdb, 0xb1, 0xd8, 0xbe, 0xd2, 0x89, 0xc2, 0x5b, 0xdb),
+	SERVICE(STK, stk,
+		0xd8, 0xf2, 0x01, 0x31, 0xfc, 0xb5, 0x4e, 0x17, 0x86, 0x02, 0xd6, 0xed, 0x38, 0x16, 0x16, 0x4c),
+	SERVICE(AUTH, auth,
+		0x1d, 0x2b, 0x5f, 0xf7, 0x0a, 0xa1, 0x48, 0xb2, 0xaa, 0x52, 0x50, 0xf1, 0x57, 0x67, 0x17, 0x4e),
+	SERVICE(DSS, dss,
+		0xc0, 0x8a, 0x26, 0xdd, 0x77, 0x18, 0x43, 0x82, 0x84, 0x82, 0x6e, 0x0d, 0x58, 0x3c, 0x4d, 0x0e),
+	SERVICE(EXT_QMUX, ext_qmux,
+		0xd1, 0xa3, 0x0b, 0xc2, 0xf9, 0x7a, 0x6e, 0x43, 0xbf, 0x65, 0xc7, 0xe2, 0x4f, 0xb0, 0xf0, 0xd3),
+	SERVICE(MULTICARRIER, multicarrier,
+		0x8b, 0x56, 0x96, 0x48, 0x62, 0x8d, 0x46, 0x53, 0x9b, 0x9f, 0x10, 0x25, 0x40, 0x44, 0x24, 0xe1),
+	SERVICE(MSFWID, msfwid,
+		0xe9, 0xf7, 0xde, 0xa2, 0xfe, 0xaf, 0x40, 0x09, 0x93, 0xce, 0x90, 0xa3, 0x69, 0x41, 0x03, 0xb6),
+	SERVICE(MS_HOSTSHUTDOWN, ms_hostshutdown,
+		0x88, 0x3b, 0x7c, 0x26, 0x98, 0x5f, 0x43, 0xfa, 0x98, 0x04, 0x27, 0xd7, 0xfb, 0x80, 0x95, 0x9c),
+};
+
+/* Table 10-15: MBIM_STATUS_CODES */
+static const char *const status_names[] = {
+	[0] = "MBIM_STATUS_SUCCESS",
+	[1] = "MBIM_STATUS_BUSY",
+	[2] = "MBIM_STATUS_FAILURE",
+	[3] = "MBIM_STATUS_SIM_NOT_INSERTED",
+	[4] = "MBIM_STATUS_BAD_SIM",
+	[5] = "MBIM_STATUS_PIN_REQUIRED",
+	[6] = "MBIM_STATUS_PIN_DISABLED",
+	[7] = "MBIM_STATUS_NOT_REGISTERED",
+	[8] = "MBIM_STATUS_PROVIDERS_NOT_FOUND",
+	[9] = "MBIM_STATUS_NO_DEVICE_SUPPORT",
+	[10] = "MBIM_STATUS_PROVIDER_NOT_VISIBLE",
+	[11] = "MBIM_STATUS_DATA_CLASS_NOT_AVAILABLE",
+	[12] = "MBIM_STATUS_PACKET_SERVICE_DETACHED",
+	[13] = "MBIM_STATUS_MAX_ACTIVATED_CONTEXTS",
+	[14] = "MBIM_STATUS_NOT_INITIALIZED",
+	[15] = "MBIM_STATUS_VOICE_CALL_IN_PROGRESS",
+	[16] = "MBIM_STATUS_CONTEXT_NOT_ACTIVATED",
+	[17] = "MBIM_STATUS_SERVICE_NOT_ACTIVATED",
+	[18] = "MBIM_STATUS_INVALID_ACCESS_STRING",
+	[19] = "MBIM_STATUS_INVALID_USER_NAME_PWD",
+	[20] = "MBIM_STATUS_RADIO_POWER_OFF",
+	[21] = "MBIM_STATUS_INVALID_PARAMETERS",
+	[22] = "MBIM_STATUS_READ_FAILURE",
+	[23] = "MBIM_STATUS_WRITE_FAILURE",
+	[25] = "MBIM_STATUS_NO_PHONEBOOK",
+	[26] = "MBIM_STATUS_PARAMETER_TOO_LONG",
+	[27] = "MBIM_STATUS_STK_BUSY",
+	[28] = "MBIM_STATUS_OPERATION_NOT_ALLOWED",
+	[29] = "MBIM_STATUS_MEMORY_FAILURE",
+	[30] = "MBIM_STATUS_INVALID_MEMORY_INDEX",
+	[31] = "MBIM_STATUS_MEMORY_FULL",
+	[32] = "MBIM_STATUS_FILTER_NOT_SUPPORTED",
+	[33] = "MBIM_STATUS_DSS_INSTANCE_LIMIT",
+	[34] = "MBIM_STATUS_INVALID_DEVICE_SERVICE_OPERATION",
+	[35] = "MBIM_STATUS_AUTH_INCORRECT_AUTN",
+	[36] = "MBIM_STATUS_AUTH_SYNC_FAILURE",
+	[37] = "MBIM_STATUS_AUTH_AMF_NOT_SET",
+	[100] = "MBIM_STATUS_SMS_UNKNOWN_SMSC_ADDRESS",
+	[101] = "MBIM_STATUS_SMS_NETWORK_TIMEOUT",
+	[102] = "MBIM_STATUS_SMS_LANG_NOT_SUPPORTED",
+	[103] = "MBIM_STATUS_SMS_ENCODING_NOT_SUPPORTED",
+	[104] = "MBIM_STATUS_SMS_FORMAT_NOT_SUPPORTED",
+};
+
+/* Table 9-8: MBIM_PROTOCOL_ERROR_CODES */
+static const char *const error_names[] = {
+	[1] = "MBIM_ERROR_TIMEOUT_FRAGMENT",
+	[2] = "MBIM_ERROR_FRAGMENT_OUT_OF_SEQUENCE",
+	[3] = "MBIM_ERROR_LENGTH_MISMATCH",
+	[4] = "MBIM_ERROR_DUPLICATED_TID",
+	[5] = "MBIM_ERROR_NOT_OPENED",
+	[6] = "MBIM_ERROR_UNKNOWN",
+	[7] = "MBIM_ERROR_CANCEL",
+	[8] = "MBIM_ERROR_MAX_TRANSFER",
+};
+
+static const char *lookup(const char *const *names, size_t n, __u32 val)
+{
+	return val < n && names[val] ? names[val] : "<unknown>";
+}
+
+const char *mbim_type_name(__u32 type)
+{
+	switch (type) {
+	case MBIM_OPEN_MSG:
+		return "MBIM_OPEN_MSG";
+	case MBIM_CLOSE_MSG:
+		return "MBIM_CLOSE_MSG";
+	case MBIM_COMMAND_MSG:
+		return "MBIM_COMMAND_MSG";
+	case MBIM_HOST_ERROR_MSG:
+		return "MBIM_HOST_ERROR_MSG";
+	case MBIM_OPEN_DONE:
+		return "MBIM_OPEN_DONE";
+	case MBIM_CLOSE_DONE:
+		return "MBIM_CLOSE_DONE";
+	case MBIM_COMMAND_DONE:
+		return "MBIM_COMMAND_DONE";
+	case MBIM_FUNCTION_ERROR_MSG:
+		return "MBIM_FUNCTION_ERROR_MSG";
+	case MBIM_INDICATE_STATUS_MSG:
+		return "MBIM_INDICATE_STATUS_MSG";
+	}
+	return "<unknown>";
+}
+
+const char *mbim_status_name(__u32 status)
+{
+	return lookup(status_names, ARRAY_SIZE(status_names), status);
+}
+
+const char *mbim_error_name(__u32 error)
+{
+	return lookup(error_names, ARRAY_SIZE(error_names), error);
+}
+
+const char *mbim_cid_name(enum mbim_service service, __u32 cid)
+{
+	const struct mbim_service_desc *s = &mbim_services[service];
+
+	return lookup(s->cids, s->ncids, cid);
+}
+
+enum mbim_service mbim_uuid_to_service(const __u8 *uuid)
+{
+	int i;
+
+	for (i = 1; i < MBIM_SERVICE_MAX; i++)
+		if (!memcmp(uuid, mbim_services[i].uuid, MBIM_UUID_LEN))
+			return i;
+	return MBIM_SERVICE_UNKNOWN;
+}
+
+char *mbim_uuid_str(char *buf, const __u8 *u)
+{
+	sprintf(buf, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+		u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7],
+		u[8], u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+	return buf;
+}
+
+int mbim_decode(struct mbim_msg *msg, const void *buf, size_t len)
+{
+	const __u8 *b = buf;
+	size_t hdrlen;
+
+	if (len < MBIM_HDR_LEN)
+		return -EMSGSIZE;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->type = get_le32(b);
+	msg->len = get_le32(b + 4);
+	msg->tid = get_le32(b + 8);
+	msg->total = 1;
+
+	if (msg->len < MBIM_HDR_LEN)
+		return -EINVAL;
+	if (msg->len > len)
+		return -EMSGSIZE;
+
+	switch (msg->type) {
+	case MBIM_OPEN_MSG:		/* MaxControlTransfer */
+	case MBIM_HOST_ERROR_MSG:
+	case MBIM_OPEN_DONE:
+	case MBIM_CLOSE_DONE:
+	case MBIM_FUNCTION_ERROR_MSG:
+		if (msg->len < MBIM_HDR_LEN + 4)
+			return -EINVAL;
+		msg->status = get_le32(b + MBIM_HDR_LEN);
+		/* fall through */
+	case MBIM_CLOSE_MSG:
+		return msg->len;
+	}
+
+	/* unknown types are passed on undecoded */
+	if (!mbim_is_fragmented(msg->type))
+		return msg->len;
+
+	if (msg->len < MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN)
+		return -EINVAL;
+	msg->total = get_le32(b + 12);
+	msg->current = get_le32(b + 16);
+	if (!msg->total || msg->current >= msg->total)
+		return -EINVAL;
+	if (msg->current)
+		return msg->len;
+
+	hdrlen = msg->type == MBIM_INDICATE_STATUS_MSG ? MBIM_INDICATE_HDR_LEN : MBIM_COMMAND_HDR_LEN;
+	if (msg->len < hdrlen)
+		return -EINVAL;
+
+	b += MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN;
+	msg->uuid = b;
+	msg->service = mbim_uuid_to_service(b);
+	msg->cid = get_le32(b + 16);
+	if (msg->type == MBIM_INDICATE_STATUS_MSG) {
+		msg->infolen = get_le32(b + 20);
+		msg->info = b + 24;
+	} else {
+		msg->status = get_le32(b + 20);
+		msg->infolen = get_le32(b + 24);
+		msg->info = b + 28;
+	}
+
+	/* the info buffer may be padded, but must fit a complete message */
+	if (msg->total == 1 && hdrlen + msg->infolen > msg->len)
+		return -EINVAL;
+	return msg->len;
+}
+
+static int encode_hdr(__u8 *b, size_t size, size_t len, __u32 type, __u32 tid)
+{
+	if (len > size)
+		return -EMSGSIZE;
+	put_le32(b, type);
+	put_le32(b + 4, len);
+	put_le32(b + 8, tid);
+	return len;
+}
+
+int mbim_encode_open(void *buf, size_t size, __u32 tid, __u32 maxctrl)
+{
+	int len = encode_hdr(buf, size, MBIM_HDR_LEN + 4, MBIM_OPEN_MSG, tid);
+
+	if (len > 0)
+		put_le32((__u8 *)buf + MBIM_HDR_LEN, maxctrl);
+	return len;
+}
+
+int mbim_encode_close(void *buf, size_t size, __u32 tid)
+{
+	return encode_hdr(buf, size, MBIM_HDR_LEN, MBIM_CLOSE_MSG, tid);
+}
+
+int mbim_encode_host_error(void *buf, size_t size, __u32 tid, __u32 error)
+{
+	int len = encode_hdr(buf, size, MBIM_HDR_LEN + 4, MBIM_HOST_ERROR_MSG, tid);
+
+	if (len > 0)
+		put_le32((__u8 *)buf + MBIM_HDR_LEN, error);
+	return len;
+}
+
+int mbim_encode_command(void *buf, size_t size, __u32 tid, enum mbim_service service,
+			__u32 cid, __u32 cmdtype, const void *info, size_t infolen)
+{
+	__u8 *b = buf;
+	int len;
+
+	if (service <= MBIM_SERVICE_UNKNOWN || service >= MBIM_SERVICE_MAX)
+		return -EINVAL;
+	len = encode_hdr(b, size, MBIM_COMMAND_HDR_LEN + infolen, MBIM_COMMAND_MSG, tid);
+	if (len < 0)
+		return len;
+
+	b += MBIM_HDR_LEN;
+	put_le32(b, 1);
+	put_le32(b + 4, 0);
+	b += MBIM_FRAG_HDR_LEN;
+	memcpy(b, mbim_services[service].uuid, MBIM_UUID_LEN);
+	put_le32(b + 16, cid);
+	put_le32(b + 20, cmdtype);
+	put_le32(b + 24, infolen);
+	if (infolen)
+		memcpy(b + 28, info, infolen);
+	return len;
+}
+
+__u32 mbim_nfragments(size_t len, size_t maxctrl)
+{
+	size_t hdr = MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN;
+
+	if (len <= maxctrl || maxctrl <= hdr)
+		return 1;
+	return (len - hdr + maxctrl - hdr - 1) / (maxctrl - hdr);
+}
+
+int mbim_fragment(void *buf, size_t maxctrl, const void *msg, size_t len, __u32 n)
+{
+	size_t hdr = MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN, cap, off, chunk;
+	const __u8 *m = msg;
+	__u8 *b = buf;
+	__u32 total;
+
+	if (len < MBIM_HDR_LEN)
+		return -EINVAL;
+
+	/* single fragment, possibly not fragmentable */
+	if (len <= maxctrl) {
+		if (n)
+			return 0;
+		memcpy(b, m, len);
+		return len;
+	}
+	if (!mbim_is_fragmented(get_le32(m)) || len < hdr || maxctrl <= hdr)
+		return -EMSGSIZE;
+
+	total = mbim_nfragments(len, maxctrl);
+	if (n >= total)
+		return 0;
+
+	cap = maxctrl - hdr;
+	off = hdr + n * cap;
+	chunk = len - off < cap ? len - off : cap;
+
+	memcpy(b, m, MBIM_HDR_LEN);
+	put_le32(b + 4, hdr + chunk);
+	put_le32(b + 12, total);
+	put_le32(b + 16, n);
+	memcpy(b + hdr, m + off, chunk);
+	return hdr + chunk;
+}
+
+static struct mbim_reasm_slot *find_slot(struct mbim_reasm *r, __u32 type, __u32 tid)
+{
+	int i;
+
+	for (i = 0; i < MBIM_REASM_SLOTS; i++)
+		if (r->slot[i].next && r->slot[i].type == type && r->slot[i].tid == tid)
+			return &r->slot[i];
+	return NULL;
+}
+
+/* an unused slot, or the oldest one */
+static struct mbim_reasm_slot *new_slot(struct mbim_reasm *r)
+{
+	struct mbim_reasm_slot *s = &r->slot[0];
+	int i;
+
+	for (i = 0; i < MBIM_REASM_SLOTS; i++) {
+		if (!r->slot[i].next)
+			return &r->slot[i];
+		if (r->slot[i].age < s->age)
+			s = &r->slot[i];
+	}
+	r->dropped++;
+	return s;
+}
+
+static int slot_append(struct mbim_reasm_slot *s, const __u8 *data, size_t len)
+{
+	size_t need = s->len + len;
+	__u8 *p;
+
+	if (need > s->size) {
+		size_t size = s->size ? s->size : MBIM_MAX_CTRL;
+
+		while (size < need)
+			size *= 2;
+		p = realloc(s->buf, size);
+		if (!p)
+			return -ENOMEM;
+		s->buf = p;
+		s->size = size;
+	}
+	memcpy(s->buf + s->len, data, len);
+	s->len = need;
+	return 0;
+}
+
+int mbim_reassemble(struct mbim_reasm *r, const void *buf, size_t len,
+		    const __u8 **out, size_t *outlen)
+{
+	const size_t hdr = MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN;
+	struct mbim_reasm_slot *s;
+	struct mbim_msg msg;
+	int rc;
+
+	rc = mbim_decode(&msg, buf, len);
+	if (rc < 0)
+		return rc;
+
+	if (msg.total == 1) {
+		*out = buf;
+		*outlen = msg.len;
+		return 1;
+	}
+
+	s = find_slot(r, msg.type, msg.tid);
+	if (msg.current == 0) {
+		if (!s)
+			s = new_slot(r);
+		s->type = msg.type;
+		s->tid = msg.tid;
+		s->total = msg.total;
+		s->len = 0;
+		rc = slot_append(s, buf, msg.len);
+	} else if (!s || s->next != msg.current || s->total != msg.total) {
+		if (s)
+			s->next = 0;
+		r->dropped++;
+		return -EPROTO;
+	} else {
+		rc = slot_append(s, (const __u8 *)buf + hdr, msg.len - hdr);
+	}
+	if (rc < 0) {
+		s->next = 0;
+		return rc;
+	}
+
+	s->next = msg.current + 1;
+	s->age = r->seq++;
+	if (s->next < s->total)
+		return 0;
+
+	/* make it look like a single fragment message */
+	s->next = 0;
+	put_le32(s->buf + 4, s->len);
+	put_le32(s->buf + 12, 1);
+	put_le32(s->buf + 16, 0);
+	if (mbim_decode(&msg, s->buf, s->len) < 0)
+		return -EINVAL;
+	*out = s->buf;
+	*outlen = s->len;
+	return 1;
+}
+
+void mbim_reasm_free(struct mbim_reasm *r)
+{
+	int i;
+
+	for (i = 0; i < MBIM_REASM_SLOTS; i++) {
+		free(r->slot[i].buf);
+		r->slot[i].buf = NULL;
+		r->slot[i].size = 0;
+		r->slot[i].next = 0;
+	}
+}
@@ -0,0 +1,212 @@
+/*
+ * mbim.h - MBIM control message framing and fragment reassembly
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * An MBIM control message looks like this:
+ *
+ *   type(4) len(4) tid(4)				- MBIM_MESSAGE_HEADER
+ *   total(4) current(4)				- MBIM_FRAGMENT_HEADER
+ *   uuid(16) cid(4) status(4) infolen(4) info...	- COMMAND(_DONE)
+ *   uuid(16) cid(4) infolen(4) info...		- INDICATE_STATUS
+ *
+ * where "status" is the command type (0 = query, 1 = set) in an
+ * MBIM_COMMAND_MSG.  All fields are little endian, except for the
+ * UUIDs which are stored in network byte order.  Only fragment 0 has
+ * the uuid, cid and info header - the rest of the fragments carry
+ * more info data.
+ */
+
+#ifndef _MBIM_H
+#define _MBIM_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#define MBIM_HDR_LEN		12
+#define MBIM_FRAG_HDR_LEN	8
+#define MBIM_COMMAND_HDR_LEN	(MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN + 28)
+#define MBIM_INDICATE_HDR_LEN	(MBIM_HDR_LEN + MBIM_FRAG_HDR_LEN + 24)
+#define MBIM_UUID_LEN		16
+
+/* the cdc-wdm default - the real maximum is read with IOCTL_WDM_MAX_COMMAND */
+#define MBIM_MAX_CTRL		4096
+
+/* message types */
+#define MBIM_OPEN_MSG			0x00000001
+#define MBIM_CLOSE_MSG			0x00000002
+#define MBIM_COMMAND_MSG		0x00000003
+#define MBIM_HOST_ERROR_MSG		0x00000004
+#define MBIM_OPEN_DONE			0x80000001
+#define MBIM_CLOSE_DONE			0x80000002
+#define MBIM_COMMAND_DONE		0x80000003
+#define MBIM_FUNCTION_ERROR_MSG		0x80000004
+#define MBIM_INDICATE_STATUS_MSG	0x80000007
+
+/* MBIM_PROTOCOL_ERROR_CODES */
+#define MBIM_ERROR_TIMEOUT_FRAGMENT		1
+#define MBIM_ERROR_FRAGMENT_OUT_OF_SEQUENCE	2
+#define MBIM_ERROR_LENGTH_MISMATCH		3
+#define MBIM_ERROR_DUPLICATED_TID		4
+#define MBIM_ERROR_NOT_OPENED			5
+
+/* the MBIM_STATUS_CODES used by the tools - see mbim_status_name() for all */
+#define MBIM_STATUS_SUCCESS			0
+#define MBIM_STATUS_BUSY			1
+#define MBIM_STATUS_FAILURE			2
+#define MBIM_STATUS_INVALID_PARAMETERS		21
+
+#define MBIM_CMD_QUERY		0
+#define MBIM_CMD_SET		1
+
+/* services, indexing mbim_services[] */
+enum mbim_service {
+	MBIM_SERVICE_UNKNOWN = 0,
+	MBIM_SERVICE_BASIC_CONNECT,
+	MBIM_SERVICE_SMS,
+	MBIM_SERVICE_USSD,
+	MBIM_SERVICE_PHONEBOOK,
+	MBIM_SERVICE_STK,
+	MBIM_SERVICE_AUTH,
+	MBIM_SERVICE_DSS,
+	MBIM_SERVICE_EXT_QMUX,
+	MBIM_SERVICE_MULTICARRIER,
+	MBIM_SERVICE_MSFWID,
+	MBIM_SERVICE_MS_HOSTSHUTDOWN,
+	MBIM_SERVICE_MAX,
+};
+
+struct mbim_service_desc {
+	const char *name;
+	__u8 uuid[MBIM_UUID_LEN];
+	const char *const *cids;	/* names, indexed by cid */
+	int ncids;
+};
+
+extern const struct mbim_service_desc mbim_services[MBIM_SERVICE_MAX];
+
+/* the CID of MBIM_SERVICE_EXT_QMUX carrying QMUX frames */
+#define MBIM_CID_QMI		1
+
+static inline int mbim_is_fragmented(__u32 type)
+{
+	return type == MBIM_COMMAND_MSG || type == MBIM_COMMAND_DONE ||
+		type == MBIM_INDICATE_STATUS_MSG;
+}
+
+/*
+ * decoded message - uuid and info point into the original buffer.
+ * The command fields are only valid if total is 1, i.e. for a
+ * complete or reassembled message
+ */
+struct mbim_msg {
+	__u32 type;
+	__u32 len;		/* message length, including all headers */
+	__u32 tid;
+	__u32 total;		/* fragment header, 1 and 0 if none */
+	__u32 current;
+	__u32 status;		/* *_DONE status, error code, MaxControlTransfer
+				 * or MBIM_CMD_QUERY/SET for COMMAND_MSG */
+	enum mbim_service service;
+	const __u8 *uuid;
+	__u32 cid;
+	__u32 infolen;
+	const __u8 *info;
+};
+
+/*
+ * Decode the first message in buf.  Returns the message length,
+ * which may be less than len if buf holds more than one message,
+ * -EMSGSIZE if the message is truncated, or -EINVAL if it is
+ * malformed
+ */
+int mbim_decode(struct mbim_msg *msg, const void *buf, size_t len);
+
+/* return the service with this uuid, or MBIM_SERVICE_UNKNOWN */
+enum mbim_service mbim_uuid_to_service(const __u8 *uuid);
+
+const char *mbim_type_name(__u32 type);
+const char *mbim_status_name(__u32 status);
+const char *mbim_error_name(__u32 error);
+const char *mbim_cid_name(enum mbim_service service, __u32 cid);
+
+/* "a289cc33-bcbb-8b4f-b6b0-133ec2aae6df" - buf must hold 37 bytes */
+char *mbim_uuid_str(char *buf, const __u8 *uuid);
+
+/*
+ * Message builders.  Each returns the message length or -EMSGSIZE.
+ * Command messages larger than the maximum control transfer must be
+ * split using mbim_fragment()
+ */
+int mbim_encode_open(void *buf, size_t size, __u32 tid, __u32 maxctrl);
+int mbim_encode_close(void *buf, size_t size, __u32 tid);
+int mbim_encode_command(void *buf, size_t size, __u32 tid, enum mbim_service service,
+			__u32 cid, __u32 cmdtype, const void *info, size_t infolen);
+int mbim_encode_host_error(void *buf, size_t size, __u32 tid, __u32 error);
+
+/*
+ * Write fragment n of the complete message in msg to buf, which
+ * must hold maxctrl bytes.  Returns the fragment length, 0 when
+ * there are no more fragments, or a negative errno
+ */
+int mbim_fragment(void *buf, size_t maxctrl, const void *msg, size_t len, __u32 n);
+
+/* number of fragments needed to send a len byte message */
+__u32 mbim_nfragments(size_t len, size_t maxctrl);
+
+/* change the transaction id of the message in buf */
+static inline void mbim_set_tid(void *buf, __u32 tid)
+{
+	__u8 *b = buf;
+
+	b[8] = tid;
+	b[9] = tid >> 8;
+	b[10] = tid >> 16;
+	b[11] = tid >> 24;
+}
+
+/*
+ * Reassembly of fragmented messages, keyed on message type and
+ * transaction id.  A few transactions may be in progress at the
+ * same time.  The oldest one is dropped to make room for a new one
+ */
+#define MBIM_REASM_SLOTS	8
+
+struct mbim_reasm_slot {
+	__u32 type;
+	__u32 tid;
+	__u32 total;
+	__u32 next;		/* expected fragment, 0 if unused */
+	unsigned long age;
+	size_t len;
+	size_t size;
+	__u8 *buf;
+};
+
+struct mbim_reasm {
+	struct mbim_reasm_slot slot[MBIM_REASM_SLOTS];
+	unsigned long seq;
+	unsigned long dropped;
+};
+
+/*
+ * Add the message in buf, which must be one complete message or
+ * fragment as returned by mbim_decode().  Returns 1 and points *out
+ * to the complete message when the last fragment arrives, 0 if
+ * more fragments are expected, or a negative errno.  An out of
+ * sequence fragment discards the transaction and returns -EPROTO.
+ *
+ * Unfragmented messages are passed through without copying.  The
+ * reassembled message looks like a single fragment message, and
+ * is valid until the next call
+ */
+int mbim_reassemble(struct mbim_reasm *r, const void *buf, size_t len,
+		    const __u8 **out, size_t *outlen);
+
+void mbim_reasm_free(struct mbim_reasm *r);
+
+#endif /* _MBIM_H */
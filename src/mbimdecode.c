@@ -0,0 +1,1401 @@
+/*
+ * mbimdecode - pretty-print MBIM control messages like mbim.pl does
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Reads either a raw stream of MBIM messages, like the data read from
+ * /dev/cdc-wdmX, or text with messages in hex, like the mbim.pl debug
+ * dump or the "mbim.pl offline" format.  Fragmented COMMAND_DONE and
+ * INDICATE_STATUS messages are reassembled by transaction id before
+ * decoding.  Embedded QMUX frames are decoded like qmidecode does.
+ *
+ *   mbimdecode < /dev/cdc-wdm0
+ *   echo 01:00:00:80:10:00:00:00:01:00:00:00:00:00:00:00 | mbimdecode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include "qmux.h"
+#include "qmiprint.h"
+#include "mbim.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+static struct mbim_reasm reasm;
+static unsigned long msgs, errors;
+
+struct val {
+	__u32 val;
+	const char *name;
+};
+
+#define T(x) x, ARRAY_SIZE(x)
+
+/* Table 10-7: MBIM_DEVICE_TYPE */
+static const struct val devicetype[] = {
+	{ 1, "MBIMDeviceTypeEmbedded" },
+	{ 2, "MBIMDeviceTypeRemovable" },
+	{ 3, "MBIMDeviceTypeRemote" },
+};
+
+/* Table 10-8: MBIM_CELLULAR_CLASS */
+static const struct val cellclass[] = {
+	{ 1, "MBIMCellularClassGsm" },
+	{ 2, "MBIMCellularClassCdma" },
+};
+
+/* Table 10-9: MBIM_VOICE_CLASS */
+static const struct val voiceclass[] = {
+	{ 0, "MBIMVoiceClassUnknown" },
+	{ 1, "MBIMVoiceClassNoVoice" },
+	{ 2, "MBIMVoiceClassSeparateVoiceData" },
+	{ 3, "MBIMVoiceClassSimultaneousVoiceData" },
+};
+
+/* Table 10-10: MBIM_SIM_CLASS */
+static const struct val simclass[] = {
+	{ 1, "MBIMSimClassSimLogical" },
+	{ 2, "MBIMSimClassSimRemovable" },
+};
+
+/* Table 10-11: MBIM_DATA_CLASS */
+static const struct val dataclass[] = {
+	{ 0x0, "MBIMDataClassNone" },
+	{ 0x1, "MBIMDataClassGPRS" },
+	{ 0x2, "MBIMDataClassEDGE" },
+	{ 0x4, "MBIMDataClassUMTS" },
+	{ 0x8, "MBIMDataClassHSDPA" },
+	{ 0x10, "MBIMDataClassHSUPA" },
+	{ 0x20, "MBIMDataClassLTE" },
+	{ 0x10000, "MBIMDataClass1XRTT" },
+	{ 0x20000, "MBIMDataClass1XEVDO" },
+	{ 0x40000, "MBIMDataClass1XEVDORevA" },
+	{ 0x80000, "MBIMDataClass1XEVDV" },
+	{ 0x100000, "MBIMDataClass3XRTT" },
+	{ 0x200000, "MBIMDataClass1XEVDORevB" },
+	{ 0x400000, "MBIMDataClassUMB" },
+	{ 0x80000000, "MBIMDataClassCustom" },
+};
+
+/* Table 10-12: MBIM_SMS_CAPS */
+static const struct val smscaps[] = {
+	{ 1, "MBIMSmsCapsPduReceive" },
+	{ 2, "MBIMSmsCapsPduSend" },
+	{ 4, "MBIMSmsCapsTextReceive" },
+	{ 8, "MBIMSmsCapsTextSend" },
+};
+
+/* Table 10-13: MBIM_CTRL_CAPS */
+static const struct val ctrlcaps[] = {
+	{ 0x01, "MBIMCtrlCapsRegManual" },
+	{ 0x02, "MBIMCtrlCapsHwRadioSwitch" },
+	{ 0x04, "MBIMCtrlCapsCdmaMobileIp" },
+	{ 0x08, "MBIMCtrlCapsCdmaSimpleIp" },
+	{ 0x10, "MBIMCtrlCapsMultiCarrier" },
+};
+
+/* Table 10-16: MBIM_SUBSCRIBER_READY_STATE */
+static const struct val readystate[] = {
+	{ 0, "MBIMSubscriberReadyStateNotInitialized" },
+	{ 1, "MBIMSubscriberReadyStateInitialized" },
+	{ 2, "MBIMSubscriberReadyStateSimNotInserted" },
+	{ 3, "MBIMSubscriberReadyStateBadSim" },
+	{ 4, "MBIMSubscriberReadyStateFailure" },
+	{ 5, "MBIMSubscriberReadyStateNotActivated" },
+	{ 6, "MBIMSubscriberReadyStateDeviceLocked" },
+};
+
+/* Table 10-17: MBIM_UNIQUE_ID_FLAGS */
+static const struct val readyinfo[] = {
+	{ 0, "MBIMReadyInfoFlagsNone" },
+	{ 1, "MBIMReadyInfoFlagsProtectUniqueID" },
+};
+
+/* Table 10-24: MBIM_PIN_TYPE */
+static const struct val pintype[] = {
+	{ 0, "MBIMPinTypeNone" },
+	{ 1, "MBIMPinTypeCustom" },
+	{ 2, "MBIMPinTypePin1" },
+	{ 3, "MBIMPinTypePin2" },
+	{ 4, "MBIMPinTypeDeviceSimPin" },
+	{ 5, "MBIMPinTypeDeviceFirstSimPin" },
+	{ 6, "MBIMPinTypeNetworkPin" },
+	{ 7, "MBIMPinTypeNetworkSubsetPin" },
+	{ 8, "MBIMPinTypeServiceProviderPin" },
+	{ 9, "MBIMPinTypeCorporatePin" },
+	{ 10, "MBIMPinTypeSubsidyLock" },
+	{ 11, "MBIMPinTypePuk1" },
+	{ 12, "MBIMPinTypePuk2" },
+	{ 13, "MBIMPinTypeDeviceFirstSimPuk" },
+	{ 14, "MBIMPinTypeNetworkPuk" },
+	{ 15, "MBIMPinTypeNetworkSubsetPuk" },
+	{ 16, "MBIMPinTypeServiceProviderPuk" },
+	{ 17, "MBIMPinTypeCorporatePuk" },
+};
+
+/* Table 10-25: MBIM_PIN_STATE */
+static const struct val pinstate[] = {
+	{ 0, "MBIMPinStateUnlocked" },
+	{ 1, "MBIMPinStateLocked" },
+};
+
+/* Table 10-31: MBIM_PIN_MODE */
+static const struct val pinmode[] = {
+	{ 0, "NotSupported" },
+	{ 1, "Enabled" },
+	{ 2, "Disabled" },
+};
+
+/* Table 10-32: MBIM_PIN_FORMAT */
+static const struct val pinformat[] = {
+	{ 0, "Unknown" },
+	{ 1, "Numeric" },
+	{ 2, "AlphaNumeric" },
+};
+
+/* Table 10-44: 3GPP TS 24.008 Cause codes for NwError */
+static const struct val nwerror[] = {
+	{ 0, "none" },
+	{ 2, "International Mobile Subscriber" },
+	{ 4, "IMSI unknown in VLR" },
+	{ 6, "Illegal ME" },
+	{ 7, "GPRS services not allowed" },
+	{ 8, "GPRS and non-GPRS services not allowed" },
+	{ 11, "PLMN not allowed" },
+	{ 12, "Location area not allowed" },
+	{ 13, "Roaming not allowed in this" },
+	{ 14, "GPRS services not allowed in this PLMN" },
+	{ 15, "No suitable cells in location area" },
+	{ 17, "Network failure" },
+	{ 22, "Congestion" },
+};
+
+/* Table 10-46: MBIM_REGISTER_STATE */
+static const struct val regstate[] = {
+	{ 0, "MBIMRegisterStateUnknown" },
+	{ 1, "MBIMRegisterStateDeregistered" },
+	{ 2, "MBIMRegisterStateSearching" },
+	{ 3, "MBIMRegisterStateHome" },
+	{ 4, "MBIMRegisterStateRoaming" },
+	{ 5, "MBIMRegisterStatePartner" },
+	{ 6, "MBIMRegisterStateDenied" },
+};
+
+/* Table 10-47: MBIM_REGISTER_MODE */
+static const struct val regmode[] = {
+	{ 0, "MBIMRegisterModeUnknown" },
+	{ 1, "MBIMRegisterModeAutomatic" },
+	{ 2, "MBIMRegisterModeManual" },
+};
+
+/* Table 10-53: MBIM_PACKET_SERVICE_STATE */
+static const struct val packetstate[] = {
+	{ 0, "MBIMPacketServiceStateUnknown" },
+	{ 1, "MBIMPacketServiceStateAttaching" },
+	{ 2, "MBIMPacketServiceStateAttached" },
+	{ 3, "MBIMPacketServiceStateDetaching" },
+	{ 4, "MBIMPacketServiceStateDetached" },
+};
+
+/* Table 10-62: MBIM_AUTH_PROTOCOL */
+static const struct val authproto[] = {
+	{ 0, "MBIMAuthProtocolNone" },
+	{ 1, "MBIMAuthProtocolPap" },
+	{ 2, "MBIMAuthProtocolChap" },
+	{ 3, "MBIMAuthProtocolMsChapV2" },
+};
+
+/* Table 10-63: MBIM_CONTEXT_IP_TYPE */
+static const struct val iptype[] = {
+	{ 0, "MBIMContextIPTypeDefault" },
+	{ 1, "MBIMContextIPTypeIPv4" },
+	{ 2, "MBIMContextIPTypeIPv6" },
+	{ 3, "MBIMContextIPTypeIPv4v6" },
+	{ 4, "MBIMContextIPTypeIPv4AndIPv6" },
+};
+
+/* Table 10-64: MBIM_ACTIVATION_STATE */
+static const struct val actstate[] = {
+	{ 0, "MBIMActivationStateUnknown" },
+	{ 1, "MBIMActivationStateActivated" },
+	{ 2, "MBIMActivationStateActivating" },
+	{ 3, "MBIMActivationStateDeactivated" },
+	{ 4, "MBIMActivationStateDeactivating" },
+};
+
+/* Table 10-65: MBIM_VOICE_CALL_STATE */
+static const struct val voicestate[] = {
+	{ 0, "MBIMVoiceCallStateNone" },
+	{ 1, "MBIMVoiceCallStateInProgress" },
+	{ 2, "MBIMVoiceCallStateHangUp" },
+};
+
+/* Table 10-77: MBIM_SMS_STORAGE_STATE */
+static const struct val smsstoragestate[] = {
+	{ 0, "MBIMSmsStorageNotInitialized" },
+	{ 1, "MBIMSmsStorageInitialized" },
+};
+
+/* Table 10-78: MBIM_SMS_FORMAT */
+static const struct val smsformat[] = {
+	{ 0, "MBIMSmsFormatPdu" },
+	{ 1, "MBIMSmsFormatCdma" },
+};
+
+/* Table 10-85: MBIM_SMS_MESSAGE_STATUS */
+static const struct val smsmsgstatus[] = {
+	{ 0, "MBIMSmsStatusNew" },
+	{ 1, "MBIMSmsStatusOld" },
+	{ 2, "MBIMSmsStatusDraft" },
+	{ 3, "MBIMSmsStatusSent" },
+};
+
+/* Table 10-98: MBIM_SMS_STATUS_FLAGS */
+static const struct val smsflags[] = {
+	{ 0, "MBIM_SMS_FLAG_NONE" },
+	{ 1, "MBIM_SMS_FLAG_MESSAGE_STORE_FULL" },
+	{ 2, "MBIM_SMS_FLAG_NEW_MESSAGE" },
+};
+
+/* Table 10-113: MBIM_PHONEBOOK_STATE */
+static const struct val phonebookstate[] = {
+	{ 0, "MBIMPhonebookNotInitialized" },
+	{ 1, "MBIMPhonebookInitialized" },
+};
+
+static const struct val ipcfg[] = {
+	{ 0x01, "address" },
+	{ 0x02, "gateway" },
+	{ 0x04, "dns" },
+	{ 0x08, "mtu" },
+};
+
+/* Table 10-66: MBIM_CONTEXT_TYPES */
+static const struct {
+	const char *name;
+	const char *uuid;
+} context[] = {
+	{ "MBIMContextTypeNone", "B43F758C-A560-4B46-B35E-C5869641FB54" },
+	{ "MBIMContextTypeInternet", "7E5E2A7E-4E6F-7272-736B-656E7E5E2A7E" },
+	{ "MBIMContextTypeVpn", "9B9F7BBE-8952-44B7-83AC-CA41318DF7A0" },
+	{ "MBIMContextTypeVoice", "88918294-0EF4-4396-8CCA-A8588FBC02B2" },
+	{ "MBIMContextTypeVideoShare", "05A2A716-7C34-4B4D-9A91-C5EF0C7AAACC" },
+	{ "MBIMContextTypePurchase", "B3272496-AC6C-422B-A8C0-ACF687A27217" },
+	{ "MBIMContextTypeIMS", "21610D01-3074-4BCE-9425-B53A07D697D6" },
+	{ "MBIMContextTypeMMS", "46726664-7269-6BC6-9624-D1D35389ACA9" },
+	{ "MBIMContextTypeLocal", "A57A9AFC-B09F-45D7-BB40-033C39F60DB9" },
+};
+
+static const char *lookup(const struct val *t, int n, __u32 val, const char *def)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (t[i].val == val)
+			return t[i].name;
+	return def;
+}
+
+#define NAME(t, v) lookup(T(t), v, "")
+
+/* MBIMDataClassLTE => LTE */
+static const char *strip_class(const char *name)
+{
+	const char *p = name, *q;
+
+	if (strncmp(p, "MBIM", 4))
+		return name;
+	p += 4;
+	if (!isupper(*p))
+		return name;
+	for (p++; islower(*p); p++)
+		;
+	for (q = p; isalpha(*q) && (q == p || islower(*q)); q++)
+		;
+	if (q - p == 5 && !strncmp(p, "Class", 5))
+		return q;
+	if (q - p == 4 && (!strncmp(p, "Caps", 4) || !strncmp(p, "Type", 4)))
+		return q;
+	return name;
+}
+
+static const char *value_to_class(__u32 val, const struct val *t, int n)
+{
+	return strip_class(lookup(t, n, val, "Unknown"));
+}
+
+static void print_flags(__u32 flags, const struct val *t, int n)
+{
+	const char *sep = "";
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (flags & t[i].val) {
+			printf("%s%s", sep, strip_class(t[i].name));
+			sep = ", ";
+		}
+	if (!*sep)
+		printf("None");
+}
+
+/* info buffer access, reading zeros outside the buffer like unpack does */
+struct info {
+	const __u8 *p;
+	size_t len;
+};
+
+static __u32 u32(const struct info *in, size_t off)
+{
+	return off + 4 <= in->len ? get_le32(in->p + off) : 0;
+}
+
+static __u64 u64(const struct info *in, size_t off)
+{
+	return (__u64)u32(in, off + 4) << 32 | u32(in, off);
+}
+
+static int sub(struct info *out, const struct info *in, size_t off, size_t len)
+{
+	if (off > in->len || len > in->len - off) {
+		out->p = NULL;
+		out->len = 0;
+		return -1;
+	}
+	out->p = in->p + off;
+	out->len = len;
+	return 0;
+}
+
+static void put_utf8(unsigned int c)
+{
+	if (c < 0x80) {
+		putchar(c);
+	} else if (c < 0x800) {
+		putchar(0xc0 | c >> 6);
+		putchar(0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		putchar(0xe0 | c >> 12);
+		putchar(0x80 | (c >> 6 & 0x3f));
+		putchar(0x80 | (c & 0x3f));
+	} else {
+		putchar(0xf0 | c >> 18);
+		putchar(0x80 | (c >> 12 & 0x3f));
+		putchar(0x80 | (c >> 6 & 0x3f));
+		putchar(0x80 | (c & 0x3f));
+	}
+}
+
+/* UTF-16, little endian in MBIM and big endian in SMS */
+static void print_utf16(const __u8 *p, size_t len, int be)
+{
+	unsigned int c, c2;
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2) {
+		c = be ? p[i] << 8 | p[i + 1] : p[i + 1] << 8 | p[i];
+		if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+			c2 = be ? p[i + 2] << 8 | p[i + 3] : p[i + 3] << 8 | p[i + 2];
+			if (c2 >= 0xdc00 && c2 < 0xe000) {
+				c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+				i += 2;
+			}
+		}
+		put_utf8(c);
+	}
+}
+
+static void utf16_field(const struct info *in, __u32 off, __u32 len)
+{
+	struct info s;
+
+	if (!len) {
+		printf("[0] <none>");
+		return;
+	}
+	printf("[%u] ", len);
+	if (sub(&s, in, off, len) < 0)
+		printf("<outside buffer>");
+	else
+		print_utf16(s.p, s.len, 0);
+}
+
+static void print_uuid(const __u8 *uuid)
+{
+	char buf[40];
+
+	printf("%s", mbim_uuid_str(buf, uuid));
+}
+
+static const char *type_to_context(const __u8 *uuid)
+{
+	char buf[40];
+	size_t i;
+
+	mbim_uuid_str(buf, uuid);
+	for (i = 0; i < ARRAY_SIZE(context); i++)
+		if (!strcasecmp(buf, context[i].uuid))
+			return context[i].name;
+	return "<unknown>";
+}
+
+static void print_context_type(const char *indent, const struct info *in, size_t off)
+{
+	struct info s;
+
+	if (sub(&s, in, off, MBIM_UUID_LEN) < 0)
+		return;
+	printf("%sContextType:\t", indent);
+	print_uuid(s.p);
+	printf(" (%s)\n", type_to_context(s.p));
+}
+
+static void hexdump(const __u8 *p, size_t len, const char *sep)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		printf("%02x%s", p[i], sep);
+}
+
+static void ipv4_address(const struct info *in, size_t off)
+{
+	struct info s;
+
+	if (sub(&s, in, off, 4) < 0)
+		return;
+	printf("%u.%u.%u.%u", s.p[0], s.p[1], s.p[2], s.p[3]);
+}
+
+static void ipv6_address(const struct info *in, size_t off)
+{
+	char buf[INET6_ADDRSTRLEN];
+	struct info s;
+
+	if (sub(&s, in, off, 16) < 0)
+		return;
+	printf("%s", inet_ntop(AF_INET6, s.p, buf, sizeof(buf)));
+}
+
+/* Table 10-37: MBIM_PROVIDER */
+static void decode_provider(const struct info *in)
+{
+	printf("    ProviderId:\t");
+	utf16_field(in, u32(in, 0), u32(in, 4));
+	printf("\n    ProviderState:\t%u\n", u32(in, 8));
+	printf("    ProviderName:\t");
+	utf16_field(in, u32(in, 12), u32(in, 16));
+	printf("\n    CellularClass:\t%u\n", u32(in, 20));
+	printf("    RSSI:\t%u\n", u32(in, 24));
+	printf("    ErrorRate:\t%u\n", u32(in, 28));
+}
+
+/* Table 10-39: MBIM_PROVIDERS */
+static void decode_providers(const struct info *in)
+{
+	__u32 i, ec = u32(in, 0);
+	struct info s;
+
+	printf("  ElementCount (EC): %u\n  ProvidersRefList:\n", ec);
+	for (i = 0; i < ec; i++)
+		if (!sub(&s, in, u32(in, 4 + 8 * i), u32(in, 8 + 8 * i)))
+			decode_provider(&s);
+}
+
+static void decode_context(const struct info *in)
+{
+	struct info s;
+	int i;
+
+	printf("    ContextId:\t%u\n", u32(in, 0));
+	print_context_type("    ", in, 4);
+	for (i = 0; i < 3; i++) {
+		static const char *const field[] = { "AccessString", "UserName", "Password" };
+
+		printf("    %s:\t", field[i]);
+		if (sub(&s, in, u32(in, 20 + 8 * i), u32(in, 24 + 8 * i)) || !s.len)
+			printf("<none>");
+		else
+			print_utf16(s.p, s.len, 0);
+		printf("\n");
+	}
+	printf("    Compression:\t%u\n", u32(in, 44));
+	printf("    AuthProtocol:\t%u\n", u32(in, 48));
+}
+
+static void print_cid_list(enum mbim_service service, const struct info *in, size_t off, __u32 n)
+{
+	__u32 i;
+
+	printf("    CidCount:\t%u\n", n);
+	printf("    CidList:\t");
+	for (i = 0; i < n; i++)
+		printf("%s%u", i ? ", " : "", u32(in, off + 4 * i));
+	printf("\n");
+	for (i = 0; i < n; i++)
+		printf("      %s\n", mbim_cid_name(service, u32(in, off + 4 * i)));
+}
+
+static void print_service(const __u8 *uuid)
+{
+	enum mbim_service service = mbim_uuid_to_service(uuid);
+
+	printf("  %s (", mbim_services[service].name);
+	print_uuid(uuid);
+	printf(")\n");
+}
+
+/* Table 10-138: MBIM_DEVICE_SERVICE_ELEMENT */
+static void decode_device_service(const struct info *in)
+{
+	__u32 payload = u32(in, 16);
+
+	if (in->len < 28)
+		return;
+	print_service(in->p);
+	printf("    DssPayload:\t0x%08x%s%s\n", payload, payload & 0x1 ? "\tout" : "", payload & 0x2 ? "\tin" : "");
+	printf("    MaxDssInstances:\t%u\n", u32(in, 20));
+	print_cid_list(mbim_uuid_to_service(in->p), in, 28, u32(in, 24));
+}
+
+/* Table 10-141: MBIM_EVENT_ENTRY */
+static void decode_event_entry(const struct info *in)
+{
+	if (in->len < 20)
+		return;
+	print_service(in->p);
+	print_cid_list(mbim_uuid_to_service(in->p), in, 20, u32(in, 16));
+}
+
+static void decode_ip_configuration(const struct info *in)
+{
+	__u32 v4cfg = u32(in, 4), v6cfg = u32(in, 8), i, n;
+
+	printf("  SessionId:\t%u\n", u32(in, 0));
+	printf("  IPv4ConfigurationAvailable:\t0x%08x ", v4cfg);
+	print_flags(v4cfg, T(ipcfg));
+	printf("\n  IPv6ConfigurationAvailable:\t0x%08x ", v6cfg);
+	print_flags(v6cfg, T(ipcfg));
+	printf("\n");
+	if (v4cfg & 0x01) {
+		n = u32(in, 12);
+		printf("  IPv4AddressCount:\t%u\n", n);
+		for (i = 0; i < n; i++) {
+			printf("    ");
+			ipv4_address(in, u32(in, 16) + i * 8 + 4);
+			printf("/%u\n", u32(in, u32(in, 16) + i * 8));
+		}
+	}
+	if (v6cfg & 0x01) {
+		n = u32(in, 20);
+		printf("  IPv6AddressCount:\t%u\n", n);
+		for (i = 0; i < n; i++) {
+			printf("    ");
+			ipv6_address(in, u32(in, 24) + i * 20 + 4);
+			printf("/%u\n", u32(in, u32(in, 24) + i * 20));
+		}
+	}
+	if (v4cfg & 0x02) {
+		printf("  IPv4Gateway:\t");
+		ipv4_address(in, u32(in, 28));
+		printf("\n");
+	}
+	if (v6cfg & 0x02) {
+		printf("  IPv6Gateway:\t");
+		ipv6_address(in, u32(in, 32));
+		printf("\n");
+	}
+	if (v4cfg & 0x04) {
+		n = u32(in, 36);
+		printf("  IPv4DnsServerCount:\t%u\n", n);
+		for (i = 0; i < n; i++) {
+			printf("    ");
+			ipv4_address(in, u32(in, 40) + i * 4);
+			printf("\n");
+		}
+	}
+	if (v6cfg & 0x04) {
+		n = u32(in, 44);
+		printf("  IPv6DnsServerCount:\t%u\n", n);
+		for (i = 0; i < n; i++) {
+			printf("    ");
+			ipv6_address(in, u32(in, 48) + i * 16);
+			printf("\n");
+		}
+	}
+	if (v4cfg & 0x08)
+		printf("  IPv4Mtu:\t%u\n", u32(in, 52));
+	if (v6cfg & 0x08)
+		printf("  IPv6Mtu:\t%u\n", u32(in, 56));
+}
+
+static void decode_basic_connect(__u32 cid, const struct info *in, int set)
+{
+	static const char *const pins[] = {
+		"Pin1", "Pin2", "DeviceSimPin", "DeviceFirstSimPin", "NetworkPin", "NetworkSubsetPin",
+		"ServiceProviderPin", "CorporatePin", "SubsidyLock", "Custom",
+	};
+	struct info s;
+	__u32 i, n, v;
+
+	switch (cid) {
+	case 1: /* MBIM_CID_DEVICE_CAPS */
+		v = u32(in, 0);
+		printf("  DeviceType:\t%s (%u)\n", value_to_class(v, T(devicetype)), v);
+		v = u32(in, 4);
+		printf("  CellularClass:\t0x%08x %s\n", v, value_to_class(v, T(cellclass)));
+		v = u32(in, 8);
+		printf("  VoiceClass:\t0x%08x %s\n", v, value_to_class(v, T(voiceclass)));
+		v = u32(in, 12);
+		printf("  SIMClass:\t0x%08x %s\n", v, value_to_class(v, T(simclass)));
+		v = u32(in, 16);
+		printf("  DataClass:\t0x%08x ", v);
+		print_flags(v, T(dataclass));
+		v = u32(in, 20);
+		printf("\n  SMSCaps:\t0x%08x ", v);
+		print_flags(v, T(smscaps));
+		v = u32(in, 24);
+		printf("\n  ControlCaps:\t0x%08x ", v);
+		print_flags(v, T(ctrlcaps));
+		printf("\n  MaxSessions:\t%u\n", u32(in, 28));
+		printf("  CustomDataClass:\t");
+		utf16_field(in, u32(in, 32), u32(in, 36));
+		printf("\n  DeviceId:\t");
+		utf16_field(in, u32(in, 40), u32(in, 44));
+		printf("\n  FirmwareInfo:\t");
+		utf16_field(in, u32(in, 48), u32(in, 52));
+		printf("\n  HardwareInfo:\t");
+		utf16_field(in, u32(in, 56), u32(in, 60));
+		printf("\n");
+		break;
+	case 2: /* MBIM_CID_SUBSCRIBER_READY_STATUS */
+		v = u32(in, 0);
+		printf("  ReadyState:\t%s (%u)\n", NAME(readystate, v), v);
+		printf("  SubscriberId:\t");
+		utf16_field(in, u32(in, 4), u32(in, 8));
+		printf("\n  SimIccId:\t");
+		utf16_field(in, u32(in, 12), u32(in, 16));
+		v = u32(in, 20);
+		printf("\n  ReadyInfo:\t%s (%u)\n", NAME(readyinfo, v), v);
+		n = u32(in, 24);
+		printf("  ElementCount (EC):\t%u\n", n);
+		for (i = 0; i < n; i++) {
+			printf("    TelephoneNumber %u:\t", i);
+			utf16_field(in, u32(in, 28 + 8 * i), u32(in, 32 + 8 * i));
+			printf("\n");
+		}
+		break;
+	case 3: /* MBIM_CID_RADIO_STATE */
+		printf("  HwRadioState:\t%s\n", u32(in, 0) ? "on" : "off");
+		printf("  SwRadioState:\t%s\n", u32(in, 4) ? "on" : "off");
+		break;
+	case 4: /* MBIM_CID_PIN */
+		v = u32(in, 0);
+		printf("  PINType:\t%u (%s)\n", v, NAME(pintype, v));
+		v = u32(in, 4);
+		printf("  PINState:\t%u (%s)\n", v, NAME(pinstate, v));
+		printf("  RemainingAttempts:\t%u\n", u32(in, 8));
+		break;
+	case 5: /* MBIM_CID_PIN_LIST */
+		for (i = 0; i < ARRAY_SIZE(pins); i++)
+			printf("  %s:\t%s, %s, min = %u, max = %u\n", pins[i],
+			       lookup(T(pinmode), u32(in, i * 16), "Unknown"),
+			       lookup(T(pinformat), u32(in, i * 16 + 4), "Unknown"),
+			       u32(in, i * 16 + 8), u32(in, i * 16 + 12));
+		break;
+	case 6: /* MBIM_CID_HOME_PROVIDER */
+		decode_provider(in);
+		break;
+	case 7: /* MBIM_CID_PREFERRED_PROVIDERS */
+	case 8: /* MBIM_CID_VISIBLE_PROVIDERS */
+		decode_providers(in);
+		break;
+	case 9: /* MBIM_CID_REGISTER_STATE */
+		v = u32(in, 0);
+		printf("    NwError:\t%u (%s)\n", v, NAME(nwerror, v));
+		v = u32(in, 4);
+		printf("    RegisterState:\t%u (%s)\n", v, NAME(regstate, v));
+		v = u32(in, 8);
+		printf("    RegisterMode:\t%u (%s)\n", v, NAME(regmode, v));
+		v = u32(in, 12);
+		printf("    AvailableDataClasses:\t0x%08x ", v);
+		print_flags(v, T(dataclass));
+		v = u32(in, 16);
+		printf("\n    CurrentCellularClass:\t0x%08x %s\n", v, value_to_class(v, T(dataclass)));
+		printf("    ProviderId:\t");
+		utf16_field(in, u32(in, 20), u32(in, 24));
+		printf("\n    ProviderName:\t");
+		utf16_field(in, u32(in, 28), u32(in, 32));
+		printf("\n    RoamingtText:\t");
+		utf16_field(in, u32(in, 36), u32(in, 40));
+		printf("\n    RegistrationFlag:\t0x%08x\n", u32(in, 44));
+		break;
+	case 10: /* MBIM_CID_PACKET_SERVICE */
+		v = u32(in, 0);
+		printf("  NwError:\t%s (%u)\n", NAME(nwerror, v), v);
+		v = u32(in, 4);
+		printf("  PacketServiceState:\t%s (%u)\n", NAME(packetstate, v), v);
+		v = u32(in, 8);
+		printf("  HighestAvailableDataClass:\t0x%08x ", v);
+		print_flags(v, T(dataclass));
+		printf("\n  UplinkSpeed:\t%llu\n", (unsigned long long)u64(in, 12));
+		printf("  DownlinkSpeed:\t%llu\n", (unsigned long long)u64(in, 20));
+		break;
+	case 11: /* MBIM_CID_SIGNAL_STATE */
+		printf("  RSSI:\t%u\n", u32(in, 0));
+		printf("  ErrorRate:\t%u\n", u32(in, 4));
+		printf("  SignalStrengthInterval:\t%u\n", u32(in, 8));
+		printf("  RSSIThreshold:\t%u\n", u32(in, 12));
+		printf("  ErrorRateThreshold:\t%u\n", u32(in, 16));
+		break;
+	case 12: /* MBIM_CID_CONNECT */
+		printf("  SessionId:\t%u\n", u32(in, 0));
+		if (!set) {
+			v = u32(in, 4);
+			printf("  ActivationState:\t%s (%u)\n", NAME(actstate, v), v);
+			v = u32(in, 8);
+			printf("  VoiceCallState:\t%s (%u)\n", NAME(voicestate, v), v);
+			v = u32(in, 12);
+			printf("  IPType:\t%s (%u)\n", NAME(iptype, v), v);
+			print_context_type("  ", in, 16);
+			v = u32(in, 32);
+			printf("  NwError:\t%u (%s)\n", v, lookup(T(nwerror), v, "unknown"));
+			break;
+		}
+		printf("  ActivationCommand:\t%s\n", u32(in, 4) ? "Activate" : "Deactivate");
+		printf("  AccessString:\t");
+		utf16_field(in, u32(in, 8), u32(in, 12));
+		printf("\n  UserName:\t");
+		utf16_field(in, u32(in, 16), u32(in, 20));
+		printf("\n  Password:\t");
+		utf16_field(in, u32(in, 24), u32(in, 28));
+		printf("\n  Compression:\t%s\n", u32(in, 32) ? "Enable" : "None");
+		v = u32(in, 36);
+		printf("  AuthProtocol:\t%s (%u)\n", NAME(authproto, v), v);
+		v = u32(in, 40);
+		printf("  IPType:\t%s (%u)\n", NAME(iptype, v), v);
+		print_context_type("  ", in, 44);
+		break;
+	case 13: /* MBIM_CID_PROVISIONED_CONTEXTS */
+		n = u32(in, 0);
+		printf("  ElementCount (EC): %u\n  ProvisionedContextRefList:\n", n);
+		for (i = 0; i < n; i++) {
+			printf("  Context #%u:\n", i);
+			if (!sub(&s, in, u32(in, 4 + 8 * i), u32(in, 8 + 8 * i)))
+				decode_context(&s);
+		}
+		break;
+	case 15: /* MBIM_CID_IP_CONFIGURATION */
+		decode_ip_configuration(in);
+		break;
+	case 16: /* MBIM_CID_DEVICE_SERVICES */
+		n = u32(in, 0);
+		printf("  DeviceServicesCount (DSC):\t%u\n", n);
+		printf("  MaxDssSessions:\t%u\n", u32(in, 4));
+		for (i = 0; i < n; i++)
+			if (!sub(&s, in, u32(in, 8 + 8 * i), u32(in, 12 + 8 * i)))
+				decode_device_service(&s);
+		break;
+	case 19: /* MBIM_CID_DEVICE_SERVICE_SUBSCRIBE_LIST */
+		n = u32(in, 0);
+		printf("  ElementCount (EC): %u\n  DeviceServiceSubscribeRefList:\n", n);
+		for (i = 0; i < n; i++)
+			if (!sub(&s, in, u32(in, 4 + 8 * i), u32(in, 8 + 8 * i)))
+				decode_event_entry(&s);
+		break;
+	default:
+		printf("CID %u decoding is not yet supported\n", cid);
+		hexdump(in->p, in->len, " ");
+		printf("\n");
+	}
+}
+
+/* 3GPP TS 23.038 GSM 7 bit default alphabet and extension table, in UTF-8 */
+static const char *const gsm7[128] = {
+	"@", "£", "$", "¥", "è", "é", "ù", "ì", "ò", "Ç", "\n", "Ø", "ø", "\r", "Å", "å",
+	"Δ", "_", "Φ", "Γ", "Λ", "Ω", "Π", "Ψ", "Σ", "Θ", "Ξ", "", "Æ", "æ", "ß", "É",
+	" ", "!", "\"", "#", "¤", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/",
+	"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?",
+	"¡", "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O",
+	"P", "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "Ä", "Ö", "Ñ", "Ü", "§",
+	"¿", "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o",
+	"p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "ä", "ö", "ñ", "ü", "à",
+};
+
+static const char *gsm7_ext(int c)
+{
+	switch (c) {
+	case 0x0a: return "\f";
+	case 0x14: return "^";
+	case 0x28: return "{";
+	case 0x29: return "}";
+	case 0x2f: return "\\";
+	case 0x3c: return "[";
+	case 0x3d: return "~";
+	case 0x3e: return "]";
+	case 0x40: return "|";
+	case 0x65: return "€";
+	}
+	return " ";
+}
+
+/* print septets skip..n-1 of the packed 7 bit data */
+static void print_gsm7(const __u8 *p, size_t len, size_t skip, size_t n)
+{
+	int esc = 0, c;
+	size_t i, bit;
+
+	for (i = skip; i < n; i++) {
+		bit = i * 7;
+		if (bit / 8 >= len)
+			break;
+		c = p[bit / 8] >> (bit % 8);
+		if (bit % 8 > 1 && bit / 8 + 1 < len)
+			c |= p[bit / 8 + 1] << (8 - bit % 8);
+		c &= 0x7f;
+		if (esc) {
+			printf("%s", gsm7_ext(c));
+			esc = 0;
+		} else if (c == 0x1b) {
+			esc = 1;
+		} else {
+			printf("%s", gsm7[c]);
+		}
+	}
+}
+
+static const char *const numtypes[] = {
+	"unknown", "international", "national", "network", "subscriber", "alpha", "abbrev", "reserved",
+};
+
+static const char *const plantypes[] = {
+	"Unknown", "ISDN_e164", "undef2", "Data_x121", "Telex", "SCspec5", "SCspec6", "undef7",
+	"National", "Private", "ERMES", "undefb", "undefc", "undefd", "undefe", "Reserved",
+};
+
+/* type byte followed by semi-octets or 7 bit alpha */
+static void print_address(const __u8 *p, size_t len)
+{
+	int type;
+	size_t i;
+
+	if (!len) {
+		printf("-");
+		return;
+	}
+	type = p[0] >> 4 & 7;
+	printf("%d.%s.%s:", p[0] >> 7, numtypes[type], plantypes[p[0] & 0xf]);
+	if (type == 5) {
+		print_gsm7(p + 1, len - 1, 0, (len - 1) * 8 / 7);
+		return;
+	}
+	for (i = 1; i < len; i++)
+		printf("%x%x", p[i] & 0xf, p[i] >> 4);
+}
+
+/* swapped semi-octets, like the SCTS */
+static void print_swapped(const __u8 *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		printf("%x%x", p[i] & 0xf, p[i] >> 4);
+}
+
+/*
+ * 3GPP TS 23.040 SMS PDU, with the SMSC address first, as stored by
+ * MBIMSmsFormatPdu.  The direction is guessed from the SMSC length
+ */
+static void decode_sms_pdu(const __u8 *p, size_t len)
+{
+	static const char *const pdutypes[4][2] = {
+		{ "deliver-report", "deliver" },
+		{ "submit", "submit-report" },
+		{ "command", "status-report" },
+		{ "unknown-out", "unknown-in" },
+	};
+	size_t off = 0, n, udl = 0, hdr = 0;
+	int incoming, mti, hasvp, dcs = 0;
+	const char *type;
+	__u8 pdu;
+
+#define NEED(x) do { if (off + (x) > len) goto out; } while (0)
+
+	NEED(1);
+	n = p[off++];
+	NEED(n);
+	printf("smsc: ");
+	print_address(p + off, n);
+	printf("\n");
+	off += n;
+	incoming = n != 0;
+
+	NEED(1);
+	pdu = p[off++];
+	mti = pdu & 3;
+	type = pdutypes[mti][incoming];
+	printf("%s %s\n", type, mti ? "done" : "");
+
+	/* only deliver and submit are decoded further */
+	if (strcmp(type, "deliver") && strcmp(type, "submit"))
+		goto out;
+
+	if (!incoming) {
+		NEED(1);
+		printf("MR: %02x\n", p[off++]);
+	}
+	NEED(1);
+	n = 1 + (p[off++] + 1) / 2;
+	NEED(n);
+	printf("%s: ", incoming ? "OA" : "DA");
+	print_address(p + off, n);
+	printf("\n");
+	off += n;
+
+	NEED(2);
+	printf("prot: %02x\n", p[off++]);
+	dcs = p[off++];
+	printf("dcs: %02x\n", dcs);
+
+	hasvp = !incoming ? (pdu & 0x18) >> 3 : 0;
+	if (hasvp == 1) {
+		NEED(1);
+		printf("VP: rel %d\n", p[off++]);
+	} else if (hasvp) {
+		NEED(7);
+		printf("VP: %s ", hasvp == 2 ? "enh" : "abs");
+		hexdump(p + off, 7, "");
+		printf("\n");
+		off += 7;
+	}
+	if (incoming) {
+		NEED(7);
+		printf("scts: ");
+		print_swapped(p + off, 7);
+		printf("\n");
+		off += 7;
+	}
+
+	NEED(1);
+	udl = p[off++];
+	if (pdu & 0x40) {	/* UDHI */
+		NEED(1);
+		hdr = p[off] + 1;
+		NEED(hdr);
+		printf("udh: ");
+		hexdump(p + off, hdr, "");
+		printf("\n");
+		if (hdr > udl)
+			hdr = udl;
+	}
+
+	if (dcs & 0x20) {
+		printf("compressed[%02zx]: ", udl);
+		hexdump(p + off, len - off, "");
+		printf("\n");
+		off = len;
+	} else if ((dcs & 0x0c) == 0) {
+		n = (udl * 7 + 7) / 8;
+		NEED(n);
+		printf("msg: '");
+		print_gsm7(p + off, n, (hdr * 8 + 6) / 7, udl);
+		printf("'\n");
+		off += n;
+	} else if ((dcs & 0x0c) == 0x04) {
+		NEED(udl);
+		printf("msg: '%.*s'\n", (int)(udl - hdr), p + off + hdr);
+		off += udl;
+	} else if ((dcs & 0x0c) == 0x08) {
+		NEED(udl);
+		printf("msg: U'");
+		print_utf16(p + off + hdr, udl - hdr, 1);
+		printf("'\n");
+		off += udl;
+	} else {
+		printf("msg: unknown encoding: ");
+		hexdump(p + off, len - off, "");
+		printf("\n");
+		off = len;
+	}
+out:
+	printf("leftover: %zd\n", (ssize_t)len - (ssize_t)off);
+#undef NEED
+}
+
+static void decode_sms(__u32 cid, const struct info *in)
+{
+	struct info s;
+	__u32 i, n, v, format;
+
+	switch (cid) {
+	case 1: /* MBIM_CID_SMS_CONFIGURATION */
+		printf("  SmsStorageState:\t%s\n", NAME(smsstoragestate, u32(in, 0)));
+		printf("  Format:\t%s\n", NAME(smsformat, u32(in, 4)));
+		printf("  MaxMessages:\t%u\n", u32(in, 8));
+		printf("  CdmaShortMessageSize:\t%u\n", u32(in, 12));
+		printf("  ScAddress:\t");
+		utf16_field(in, u32(in, 16), u32(in, 20));
+		printf("\n");
+		break;
+	case 2: /* MBIM_CID_SMS_READ */
+		format = u32(in, 0);
+		n = u32(in, 4);
+		printf("  Format:\t%s\n", NAME(smsformat, format));
+		printf("  ElementCount (EC): %u\n  SmsRefList:\n", n);
+		for (i = 0; i < n; i++) {
+			if (sub(&s, in, u32(in, 8 + 8 * i), u32(in, 12 + 8 * i)))
+				continue;
+			if (format == 0) {
+				struct info pdu;
+
+				printf("    MessageIndex:\t%u\n", u32(&s, 0));
+				v = u32(&s, 4);
+				printf("    MessageStatus:\t%s (%u)\n", NAME(smsmsgstatus, v), v);
+				if (!sub(&pdu, &s, u32(&s, 8), u32(&s, 12)))
+					decode_sms_pdu(pdu.p, pdu.len);
+			} else if (format == 1) {
+				printf("dummy function\n");
+			} else {
+				printf("Unsupported SMS format: %u\n", format);
+			}
+		}
+		break;
+	case 5: /* MBIM_CID_SMS_MESSAGE_STORE_STATUS */
+		v = u32(in, 0);
+		printf("  Flags:\t%s (%u)\n", NAME(smsflags, v), v);
+		printf("  MessageIndex:\t%u\n", u32(in, 4));
+		break;
+	default:
+		printf("SMS CID %u decoding is not yet supported\n", cid);
+	}
+}
+
+static void decode_phonebook(__u32 cid, const struct info *in)
+{
+	if (cid != 1) {	/* MBIM_CID_PHONEBOOK_CONFIGURATION */
+		printf("PHONEBOOK CID %u decoding is not yet supported\n", cid);
+		return;
+	}
+	printf("  PhonebookState:\t%s\n", NAME(phonebookstate, u32(in, 0)));
+	printf("  TotalNbrOfEntries:\t%u\n", u32(in, 4));
+	printf("  UsedEntries:\t%u\n", u32(in, 8));
+	printf("  MaxNumberLength:\t%u\n", u32(in, 12));
+	printf("  MaxNameLength:\t%u\n", u32(in, 16));
+}
+
+/* the embedded QMUX frames, decoded by the qmidecode printer */
+static void decode_ext_qmux(__u32 cid, const struct info *in)
+{
+	struct qmi_msg qmi;
+	size_t off;
+	int len;
+
+	if (cid != MBIM_CID_QMI) {
+		printf("EXT_QMUX CID %u decoding is not yet supported\n", cid);
+		return;
+	}
+	for (off = 0; off < in->len; off += len) {
+		len = qmux_decode(&qmi, in->p + off, in->len - off);
+		if (len < 0) {
+			printf("invalid QMUX frame: %s\n", strerror(-len));
+			hexdump(in->p + off, in->len - off, " ");
+			printf("\n");
+			return;
+		}
+		qmi_pretty_print(stdout, &qmi, 0);
+	}
+}
+
+static void decode_info(const struct mbim_msg *msg)
+{
+	struct info in = { msg->info, msg->infolen };
+
+	switch (msg->service) {
+	case MBIM_SERVICE_BASIC_CONNECT:
+		decode_basic_connect(msg->cid, &in, msg->type == MBIM_COMMAND_MSG && msg->status);
+		break;
+	case MBIM_SERVICE_SMS:
+		decode_sms(msg->cid, &in);
+		break;
+	case MBIM_SERVICE_PHONEBOOK:
+		decode_phonebook(msg->cid, &in);
+		break;
+	case MBIM_SERVICE_USSD:
+	case MBIM_SERVICE_STK:
+	case MBIM_SERVICE_AUTH:
+		printf("%s CID %u decoding is not yet supported\n", mbim_services[msg->service].name, msg->cid);
+		break;
+	case MBIM_SERVICE_DSS:
+		if (msg->cid != 1)	/* MBIM_CID_DSS_CONNECT has no info buffer */
+			printf("DSS CID %u decoding is not yet supported\n", msg->cid);
+		break;
+	case MBIM_SERVICE_EXT_QMUX:
+		decode_ext_qmux(msg->cid, &in);
+		break;
+	case MBIM_SERVICE_MSFWID:
+		if (msg->cid == 1 && in.len >= MBIM_UUID_LEN) {
+			printf("  FirmwareID:\t");
+			print_uuid(in.p);
+			printf("\n");
+		} else {
+			printf("MSFWID %u decoding is not yet supported\n", msg->cid);
+		}
+		break;
+	default:
+		printf("decoding of %s CIDs is not yet supported\n", mbim_services[msg->service].name);
+		hexdump(in.p, in.len, " ");
+		printf("\n");
+	}
+}
+
+/* the complete or reassembled message */
+static void print_body(const struct mbim_msg *msg)
+{
+	printf("%s (", mbim_services[msg->service].name);
+	print_uuid(msg->uuid);
+	printf(")\n");
+	printf("%s (%u)\n", mbim_cid_name(msg->service, msg->cid), msg->cid);
+	if (msg->type == MBIM_COMMAND_DONE)
+		printf("%s (%u)\n", mbim_status_name(msg->status), msg->status);
+	else if (msg->type == MBIM_COMMAND_MSG)
+		printf("%s (%u)\n", msg->status ? "SET_COMMAND" : "QUERY_COMMAND", msg->status);
+	printf("InformationBuffer [%u]:\n", msg->infolen);
+	if (msg->infolen)
+		decode_info(msg);
+}
+
+static void print_msg(const __u8 *buf, size_t len)
+{
+	struct mbim_msg msg;
+	const __u8 *full;
+	size_t fulllen;
+	int rc;
+
+	rc = mbim_decode(&msg, buf, len);
+	if (rc < 0) {
+		fprintf(stderr, "invalid MBIM message (%zu bytes): %s\n", len, strerror(-rc));
+		errors++;
+		return;
+	}
+	msgs++;
+
+	printf("MBIM_MESSAGE_HEADER\n");
+	printf("  MessageType:\t0x%08x (%s)\n", msg.type, mbim_type_name(msg.type));
+	printf("  MessageLength:\t%u\n", msg.len);
+	printf("  TransactionId:\t%u\n", msg.tid);
+
+	switch (msg.type) {
+	case MBIM_OPEN_MSG:
+		printf("  MaxControlTransfer:\t%u\n", msg.status);
+		return;
+	case MBIM_OPEN_DONE:
+	case MBIM_CLOSE_DONE:
+		printf("%s (%u)\n", mbim_status_name(msg.status), msg.status);
+		return;
+	case MBIM_HOST_ERROR_MSG:
+	case MBIM_FUNCTION_ERROR_MSG:
+		printf("%s (%u)\n", mbim_error_name(msg.status), msg.status);
+		return;
+	}
+	if (!mbim_is_fragmented(msg.type))
+		return;
+
+	printf("MBIM_FRAGMENT_HEADER\n");
+	printf("  TotalFragments:\t%u\n", msg.total);
+	printf("  CurrentFragment:\t%u\n", msg.current);
+
+	rc = mbim_reassemble(&reasm, buf, msg.len, &full, &fulllen);
+	if (rc == -EPROTO) {
+		printf("fragment out of sequence - dropped\n");
+		errors++;
+	}
+	if (rc <= 0)
+		return;
+	if (full != buf)
+		mbim_decode(&msg, full, fulllen);
+	print_body(&msg);
+}
+
+/* raw messages, possibly split across or concatenated in reads */
+static int decode_raw(int fd, __u8 *buf, size_t size, size_t have)
+{
+	struct mbim_msg msg;
+	size_t off;
+	ssize_t n;
+	int len;
+
+	do {
+		for (off = 0; off < have; off += len) {
+			len = mbim_decode(&msg, buf + off, have - off);
+			if (len == -EMSGSIZE && have - off < size)
+				break;
+			if (len < 0) {	/* resync on the next 32bit word */
+				errors++;
+				len = have - off < 4 ? have - off : 4;
+				continue;
+			}
+			print_msg(buf + off, len);
+		}
+		have -= off;
+		memmove(buf, buf + off, have);
+
+		fflush(stdout);
+		n = read(fd, buf + have, size - have);
+		if (n > 0)
+			have += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	if (have)
+		fprintf(stderr, "%zu bytes of truncated message at end of input\n", have);
+	return n < 0 ? -errno : 0;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* one or more messages in hex, separated by space, ':' or ','.  Lines without hex are ignored */
+static void decode_hex_line(const char *p, const char *end)
+{
+	static __u8 line[1 << 16];
+	struct mbim_msg msg;
+	size_t len = 0, off;
+	int hi, lo, n;
+
+	while (p < end && len < sizeof(line)) {
+		if (isspace(*p) || *p == ':' || *p == ',') {
+			p++;
+			continue;
+		}
+		if (p + 1 < end && p[0] == '0' && p[1] == 'x')
+			p += 2;
+		hi = p < end ? hexval(p[0]) : -1;
+		lo = p + 1 < end ? hexval(p[1]) : -1;
+		if (hi < 0)
+			break;
+		if (lo < 0) {
+			line[len++] = hi;
+			p++;
+		} else {
+			line[len++] = hi << 4 | lo;
+			p += 2;
+		}
+	}
+
+	for (off = 0; off < len; off += n) {
+		n = mbim_decode(&msg, line + off, len - off);
+		if (n < 0) {
+			print_msg(line + off, len - off);
+			return;
+		}
+		print_msg(line + off, n);
+	}
+}
+
+static int decode_hex(int fd, char *buf, size_t size, size_t have)
+{
+	char *p, *nl;
+	ssize_t n;
+
+	do {
+		for (p = buf; (nl = memchr(p, '\n', have - (p - buf))); p = nl + 1)
+			decode_hex_line(p, nl);
+		have -= p - buf;
+		memmove(buf, p, have);
+
+		if (have == size) {
+			decode_hex_line(buf, buf + have);
+			have = 0;
+		}
+
+		fflush(stdout);
+		n = read(fd, buf + have, size - have);
+		if (n > 0)
+			have += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	decode_hex_line(buf, buf + have);
+	return n < 0 ? -errno : 0;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "raw",	0, 0, 'r' },
+	{ "hex",	0, 0, 'x' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--raw|--hex] [file]\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static __u8 buf[1 << 17];
+	int opt, fd = 0, mode = 0, ret;
+	ssize_t n = 0;
+
+	while ((opt = getopt_long(argc, argv, "hrx", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+		case 'x':
+			mode = opt;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			exit(1);
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+	/* peek at the first byte: text starts with a hex digit, '-' or white space */
+	if (!mode) {
+		do {
+			n = read(fd, buf, sizeof(buf));
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			perror("read");
+			exit(1);
+		}
+		mode = n > 0 && (isxdigit(buf[0]) || isspace(buf[0]) || buf[0] == '-') ? 'x' : 'r';
+	}
+
+	if (mode == 'r')
+		ret = decode_raw(fd, buf, sizeof(buf), n);
+	else
+		ret = decode_hex(fd, (char *)buf, sizeof(buf), n);
+
+	fflush(stdout);
+	mbim_reasm_free(&reasm);
+	if (errors || reasm.dropped)
+		fprintf(stderr, "%lu messages decoded, %lu errors, %lu fragmented messages dropped\n",
+			msgs, errors, reasm.dropped);
+	return ret < 0 || errors;
+}
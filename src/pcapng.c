@@ -0,0 +1,353 @@
+/*
+ * pcapng.c - capture control frames to a pcapng file, and read them back
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "pcapng.h"
+
+#define BLOCK_SHB	0x0a0d0d0a
+#define BLOCK_IDB	0x00000001
+#define BLOCK_EPB	0x00000006
+
+#define OPT_ENDOFOPT	0
+#define OPT_IF_NAME	2
+#define OPT_EPB_FLAGS	2
+
+#define PAD4(x)		(((x) + 3) & ~3)
+
+/* large enough to make the write cost per frame negligible */
+#define PCAPNG_BUFSZ	(1 << 18)
+
+static const __u8 zero[4];
+
+/* blocks are written in host byte order, as told by the SHB magic */
+static void put(FILE *f, const void *data, size_t len)
+{
+	if (len)
+		fwrite(data, 1, len, f);
+}
+
+static void put32(FILE *f, __u32 val)
+{
+	put(f, &val, sizeof(val));
+}
+
+static void put_opt(FILE *f, __u16 code, const void *data, __u16 len)
+{
+	__u16 hdr[2] = { code, len };
+
+	put(f, hdr, sizeof(hdr));
+	put(f, data, len);
+	put(f, zero, PAD4(len) - len);
+}
+
+static int write_shb(struct pcapng *p)
+{
+	__u32 len = 28;
+	__u16 version[2] = { 1, 0 };
+	__s64 seclen = -1;	/* unknown */
+
+	flockfile(p->f);
+	put32(p->f, BLOCK_SHB);
+	put32(p->f, len);
+	put32(p->f, 0x1a2b3c4d);
+	put(p->f, version, sizeof(version));
+	put(p->f, &seclen, sizeof(seclen));
+	put32(p->f, len);
+	funlockfile(p->f);
+	return ferror(p->f) ? -EIO : 0;
+}
+
+struct pcapng *pcapng_open(const char *path)
+{
+	struct pcapng *p = calloc(1, sizeof(*p));
+
+	if (!p)
+		return NULL;
+	p->buf = malloc(PCAPNG_BUFSZ);
+	if (!p->buf)
+		goto err;
+	p->f = strcmp(path, "-") ? fopen(path, "a") : stdout;
+	if (!p->f)
+		goto err;
+	setvbuf(p->f, p->buf, _IOFBF, PCAPNG_BUFSZ);
+	if (write_shb(p) < 0) {
+		errno = EIO;
+		goto err;
+	}
+	return p;
+err:
+	if (p->f && p->f != stdout)
+		fclose(p->f);
+	free(p->buf);
+	free(p);
+	return NULL;
+}
+
+int pcapng_add_interface(struct pcapng *p, const char *device, __u16 linktype)
+{
+	size_t namelen = strlen(device);
+	__u16 hdr[2] = { linktype, 0 };
+	__u32 len;
+	int id;
+
+	if (namelen > 0xffff)
+		return -EINVAL;
+
+	/* header, snaplen, if_name, end of options and trailer */
+	len = 16 + 4 + PAD4(namelen) + 4 + 4;
+
+	flockfile(p->f);
+	put32(p->f, BLOCK_IDB);
+	put32(p->f, len);
+	put(p->f, hdr, sizeof(hdr));
+	put32(p->f, 0);		/* no snaplen */
+	put_opt(p->f, OPT_IF_NAME, device, namelen);
+	put_opt(p->f, OPT_ENDOFOPT, zero, 0);
+	put32(p->f, len);
+	id = p->nif++;
+	funlockfile(p->f);
+	return ferror(p->f) ? -EIO : id;
+}
+
+int pcapng_write(struct pcapng *p, int ifid, int dir, const void *data, size_t len)
+{
+	struct timeval tv;
+	__u64 ts;
+	__u32 blen, flags = dir & 3;
+
+	if (ifid < 0 || ifid >= p->nif)
+		return -EINVAL;
+
+	gettimeofday(&tv, NULL);
+	ts = (__u64)tv.tv_sec * 1000000 + tv.tv_usec;
+
+	/* header, 5 fixed fields, data, epb_flags, end of options and trailer */
+	blen = 8 + 20 + PAD4(len) + 8 + 4 + 4;
+
+	flockfile(p->f);
+	put32(p->f, BLOCK_EPB);
+	put32(p->f, blen);
+	put32(p->f, ifid);
+	put32(p->f, ts >> 32);
+	put32(p->f, ts);
+	put32(p->f, len);	/* captured */
+	put32(p->f, len);	/* original */
+	put(p->f, data, len);
+	put(p->f, zero, PAD4(len) - len);
+	put_opt(p->f, OPT_EPB_FLAGS, &flags, sizeof(flags));
+	put_opt(p->f, OPT_ENDOFOPT, zero, 0);
+	put32(p->f, blen);
+	funlockfile(p->f);
+	return ferror(p->f) ? -EIO : 0;
+}
+
+int pcapng_flush(struct pcapng *p)
+{
+	return fflush(p->f) ? -errno : 0;
+}
+
+void pcapng_close(struct pcapng *p)
+{
+	if (!p)
+		return;
+	/* stdout keeps using the buffer until exit */
+	if (p->f == stdout) {
+		fflush(p->f);
+	} else {
+		fclose(p->f);
+		free(p->buf);
+	}
+	free(p);
+}
+
+/* reading */
+
+static __u32 rd32(const struct pcapng_reader *r, const __u8 *p)
+{
+	__u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap32(v) : v;
+}
+
+static __u16 rd16(const struct pcapng_reader *r, const __u8 *p)
+{
+	__u16 v;
+
+	memcpy(&v, p, sizeof(v));
+	return r->swap ? __builtin_bswap16(v) : v;
+}
+
+struct pcapng_reader *pcapng_open_read(const char *path)
+{
+	struct pcapng_reader *r = calloc(1, sizeof(*r));
+
+	if (!r)
+		return NULL;
+	r->size = 1 << 16;
+	r->buf = malloc(r->size);
+	r->f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!r->buf || !r->f) {
+		pcapng_close_read(r);
+		return NULL;
+	}
+	return r;
+}
+
+void pcapng_close_read(struct pcapng_reader *r)
+{
+	if (!r)
+		return;
+	if (r->f && r->f != stdin)
+		fclose(r->f);
+	free(r->buf);
+	free(r);
+}
+
+/* the interface options we care about */
+static void parse_idb(struct pcapng_reader *r, const __u8 *opt, size_t len)
+{
+	int id = r->nif++;
+	__u16 code, olen;
+	__u8 res;
+
+	if (id >= PCAPNG_MAX_IF)
+		return;
+	r->ifs[id].linktype = rd16(r, r->buf + 8);
+	r->ifs[id].tsdiv = 1;
+	r->ifs[id].tsmul = 1;
+	r->ifs[id].name[0] = 0;
+
+	while (len >= 4) {
+		code = rd16(r, opt);
+		olen = rd16(r, opt + 2);
+		if (code == OPT_ENDOFOPT || 4 + PAD4(olen) > len)
+			break;
+		if (code == OPT_IF_NAME) {
+			if (olen >= sizeof(r->ifs[id].name))
+				olen = sizeof(r->ifs[id].name) - 1;
+			memcpy(r->ifs[id].name, opt + 4, olen);
+			r->ifs[id].name[olen] = 0;
+		}
+		if (code == 9 && olen >= 1) {	/* if_tsresol */
+			__u64 units = 1;
+			int i;
+
+			res = opt[4];
+			if (res & 0x80) {
+				/* power of 2 - close enough for our use */
+				for (i = 0; i < (res & 0x7f) && i < 63; i++)
+					units *= 2;
+				units = units < 1000000 ? 1 : units / 1000000;
+				r->ifs[id].tsdiv = units;
+			} else {
+				for (i = 0; i < res && i < 19; i++)
+					units *= 10;
+				if (units >= 1000000)
+					r->ifs[id].tsdiv = units / 1000000;
+				else
+					r->ifs[id].tsmul = 1000000 / units;
+			}
+		}
+		opt += 4 + PAD4(olen);
+		len -= 4 + PAD4(olen);
+	}
+}
+
+int pcapng_read(struct pcapng_reader *r, struct pcapng_rec *rec)
+{
+	__u32 type, len, ifid, caplen, magic;
+	__u16 code, olen;
+	const __u8 *opt;
+	size_t optlen;
+	__u64 ts;
+	__u8 *tmp;
+
+	while (1) {
+		if (fread(r->buf, 1, 8, r->f) != 8)
+			return 0;
+		memcpy(&type, r->buf, 4);
+		memcpy(&len, r->buf + 4, 4);
+
+		/* the byte order is set by each section header */
+		if (type == BLOCK_SHB) {
+			if (fread(r->buf + 8, 1, 4, r->f) != 4)
+				return -EIO;
+			memcpy(&magic, r->buf + 8, 4);
+			if (magic == 0x1a2b3c4d)
+				r->swap = 0;
+			else if (magic == 0x4d3c2b1a)
+				r->swap = 1;
+			else
+				return -EINVAL;
+			r->nif = 0;
+			len = rd32(r, r->buf + 4);
+			if (len < 28 || len % 4 || len > r->size)
+				return -EINVAL;
+			/* no fseek, as this may be a pipe */
+			if (fread(r->buf + 12, 1, len - 12, r->f) != len - 12)
+				return 0;
+			continue;
+		}
+
+		len = rd32(r, r->buf + 4);
+		if (len < 12 || len % 4)
+			return -EINVAL;
+		if (len > r->size) {
+			tmp = realloc(r->buf, len);
+			if (!tmp)
+				return -ENOMEM;
+			r->buf = tmp;
+			r->size = len;
+		}
+		if (fread(r->buf + 8, 1, len - 8, r->f) != len - 8)
+			return 0;	/* truncated by a running capture */
+		type = rd32(r, r->buf);
+
+		if (type == BLOCK_IDB && len >= 20) {
+			parse_idb(r, r->buf + 16, len - 20);
+			continue;
+		}
+		if (type != BLOCK_EPB || len < 32)
+			continue;
+
+		ifid = rd32(r, r->buf + 8);
+		caplen = rd32(r, r->buf + 20);
+		if (ifid >= r->nif || ifid >= PCAPNG_MAX_IF || 28 + PAD4(caplen) + 4 > len)
+			continue;
+
+		ts = (__u64)rd32(r, r->buf + 12) << 32 | rd32(r, r->buf + 16);
+		rec->ifid = ifid;
+		rec->linktype = r->ifs[ifid].linktype;
+		rec->device = r->ifs[ifid].name;
+		rec->ts = ts / r->ifs[ifid].tsdiv * r->ifs[ifid].tsmul;
+		rec->data = r->buf + 28;
+		rec->len = caplen;
+		rec->dir = 0;
+
+		opt = r->buf + 28 + PAD4(caplen);
+		optlen = len - 4 - (opt - r->buf);
+		while (optlen >= 4) {
+			code = rd16(r, opt);
+			olen = rd16(r, opt + 2);
+			if (code == OPT_ENDOFOPT || 4 + PAD4(olen) > optlen)
+				break;
+			if (code == OPT_EPB_FLAGS && olen == 4)
+				rec->dir = rd32(r, opt + 4) & 3;
+			opt += 4 + PAD4(olen);
+			optlen -= 4 + PAD4(olen);
+		}
+		return 1;
+	}
+}
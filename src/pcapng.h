@@ -0,0 +1,101 @@
+/*
+ * pcapng.h - capture control frames to a pcapng file, and read them back
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Writes the pcapng format described in
+ * http://www.winpcap.org/ntar/draft/PCAP-DumpFileFormat.html
+ *
+ * Each opened file gets a Section Header Block.  Appending to an
+ * existing capture is therefore fine, as it just adds a new section.
+ * Every device is an Interface Description Block named after the
+ * device, and every frame is an Enhanced Packet Block with a
+ * microsecond timestamp and the direction in the epb_flags option.
+ *
+ * There are no registered link types for QMUX or MBIM control
+ * messages, so the private DLT_USER0 and DLT_USER1 are used.  To
+ * make wireshark decode MBIM, add "mbim.control" as payload protocol
+ * for User 1 (DLT=148) in the DLT_USER protocol preferences.
+ *
+ * Output is written through a large stdio buffer and flushed only
+ * when asked to, or when the buffer is full.  A block is always
+ * written in one go, so one capture may be shared between threads.
+ */
+
+#ifndef _PCAPNG_H
+#define _PCAPNG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <linux/types.h>
+
+#define PCAPNG_LINKTYPE_QMUX	147	/* LINKTYPE_USER0 */
+#define PCAPNG_LINKTYPE_MBIM	148	/* LINKTYPE_USER1 */
+
+/* epb_flags direction */
+#define PCAPNG_IN		1	/* from the modem */
+#define PCAPNG_OUT		2	/* to the modem */
+
+struct pcapng {
+	FILE *f;
+	char *buf;
+	int nif;
+};
+
+/*
+ * Open path for appending, or stdout if path is "-".  Returns NULL
+ * with errno set on failure
+ */
+struct pcapng *pcapng_open(const char *path);
+
+/* add an interface for device, returning the interface id or -errno */
+int pcapng_add_interface(struct pcapng *p, const char *device, __u16 linktype);
+
+/* record one frame, timestamped now */
+int pcapng_write(struct pcapng *p, int ifid, int dir, const void *data, size_t len);
+
+int pcapng_flush(struct pcapng *p);
+void pcapng_close(struct pcapng *p);
+
+/*
+ * Reading captures.  Handles both byte orders, several sections and
+ * the if_tsresol option, so files saved by other tools can be read
+ */
+#define PCAPNG_MAX_IF	16
+
+struct pcapng_rec {
+	int ifid;
+	__u16 linktype;
+	const char *device;	/* if_name, or "" */
+	int dir;		/* PCAPNG_IN, PCAPNG_OUT or 0 if unknown */
+	__u64 ts;		/* microseconds */
+	const __u8 *data;	/* valid until the next read */
+	size_t len;
+};
+
+struct pcapng_reader {
+	FILE *f;
+	__u8 *buf;
+	size_t size;
+	int swap;
+	int nif;
+	struct {
+		__u16 linktype;
+		__u64 tsdiv;	/* divide by this for microseconds */
+		__u64 tsmul;	/* or multiply */
+		char name[64];
+	} ifs[PCAPNG_MAX_IF];
+};
+
+struct pcapng_reader *pcapng_open_read(const char *path);
+
+/* read the next packet.  Returns 1, 0 at the end or -errno */
+int pcapng_read(struct pcapng_reader *r, struct pcapng_rec *rec);
+
+void pcapng_close_read(struct pcapng_reader *r);
+
+#endif /* _PCAPNG_H */
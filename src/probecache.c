@@ -0,0 +1,240 @@
+/*
+ * probecache.c - persistent cache of probed USB interface capabilities
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include "probecache.h"
+
+#define PROBECACHE_HDR	"# qmiprobe 1\n"
+#define USB_DT_DEVICE_SIZE	18
+
+static const char *const type_str[] = {
+	[PROBE_TYPE_NONE] = "none",
+	[PROBE_TYPE_QMI] = "qmi",
+	[PROBE_TYPE_MBIM] = "mbim",
+	[PROBE_TYPE_AT] = "at",
+};
+
+const char *probecache_type_str(int type)
+{
+	if (type < 0 || type >= (int)(sizeof(type_str) / sizeof(type_str[0])))
+		return "none";
+	return type_str[type];
+}
+
+static int parse_type(const char *str)
+{
+	int i;
+
+	for (i = 0; i < (int)(sizeof(type_str) / sizeof(type_str[0])); i++)
+		if (!strcmp(str, type_str[i]))
+			return i;
+	return -1;
+}
+
+static int sysfs_hex(const char *dir, const char *attr, __u16 *val)
+{
+	char path[PATH_MAX], buf[16];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	if (!fgets(buf, sizeof(buf), f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+	*val = strtoul(buf, NULL, 16);
+	return 0;
+}
+
+int probecache_key(const char *usbdev, struct probe_key *key)
+{
+	char dir[PATH_MAX], path[PATH_MAX + 16];
+	unsigned char buf[4096];
+	__u32 hash = 0x811c9dc5;	/* FNV-1a */
+	size_t n, i, total = 0;
+	FILE *f;
+	int rc;
+
+	snprintf(dir, sizeof(dir), "/sys/bus/usb/devices/%s", usbdev);
+	memset(key, 0, sizeof(*key));
+	if ((rc = sysfs_hex(dir, "idVendor", &key->vid)) < 0 ||
+	    (rc = sysfs_hex(dir, "idProduct", &key->pid)) < 0 ||
+	    (rc = sysfs_hex(dir, "bcdDevice", &key->bcd)) < 0)
+		return rc;
+
+	/* the device descriptor followed by all configuration descriptors */
+	snprintf(path, sizeof(path), "%s/descriptors", dir);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		for (i = total < USB_DT_DEVICE_SIZE ? USB_DT_DEVICE_SIZE - total : 0; i < n; i++)
+			hash = (hash ^ buf[i]) * 0x01000193;
+		total += n;
+	}
+	rc = ferror(f) ? -EIO : 0;
+	fclose(f);
+	if (rc < 0 || total <= USB_DT_DEVICE_SIZE)
+		return -EIO;
+	key->hash = hash;
+	return 0;
+}
+
+static int same_key(const struct probe_key *a, const struct probe_key *b)
+{
+	return a->vid == b->vid && a->pid == b->pid && a->bcd == b->bcd && a->hash == b->hash;
+}
+
+/* "00:1.5,01:1.12" */
+static void parse_versions(struct probe_entry *e, char *str)
+{
+	unsigned int sys, major, minor;
+	char *p;
+
+	for (p = strtok(str, ","); p && e->nver < PROBECACHE_MAX_VER; p = strtok(NULL, ",")) {
+		if (sscanf(p, "%x:%u.%u", &sys, &major, &minor) != 3)
+			continue;
+		e->ver[e->nver].sys = sys;
+		e->ver[e->nver].major = major;
+		e->ver[e->nver].minor = minor;
+		e->nver++;
+	}
+}
+
+int probecache_load(struct probe_cache *c)
+{
+	char line[1024], type[16], *ver;
+	unsigned int hash;
+	struct probe_entry *e;
+	int n, len;
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+	f = fopen(PROBECACHE, "r");
+	if (!f)
+		return 0;
+	if (!fgets(line, sizeof(line), f) || strcmp(line, PROBECACHE_HDR)) {
+		fclose(f);
+		return 0;
+	}
+	while (c->n < PROBECACHE_MAX && fgets(line, sizeof(line), f)) {
+		e = &c->e[c->n];
+		memset(e, 0, sizeof(*e));
+		len = 0;
+		n = sscanf(line, "%hx:%hx %hx %x %d %15s %n", &e->key.vid, &e->key.pid,
+			   &e->key.bcd, &hash, &e->intf, type, &len);
+		if (n < 6 || (e->type = parse_type(type)) < 0)
+			continue;
+		e->key.hash = hash;
+		if (len) {
+			ver = line + len;
+			ver[strcspn(ver, "\n")] = 0;
+			parse_versions(e, ver);
+		}
+		c->n++;
+	}
+	fclose(f);
+	return c->n;
+}
+
+int probecache_save(struct probe_cache *c)
+{
+	char tmp[sizeof(PROBECACHE) + 16];
+	const struct probe_entry *e;
+	FILE *f;
+	int i, j, rc;
+
+	if (!c->dirty)
+		return 0;
+
+	/* replace atomically, as readers do not lock */
+	snprintf(tmp, sizeof(tmp), "%s.%d", PROBECACHE, getpid());
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+	fputs(PROBECACHE_HDR, f);
+	for (i = 0; i < c->n; i++) {
+		e = &c->e[i];
+		fprintf(f, "%04x:%04x %04x %08x %d %s", e->key.vid, e->key.pid, e->key.bcd,
+			e->key.hash, e->intf, probecache_type_str(e->type));
+		for (j = 0; j < e->nver; j++)
+			fprintf(f, "%c%02x:%u.%u", j ? ',' : ' ', e->ver[j].sys, e->ver[j].major, e->ver[j].minor);
+		fputc('\n', f);
+	}
+	if (fclose(f) || rename(tmp, PROBECACHE)) {
+		rc = -errno;
+		unlink(tmp);
+		return rc;
+	}
+	c->dirty = 0;
+	return 0;
+}
+
+int probecache_known(const struct probe_cache *c, const struct probe_key *key, const int *intf, int n)
+{
+	int i;
+
+	/* nothing to probe, but has it been looked at? */
+	if (!n) {
+		for (i = 0; i < c->n; i++)
+			if (same_key(&c->e[i].key, key))
+				return 1;
+		return 0;
+	}
+	for (i = 0; i < n; i++)
+		if (!probecache_find(c, key, intf[i]))
+			return 0;
+	return 1;
+}
+
+const struct probe_entry *probecache_find(const struct probe_cache *c, const struct probe_key *key, int intf)
+{
+	int i;
+
+	for (i = 0; i < c->n; i++)
+		if (same_key(&c->e[i].key, key) && c->e[i].intf == intf)
+			return &c->e[i];
+	return NULL;
+}
+
+struct probe_entry *probecache_add(struct probe_cache *c, const struct probe_key *key, int intf, int type)
+{
+	struct probe_entry *e = (struct probe_entry *)probecache_find(c, key, intf);
+
+	if (!e) {
+		if (c->n == PROBECACHE_MAX)
+			return NULL;
+		e = &c->e[c->n++];
+	}
+	memset(e, 0, sizeof(*e));
+	e->key = *key;
+	e->intf = intf;
+	e->type = type;
+	c->dirty = 1;
+	return e;
+}
+
+const struct probe_ver *probecache_ver(const struct probe_entry *e, __u8 sys)
+{
+	int i;
+
+	for (i = 0; i < e->nver; i++)
+		if (e->ver[i].sys == sys)
+			return &e->ver[i];
+	return NULL;
+}
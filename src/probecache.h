@@ -0,0 +1,92 @@
+/*
+ * probecache.h - persistent cache of probed USB interface capabilities
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Probing a modem gives the same result for every device of the same
+ * model and firmware, so the results are kept across reboots, keyed
+ * by the USB identity of the device:
+ *
+ *   # qmiprobe 1
+ *   <vid>:<pid> <bcdDevice> <hash> <interface> <type> [<sys>:<major>.<minor>,...]
+ *
+ * where <hash> is the 32 bit FNV-1a hash of the configuration
+ * descriptors in sysfs, and <type> is one of "qmi", "mbim", "at" or
+ * "none".  The list of supported QMI services and their versions is
+ * from QMI_CTL_GET_VERSION_INFO, in hex, i.e. "00:1.5,01:1.12".
+ *
+ * Only definite results are saved, and a device is known when all the
+ * interfaces to probe have an entry.  Other programs may save entries
+ * for single interfaces as they find them.
+ */
+
+#ifndef _PROBECACHE_H
+#define _PROBECACHE_H
+
+#include <linux/types.h>
+
+#define PROBECACHE		"/var/cache/qmiprobe.cache"
+#define PROBECACHE_MAX		256	/* interfaces */
+#define PROBECACHE_MAX_VER	48	/* QMI services per interface */
+
+enum probe_type {
+	PROBE_TYPE_NONE = 0,
+	PROBE_TYPE_QMI,
+	PROBE_TYPE_MBIM,
+	PROBE_TYPE_AT,
+};
+
+struct probe_key {
+	__u16 vid;
+	__u16 pid;
+	__u16 bcd;		/* bcdDevice, i.e. the firmware revision */
+	__u32 hash;		/* of the configuration descriptors */
+};
+
+struct probe_ver {
+	__u8 sys;
+	__u16 major;
+	__u16 minor;
+};
+
+struct probe_entry {
+	struct probe_key key;
+	int intf;
+	int type;		/* enum probe_type */
+	int nver;
+	struct probe_ver ver[PROBECACHE_MAX_VER];
+};
+
+struct probe_cache {
+	int n;
+	int dirty;		/* changed since loaded */
+	struct probe_entry e[PROBECACHE_MAX];
+};
+
+/* the key of a USB device, by its sysfs name, i.e. "2-1".  Returns 0 or -errno */
+int probecache_key(const char *usbdev, struct probe_key *key);
+
+/* read the cache.  A missing cache is empty.  Returns the number of entries */
+int probecache_load(struct probe_cache *c);
+
+/* replace the cache, if dirty.  Returns 0 or -errno */
+int probecache_save(struct probe_cache *c);
+
+/* is there an entry for each of the n interfaces in intf, or any if n is 0? */
+int probecache_known(const struct probe_cache *c, const struct probe_key *key, const int *intf, int n);
+
+const struct probe_entry *probecache_find(const struct probe_cache *c, const struct probe_key *key, int intf);
+
+/* the entry of the interface, replacing any existing.  NULL if full */
+struct probe_entry *probecache_add(struct probe_cache *c, const struct probe_key *key, int intf, int type);
+
+/* the version of a QMI service, or NULL if not supported */
+const struct probe_ver *probecache_ver(const struct probe_entry *e, __u8 sys);
+
+const char *probecache_type_str(int type);
+
+#endif /* _PROBECACHE_H */
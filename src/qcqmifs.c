@@ -22,7 +22,7 @@
 
   
   Building it:
-  gcc -Wall `pkg-config fuse --cflags --libs` qcqmifs.c -o qcqmifs
+  gcc -Wall `pkg-config fuse --cflags --libs` -lpthread qcqmifs.c qmux.c -o qcqmifs
 
   Running it (with the optional:
   # ./qcqmifs /mnt/whatever -d -o default_permissions,allow_other
@@ -35,6 +35,13 @@
   - create a symlink from /dev/qcqmi or /dev/qcqmi0 to the wanted
      mirror device
 
+  - any number of processes can open the same mirror device.  The
+     first open of a mirror opens /dev/cdc-wdmX and starts a reader
+     thread.  Every open file is a separate QMI client, getting its
+     own client ID from the IOCTL_QMI_GET_SERVICE_FILE ioctl.  All
+     clients share the one cdc-wdm file descriptor, and received
+     messages are demultiplexed by service and client ID
+
  Restrictions:
 
    - no dynamic device discovery.  Program must be restarted to detect
@@ -45,6 +52,11 @@
    - /dev/qcqmiX where X > 0 is not supported by the SDK, so the symlink
      names cannot always match real device names
 
+   - FUSE only allows restricted ioctls on regular files, so the
+     kernel will not pass a buffer for IOCTL_QMI_GET_DEVICE_VIDPID
+     and IOCTL_QMI_GET_DEVICE_MEID.  The values are copied out if we
+     get a buffer, but a real SDK will need cuseqmi for these two
+
 
 */
 
@@ -60,6 +72,10 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/types.h>
+#include "qmux.h"
 
 static int qcqmi_getattr(const char *path, struct stat *stbuf)
 {
@@ -129,85 +145,642 @@ static int qcqmi_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	return 0;
 }
 
+/* -- from qcqmi.c --- */
+
+#define IOCTL_QMI_GET_SERVICE_FILE      (0x8BE0 + 1)
+#define IOCTL_QMI_GET_DEVICE_VIDPID     (0x8BE0 + 2)
+#define IOCTL_QMI_GET_DEVICE_MEID       (0x8BE0 + 3)
+#define IOCTL_QMI_CLOSE                 (0x8BE0 + 4)
+
+#define DBG(fmt, arg...)						\
+do {									\
+	fprintf(stderr, "%s: " fmt "\n", __func__, ##arg);		\
+} while (0)
+
+/* -- eof from qcqmi.c --- */
+
+#define MAXDEVS 10
+#define MEIDLEN 14
+#define CTL_TIMEOUT 5		/* seconds */
+#define INVALID_CID ((__u16)-1)
+
+/* usbmisc class name - was previously "usb" */
+static const char usbmisc[] = "usbmisc";
+
+/* a QMI reply or indication queued for a client */
+struct qmimsg {
+	struct qmimsg *next;
+	size_t len;		/* frame length, including the QMUX header */
+	__u8 frame[];		/* the QMUX header is stripped when read */
+};
+
+/* the shared backend - one per /dev/cdc-wdmX */
 struct cdcwdmdev {
 	char *name;
 	int fd;
-	int cid;
+	int users;		/* number of open mirror files */
+	__u32 vidpid;
+	char meid[MEIDLEN];
+	int have_meid;
+	__u8 ctl_tid;		/* last used QMI_CTL transaction id */
+	pthread_t reader;
+	pthread_mutex_t wr_mutex;	/* serializing writes to fd */
+	pthread_mutex_t cl_mutex;	/* protecting the client list */
+	struct qclient *clients;
 };
 
-static int qcqmi_open(const char *path, struct fuse_file_info *fi)
-{
-	int fd, x;
-	char name[] = "/dev/cdc-wdmX";
-	struct cdcwdmdev *handle;
+/* a client - one per open mirror file, or a temporary QMI_CTL user */
+struct qclient {
+	struct cdcwdmdev *dev;
+	__u16 cid;		/* service << 8 | client ID */
+	int closing;		/* IOCTL_QMI_CLOSE wakes up any reader */
+	struct qmimsg *rq;
+	pthread_mutex_t rqlock;
+	pthread_cond_t ready;	/* data available for reading */
+	struct qclient *next;
+};
 
-	fprintf(stderr, "%s: path=%s\n", __func__, path);
+static struct cdcwdmdev *devs[MAXDEVS];
+static pthread_mutex_t devs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* map "/qcqmiX" to X */
+static int path_to_devnum(const char *path)
+{
+	int x;
 
 	if (strncmp("/qcqmi", path, 6))
 		return -EINVAL;
 
 	x = strtoul(path + 6, NULL, 10);
-	if (x > 9)
+	if (x >= MAXDEVS)
 		return -EINVAL;
+	return x;
+}
+
+static struct qclient *new_client(struct cdcwdmdev *dev, __u16 cid)
+{
+	struct qclient *client = calloc(1, sizeof(struct qclient));
+
+	if (!client)
+		return NULL;
+
+	client->dev = dev;
+	client->cid = cid;
+	pthread_mutex_init(&client->rqlock, NULL);
+	pthread_cond_init(&client->ready, NULL);
+
+	/* can always insert at head */
+	pthread_mutex_lock(&dev->cl_mutex);
+	client->next = dev->clients;
+	dev->clients = client;
+	pthread_mutex_unlock(&dev->cl_mutex);
+	return client;
+}
+
+static void destroy_client(struct qclient *client)
+{
+	struct cdcwdmdev *dev = client->dev;
+	struct qclient **p;
+	struct qmimsg *m, *tmp;
+
+	pthread_mutex_lock(&dev->cl_mutex);
+	for (p = &dev->clients; *p; p = &(*p)->next)
+		if (*p == client) {
+			*p = client->next;
+			break;
+		}
+	pthread_mutex_unlock(&dev->cl_mutex);
+
+	/* free all unread messages */
+	m = client->rq;
+	while (m) {
+		tmp = m;
+		m = m->next;
+		free(tmp);
+	}
+	pthread_mutex_destroy(&client->rqlock);
+	pthread_cond_destroy(&client->ready);
+	free(client);
+}
+
+/* add a copy of the complete QMUX frame to client's read queue */
+static void add_msg_to_client(struct qclient *client, const void *buf, size_t len)
+{
+	struct qmimsg *new, **p;
+
+	new = malloc(sizeof(struct qmimsg) + len);
+	if (!new) {
+		DBG("dropping message for client %04x", client->cid);
+		return;
+	}
+	new->next = NULL;
+	new->len = len;
+	memcpy(new->frame, buf, len);
+
+	pthread_mutex_lock(&client->rqlock);
+	for (p = &client->rq; *p; p = &(*p)->next);
+	*p = new;
+	pthread_cond_signal(&client->ready);
+	pthread_mutex_unlock(&client->rqlock);
+}
+
+/* copy the decoded frame in buf to every client that should receive it */
+static void copy_msg_to_clients(struct cdcwdmdev *dev, const struct qmi_msg *msg, const void *buf)
+{
+	struct qclient *p;
+	__u16 mask = 0, val = 0;
+
+	if (msg->service == QMI_CTL) { /* responses go to the waiting do_ctl() */
+		if (msg->flags != QMI_CTL_FLAG_RESPONSE)
+			return;
+		mask = 0xffff;
+	} else { /* clients with this service */
+		val = msg->service << 8;
+		mask = 0xff << 8;
+		if (msg->cid != 0xff) { /* only address clients with this cid */
+			val |= msg->cid;
+			mask |= 0xff;
+		}
+	}
+
+	pthread_mutex_lock(&dev->cl_mutex);
+	for (p = dev->clients; p; p = p->next)
+		if (p->cid != INVALID_CID && (p->cid & mask) == val)
+			add_msg_to_client(p, buf, msg->len);
+	pthread_mutex_unlock(&dev->cl_mutex);
+}
+
+/* ==== reader thread, one per backend ===== */
+static void *readcdcwdm(void *arg)
+{
+	struct cdcwdmdev *dev = arg;
+	struct qmi_msg msg;
+	__u8 buf[4096];
+	ssize_t n;
+	int off, len;
+
+	do {
+		n = read(dev->fd, buf, sizeof(buf));
+
+		/* a single read may return more than one QMUX frame */
+		for (off = 0; off < n; off += len) {
+			len = qmux_decode(&msg, buf + off, n - off);
+			if (len < 0) {
+				DBG("%s: dropping %zd bytes: %s", dev->name, n - off, strerror(-len));
+				break;
+			}
+			copy_msg_to_clients(dev, &msg, buf + off);
+		}
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	DBG("%s: reader exiting", dev->name);
+	return NULL;
+}
+
+/* dequeue the first message matching service, msgid and tid, waiting until deadline */
+static struct qmimsg *wait_for_reply(struct qclient *client, struct qmi_msg *reply,
+				     const struct qmi_msg *req, const struct timespec *deadline)
+{
+	struct qmimsg *msg = NULL;
+
+	pthread_mutex_lock(&client->rqlock);
+	while (!msg) {
+		/* drop everything else */
+		while (!msg && client->rq) {
+			msg = client->rq;
+			client->rq = msg->next;
+			if (qmux_decode(reply, msg->frame, msg->len) < 0 ||
+			    reply->service != req->service ||
+			    reply->msgid != req->msgid ||
+			    reply->tid != req->tid) {
+				free(msg);
+				msg = NULL;
+			}
+		}
+		if (!msg && pthread_cond_timedwait(&client->ready, &client->rqlock, deadline) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&client->rqlock);
+	return msg;
+}
+
+/*
+ * send a request and wait for the reply, using the temporary client
+ * which must be registered with the CID the reply is addressed to
+ */
+static struct qmimsg *do_request(struct qclient *client, const void *buf, size_t len,
+				 struct qmi_msg *reply)
+{
+	struct cdcwdmdev *dev = client->dev;
+	struct qmi_msg req;
+	struct timespec deadline;
+	int rc;
+
+	if (qmux_decode(&req, buf, len) < 0)
+		return NULL;
+
+	pthread_mutex_lock(&dev->wr_mutex);
+	rc = write(dev->fd, buf, len);
+	pthread_mutex_unlock(&dev->wr_mutex);
+	if (rc < 0) {
+		DBG("%s: write failed: %s", dev->name, strerror(errno));
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += CTL_TIMEOUT;
+	return wait_for_reply(client, reply, &req, &deadline);
+}
+
+/* send a QMI_CTL request with a single TLV 0x01, returning the reply or NULL */
+static struct qmimsg *do_ctl(struct cdcwdmdev *dev, __u16 msgid, const void *tlv, __u16 tlvlen,
+			     struct qmi_msg *reply)
+{
+	struct qmi_msg req = {
+		.service = QMI_CTL,
+		.msgid = msgid,
+	};
+	struct qclient *client;
+	struct qmimsg *msg = NULL;
+	__u8 buf[64];
+	int len;
+
+	/* QMI_CTL replies are routed to any client with cid 0 */
+	client = new_client(dev, 0);
+	if (!client)
+		return NULL;
+
+	pthread_mutex_lock(&dev->wr_mutex);
+	req.tid = ++dev->ctl_tid ? dev->ctl_tid : ++dev->ctl_tid; /* tid 0 is reserved */
+	pthread_mutex_unlock(&dev->wr_mutex);
+
+	qmux_encode(buf, sizeof(buf), &req);
+	len = qmux_add_tlv(buf, sizeof(buf), 0x01, tlv, tlvlen);
+	if (len > 0)
+		msg = do_request(client, buf, len, reply);
+	destroy_client(client);
+	return msg;
+}
+
+/* QMI_CTL GET_CLIENT_ID, returning service << 8 | cid */
+static int alloc_cid(struct cdcwdmdev *dev, __u8 service)
+{
+	struct qmi_msg reply;
+	struct qmimsg *msg;
+	const __u8 *data;
+	int rc;
+
+	msg = do_ctl(dev, QMI_CTL_GET_CLIENT_ID, &service, 1, &reply);
+	if (!msg)
+		return -ETIMEDOUT;
+
+	rc = qmi_status(&reply);
+	if (rc) {
+		DBG("%s: QMI error %#06x", dev->name, rc);
+		rc = -EIO;
+	} else if (qmi_tlv_get(&reply, 0x01, &data) < 2 || data[0] != service) {
+		rc = -EIO;
+	} else {
+		rc = service << 8 | data[1];
+	}
+	free(msg);
+	return rc;
+}
+
+/* QMI_CTL RELEASE_CLIENT_ID */
+static int release_cid(struct cdcwdmdev *dev, __u16 cid)
+{
+	struct qmi_msg reply;
+	struct qmimsg *msg;
+	__u8 tlv[] = { cid >> 8, cid & 0xff };
+	int rc;
+
+	msg = do_ctl(dev, QMI_CTL_RELEASE_CLIENT_ID, tlv, sizeof(tlv), &reply);
+	if (!msg)
+		return -ETIMEDOUT;
+	rc = qmi_status(&reply) ? -EIO : 0;
+	free(msg);
+	return rc;
+}
+
+/* DMS GET_DEVICE_SERIAL_NUMBERS using a temporary client */
+static int get_meid(struct cdcwdmdev *dev)
+{
+	struct qmi_msg req = {
+		.service = QMI_DMS,
+		.tid = 1,
+		.msgid = 0x0025,
+	};
+	struct qmi_msg reply;
+	struct qclient *client;
+	struct qmimsg *msg;
+	const __u8 *data;
+	__u8 buf[32];
+	int cid, len, rc = -ETIMEDOUT;
+
+	cid = alloc_cid(dev, QMI_DMS);
+	if (cid < 0)
+		return cid;
+	client = new_client(dev, cid);
+	if (!client) {
+		release_cid(dev, cid);
+		return -ENOMEM;
+	}
+
+	req.cid = cid & 0xff;
+	len = qmux_encode(buf, sizeof(buf), &req);
+	msg = do_request(client, buf, len, &reply);
+	if (msg) {
+		len = qmi_tlv_get(&reply, 0x12, &data); /* MEID */
+		if (len > 0) {
+			memset(dev->meid, '0', MEIDLEN);
+			memcpy(dev->meid, data, len < MEIDLEN ? len : MEIDLEN);
+			dev->have_meid = 1;
+			rc = 0;
+		} else {
+			rc = -ENODATA;
+		}
+		free(msg);
+	}
+	destroy_client(client);
+	release_cid(dev, cid);
+	return rc;
+}
+
+/* get vid:pid of the USB device owning /dev/cdc-wdmX */
+static __u32 vidpidfromsysfs(const char *name)
+{
+	char buf[128];
+	const char *devname = strrchr(name, '/') + 1;
+	unsigned int vid = 0, pid = 0;
+	FILE *s;
+
+	snprintf(buf, sizeof(buf), "/sys/class/%s/%s/device/../idVendor", usbmisc, devname);
+	s = fopen(buf, "r");
+	if (s) {
+		if (fscanf(s, "%x", &vid) != 1)
+			vid = 0;
+		fclose(s);
+	}
+	snprintf(buf, sizeof(buf), "/sys/class/%s/%s/device/../idProduct", usbmisc, devname);
+	s = fopen(buf, "r");
+	if (s) {
+		if (fscanf(s, "%x", &pid) != 1)
+			pid = 0;
+		fclose(s);
+	}
+	return vid << 16 | pid;
+}
+
+/* get a reference to the shared backend, opening it if necessary */
+static struct cdcwdmdev *get_dev(int x, int *err)
+{
+	struct cdcwdmdev *dev;
+	char name[] = "/dev/cdc-wdmX";
+
+	pthread_mutex_lock(&devs_mutex);
+	dev = devs[x];
+	if (dev) {
+		dev->users++;
+		goto out;
+	}
+
 	sprintf(name, "/dev/cdc-wdm%u", x);
+	dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		*err = -ENOMEM;
+		goto out;
+	}
+	dev->fd = open(name, O_RDWR);
+	if (dev->fd < 0) {
+		*err = -errno;
+		fprintf(stderr, "%s: open(%s) failed, errno=%d\n", __func__, name, errno);
+		free(dev);
+		dev = NULL;
+		goto out;
+	}
+	dev->name = strdup(name);
+	dev->users = 1;
+	dev->vidpid = vidpidfromsysfs(name);
+	memset(dev->meid, '0', MEIDLEN);
+	pthread_mutex_init(&dev->wr_mutex, NULL);
+	pthread_mutex_init(&dev->cl_mutex, NULL);
+	if (pthread_create(&dev->reader, NULL, readcdcwdm, dev)) {
+		*err = -EAGAIN;
+		close(dev->fd);
+		free(dev->name);
+		free(dev);
+		dev = NULL;
+		goto out;
+	}
+	devs[x] = dev;
+	DBG("%s: shared backend opened, vid:pid=%04x:%04x", name, dev->vidpid >> 16, dev->vidpid & 0xffff);
+out:
+	pthread_mutex_unlock(&devs_mutex);
+	return dev;
+}
+
+/* drop a reference, closing the backend when the last user is gone */
+static void put_dev(struct cdcwdmdev *dev)
+{
+	int x;
 
-	fd = open(name, fi->flags);
-	if (fd < 0) {
-		fprintf(stderr, "%s: open(%s) returned %d, errno=%d\n", __func__, name, fd, errno);
-		return -errno;
+	pthread_mutex_lock(&devs_mutex);
+	if (--dev->users) {
+		pthread_mutex_unlock(&devs_mutex);
+		return;
 	}
+	for (x = 0; x < MAXDEVS; x++)
+		if (devs[x] == dev)
+			devs[x] = NULL;
+	pthread_mutex_unlock(&devs_mutex);
+
+	/* the blocking read will not notice a close() */
+	pthread_cancel(dev->reader);
+	pthread_join(dev->reader, NULL);
+	close(dev->fd);
+	DBG("%s: shared backend closed", dev->name);
+	pthread_mutex_destroy(&dev->wr_mutex);
+	pthread_mutex_destroy(&dev->cl_mutex);
+	free(dev->name);
+	free(dev);
+}
 
-	handle = malloc(sizeof(struct cdcwdmdev));
-	handle->name = strdup(name);
-	handle->fd = fd;
-	handle->cid = -1; /* invalid */
+static int qcqmi_open(const char *path, struct fuse_file_info *fi)
+{
+	struct cdcwdmdev *dev;
+	struct qclient *client;
+	int x, err = 0;
+
+	fprintf(stderr, "%s: path=%s\n", __func__, path);
+
+	x = path_to_devnum(path);
+	if (x < 0)
+		return x;
+
+	dev = get_dev(x, &err);
+	if (!dev)
+		return err;
+
+	client = new_client(dev, INVALID_CID);
+	if (!client) {
+		put_dev(dev);
+		return -ENOMEM;
+	}
 
 	fi->nonseekable = 1;
-	fi->fh = (uint64_t)handle;
+	fi->direct_io = 1;
+	fi->fh = (uint64_t)client;
 
 	return 0;
 }
 
 static int qcqmi_release(const char *path, struct fuse_file_info *fi)
 {
-	struct cdcwdmdev *handle = (void *)fi->fh;
+	struct qclient *client = (void *)fi->fh;
+	struct cdcwdmdev *dev = client->dev;
 
-	fprintf(stderr, "%s: path=%s\n", __func__, path);
+	fprintf(stderr, "%s: path=%s, cid=%04x\n", __func__, path, client->cid);
 
 	fi->fh = (uint64_t)NULL;
-	close(handle->fd);
-	free(handle->name);
-	free(handle);
+	if (client->cid != INVALID_CID)
+		release_cid(dev, client->cid);
+	destroy_client(client);
+	put_dev(dev);
 	return 0;
 }
 
-
+/* return the next queued message only */
 static int qcqmi_read(const char *path, char *buf, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
 {
-	struct cdcwdmdev *handle = (void *)fi->fh;
-
-	fprintf(stderr, "%s: path=%s, proxying to %s\n", __func__, path, handle->name);
-	return 0;
+	struct qclient *client = (void *)fi->fh;
+	struct qmimsg *msg;
+	int ret;
+
+	if (client->cid == INVALID_CID)
+		return -EBADR;
+
+	pthread_mutex_lock(&client->rqlock);
+	while (!client->rq && !client->closing) {
+		if (fi->flags & O_NONBLOCK) {
+			pthread_mutex_unlock(&client->rqlock);
+			return -EAGAIN;
+		}
+		pthread_cond_wait(&client->ready, &client->rqlock);
+	}
+	msg = client->rq;
+	if (msg && msg->len - QMUX_HDR_LEN <= size)
+		client->rq = msg->next;
+	pthread_mutex_unlock(&client->rqlock);
+
+	if (!msg)
+		return -EBADR;		/* woken by IOCTL_QMI_CLOSE */
+	ret = msg->len - QMUX_HDR_LEN;
+	if (ret > size)
+		return -EINVAL;		/* leaving the message queued */
+
+	memcpy(buf, msg->frame + QMUX_HDR_LEN, ret);
+	free(msg);
+	return ret;
 }
 
+/* prepend a QMUX header for this client and write to the shared fd */
 static int qcqmi_write(const char *path, const char *buf, size_t size, off_t offset,
- 		       struct fuse_file_info *fi)
+		       struct fuse_file_info *fi)
 {
-	struct cdcwdmdev *handle = (void *)fi->fh;
+	struct qclient *client = (void *)fi->fh;
+	struct cdcwdmdev *dev = client->dev;
+	char *wbuf;
+	int ret, len;
+
+	if (client->cid == INVALID_CID) {
+		DBG("Client ID must be set before writing");
+		return -EBADR;
+	}
 
-	fprintf(stderr, "%s: path=%s, proxying to %s\n", __func__, path, handle->name);
-	
-	return size;
+	wbuf = malloc(size + QMUX_HDR_LEN);
+	if (!wbuf)
+		return -ENOMEM;
+	memcpy(wbuf + QMUX_HDR_LEN, buf, size);
+	len = qmux_wrap(wbuf, size + QMUX_HDR_LEN, client->cid >> 8, client->cid & 0xff, size);
+	if (len < 0) {
+		free(wbuf);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&dev->wr_mutex);
+	ret = write(dev->fd, wbuf, len);
+	if (ret < 0)
+		ret = -errno;
+	pthread_mutex_unlock(&dev->wr_mutex);
+	free(wbuf);
+
+	if (ret < 0)
+		return ret;
+	return ret > QMUX_HDR_LEN ? ret - QMUX_HDR_LEN : -EIO;
 }
 
 static int qcqmi_ioctl(const char *path, int cmd, void *arg,
 		       struct fuse_file_info *fi, unsigned int flags, void *data)
 {
-	struct cdcwdmdev *handle = (void *)fi->fh;
+	struct qclient *client = (void *)fi->fh;
+	struct cdcwdmdev *dev = client->dev;
+	int cid;
 
-	fprintf(stderr, "%s: path=%s, proxying to %s\n", __func__, path, handle->name);
-	return  -EBADRQC;
+	fprintf(stderr, "%s: path=%s, cmd=%#010x, arg=%p\n", __func__, path, cmd, arg);
+
+	switch (cmd) {
+	case IOCTL_QMI_GET_SERVICE_FILE:
+		if (client->cid != INVALID_CID) {
+			DBG("Close the current connection before opening a new one");
+			return -EBADR;
+		}
+		cid = alloc_cid(dev, (__u8)(long)arg);
+		if (cid < 0)
+			return cid;
+		DBG("%s: allocated cid %04x", dev->name, cid);
+
+		/* the reader may see the cid as soon as it is set */
+		pthread_mutex_lock(&dev->cl_mutex);
+		client->cid = cid;
+		client->closing = 0;
+		pthread_mutex_unlock(&dev->cl_mutex);
+		return 0;
+
+	/* kick any pending reader off the waitqueue before the file is closed */
+	case IOCTL_QMI_CLOSE:
+		if (client->cid == INVALID_CID)
+			return -EBADR;
+		cid = client->cid;
+		pthread_mutex_lock(&dev->cl_mutex);
+		client->cid = INVALID_CID;
+		pthread_mutex_unlock(&dev->cl_mutex);
+
+		pthread_mutex_lock(&client->rqlock);
+		client->closing = 1;
+		pthread_cond_broadcast(&client->ready);
+		pthread_mutex_unlock(&client->rqlock);
+		return release_cid(dev, cid);
+
+	case IOCTL_QMI_GET_DEVICE_VIDPID:
+		if (!data)
+			return -EFAULT;
+		memcpy(data, &dev->vidpid, sizeof(__u32));
+		return 0;
+
+	case IOCTL_QMI_GET_DEVICE_MEID:
+		if (!data)
+			return -EFAULT;
+		if (!dev->have_meid)
+			get_meid(dev);
+		memcpy(data, dev->meid, MEIDLEN);
+		return 0;
+
+	default:
+		DBG("unsupported ioctl");
+		return -EBADRQC;
+	}
 }
 
 static int qcqmi_chmod(const char *path, mode_t mode)
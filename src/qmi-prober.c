@@ -4,6 +4,17 @@
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
  *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Finds the QMI interfaces of USB devices not bound to any driver.
+ * Every unbound vendor specific interface with an interrupt endpoint
+ * on every device (or on the given vid:pid devices) is probed at the
+ * same time, using the asynchronous transport in usbwdm.c.  Replies
+ * are fetched as the devices announce them with RESPONSE_AVAILABLE
+ * notifications.
+ *
+ * The results, including the QMI service versions, are saved in the
+ * probe cache described in probecache.h.  Devices found there are not
+ * probed again, unless --rescan is given.
  */
 
 #include <stdio.h>
@@ -12,177 +23,522 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <limits.h>
 #include <libusb.h>
 #include <linux/types.h>
+#include "qmux.h"
+#include "probecache.h"
+#include "usbwdm.h"
+
+#define MAX_PROBES	64
+
+enum probe_result {
+	PROBE_PENDING = 0,
+	PROBE_QMI,
+	PROBE_NOT_QMI,		/* the request was stalled, or the reply was not QMI */
+	PROBE_BOUND,		/* in use by a kernel driver */
+	PROBE_BUSY,		/* could not claim it */
+	PROBE_TIMEOUT,
+	PROBE_FAILED,		/* the request failed, for an unknown reason */
+};
+
+static const char *const result_str[] = {
+	[PROBE_PENDING] = "pending",
+	[PROBE_QMI] = "QMI",
+	[PROBE_NOT_QMI] = "not QMI",
+	[PROBE_BOUND] = "bound to a driver",
+	[PROBE_BUSY] = "busy",
+	[PROBE_TIMEOUT] = "no reply",
+	[PROBE_FAILED] = "failed",
+};
 
-/* dump device info */
-static void print_usb_device(libusb_device_handle *handle)
+struct probe {
+	libusb_device_handle *handle;
+	int bus, addr;
+	__u16 vid, pid;
+	int ifnum;
+	int opened;
+	struct usbwdm w;
+	int result;
+	int qmi;			/* replied to the probe */
+	struct probe_key key;
+	int has_key;
+	char usbdev[32];		/* sysfs name, i.e. "2-1" */
+	int config;			/* bConfigurationValue */
+	int nver;
+	struct probe_ver ver[PROBECACHE_MAX_VER];
+};
+
+static struct probe probe[MAX_PROBES];
+static int nprobes;
+static int verbose;
+static struct probe_cache cache;
+static int rescan;
+
+static long long now_ms(void)
 {
-	libusb_device *dev;
-	struct libusb_device_descriptor desc;
-	int err;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * just send a release cid=0 for system=255 to trigger a
+ * QMI_ERR_INVALID_SERVICE_TYPE (0x1f) error
+ */
+static int mk_probe(unsigned char *buf, size_t size)
+{
+	struct qmi_msg msg = {
+		.service = QMI_CTL,
+		.tid = 1,
+		.msgid = QMI_CTL_RELEASE_CLIENT_ID,
+	};
+	__u8 tlv[] = { 0xff, 0x00 };	/* system 0xff does not exist, and cid 0 is impossible */
+
+	qmux_encode(buf, size, &msg);
+	return qmux_add_tlv(buf, size, 0x01, tlv, sizeof(tlv));
+}
+
+/* all supported services */
+static int mk_get_version(unsigned char *buf, size_t size)
+{
+	struct qmi_msg msg = {
+		.service = QMI_CTL,
+		.tid = 2,
+		.msgid = QMI_CTL_GET_VERSION_INFO,
+	};
+	__u8 all = 0xff;
 
-	dev = libusb_get_device(handle);
-	if (dev == NULL)
+	qmux_encode(buf, size, &msg);
+	return qmux_add_tlv(buf, size, 0x01, &all, 1);
+}
+
+/* TLV 0x01 is a list of supported systems: n, n * (sys, major, minor) */
+static void parse_versions(struct probe *p, const struct qmi_msg *msg)
+{
+	const __u8 *data;
+	int n, i;
+
+	n = qmi_tlv_get(msg, 0x01, &data);
+	if (n < 1 || n < 1 + data[0] * 5)
 		return;
+	for (i = 0; i < data[0] && p->nver < PROBECACHE_MAX_VER; i++, p->nver++) {
+		p->ver[p->nver].sys = data[1 + i * 5];
+		p->ver[p->nver].major = get_le16(data + 2 + i * 5);
+		p->ver[p->nver].minor = get_le16(data + 4 + i * 5);
+	}
+}
 
-	err = libusb_get_device_descriptor(dev, &desc);
-	if (err)
+static void send_req(struct probe *p, int (*mk)(unsigned char *, size_t))
+{
+	unsigned char buf[256];
+	int len = mk(buf, sizeof(buf));
+	int ret;
+
+	if (verbose)
+		dump_qmux(buf, len);
+	ret = usbwdm_send(&p->w, buf, len);
+	if (ret) {
+		fprintf(stderr, "%03d/%03d interface %d: usbwdm_send() failed: %s\n",
+			p->bus, p->addr, p->ifnum, libusb_error_name(ret));
+		p->result = p->qmi ? PROBE_QMI : ret == LIBUSB_ERROR_PIPE ? PROBE_NOT_QMI : PROBE_FAILED;
+	}
+}
+
+/*
+ * a STALL on the request means that this is not QMI.  Other errors,
+ * like timeouts, tell nothing
+ */
+static void sent(struct usbwdm *w, int status)
+{
+	struct probe *p = w->priv;
+
+	if (verbose)
+		fprintf(stderr, "%03d/%03d interface %d: send status %d\n", p->bus, p->addr, p->ifnum, status);
+	if (status == LIBUSB_TRANSFER_COMPLETED || p->result)
 		return;
+	if (p->qmi)
+		p->result = PROBE_QMI;
+	else
+		p->result = status == LIBUSB_TRANSFER_STALL ? PROBE_NOT_QMI : PROBE_FAILED;
+}
+
+/* anything else is unsolicited, and ours may be next */
+static void rx(struct usbwdm *w, const void *buf, size_t len)
+{
+	struct probe *p = w->priv;
+	struct qmi_msg msg;
 
-	printf("bLength=%d\nbDescriptorType=%d\nbDeviceClass=%x\nidVendor=%04x\nidProduct=%04x\n",
-		desc.bLength, desc.bDescriptorType, desc.bDeviceClass, desc.idVendor, desc.idProduct);
+	if (p->result || len < QMUX_HDR_LEN)
+		return;
+	if (verbose)
+		dump_qmux(buf, len);
+	if (qmux_decode(&msg, buf, len) <= 0 || msg.service != QMI_CTL)
+		return;
+
+	if (msg.msgid == QMI_CTL_RELEASE_CLIENT_ID && qmi_status(&msg) == 0x1f) {
+		p->qmi = 1;
+		send_req(p, mk_get_version);
+	} else if (p->qmi && msg.msgid == QMI_CTL_GET_VERSION_INFO) {
+		parse_versions(p, &msg);
+		p->result = PROBE_QMI;
+	}
 }
 
-/* open the given device */
-static libusb_device_handle *open_device(char *device)
+/* the sysfs name of the device, i.e. "2-1.4" */
+static int usb_name(libusb_device *dev, char *buf, size_t size)
 {
-	uint16_t vendor_id = 0, product_id = 0;
+	__u8 port[8];
+	int i, n, len;
 
-	if ((sscanf(device, " %hx : %hx ", &vendor_id, &product_id) != 2) || (vendor_id == 0) || (product_id == 0))
-		return NULL;
+	n = libusb_get_port_numbers(dev, port, sizeof(port));
+	if (n <= 0)
+		return -1;
+	len = snprintf(buf, size, "%d", libusb_get_bus_number(dev));
+	for (i = 0; i < n && len < (int)size; i++)
+		len += snprintf(buf + len, size - len, "%c%d", i ? '.' : '-', port[i]);
+	return 0;
+}
 
-	return libusb_open_device_with_vid_pid(NULL, vendor_id, product_id);
+/*
+ * the capability of an interface bound to a kernel driver, or -1.
+ * Other drivers, like qcserial and option, make it "none", except
+ * usbfs which is just another program probing it
+ */
+static int bound_type(const char *usbdev, int config, int ifnum)
+{
+	char link[PATH_MAX], target[PATH_MAX], *p;
+	ssize_t len;
+
+	snprintf(link, sizeof(link), "/sys/bus/usb/devices/%s:%d.%d/driver", usbdev, config, ifnum);
+	len = readlink(link, target, sizeof(target) - 1);
+	if (len <= 0)
+		return -1;
+	target[len] = 0;
+	p = strrchr(target, '/');
+	p = p ? p + 1 : target;
+	if (!strcmp(p, "qmi_wwan"))
+		return PROBE_TYPE_QMI;
+	if (!strcmp(p, "cdc_mbim"))
+		return PROBE_TYPE_MBIM;
+	if (!strcmp(p, "cdc_acm"))
+		return PROBE_TYPE_AT;
+	if (!strcmp(p, "usbfs"))
+		return -1;
+	return PROBE_TYPE_NONE;
 }
 
-static int read_reply(libusb_device_handle *handle, int interface, char *buf, int size)
+static void print_versions(const struct probe_ver *ver, int n)
 {
-	int ret;
+	int i;
+
+	for (i = 0; i < n; i++)
+		printf("%c%02x:%u.%u", i ? ',' : ' ', ver[i].sys, ver[i].major, ver[i].minor);
+	printf("\n");
+}
+
+/* the cached results of a known device */
+static void print_cached(libusb_device *dev, const struct probe_key *key)
+{
+	const struct probe_entry *e;
+	int i;
 
-        ret = libusb_control_transfer(handle, 
-				LIBUSB_ENDPOINT_IN + LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE,  /* 0xa1 */
-				1, /* CDC GET_ENCAPSULATED_RESPONSE */
-				0, /* zero */
-				interface, /* wIndex = interface */
-				buf,
-				size,
-				1000);
-
-	if (ret >= (int)sizeof(struct qmux)) {
-		fprintf(stderr, "\n== %s() returned %d bytes ==\n", __FUNCTION__, ret);
-		dump_qmux(buf);
+	for (i = 0; i < cache.n; i++) {
+		e = &cache.e[i];
+		if (e->key.vid != key->vid || e->key.pid != key->pid ||
+		    e->key.bcd != key->bcd || e->key.hash != key->hash)
+			continue;
+		printf("%03d/%03d %04x:%04x %d: %s (cached)", libusb_get_bus_number(dev),
+		       libusb_get_device_address(dev), key->vid, key->pid, e->intf, probecache_type_str(e->type));
+		print_versions(e->ver, e->nver);
 	}
+}
 
-	fprintf(stderr, "%s: libusb_control_transfer() returned %d\n",  __FUNCTION__, ret);
-	return ret;
+/* the type to save for a result, or -1 if it is unknown */
+static int cache_type(const struct probe *p)
+{
+	switch (p->result) {
+	case PROBE_QMI:
+		return PROBE_TYPE_QMI;
+	case PROBE_NOT_QMI:
+		return PROBE_TYPE_NONE;
+	case PROBE_BOUND:
+		return bound_type(p->usbdev, p->config, p->ifnum);
+	default:
+		return -1;
+	}
 }
 
-/* send control message to the device */
-static int send_msg(libusb_device_handle *handle, int interface, char *buf, int size)
+/* the class is enough for MBIM and CDC ACM */
+static void cache_classes(libusb_device *dev, const struct probe_key *key)
 {
-	int ret;
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt;
+	int i;
 
-	fprintf(stderr, "\n== %s() ==\n", __FUNCTION__);
-	dump_qmux(buf);
+	if (libusb_get_active_config_descriptor(dev, &cfg))
+		return;
+	for (i = 0; i < cfg->bNumInterfaces; i++) {
+		alt = &cfg->interface[i].altsetting[0];
+		if (alt->bInterfaceClass != LIBUSB_CLASS_COMM)
+			continue;
+		if (alt->bInterfaceSubClass == 0x0e)
+			probecache_add(&cache, key, alt->bInterfaceNumber, PROBE_TYPE_MBIM);
+		if (alt->bInterfaceSubClass == 0x02)
+			probecache_add(&cache, key, alt->bInterfaceNumber, PROBE_TYPE_AT);
+	}
+	libusb_free_config_descriptor(cfg);
+}
+
+/*
+ * save the results of the n probes of a device, unless unknown.  The
+ * device is probed again until all its candidates have an entry
+ */
+static void cache_device(const struct probe *p, int n)
+{
+	struct probe_entry *e;
+	int i, type;
+
+	if (!p->has_key)
+		return;
+	cache_classes(libusb_get_device(p->handle), &p->key);
+	for (i = 0; i < n; i++) {
+		type = cache_type(&p[i]);
+		if (type < 0)
+			continue;
+		e = probecache_add(&cache, &p[i].key, p[i].ifnum, type);
+		if (!e)
+			return;
+		memcpy(e->ver, p[i].ver, p[i].nver * sizeof(p[i].ver[0]));
+		e->nver = p[i].nver;
+	}
+}
+
+/* start probing every candidate interface.  Returns the number of interfaces */
+static int add_device(libusb_device_handle *handle, const struct libusb_device_descriptor *desc,
+		      const struct probe_key *key, const char *usbdev)
+{
+	libusb_device *dev = libusb_get_device(handle);
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt;
+	struct probe *p;
+	int i, size, n = 0;
+
+	if (libusb_get_active_config_descriptor(dev, &cfg))
+		return 0;
+
+	for (i = 0; i < cfg->bNumInterfaces && nprobes < MAX_PROBES; i++) {
+		alt = &cfg->interface[i].altsetting[0];
+		if (alt->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC || usbwdm_find_ep(alt, &size) < 0)
+			continue;
+
+		p = &probe[nprobes++];
+		memset(p, 0, sizeof(*p));
+		p->handle = handle;
+		p->bus = libusb_get_bus_number(dev);
+		p->addr = libusb_get_device_address(dev);
+		p->vid = desc->idVendor;
+		p->pid = desc->idProduct;
+		p->ifnum = alt->bInterfaceNumber;
+		if (key) {
+			p->key = *key;
+			p->has_key = 1;
+			snprintf(p->usbdev, sizeof(p->usbdev), "%s", usbdev);
+			p->config = cfg->bConfigurationValue;
+		}
+		n++;
+
+		if (libusb_kernel_driver_active(handle, p->ifnum) == 1) {
+			p->result = PROBE_BOUND;
+			continue;
+		}
+		if (usbwdm_open(&p->w, handle, p->ifnum, 1, rx, p)) {
+			p->result = PROBE_BUSY;
+			continue;
+		}
+		p->w.sent = sent;
+		p->opened = 1;
+		send_req(p, mk_probe);
+	}
+
+	libusb_free_config_descriptor(cfg);
+	return n;
+}
+
+/* the interfaces add_device() would probe.  Returns the number */
+static int candidates(libusb_device *dev, int *intf, int max)
+{
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt;
+	int i, size, n = 0;
+
+	if (libusb_get_active_config_descriptor(dev, &cfg))
+		return 0;
+	for (i = 0; i < cfg->bNumInterfaces && n < max; i++) {
+		alt = &cfg->interface[i].altsetting[0];
+		if (alt->bInterfaceClass == LIBUSB_CLASS_VENDOR_SPEC && usbwdm_find_ep(alt, &size) >= 0)
+			intf[n++] = alt->bInterfaceNumber;
+	}
+	libusb_free_config_descriptor(cfg);
+	return n;
+}
+
+/* is the device one of the vid:pid arguments, or are there none? */
+static int wanted(const struct libusb_device_descriptor *desc, char **devices, int n)
+{
+	uint16_t vendor_id, product_id;
+	int i;
 
-        ret = libusb_control_transfer(handle, 
-				LIBUSB_REQUEST_TYPE_CLASS + LIBUSB_RECIPIENT_INTERFACE,  /* 0x21 */
-				0, /* CDC SEND_ENCAPSULATED_COMMAND */ 
-				0, /* zero */
-				interface, /* wIndex = interface */
-				buf,
-				size,
-				1000);
-	fprintf(stderr, "%s: libusb_control_transfer() returned %d\n", __FUNCTION__, ret);
-	return ret;
+	for (i = 0; i < n; i++)
+		if (sscanf(devices[i], " %hx : %hx ", &vendor_id, &product_id) == 2 &&
+		    desc->idVendor == vendor_id && desc->idProduct == product_id)
+			return 1;
+	return !n;
+}
+
+static int open_devices(char **devices, int n)
+{
+	struct libusb_device_descriptor desc;
+	struct probe_key key;
+	libusb_device **list;
+	libusb_device_handle *handle;
+	char name[32];
+	ssize_t cnt, i;
+	int ret, has_key, nintf, intf[MAX_PROBES], found = 0;
+
+	cnt = libusb_get_device_list(NULL, &list);
+	for (i = 0; i < cnt; i++) {
+		if (libusb_get_device_descriptor(list[i], &desc) || !wanted(&desc, devices, n))
+			continue;
+
+		/* known hardware needs no probing */
+		has_key = !usb_name(list[i], name, sizeof(name)) && !probecache_key(name, &key);
+		nintf = candidates(list[i], intf, MAX_PROBES);
+		if (has_key && !rescan && probecache_known(&cache, &key, intf, nintf)) {
+			print_cached(list[i], &key);
+			found++;
+			continue;
+		}
+
+		ret = libusb_open(list[i], &handle);
+		if (ret) {
+			if (n)
+				fprintf(stderr, "%03d/%03d: libusb_open() failed: %s\n",
+					libusb_get_bus_number(list[i]), libusb_get_device_address(list[i]),
+					libusb_error_name(ret));
+			continue;
+		}
+		if (add_device(handle, &desc, has_key ? &key : NULL, name) > 0) {
+			found++;
+			continue;
+		}
+
+		/* nothing to probe */
+		if (has_key)
+			cache_classes(list[i], &key);
+		libusb_close(handle);
+	}
+	if (cnt >= 0)
+		libusb_free_device_list(list, 1);
+	return found;
+}
+
+/* wait for all replies, or the timeout */
+static void run_probes(int timeout)
+{
+	long long deadline = now_ms() + timeout;
+	struct timeval tv;
+	int i, busy;
+
+	do {
+		tv.tv_sec = 0;
+		tv.tv_usec = 10 * 1000;
+		libusb_handle_events_timeout(NULL, &tv);
+		for (i = 0, busy = 0; i < nprobes; i++)
+			busy += !probe[i].result;
+	} while (busy && now_ms() < deadline);
+
+	/* nothing more is sent once there is a result */
+	for (i = 0; i < nprobes; i++)
+		if (!probe[i].result)
+			probe[i].result = probe[i].qmi ? PROBE_QMI : PROBE_TIMEOUT;
+	for (i = 0; i < nprobes; i++)
+		if (probe[i].opened)
+			usbwdm_close(&probe[i].w);
 }
 
 static struct option main_options[] = {
 	{ "help",	0, 0, 'h' },
+	{ "rescan",	0, 0, 'r' },
+	{ "timeout",	1, 0, 't' },
+	{ "verbose",	0, 0, 'v' },
 	{ 0, 0, 0, 0 }
 };
 
 
 void usage(char *prog)
 {
-	fprintf(stderr, "Usage: %s vid:pid\n\n", prog);
+	fprintf(stderr, "Usage: %s [--rescan] [--timeout ms] [--verbose] [vid:pid...]\n\n", prog);
 }
 
 int main(int argc, char *argv[])
 {
-	char *prog, *device = NULL;
-	int i, opt, ret, interface;
-	libusb_device_handle *handle;
-	char buf[500];
-	int size = sizeof(buf), len;
-	unsigned char cid = 0;
+	char *prog;
+	int i, first, opt, ret, timeout = 500;
+	long long start;
+	struct probe *p;
 
 	prog = argv[0];
-	while ((opt = getopt_long(argc, argv, "h", main_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "rt:vh", main_options, NULL)) != -1) {
 		switch(opt) {
+		case 'r':
+			rescan = 1;
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
 		case 'h':
 			usage(prog);
 			exit(0);
 		}
 	}
 
-	if (optind >= argc) {
-		usage(prog);
-		exit(0);
-	}
-
-	device = strdup(argv[optind]);
-
-	if (ret = libusb_init(NULL)) {
+	if ((ret = libusb_init(NULL))) {
 		fprintf(stderr, "libusb_init() failed: %d\n", ret);
 		exit(1);
 	}
-	
-	if (handle = open_device(device)) {
-
-		/* FIXME: for each interface:
- 		   - ignore if bound
-		   - ignore unless containing interrupt endpoint (and either bulk in+out or nothing else?)
-		*/
-		
-		ret = libusb_claim_interface (handle, interface);
-
-		/* just send a static release cid=0 for system=255 to trigger a
-		   QMI_ERR_INVALID_SERVICE_TYPE error
-		*/
-		unsigned char req[0x11] = { 0x01,	// .tf (always 1)
-					    0x10, 0x00, // .len (excl .tf)
-					    0x00,	// .ctrl (control point)
-					    0x00,	// .service (QMI_CTL)
-					    0x00,	// .cid (irrelevant for QMI_CTL)
-					    0x00,	// .flags
-					    0x00,	// .txid (don't care)
-					    0x23, 0x00, // .msgid
-					    0x05, 0x00, // .len
-					    0x01,	// .tlvid
-					    0x02, 0x00, // .tlvlen
-					    0xff, 	// .tlv[0] == system (0xff does not exist)
-					    0x0,	// .tlv[1] == cid (0 is impossible)
-		};
-
-		/* the expected static reply to the above request is: */
-		unsigned char reply[0x13] = { 0x01,		// .tf (always 1)
-					      0x12, 0x00,	// .len (excl .tf)
-					      0x80,		// .ctrl (service)
-					      0x00,		// .service (QMI_CTL)
-					      0x00,		// .cid (irrelevant for QMI_CTL)
-					      0x01,		// .flags (QMI_CTL response)
-					      0x00,		// .txid
-					      0x23, 0x00, 	// .msgid
-					      0x07, 0x00, 	// .len
-					      0x02,		// .tlvid
-					      0x04, 0x00, 	// .tlvlen
-					      0x01, 0x00,	// FAILED
-					      0x1f, 0x00,	// QMI_ERR_INVALID_SERVICE_TYPE
-		};
-
-		print_usb_device(handle);
-
-		i = send_msg(handle, interface, req, sizeof(req));
-
-		/* should repeat a few times to flush pending unsolicted messages */
-		sleep(2); /* just wait enough */
-		i = read_reply(handle, interface, buf, size);
-
-		ret = libusb_release_interface(handle, interface);
-	} else {
-		fprintf(stderr, "failed to open device \"%s\"\n", device);
+
+	start = now_ms();
+	probecache_load(&cache);
+	if (!open_devices(argv + optind, argc - optind))
+		fprintf(stderr, "no vendor specific interface with an interrupt endpoint found\n");
+	run_probes(timeout);
+
+	/* bus/address vid:pid interface: result */
+	for (i = 0, first = 0; i < nprobes; i++) {
+		p = &probe[i];
+		printf("%03d/%03d %04x:%04x %d: %s", p->bus, p->addr, p->vid, p->pid, p->ifnum, result_str[p->result]);
+		print_versions(p->ver, p->nver);
+
+		/* the last interface of each device */
+		if (i == nprobes - 1 || probe[i + 1].handle != p->handle) {
+			cache_device(&probe[first], i - first + 1);
+			libusb_close(p->handle);
+			first = i + 1;
+		}
 	}
-		
+	if (verbose)
+		fprintf(stderr, "probed %d interfaces in %lld ms\n", nprobes, now_ms() - start);
+
+	/* fails unless root, which is fine */
+	probecache_save(&cache);
+
 	libusb_exit(NULL);
+	return 0;
 }
@@ -0,0 +1,861 @@
+/*
+ * qmi-replay - replay a captured QMI or MBIM control session
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Reads a pcapng capture made by wdm-capture or cuseqmi --tap, and
+ * plays one side of it:
+ *
+ *  --simulate	plays the modem on a pty.  Every request is answered
+ *		with the recorded reply to the same request, followed
+ *		by the indications recorded after it.  Point qmi.pl
+ *		(MGMT=<pty>) or cuseqmi (--device=<pty>) to it
+ *  --device	plays the host, sending the recorded requests to a
+ *		cdc-wdm device, an mbim-proxy socket or a simulator,
+ *		and checks the replies against the recording
+ *
+ * Requests and replies are matched on (service, message, transaction
+ * id).  The simulator ignores the transaction id, and gives each
+ * reply the id of the request.  Recorded QMI client ids are mapped to
+ * the ones actually allocated when playing the host.
+ *
+ * By default everything runs as fast as possible: the host sends the
+ * next request when the previous reply arrives, and the simulator
+ * replies at once.  With --realtime the recorded timing is kept.
+ * The host reports the recorded and replayed latency of each
+ * transaction, and exits with an error if any reply is missing or
+ * has a different status.
+ *
+ *   qmi-replay --simulate session.pcapng &
+ *   qmi-replay --device=/dev/pts/5 session.pcapng
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/types.h>
+#include <linux/usb/cdc-wdm.h>
+#include "qmux.h"
+#include "mbim.h"
+#include "pcapng.h"
+
+#define MAX_FRAME	(1 << 16)
+
+/* frame kinds */
+enum { F_OTHER, F_REQ, F_RESP, F_IND };
+
+struct key {
+	__u32 service;
+	__u32 msg;
+	__u32 tid;
+};
+
+struct frame {
+	__u64 ts;
+	__u8 *data;
+	size_t len;
+};
+
+struct txn {
+	struct frame req;
+	struct frame resp;	/* len is 0 if there was no reply */
+	struct frame *ind;	/* indications following the reply */
+	int nind;
+	struct key key;
+	int done;		/* simulator: replayed, host: 1 = reply, -1 = timeout */
+	__u64 sent;
+	__u64 rcvd;
+	int status;
+};
+
+struct proto {
+	const char *name;
+	/* length of the first frame in buf, 0 if incomplete or -1 if garbage */
+	int (*frame_len)(const __u8 *buf, size_t len);
+	int (*classify)(const __u8 *f, size_t len, struct key *key);
+	void (*set_tid)(__u8 *f, size_t len, __u32 tid);
+	int (*status)(const __u8 *f, size_t len);
+	/* a reply to a request which was not recorded */
+	int (*mk_reply)(__u8 *buf, size_t size, const __u8 *req, size_t len);
+	char *(*describe)(char *buf, size_t size, const struct key *key);
+};
+
+static const struct proto *proto;
+static struct txn *txns;
+static int ntxn;
+static int verbose;
+static int realtime;
+
+/* fd to the peer, and the MBIM fragment size */
+static int fd;
+static __u32 maxctrl = MBIM_MAX_CTRL;
+static struct mbim_reasm reasm[2];	/* IN and OUT */
+
+static __u64 now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* -- QMI -- */
+
+static int qmi_frame_len(const __u8 *buf, size_t len)
+{
+	struct qmi_msg msg;
+	int rc = qmux_decode(&msg, buf, len);
+
+	if (rc == -EMSGSIZE)
+		return 0;
+	return rc < 0 ? -1 : rc;
+}
+
+static int qmi_classify(const __u8 *f, size_t len, struct key *key)
+{
+	struct qmi_msg msg;
+	const __u8 *data;
+	__u8 resp, ind;
+
+	if (qmux_decode(&msg, f, len) < 0)
+		return F_OTHER;
+
+	key->service = msg.service;
+	key->msg = msg.msgid;
+	key->tid = msg.tid;
+
+	/* client id requests differ only by the service asked for */
+	if (msg.service == QMI_CTL && qmi_tlv_get(&msg, 0x01, &data) >= 1 &&
+	    (msg.msgid == QMI_CTL_GET_CLIENT_ID || msg.msgid == QMI_CTL_RELEASE_CLIENT_ID))
+		key->msg |= data[0] << 16;
+
+	if (!(msg.ctrl & QMUX_CTRL_SERVICE))
+		return F_REQ;
+	resp = msg.service ? QMI_FLAG_RESPONSE : QMI_CTL_FLAG_RESPONSE;
+	ind = msg.service ? QMI_FLAG_IND : QMI_CTL_FLAG_IND;
+	if (msg.flags & resp)
+		return F_RESP;
+	if (msg.flags & ind)
+		return F_IND;
+	return F_OTHER;
+}
+
+static void qmi_set_tid(__u8 *f, size_t len, __u32 tid)
+{
+	if (len < QMUX_HDR_LEN || len < qmi_hdr_len(f[4]))
+		return;
+	f[QMUX_HDR_LEN + 1] = tid;
+	if (f[4])	/* 2 byte tid for services */
+		f[QMUX_HDR_LEN + 2] = tid >> 8;
+}
+
+static int qmi_reply_status(const __u8 *f, size_t len)
+{
+	struct qmi_msg msg;
+
+	if (qmux_decode(&msg, f, len) < 0)
+		return -EINVAL;
+	return qmi_status(&msg);
+}
+
+static int qmi_mk_reply(__u8 *buf, size_t size, const __u8 *req, size_t len)
+{
+	struct qmi_msg msg;
+	__u8 status[4] = { 1, 0, 0x5e, 0 };	/* QMI_ERR_NOT_SUPPORTED */
+	int rc;
+
+	if (qmux_decode(&msg, req, len) < 0)
+		return -EINVAL;
+	msg.ctrl = QMUX_CTRL_SERVICE;
+	msg.flags = msg.service ? QMI_FLAG_RESPONSE : QMI_CTL_FLAG_RESPONSE;
+	rc = qmux_encode(buf, size, &msg);
+	if (rc < 0)
+		return rc;
+	return qmux_add_tlv(buf, size, 0x02, status, sizeof(status));
+}
+
+static char *qmi_describe(char *buf, size_t size, const struct key *key)
+{
+	snprintf(buf, size, "svc 0x%02x msg 0x%04x", key->service, key->msg & 0xffff);
+	return buf;
+}
+
+static const struct proto qmi_proto = {
+	.name		= "QMI",
+	.frame_len	= qmi_frame_len,
+	.classify	= qmi_classify,
+	.set_tid	= qmi_set_tid,
+	.status		= qmi_reply_status,
+	.mk_reply	= qmi_mk_reply,
+	.describe	= qmi_describe,
+};
+
+/* -- MBIM, always complete messages -- */
+
+static int mbim_frame_len(const __u8 *buf, size_t len)
+{
+	struct mbim_msg msg;
+	int rc = mbim_decode(&msg, buf, len);
+
+	if (rc == -EMSGSIZE)
+		return 0;
+	return rc < 0 ? -1 : rc;
+}
+
+static int mbim_classify(const __u8 *f, size_t len, struct key *key)
+{
+	struct mbim_msg msg;
+
+	if (mbim_decode(&msg, f, len) < 0)
+		return F_OTHER;
+
+	/* OPEN/CLOSE and their DONE have no service */
+	key->service = 0;
+	key->msg = msg.type & ~0x80000000;
+	key->tid = msg.tid;
+	if (msg.type == MBIM_COMMAND_MSG || msg.type == MBIM_COMMAND_DONE ||
+	    msg.type == MBIM_INDICATE_STATUS_MSG) {
+		key->service = msg.service ? msg.service : 0x80000000 | get_le32(msg.uuid);
+		key->msg = msg.cid;
+	}
+
+	switch (msg.type) {
+	case MBIM_OPEN_MSG:
+	case MBIM_CLOSE_MSG:
+	case MBIM_COMMAND_MSG:
+		return F_REQ;
+	case MBIM_OPEN_DONE:
+	case MBIM_CLOSE_DONE:
+	case MBIM_COMMAND_DONE:
+		return F_RESP;
+	case MBIM_INDICATE_STATUS_MSG:
+		return F_IND;
+	}
+	return F_OTHER;
+}
+
+static void mbim_set_tid_len(__u8 *f, size_t len, __u32 tid)
+{
+	if (len >= MBIM_HDR_LEN)
+		mbim_set_tid(f, tid);
+}
+
+static int mbim_reply_status(const __u8 *f, size_t len)
+{
+	struct mbim_msg msg;
+
+	if (mbim_decode(&msg, f, len) < 0)
+		return -EINVAL;
+	return msg.status;
+}
+
+static int mbim_mk_reply(__u8 *buf, size_t size, const __u8 *req, size_t len)
+{
+	struct mbim_msg msg;
+
+	if (mbim_decode(&msg, req, len) < 0)
+		return -EINVAL;
+
+	/* pretend OPEN and CLOSE worked */
+	if (msg.type != MBIM_COMMAND_MSG) {
+		if (size < MBIM_HDR_LEN + 4)
+			return -EMSGSIZE;
+		put_le32(buf, msg.type | 0x80000000);
+		put_le32(buf + 4, MBIM_HDR_LEN + 4);
+		put_le32(buf + 8, msg.tid);
+		put_le32(buf + 12, 0);
+		return MBIM_HDR_LEN + 4;
+	}
+
+	if (size < MBIM_COMMAND_HDR_LEN)
+		return -EMSGSIZE;
+	put_le32(buf, MBIM_COMMAND_DONE);
+	put_le32(buf + 4, MBIM_COMMAND_HDR_LEN);
+	put_le32(buf + 8, msg.tid);
+	put_le32(buf + 12, 1);
+	put_le32(buf + 16, 0);
+	memcpy(buf + 20, msg.uuid, MBIM_UUID_LEN);
+	put_le32(buf + 36, msg.cid);
+	put_le32(buf + 40, 9);		/* MBIM_STATUS_NO_DEVICE_SUPPORT */
+	put_le32(buf + 44, 0);
+	return MBIM_COMMAND_HDR_LEN;
+}
+
+static char *mbim_describe(char *buf, size_t size, const struct key *key)
+{
+	if (!key->service)
+		snprintf(buf, size, "%s", mbim_type_name(key->msg));
+	else if (key->service < MBIM_SERVICE_MAX)
+		snprintf(buf, size, "%s", mbim_cid_name(key->service, key->msg));
+	else
+		snprintf(buf, size, "service %08x cid %u", key->service & 0x7fffffff, key->msg);
+	return buf;
+}
+
+static const struct proto mbim_proto = {
+	.name		= "MBIM",
+	.frame_len	= mbim_frame_len,
+	.classify	= mbim_classify,
+	.set_tid	= mbim_set_tid_len,
+	.status		= mbim_reply_status,
+	.mk_reply	= mbim_mk_reply,
+	.describe	= mbim_describe,
+};
+
+/* -- recording -- */
+
+static int copy_frame(struct frame *f, __u64 ts, const __u8 *data, size_t len)
+{
+	f->ts = ts;
+	f->len = len;
+	f->data = malloc(len);
+	if (!f->data)
+		return -ENOMEM;
+	memcpy(f->data, data, len);
+	return 0;
+}
+
+static int same_key(const struct key *a, const struct key *b, int tid)
+{
+	return a->service == b->service && a->msg == b->msg && (!tid || a->tid == b->tid);
+}
+
+/* add a complete frame from the recording */
+static int add_frame(__u64 ts, const __u8 *data, size_t len)
+{
+	struct txn *t;
+	struct frame *ind;
+	struct key key;
+	int i;
+
+	switch (proto->classify(data, len, &key)) {
+	case F_REQ:
+		if (!(ntxn % 256)) {
+			t = realloc(txns, (ntxn + 256) * sizeof(*t));
+			if (!t)
+				return -ENOMEM;
+			txns = t;
+		}
+		t = &txns[ntxn++];
+		memset(t, 0, sizeof(*t));
+		t->key = key;
+		return copy_frame(&t->req, ts, data, len);
+	case F_RESP:
+		/* the replies to CTL client id requests do not tell the service */
+		for (i = ntxn - 1; i >= 0; i--) {
+			t = &txns[i];
+			if (!t->resp.len && t->key.service == key.service &&
+			    (t->key.msg & 0xffff) == (key.msg & 0xffff) && t->key.tid == key.tid)
+				return copy_frame(&t->resp, ts, data, len);
+		}
+		return 0;
+	case F_IND:
+		if (!ntxn)
+			return 0;
+		t = &txns[ntxn - 1];
+		ind = realloc(t->ind, (t->nind + 1) * sizeof(*ind));
+		if (!ind)
+			return -ENOMEM;
+		t->ind = ind;
+		return copy_frame(&t->ind[t->nind++], ts, data, len);
+	}
+	return 0;
+}
+
+static int load(const char *file, int ifsel)
+{
+	struct pcapng_reader *r;
+	struct pcapng_rec rec;
+	const __u8 *data;
+	size_t len;
+	struct key key;
+	int rc, dir;
+
+	r = pcapng_open_read(file);
+	if (!r)
+		return -errno;
+
+	while ((rc = pcapng_read(r, &rec)) > 0) {
+		if (ifsel < 0)
+			ifsel = rec.ifid;
+		if (rec.ifid != ifsel)
+			continue;
+		if (!proto) {
+			proto = rec.linktype == PCAPNG_LINKTYPE_MBIM ? &mbim_proto : &qmi_proto;
+			if (verbose)
+				fprintf(stderr, "%s: %s capture of %s\n", file, proto->name, rec.device);
+		}
+
+		data = rec.data;
+		len = rec.len;
+		if (proto == &mbim_proto) {
+			/* fragments are reassembled per direction */
+			dir = rec.dir ? rec.dir == PCAPNG_OUT :
+				proto->classify(data, len, &key) == F_REQ;
+			if (mbim_reassemble(&reasm[dir], rec.data, rec.len, &data, &len) <= 0)
+				continue;
+		}
+		rc = add_frame(rec.ts, data, len);
+		if (rc < 0)
+			break;
+	}
+	pcapng_close_read(r);
+	mbim_reasm_free(&reasm[0]);
+	mbim_reasm_free(&reasm[1]);
+	return rc;
+}
+
+/* -- I/O -- */
+
+static int send_msg(const __u8 *msg, size_t len)
+{
+	static __u8 frag[MAX_FRAME];
+	__u32 n;
+	int rc;
+
+	if (proto == &qmi_proto)
+		return write(fd, msg, len) == len ? 0 : -EIO;
+
+	for (n = 0; (rc = mbim_fragment(frag, maxctrl, msg, len, n)) > 0; n++)
+		if (write(fd, frag, rc) != rc)
+			return -EIO;
+	return rc;
+}
+
+/*
+ * read what is available and call fn for each complete message.
+ * Returns -EIO on EOF or error
+ */
+static int read_msgs(void (*fn)(__u8 *msg, size_t len))
+{
+	static __u8 buf[2 * MAX_FRAME];
+	static size_t have;
+	const __u8 *full;
+	size_t off, fulllen;
+	ssize_t n;
+	int len;
+
+	n = read(fd, buf + have, sizeof(buf) - have);
+	if (n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (n <= 0)
+		return -EIO;
+	have += n;
+
+	for (off = 0; off < have; off += len) {
+		len = proto->frame_len(buf + off, have - off);
+		if (!len)
+			break;
+		if (len < 0) {
+			fprintf(stderr, "dropping %zu bytes of garbage\n", have - off);
+			off = have;
+			break;
+		}
+		if (proto == &mbim_proto) {
+			if (mbim_reassemble(&reasm[0], buf + off, len, &full, &fulllen) <= 0)
+				continue;
+			fn((__u8 *)full, fulllen);
+		} else {
+			fn(buf + off, len);
+		}
+	}
+	have -= off;
+	memmove(buf, buf + off, have);
+	return 0;
+}
+
+/* -- simulated device -- */
+
+/* replies and indications waiting for their time */
+struct sched {
+	__u64 due;
+	__u8 *data;
+	size_t len;
+	struct sched *next;
+};
+
+static struct sched *queue;
+
+static void schedule(__u64 due, const __u8 *data, size_t len, __u32 tid, int settid)
+{
+	struct sched *s = malloc(sizeof(*s) + len), **p;
+
+	if (!s)
+		return;
+	s->due = due;
+	s->data = (__u8 *)(s + 1);
+	s->len = len;
+	memcpy(s->data, data, len);
+	if (settid)
+		proto->set_tid(s->data, len, tid);
+
+	/* keep the queue sorted, and the order of equal times */
+	for (p = &queue; *p && (*p)->due <= due; p = &(*p)->next)
+		;
+	s->next = *p;
+	*p = s;
+}
+
+static void sim_request(__u8 *req, size_t len)
+{
+	static __u8 reply[MAX_FRAME];
+	__u64 now = now_us(), base;
+	struct key key;
+	struct txn *t = NULL;
+	char desc[64];
+	int i, n;
+
+	if (proto->classify(req, len, &key) != F_REQ)
+		return;
+
+	/* the first unused recording of this request, or the last used */
+	for (i = 0; i < ntxn; i++) {
+		if (!same_key(&txns[i].key, &key, 0) || !txns[i].resp.len)
+			continue;
+		t = &txns[i];
+		if (!t->done)
+			break;
+	}
+	if (verbose)
+		fprintf(stderr, "%s tid %u: %s\n", proto->describe(desc, sizeof(desc), &key),
+			key.tid, t ? (t->done ? "repeating reply" : "replying") : "not recorded");
+
+	if (!t) {
+		n = proto->mk_reply(reply, sizeof(reply), req, len);
+		if (n > 0)
+			schedule(now, reply, n, key.tid, 1);
+		return;
+	}
+
+	t->done = 1;
+	base = t->req.ts;
+	memcpy(reply, t->resp.data, t->resp.len);
+
+	/* QMI service replies go to the client id of the request */
+	if (proto == &qmi_proto && key.service)
+		reply[5] = req[5];
+	schedule(realtime ? now + t->resp.ts - base : now, reply, t->resp.len, key.tid, 1);
+
+	for (i = 0; i < t->nind; i++)
+		schedule(realtime ? now + t->ind[i].ts - base : now, t->ind[i].data, t->ind[i].len, 0, 0);
+}
+
+static int simulate(void)
+{
+	struct termios tio;
+	struct pollfd pfd;
+	struct sched *s;
+	__u64 now;
+	int slave, timeout;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		perror("pty");
+		return -1;
+	}
+
+	/* keep the slave open, so clients may come and go */
+	slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+		perror(ptsname(fd));
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	printf("%s\n", ptsname(fd));
+	fflush(stdout);
+	fprintf(stderr, "simulating %d %s transactions on %s\n", ntxn, proto->name, ptsname(fd));
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (1) {
+		now = now_us();
+		while (queue && queue->due <= now) {
+			s = queue;
+			queue = s->next;
+			send_msg(s->data, s->len);
+			free(s);
+		}
+		timeout = queue ? (queue->due - now + 999) / 1000 : -1;
+		if (poll(&pfd, 1, timeout) > 0 && read_msgs(sim_request) < 0)
+			break;
+	}
+	close(slave);
+	return 0;
+}
+
+/* -- host -- */
+
+/* recorded QMI client id => allocated client id, per service */
+static __u8 cidmap[256][256];
+
+static void qmi_map_cids(__u8 *req, size_t len)
+{
+	struct qmi_msg msg;
+	const __u8 *data;
+	__u8 *tlv;
+
+	if (qmux_decode(&msg, req, len) < 0)
+		return;
+	if (msg.service && cidmap[msg.service][msg.cid])
+		req[5] = cidmap[msg.service][msg.cid];
+	if (!msg.service && msg.msgid == QMI_CTL_RELEASE_CLIENT_ID &&
+	    qmi_tlv_get(&msg, 0x01, &data) >= 2 && cidmap[data[0]][data[1]]) {
+		tlv = (__u8 *)data;
+		tlv[1] = cidmap[data[0]][data[1]];
+	}
+}
+
+/* learn the client id actually allocated */
+static void qmi_learn_cid(const struct txn *t, const __u8 *resp, size_t len)
+{
+	struct qmi_msg rec, got;
+	const __u8 *a, *b;
+
+	if (t->key.service || (t->key.msg & 0xffff) != QMI_CTL_GET_CLIENT_ID)
+		return;
+	if (qmux_decode(&rec, t->resp.data, t->resp.len) < 0 || qmux_decode(&got, resp, len) < 0)
+		return;
+	if (qmi_tlv_get(&rec, 0x01, &a) >= 2 && qmi_tlv_get(&got, 0x01, &b) >= 2 && a[0] == b[0]) {
+		cidmap[a[0]][a[1]] = b[1];
+		if (verbose && a[1] != b[1])
+			fprintf(stderr, "svc 0x%02x: using cid %u for recorded cid %u\n", a[0], b[1], a[1]);
+	}
+}
+
+static int outstanding;
+
+static void host_reply(__u8 *msg, size_t len)
+{
+	struct key key;
+	struct txn *t;
+	int i;
+
+	if (proto->classify(msg, len, &key) != F_RESP)
+		return;
+	for (i = 0; i < ntxn; i++) {
+		t = &txns[i];
+		if (!t->sent || t->done || t->key.service != key.service ||
+		    (t->key.msg & 0xffff) != (key.msg & 0xffff) || t->key.tid != key.tid)
+			continue;
+		t->done = 1;
+		t->rcvd = now_us();
+		t->status = proto->status(msg, len);
+		if (proto == &qmi_proto)
+			qmi_learn_cid(t, msg, len);
+		outstanding--;
+		return;
+	}
+}
+
+static int open_device(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	__u16 max;
+
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+		strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			return -errno;
+		return 0;
+	}
+	fd = open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return -errno;
+	if (!ioctl(fd, IOCTL_WDM_MAX_COMMAND, &max))
+		maxctrl = max;
+	return 0;
+}
+
+static double ms(__s64 us)
+{
+	return us / 1000.0;
+}
+
+static int host(int timeout)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	__u64 start, now, due, t0 = ntxn ? txns[0].req.ts : 0;
+	__s64 rec_sum = 0, rep_sum = 0, worst = 0, d;
+	int next = 0, i, wait, missing = 0, differ = 0, replied = 0, expected = 0, worst_i = -1;
+	char desc[64];
+	struct txn *t;
+
+	start = now_us();
+	while (next < ntxn || outstanding) {
+		now = now_us();
+
+		/* give up on replies not arriving in time */
+		wait = timeout;
+		for (i = 0; i < next; i++) {
+			t = &txns[i];
+			if (!t->resp.len || t->done)
+				continue;
+			if (now >= t->sent + timeout * 1000ULL) {
+				t->done = -1;
+				outstanding--;
+			} else if ((t->sent + timeout * 1000ULL - now + 999) / 1000 < wait) {
+				wait = (t->sent + timeout * 1000ULL - now + 999) / 1000;
+			}
+		}
+		if (next == ntxn && !outstanding)
+			break;
+
+		/* send when due: at the recorded time, or when idle */
+		if (next < ntxn && (realtime || !outstanding)) {
+			due = realtime ? start + txns[next].req.ts - t0 : now;
+			if (due <= now) {
+				t = &txns[next++];
+				if (proto == &qmi_proto)
+					qmi_map_cids(t->req.data, t->req.len);
+				t->sent = now;
+				if (send_msg(t->req.data, t->req.len) < 0) {
+					perror("write");
+					return -1;
+				}
+				if (t->resp.len)
+					outstanding++;
+				continue;
+			}
+			if ((due - now + 999) / 1000 < wait)
+				wait = (due - now + 999) / 1000;
+		}
+
+		if (poll(&pfd, 1, wait) > 0 && read_msgs(host_reply) < 0) {
+			fprintf(stderr, "device closed\n");
+			break;
+		}
+	}
+
+	/* report */
+	for (i = 0; i < ntxn; i++) {
+		t = &txns[i];
+		if (!t->resp.len)
+			continue;
+		expected++;
+		proto->describe(desc, sizeof(desc), &t->key);
+		if (t->done <= 0) {
+			missing++;
+			printf("%5d %-40s tid %5u: no reply\n", i, desc, t->key.tid);
+			continue;
+		}
+		replied++;
+		d = (t->rcvd - t->sent) - (__s64)(t->resp.ts - t->req.ts);
+		rec_sum += t->resp.ts - t->req.ts;
+		rep_sum += t->rcvd - t->sent;
+		if (worst_i < 0 || d > worst) {
+			worst = d;
+			worst_i = i;
+		}
+		if (t->status != proto->status(t->resp.data, t->resp.len)) {
+			differ++;
+			printf("%5d %-40s tid %5u: status %d, recorded %d\n", i, desc, t->key.tid,
+			       t->status, proto->status(t->resp.data, t->resp.len));
+		} else if (verbose) {
+			printf("%5d %-40s tid %5u: %8.3f ms, recorded %8.3f ms (%+.3f)\n", i, desc, t->key.tid,
+			       ms(t->rcvd - t->sent), ms(t->resp.ts - t->req.ts), ms(d));
+		}
+	}
+
+	printf("%d requests, %d replies expected: %d replied, %d missing, %d with different status\n",
+	       ntxn, expected, replied, missing, differ);
+	if (replied) {
+		printf("mean latency %.3f ms, recorded %.3f ms\n", ms(rep_sum / replied), ms(rec_sum / replied));
+		proto->describe(desc, sizeof(desc), &txns[worst_i].key);
+		printf("largest increase %+.3f ms for #%d %s\n", ms(worst), worst_i, desc);
+	}
+	printf("replay took %.3f s, recorded %.3f s\n", ms(now_us() - start) / 1000,
+	       ntxn ? ms(txns[ntxn - 1].req.ts - t0) / 1000 : 0.0);
+	return missing || differ;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "simulate",	0, 0, 's' },
+	{ "device",	1, 0, 'd' },
+	{ "realtime",	0, 0, 'r' },
+	{ "interface",	1, 0, 'i' },
+	{ "timeout",	1, 0, 't' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s --simulate|--device=<dev> [--realtime] [--interface=<n>] [--timeout=<ms>] [--verbose] <capture>\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *device = NULL;
+	int opt, sim = 0, ifsel = -1, timeout = 5000, rc;
+
+	while ((opt = getopt_long(argc, argv, "hsd:ri:t:v", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			sim = 1;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'r':
+			realtime = 1;
+			break;
+		case 'i':
+			ifsel = atoi(optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+	if (optind != argc - 1 || sim == !!device) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	rc = load(argv[optind], ifsel);
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-rc));
+		exit(1);
+	}
+	if (!ntxn) {
+		fprintf(stderr, "%s: no requests found\n", argv[optind]);
+		exit(1);
+	}
+
+	if (sim)
+		return simulate() < 0;
+
+	rc = open_device(device);
+	if (rc < 0) {
+		fprintf(stderr, "%s: %s\n", device, strerror(-rc));
+		exit(1);
+	}
+	return host(timeout) != 0;
+}
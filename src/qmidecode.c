@@ -0,0 +1,220 @@
+/*
+ * qmidecode - pretty-print QMUX frames like qmi.pl does
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Reads either a raw stream of QMUX frames, like the data read from
+ * /dev/cdc-wdmX, or text with one frame per line in hex, like the
+ * qmi.pl --debug dump.  The input type is guessed from the first
+ * byte unless given.  Examples:
+ *
+ *   qmidecode < /dev/cdc-wdm0
+ *   echo "01 0f 00 00 00 00 00 01 22 00 04 00 01 01 00 01" | qmidecode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "qmux.h"
+#include "qmiprint.h"
+
+static int flags;
+static unsigned long frames, errors;
+
+static void print_frame(const __u8 *buf, size_t len)
+{
+	struct qmi_msg msg;
+	int rc;
+
+	rc = qmux_decode(&msg, buf, len);
+	if (rc < 0) {
+		fprintf(stderr, "invalid QMUX frame (%zu bytes): %s\n", len, strerror(-rc));
+		errors++;
+		return;
+	}
+	qmi_pretty_print(stdout, &msg, flags);
+	frames++;
+}
+
+/* raw frames, possibly split across or concatenated in reads */
+static int decode_raw(int fd, __u8 *buf, size_t size, size_t have)
+{
+	struct qmi_msg msg;
+	size_t off;
+	ssize_t n;
+	int len;
+
+	do {
+		for (off = 0; off < have; off += len) {
+			len = qmux_decode(&msg, buf + off, have - off);
+			if (len == -EMSGSIZE)
+				break;
+			if (len < 0) {	/* resync on the next byte */
+				errors++;
+				len = 1;
+				continue;
+			}
+			qmi_pretty_print(stdout, &msg, flags);
+			frames++;
+		}
+		have -= off;
+		memmove(buf, buf + off, have);
+
+		fflush(stdout);
+		n = read(fd, buf + have, size - have);
+		if (n > 0)
+			have += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	if (have)
+		fprintf(stderr, "%zu bytes of truncated frame at end of input\n", have);
+	return n < 0 ? -errno : 0;
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+/* parse one line of hex bytes, optionally separated by space, ':' or ',' */
+static void decode_hex_line(const char *p, const char *end)
+{
+	static __u8 frame[QMUX_MAX_LEN];
+	size_t len = 0;
+	int hi, lo;
+
+	while (p < end && len < sizeof(frame)) {
+		if (isspace(*p) || *p == ':' || *p == ',') {
+			p++;
+			continue;
+		}
+		if (p + 1 < end && p[0] == '0' && p[1] == 'x')
+			p += 2;
+		hi = p < end ? hexval(p[0]) : -1;
+		lo = p + 1 < end ? hexval(p[1]) : -1;
+		if (hi < 0)
+			break;
+		if (lo < 0) {	/* single digit */
+			frame[len++] = hi;
+			p++;
+		} else {
+			frame[len++] = hi << 4 | lo;
+			p += 2;
+		}
+	}
+	if (len)
+		print_frame(frame, len);
+}
+
+/* one frame per line */
+static int decode_hex(int fd, char *buf, size_t size, size_t have)
+{
+	char *p, *nl;
+	ssize_t n;
+
+	do {
+		for (p = buf; (nl = memchr(p, '\n', have - (p - buf))); p = nl + 1)
+			decode_hex_line(p, nl);
+		have -= p - buf;
+		memmove(buf, p, have);
+
+		/* silently split overlong lines */
+		if (have == size) {
+			decode_hex_line(buf, buf + have);
+			have = 0;
+		}
+
+		fflush(stdout);
+		n = read(fd, buf + have, size - have);
+		if (n > 0)
+			have += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	/* last line without newline */
+	decode_hex_line(buf, buf + have);
+	return n < 0 ? -errno : 0;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "raw",	0, 0, 'r' },
+	{ "hex",	0, 0, 'x' },
+	{ "names",	0, 0, 'n' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--raw|--hex] [--names] [file]\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static __u8 buf[2 * QMUX_MAX_LEN];
+	int opt, fd = 0, mode = 0, ret;
+	ssize_t n = 0;
+
+	while ((opt = getopt_long(argc, argv, "hrxn", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+		case 'x':
+			mode = opt;
+			break;
+		case 'n':
+			flags |= QMI_PRINT_NAMES;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+
+	if (optind < argc) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			exit(1);
+		}
+	}
+
+	/* keep up with an indication stream by writing in large chunks,
+	 * flushing only when waiting for more input
+	 */
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+	/* peek at the first byte: a QMUX frame always starts with 0x01 */
+	if (!mode) {
+		do {
+			n = read(fd, buf, sizeof(buf));
+		} while (n < 0 && errno == EINTR);
+		if (n < 0) {
+			perror("read");
+			exit(1);
+		}
+		mode = n > 0 && buf[0] == 0x01 ? 'r' : 'x';
+	}
+
+	if (mode == 'r')
+		ret = decode_raw(fd, buf, sizeof(buf), n);
+	else
+		ret = decode_hex(fd, (char *)buf, sizeof(buf), n);
+
+	fflush(stdout);
+	if (errors)
+		fprintf(stderr, "%lu frames decoded, %lu errors\n", frames, errors);
+	return ret < 0 || errors;
+}
@@ -0,0 +1,741 @@
+/*
+ * qmiprint.c - table driven QMI pretty-printer
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * The TLV decoders below are C versions of the decode subs in qmi.pl,
+ * and must produce the same text.  Each is named as in qmi.pl, or
+ * <svc>_<msgid>_<tlv> if qmi.pl uses an anonymous sub.  Decoders may
+ * read up to DECODE_PAD bytes beyond the TLV data, which is zero
+ * padded like unpack() pads short input, but must bound any loops by
+ * the real TLV length.  A decoder of fixed size fields returns 0 if
+ * the TLV is too short for them, so it is printed as ASCII instead of
+ * decoding the padding as qmi.pl would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "qmiprint.h"
+#include "qmitables.h"
+
+#define DECODE_PAD 128
+
+/* snprintf appending at buf + *pos, never moving past the end */
+static void add(char *buf, size_t buflen, size_t *pos, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (*pos >= buflen)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *pos, buflen - *pos, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		*pos += n;
+	if (*pos >= buflen)
+		*pos = buflen - 1;
+}
+
+static int cmp_val(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = ((const struct qmi_val *)b)->val;
+
+	return x < y ? -1 : x > y;
+}
+
+const char *qmi_map_lookup(const struct qmi_map *map, __u64 val)
+{
+	const struct qmi_val *v = bsearch(&val, map->v, map->n, sizeof(*map->v), cmp_val);
+
+	return v ? v->name : NULL;
+}
+
+/* Perl interpolates undefined hash values as "" */
+static const char *m(const struct qmi_map *map, __u64 val)
+{
+	const char *s = qmi_map_lookup(map, val);
+
+	return s ? s : "";
+}
+
+static int cmp_msg(const void *a, const void *b)
+{
+	const struct qmi_msg_desc *x = a, *y = b;
+
+	if (x->service != y->service)
+		return x->service - y->service;
+	return x->msgid - y->msgid;
+}
+
+const struct qmi_msg_desc *qmi_msg_lookup(__u8 service, __u16 msgid)
+{
+	struct qmi_msg_desc key = { .service = service, .msgid = msgid };
+
+	return bsearch(&key, qmi_msgs, qmi_nmsgs, sizeof(*qmi_msgs), cmp_msg);
+}
+
+const struct qmi_tlv_desc *qmi_tlv_lookup(const struct qmi_msg_desc *desc, __u8 type)
+{
+	int i;
+
+	for (i = 0; desc && i < desc->ntlvs; i++)
+		if (desc->tlvs[i].type == type)
+			return &desc->tlvs[i];
+	return NULL;
+}
+
+static inline __u64 get_le64(const void *p)
+{
+	return get_le32(p) | (__u64)get_le32((const __u8 *)p + 4) << 32;
+}
+
+/* ==== QMI::WDS ==== */
+
+int wds_0001_16(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 8)
+		return 0;
+	return snprintf(buf, buflen, "tx: %u, rx: %u", get_le32(data), get_le32(data + 4));
+}
+
+int wds_0022_10(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "%u", get_le16(data));
+}
+
+int wds_0022_12(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "IPv%u", data[0]);
+}
+
+int tlv_callendreason(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	__u16 type = get_le16(data), reason = get_le16(data + 2);
+	const char *s = qmi_map_lookup(&wds_call_end_reason_map, type << 16 | reason);
+
+	if (len < 4)
+		return 0;
+	return snprintf(buf, buflen, "%s: %s [type=%u, reason=%u]",
+			m(&wds_call_end_type_map, type), s ? s : "unknown", type, reason);
+}
+
+int tlv_connstatus(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0;
+
+	add(buf, buflen, &pos, "%s", m(&wds_connection_status_map, data[0]));
+	if (len > 1)
+		add(buf, buflen, &pos, ", reconfiguration %srequired", data[1] ? "" : "not ");
+	return pos;
+}
+
+int tlv_pdptype(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "%s", m(&wds_pdp_type_map, data[0]));
+}
+
+int tlv_ipv4addr(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0;
+	int i;
+
+	for (i = len - 1; i >= 0; i--)
+		add(buf, buflen, &pos, i ? "%u." : "%u", data[i]);
+	return pos;
+}
+
+int tlv_ipv6addr(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	char addr[INET6_ADDRSTRLEN];
+	size_t pos = 0;
+
+	if (!inet_ntop(AF_INET6, data, addr, sizeof(addr)))
+		return 0;
+	add(buf, buflen, &pos, "%s", addr);
+	if (len > 16)
+		add(buf, buflen, &pos, "/%u", data[16]);
+	return pos;
+}
+
+int tlv_data_bearer(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	__u32 rat_mask = get_le32(data + 1);
+	size_t pos = 0;
+	const char *s;
+	int i, n = 0;
+
+	if (len < 5)
+		return 0;
+	add(buf, buflen, &pos, "%s: ", m(&wds_current_nw_map, data[0]));
+	for (i = 0; i < 32; i++) {
+		if (!(rat_mask & 1 << i))
+			continue;
+		s = qmi_map_lookup(&wds_rat_mask_map, 1 << i);
+		add(buf, buflen, &pos, "%s%s", n++ ? "|" : "", s ? s : "unknown");
+	}
+	return pos;
+}
+
+/* ==== QMI::NAS ==== */
+
+int tlv_serving_system(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, i;
+
+	add(buf, buflen, &pos, "%s, CS_%s, PS_%s, %s, ",
+	    m(&nas_registration_map, data[0]), m(&nas_attach_map, data[1]),
+	    m(&nas_attach_map, data[2]), m(&nas_network_map, data[3]));
+	for (i = 5; i < len; i++)
+		add(buf, buflen, &pos, "%s%s", i > 5 ? "|" : "", m(&nas_radio_if_map, data[i]));
+	return pos;
+}
+
+int nas_0024_10(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0;
+
+	if (len < 1)
+		return 0;
+	add(buf, buflen, &pos, "roaming: %s", data[0] ? "off" : "on");
+	if (data[0] > 1)
+		add(buf, buflen, &pos, " operator specific: %u", data[0]);
+	return pos;
+}
+
+int tlv_data_service_cap(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, i;
+
+	add(buf, buflen, &pos, "[%u] ", data[0]);
+	for (i = 1; i < len; i++)
+		add(buf, buflen, &pos, "%s%s", i > 1 ? "|" : "", m(&nas_data_cap_map, data[i]));
+	return pos;
+}
+
+int tlv_plmn(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t n = data[4];
+
+	/* substr() stops at the end of the data */
+	if (len < 5)
+		n = 0;
+	else if (n > len - 5)
+		n = len - 5;
+	return snprintf(buf, buflen, "%u%02u - %.*s", get_le16(data), get_le16(data + 2), (int)n, data + 5);
+}
+
+int tlv_roaming_list(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	char seen[256] = { 0 };
+	size_t pos = 0, i;
+	int n = 0;
+
+	/*
+	 * qmi.pl prints 'off' once per radio interface due to operator
+	 * precedence, so this does the same
+	 */
+	for (i = 1; i < len; i += 2) {
+		if (seen[data[i]]++)
+			continue;
+		add(buf, buflen, &pos, "%soff", n++ ? ", " : "");
+	}
+	return pos;
+}
+
+int nas_0024_1c(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "lac=0x%04x", get_le16(data));
+}
+
+/* qmi.pl unpacks only 16 bits of the cell ID */
+int nas_0024_1d(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "cell_id=0x%08x", get_le16(data));
+}
+
+int nas_0024_24(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "tac=0x%04x", get_le16(data));
+}
+
+int tlv_detailed_service(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 5)
+		return 0;
+	return snprintf(buf, buflen, "%s, %s, HDR: %s, %sybrid, %sorbidden",
+			m(&nas_srv_status_map, data[0]), m(&nas_srv_cap_map, data[1]),
+			m(&nas_srv_hdr_status_map, data[2]),
+			data[3] ? "H" : "Not h", data[4] ? "F" : "Not f");
+}
+
+static void decode_rat(char *buf, size_t buflen, size_t *pos, __u16 rat)
+{
+	const char *s;
+	int i, n = 0;
+
+	for (i = 0; i < 16; i++) {
+		if (!(rat & 1 << i))
+			continue;
+		s = qmi_map_lookup(&nas_rat_map, 1 << i);
+		add(buf, buflen, pos, "%s%s", n++ ? "|" : "", s ? s : "unknown");
+	}
+	if (!n)
+		add(buf, buflen, pos, "any");
+}
+
+int tlv_pref_nets(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off;
+	int i, count = get_le16(data);
+
+	for (i = 0, off = 2; i < count && off < len; i++, off += 6) {
+		add(buf, buflen, &pos, "\n\t%u%02u (", get_le16(data + off), get_le16(data + off + 2));
+		decode_rat(buf, buflen, &pos, get_le16(data + off + 4));
+		add(buf, buflen, &pos, ")");
+	}
+	return pos;
+}
+
+static void map_active_band(char *buf, size_t buflen, size_t *pos, unsigned int band)
+{
+	const char *s;
+	int x;
+
+	if (band <= 19) {
+		add(buf, buflen, pos, "BC_%u", band); /* CDMA */
+	} else if (band <= 39 || (band > 48 && band <= 79)) {
+		add(buf, buflen, pos, "reserved");
+	} else if (band > 119 && band <= 151) {
+		x = band - 119;
+		if (band > 133)
+			x += 2;		/* there's a hole for band 15 and 16... */
+		if (band > 134)
+			x += 15;	/* and one between 17 and 33 */
+		if (band > 142)
+			x -= 23;	/* then we go back to 18 after 40... */
+		if (band > 146)
+			x += 2;		/* and have a whole for band  22 and 23 */
+		if (band > 148)
+			x += 15;	/* and up to 41 again after 25.. */
+		add(buf, buflen, pos, "E-UTRA Operating Band %d", x);
+	} else if (band > 199 && band <= 205) {
+		add(buf, buflen, pos, "TD-SCDMA Band %c", 'A' + band - 200);
+	} else {
+		s = qmi_map_lookup(&nas_active_band_map, band);
+		add(buf, buflen, pos, "%s", s ? s : "unknown");
+	}
+}
+
+int tlv_rf_band_info(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off;
+	int i;
+
+	for (i = 0, off = 1; i < data[0] && off < len; i++, off += 5) {
+		add(buf, buflen, &pos, "%s => \"", m(&nas_radio_if_map, data[off]));
+		map_active_band(buf, buflen, &pos, get_le16(data + off + 1));
+		add(buf, buflen, &pos, "\" ch %u, ", get_le16(data + off + 3));
+	}
+	return pos;
+}
+
+int nas_0034_10(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "Emergency mode: %s", data[0] ? "on" : "off");
+}
+
+int tlv_mode_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	__u16 mode = get_le16(data);
+	size_t pos = 0;
+	int i, n = 0;
+
+	if (len < 2)
+		return 0;
+	for (i = 0; i < nas_mode_map.n; i++)
+		if (mode & nas_mode_map.v[i].val)
+			add(buf, buflen, &pos, "%s%s", n++ ? "|" : "", nas_mode_map.v[i].name);
+	return pos;
+}
+
+int tlv_band_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	__u64 bands = get_le64(data);
+	size_t pos = 0;
+	int i, n = 0;
+
+	if (len < 8)
+		return 0;
+	for (i = 0; i < 64; i++)
+		if (bands & (__u64)1 << i)
+			add(buf, buflen, &pos, "%s\"%s\"", n++ ? " + " : "", m(&nas_band_map, i));
+	return pos;
+}
+
+int tlv_roaming_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "Roaming preference: %s", m(&nas_roam_map, get_le16(data)));
+}
+
+int tlv_lte_band_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	__u64 bands = get_le64(data);
+	size_t pos = 0;
+	int i, n = 0;
+
+	if (len < 8)
+		return 0;
+	add(buf, buflen, &pos, "E-UTRA Operating Bands ");
+	for (i = 0; i < 40; i++)
+		if (bands & (__u64)1 << i)
+			add(buf, buflen, &pos, "%s%u", n++ ? ", " : "", i + 1);
+	return pos;
+}
+
+int nas_0034_16(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "Network Selection: %s", data[0] ? "manual" : "automatic");
+}
+
+int tlv_service_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 4)
+		return 0;
+	return snprintf(buf, buflen, "%s", m(&nas_service_domain_map, get_le32(data)));
+}
+
+int tlv_aquis_pref(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 4)
+		return 0;
+	return snprintf(buf, buflen, "%s", m(&nas_aquis_order_map, get_le32(data)));
+}
+
+static void decode_lte_pci_data(char *buf, size_t buflen, size_t *pos, const __u8 *data)
+{
+	add(buf, buflen, pos, "%4u: rsrq=%d dB, rsrp=%d dBm, rssi=%d dBm srxlev=%d",
+	    get_le16(data), (__s16)get_le16(data + 2) / 10, (__s16)get_le16(data + 4) / 10,
+	    (__s16)get_le16(data + 6) / 10, (__s16)get_le16(data + 8));
+}
+
+int tlv_lte_intrafreq(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off;
+	int i;
+
+	add(buf, buflen, &pos, "\n\t%sidle, tac=0x%04x, global_cell=0x%08x, earfcn=%d, serving_cell=%d, %d/%d/%d/%d",
+	    data[0] ? "" : "!", get_le16(data + 4), get_le32(data + 6), get_le16(data + 10),
+	    get_le16(data + 12), data[14], data[15], data[16], data[17]);
+	for (i = 0, off = 19; i < data[18] && off < len; i++, off += 10) {
+		add(buf, buflen, &pos, "\n\t\t");
+		decode_lte_pci_data(buf, buflen, &pos, data + off);
+	}
+	return pos;
+}
+
+int tlv_lte_interfreq(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off = 2;
+	int i, j;
+
+	for (i = 0; i < data[1] && off < len; i++) {
+		add(buf, buflen, &pos, "\n\t%sidle, earfcn=%d, %d/%d/%d", data[0] ? "" : "!",
+		    get_le16(data + off), data[off + 2], data[off + 3], data[off + 4]);
+		j = data[off + 5];
+		for (off += 6; j > 0 && off < len; j--, off += 10) {
+			add(buf, buflen, &pos, "\n\t\t");
+			decode_lte_pci_data(buf, buflen, &pos, data + off);
+		}
+	}
+	return pos;
+}
+
+/*
+ * qmi.pl has one argument too few for the cell format: the rssi ends
+ * up as bsic, the srxlev as rssi, and srxlev is always 0
+ */
+int tlv_lte_neigh_gsm(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off = 2;
+	const __u8 *p;
+	int i, j;
+
+	for (i = 0; i < data[1] && off < len; i++) {
+		add(buf, buflen, &pos, "\n\t%sidle, %d/%d/%d, ncc=0x%02x", data[0] ? "" : "!",
+		    data[off + 2], data[off + 1], data[off], data[off + 3]);
+		j = data[off + 4];
+		for (off += 5; j > 0 && off < len; j--, off += 9) {
+			p = data + off;
+			add(buf, buflen, &pos, "\n\t\tarfcn=%d, %s, cell id %svalid, bsic=0x%02llx, rssi=%d dB srxlev=%d",
+			    get_le16(p), p[2] ? "1900" : "1800", p[3] ? "" : "in",
+			    (unsigned long long)((__s16)get_le16(p + 5) / 10), (__s16)get_le16(p + 7), 0);
+		}
+	}
+	return pos;
+}
+
+int tlv_lte_neigh_wcdma(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	size_t pos = 0, off = 2;
+	const __u8 *p;
+	int i, j;
+
+	for (i = 0; i < data[1] && off < len; i++) {
+		add(buf, buflen, &pos, "\n\t%sidle, uarfcn=%d, %d/%d/%d", data[0] ? "" : "!",
+		    get_le16(data + off), get_le16(data + off + 5), get_le16(data + off + 3), data[off + 2]);
+		j = data[off + 7];
+		for (off += 8; j > 0 && off < len; j--, off += 8) {
+			p = data + off;
+			add(buf, buflen, &pos, "\n\t\tpsc=%d, RSCP=%d dBm, Ec/No=%d dB, srxlev=%d",
+			    get_le16(p), (__s16)get_le16(p + 2) / 10, (__s16)get_le16(p + 4) / 10,
+			    (__s16)get_le16(p + 6));
+		}
+	}
+	return pos;
+}
+
+static int tlv_service_status(char *buf, size_t buflen, const char *system, const __u8 *data)
+{
+	return snprintf(buf, buflen, "%s: %s, True %s, %spreferred", system,
+			m(&nas_srv_status_map, data[0]), m(&nas_srv_status_map, data[1]),
+			data[2] ? "" : "Not ");
+}
+
+int nas_004d_12(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 3)
+		return 0;
+	return tlv_service_status(buf, buflen, "GSM", data);
+}
+
+int nas_004d_13(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 3)
+		return 0;
+	return tlv_service_status(buf, buflen, "WCDMA", data);
+}
+
+int nas_004d_14(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 3)
+		return 0;
+	return tlv_service_status(buf, buflen, "LTE", data);
+}
+
+int tlv_lte_system_info(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	char mcc[4] = { 0 }, mnc[4] = { 0 };
+
+	if (len < 29)
+		return 0;
+	memcpy(mcc, data + 20, 3);
+	memcpy(mnc, data + 23, data[25] > '9' ? 2 : 3);
+	return snprintf(buf, buflen, "dom: %s, cap: %s, roam: %u, %s, lac: %u, cellid: %u, reject: %s, mcc: %s, mnc: %s, tac: %u",
+			m(&nas_srv_status_map, data[1]), m(&nas_srv_status_map, data[3]), data[5],
+			data[7] ? "Not " : "", get_le16(data + 9), get_le32(data + 12),
+			m(&nas_srv_status_map, data[17]), mcc, mnc, get_le16(data + 27));
+}
+
+int nas_004d_1e(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 2)
+		return 0;
+	return snprintf(buf, buflen, "Geo sys index: 0x%04x", get_le16(data));
+}
+
+int nas_004d_21(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "Voice is %ssupported", data[0] ? "" : "not ");
+}
+
+/* ==== QMI::PDS ==== */
+
+int pds_002b_10(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 3)
+		return 0;
+	return snprintf(buf, buflen, "auto: %u, interval %u hours", data[0], get_le16(data + 1));
+}
+
+int pds_002b_13(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 6)
+		return 0;
+	return snprintf(buf, buflen, "gps_week: %u, start_offset: %u, valid: %u",
+			get_le16(data), get_le16(data + 2), get_le16(data + 4));
+}
+
+int tlv_gps_state_info(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 98)
+		return 0;
+	return snprintf(buf, buflen, "engine=%u, gps_week=%u, xtra_gps_week=%u, xtra_gps_minutes=%u, xtra_valid_hours=%u",
+			data[0], get_le16(data + 37), get_le16(data + 92), get_le16(data + 94), get_le16(data + 96));
+}
+
+/* ==== QMI::WDA ==== */
+
+int tlv_qos_format(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 1)
+		return 0;
+	return snprintf(buf, buflen, "%u", data[0]);
+}
+
+int tlv_u32(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 4)
+		return 0;
+	return snprintf(buf, buflen, "%u", get_le32(data));
+}
+
+static int tlv_enum(char *buf, size_t buflen, const struct qmi_map *map, const __u8 *data)
+{
+	const char *s = qmi_map_lookup(map, get_le32(data));
+
+	if (s)
+		return snprintf(buf, buflen, "%s", s);
+	return snprintf(buf, buflen, "unknown [%u]", get_le32(data));
+}
+
+int tlv_llp(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 4)
+		return 0;
+	return tlv_enum(buf, buflen, &wda_llp_map, data);
+}
+
+int tlv_agg(char *buf, size_t buflen, const __u8 *data, size_t len)
+{
+	if (len < 4)
+		return 0;
+	return tlv_enum(buf, buflen, &wda_agg_map, data);
+}
+
+/* ==== the printer ==== */
+
+/* same as mk_ascii() */
+static void mk_ascii(char *buf, const __u8 *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = data[i] < 32 || data[i] > 127 ? '.' : data[i];
+	buf[len] = 0;
+}
+
+static int decode_tlv(char *txt, size_t txtlen, const struct qmi_msg *msg,
+		      const struct qmi_tlv_desc *desc, const struct qmi_tlv *tlv)
+{
+	static __u8 scratch[QMUX_MAX_LEN + DECODE_PAD];
+	const __u8 *v = tlv->data;
+	__u16 status;
+	int n;
+
+	/* special casing status */
+	if (tlv->type == 0x02 && msg->ctrl == QMUX_CTRL_SERVICE) {
+		status = tlv->len >= 4 ? get_le16(v + 2) : 0;
+		return snprintf(txt, txtlen, "%s - %s", tlv->len && v[0] ? "FAILURE" : "SUCCESS",
+				status <= QMI_ERR_MAX && qmi_errname[status] ? qmi_errname[status] : "");
+	}
+	if (!desc || !desc->decode)
+		return 0;
+
+	memcpy(scratch, v, tlv->len);
+	memset(scratch + tlv->len, 0, DECODE_PAD);
+	n = desc->decode(txt, txtlen, scratch, tlv->len);
+	if (n >= (int)txtlen)
+		n = txtlen - 1;
+	return n;
+}
+
+void qmi_pretty_print(FILE *f, const struct qmi_msg *msg, int flags)
+{
+	const char *pfx = msg->ctrl ? "<= " : "=> ";
+	const struct qmi_msg_desc *desc = NULL;
+	const struct qmi_tlv_desc *tdesc;
+	struct qmi_tlv tlvs[256], tlv;
+	struct qmi_tlv_iter it;
+	char have[256] = { 0 };
+	static char txt[QMUX_MAX_LEN * 4];
+	static char hex[QMUX_MAX_LEN * 3 + 1];
+	static const char digits[] = "0123456789abcdef";
+	char *p;
+	int i, j, n;
+
+	if (msg->service == QMI_WDS || msg->service == QMI_NAS || msg->service == 0x06 /* PDS */ ||
+	    msg->service == 0x1a /* WDA */)
+		desc = qmi_msg_lookup(msg->service, msg->msgid);
+
+	fprintf(f, "%sQMUX Header:\n", pfx);
+	fprintf(f, "%s  len:    0x%04zx\n", pfx, msg->len - 1);
+	fprintf(f, "%s  sender: 0x%02x\n", pfx, msg->ctrl);
+	fprintf(f, "%s  svc:    0x%02x\n", pfx, msg->service);
+	fprintf(f, "%s  cid:    0x%02x\n", pfx, msg->cid);
+	fprintf(f, "\n%sQMI Header:\n", pfx);
+	fprintf(f, "%s  Flags:  0x%02x\n", pfx, msg->flags);
+	fprintf(f, msg->service ? "%s  TXN:    0x%04x\n" : "%s  TXN:    0x%02x\n", pfx, msg->tid);
+	fprintf(f, "%s  Cmd:    0x%04x\n", pfx, msg->msgid);
+	fprintf(f, "%s  Size:   0x%04x\n", pfx, msg->tlvlen);
+	if (flags & QMI_PRINT_NAMES)
+		fprintf(f, "%s  Name:   %s %s\n", pfx, qmi_sysname[msg->service] ? qmi_sysname[msg->service] : "?",
+			desc ? desc->name : "?");
+
+	/* sorted by type, with the last duplicate winning, like qmi.pl */
+	qmi_tlv_iter_init(&it, msg);
+	while (qmi_tlv_next(&it, &tlv) > 0) {
+		tlvs[tlv.type] = tlv;
+		have[tlv.type] = 1;
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (!have[i])
+			continue;
+		tdesc = qmi_tlv_lookup(desc, i);
+		n = decode_tlv(txt, sizeof(txt), msg, tdesc, &tlvs[i]);
+
+		/* Perl considers both "" and "0" false */
+		if (n <= 0 || !strcmp(txt, "0"))
+			mk_ascii(txt, tlvs[i].data, tlvs[i].len);
+
+		for (j = 0, p = hex; j < tlvs[i].len; j++) {
+			*p++ = digits[tlvs[i].data[j] >> 4];
+			*p++ = digits[tlvs[i].data[j] & 0xf];
+			*p++ = ' ';
+		}
+		*p = 0;
+
+		if ((flags & QMI_PRINT_NAMES) && tdesc)
+			fprintf(f, "%s[0x%02x] (%2d) %s\t%s\t[%s]\n", pfx, i, tlvs[i].len, hex, txt, tdesc->name);
+		else
+			fprintf(f, "%s[0x%02x] (%2d) %s\t%s\n", pfx, i, tlvs[i].len, hex, txt);
+	}
+}
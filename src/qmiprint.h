@@ -0,0 +1,60 @@
+/*
+ * qmiprint.h - table driven QMI pretty-printer
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * The message, TLV and value tables are generated from qmi.pl by
+ * scripts/mkqmitables.pl, and the output format is identical to
+ * pretty_print_qmi() in qmi.pl
+ */
+
+#ifndef _QMIPRINT_H
+#define _QMIPRINT_H
+
+#include <stdio.h>
+#include <linux/types.h>
+#include "qmux.h"
+
+/* TLV decoders write at most buflen bytes of text, returning the text length */
+typedef int (*qmi_tlv_decoder)(char *buf, size_t buflen, const __u8 *data, size_t len);
+
+struct qmi_val {
+	__u64 val;
+	const char *name;
+};
+
+struct qmi_map {
+	const struct qmi_val *v;
+	int n;
+};
+
+struct qmi_tlv_desc {
+	__u8 type;
+	const char *name;
+	qmi_tlv_decoder decode;
+};
+
+struct qmi_msg_desc {
+	__u8 service;
+	__u16 msgid;
+	const char *name;
+	const struct qmi_tlv_desc *tlvs;
+	int ntlvs;
+};
+
+/* returns NULL if val is not in the map */
+const char *qmi_map_lookup(const struct qmi_map *map, __u64 val);
+
+const struct qmi_msg_desc *qmi_msg_lookup(__u8 service, __u16 msgid);
+const struct qmi_tlv_desc *qmi_tlv_lookup(const struct qmi_msg_desc *desc, __u8 type);
+
+/* print options */
+#define QMI_PRINT_NAMES		0x01	/* add message and TLV names */
+
+void qmi_pretty_print(FILE *f, const struct qmi_msg *msg, int flags);
+
+#endif /* _QMIPRINT_H */
@@ -0,0 +1,94 @@
+/*
+ * qmux-bench - measure the cost of QMUX/QMI encoding and decoding
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Usage: qmux-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <linux/types.h>
+#include "qmux.h"
+
+/* a QMI_CTL GET_CLIENT_ID reply and a DMS GET_DEVICE_SERIAL_NUMBERS reply */
+static const __u8 ctl_reply[] = {
+	0x01, 0x17, 0x00, 0x80, 0x00, 0x00, 0x01, 0x01, 0x22, 0x00, 0x0c, 0x00,
+	0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x02, 0x00, 0x02, 0x01,
+};
+
+static const __u8 dms_reply[] = {
+	0x01, 0x3a, 0x00, 0x80, 0x02, 0x01, 0x02, 0x01, 0x00, 0x25, 0x00, 0x2e, 0x00,
+	0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x10, 0x01, 0x00, '0',
+	0x11, 0x0f, 0x00, '3', '5', '4', '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '1', '2',
+	0x12, 0x0e, 0x00, 'A', '1', '0', '0', '0', '0', '1', '2', '3', '4', '5', '6', '7', '8',
+};
+
+static double elapsed_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e9 + (b->tv_nsec - a->tv_nsec);
+}
+
+static long decode_all(const __u8 *buf, size_t len)
+{
+	struct qmi_msg msg;
+	struct qmi_tlv_iter it;
+	struct qmi_tlv tlv;
+	long sum = 0;
+
+	if (qmux_decode(&msg, buf, len) < 0)
+		return -1;
+	qmi_tlv_iter_init(&it, &msg);
+	while (qmi_tlv_next(&it, &tlv) > 0)
+		sum += tlv.type + tlv.len;
+	return sum + qmi_status(&msg);
+}
+
+int main(int argc, char *argv[])
+{
+	struct qmi_msg req = {
+		.service = QMI_CTL,
+		.msgid = QMI_CTL_GET_CLIENT_ID,
+	};
+	struct timespec t0, t1;
+	long i, n = 10000000;
+	volatile long sink = 0;
+	__u8 buf[64], service = QMI_WDS;
+
+	if (argc > 1)
+		n = atol(argv[1]);
+	if (n <= 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		req.tid = i;
+		qmux_encode(buf, sizeof(buf), &req);
+		sink += qmux_add_tlv(buf, sizeof(buf), 0x01, &service, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("encode QMI_CTL GET_CLIENT_ID (1 TLV):\t%6.1f ns/msg\n", elapsed_ns(&t0, &t1) / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		sink += decode_all(ctl_reply, sizeof(ctl_reply));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("decode QMI_CTL reply (2 TLVs):\t\t%6.1f ns/msg\n", elapsed_ns(&t0, &t1) / n);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++)
+		sink += decode_all(dms_reply, sizeof(dms_reply));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	printf("decode DMS reply (4 TLVs):\t\t%6.1f ns/msg\n", elapsed_ns(&t0, &t1) / n);
+
+	return sink < 0;
+}
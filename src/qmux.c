@@ -0,0 +1,237 @@
+/*
+ * qmux.c - QMUX/QMI message encoding and decoding
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include "qmux.h"
+
+int qmux_decode(struct qmi_msg *msg, const void *buf, size_t len)
+{
+	const __u8 *b = buf;
+	size_t hdrlen, flen;
+
+	if (len < QMUX_HDR_LEN)
+		return -EMSGSIZE;
+	if (b[0] != 1)
+		return -EINVAL;
+
+	flen = get_le16(b + 1) + 1;
+	msg->len = flen;
+	msg->ctrl = b[3];
+	msg->service = b[4];
+	msg->cid = b[5];
+
+	hdrlen = qmi_hdr_len(msg->service);
+	if (flen < hdrlen)
+		return -EINVAL;
+	if (flen > len)
+		return -EMSGSIZE;
+
+	b += QMUX_HDR_LEN;
+	msg->flags = b[0];
+	if (msg->service) {
+		msg->tid = get_le16(b + 1);
+		b += 3;
+	} else {
+		msg->tid = b[1];
+		b += 2;
+	}
+	msg->msgid = get_le16(b);
+	msg->tlvlen = get_le16(b + 2);
+	msg->tlv = b + 4;
+
+	/* some firmwares pad the frame, but the TLVs must fit */
+	if (hdrlen + msg->tlvlen > flen)
+		return -EINVAL;
+	return flen;
+}
+
+int qmux_encode(void *buf, size_t size, const struct qmi_msg *msg)
+{
+	__u8 *b = buf;
+	size_t hdrlen = qmi_hdr_len(msg->service);
+
+	if (size < hdrlen)
+		return -EMSGSIZE;
+
+	b[0] = 1;
+	put_le16(b + 1, hdrlen - 1);
+	b[3] = msg->ctrl;
+	b[4] = msg->service;
+	b[5] = msg->cid;
+	b += QMUX_HDR_LEN;
+	b[0] = msg->flags;
+	if (msg->service) {
+		put_le16(b + 1, msg->tid);
+		b += 3;
+	} else {
+		b[1] = msg->tid;
+		b += 2;
+	}
+	put_le16(b, msg->msgid);
+	put_le16(b + 2, 0);
+	return hdrlen;
+}
+
+int qmux_add_tlv(void *buf, size_t size, __u8 type, const void *data, __u16 len)
+{
+	__u8 *b = buf;
+	size_t hdrlen, flen;
+	__u16 tlvlen;
+
+	if (size < QMUX_HDR_LEN)
+		return -EMSGSIZE;
+	hdrlen = qmi_hdr_len(b[4]);
+	flen = get_le16(b + 1) + 1;
+	if (flen < hdrlen || flen > size)
+		return -EINVAL;
+	if (flen + QMI_TLV_HDR_LEN + len > size || flen + QMI_TLV_HDR_LEN + len > QMUX_MAX_LEN)
+		return -EMSGSIZE;
+
+	b[flen] = type;
+	put_le16(b + flen + 1, len);
+	memcpy(b + flen + QMI_TLV_HDR_LEN, data, len);
+
+	tlvlen = get_le16(b + hdrlen - 2);
+	put_le16(b + hdrlen - 2, tlvlen + QMI_TLV_HDR_LEN + len);
+	flen += QMI_TLV_HDR_LEN + len;
+	put_le16(b + 1, flen - 1);
+	return flen;
+}
+
+int qmux_wrap(void *buf, size_t size, __u8 service, __u8 cid, size_t len)
+{
+	__u8 *b = buf;
+	size_t flen = len + QMUX_HDR_LEN;
+
+	if (flen > size || flen > QMUX_MAX_LEN)
+		return -EMSGSIZE;
+
+	b[0] = 1;
+	put_le16(b + 1, flen - 1);
+	b[3] = 0;
+	b[4] = service;
+	b[5] = cid;
+	return flen;
+}
+
+void qmi_tlv_iter_init(struct qmi_tlv_iter *it, const struct qmi_msg *msg)
+{
+	it->p = msg->tlv;
+	it->end = msg->tlv + msg->tlvlen;
+}
+
+int qmi_tlv_next(struct qmi_tlv_iter *it, struct qmi_tlv *tlv)
+{
+	size_t left = it->end - it->p;
+
+	if (!left)
+		return 0;
+	if (left < QMI_TLV_HDR_LEN)
+		return -EINVAL;
+
+	tlv->type = it->p[0];
+	tlv->len = get_le16(it->p + 1);
+	if (tlv->len > left - QMI_TLV_HDR_LEN)
+		return -EINVAL;
+
+	tlv->data = it->p + QMI_TLV_HDR_LEN;
+	it->p = tlv->data + tlv->len;
+	return 1;
+}
+
+int qmi_tlv_get(const struct qmi_msg *msg, __u8 type, const __u8 **data)
+{
+	struct qmi_tlv_iter it;
+	struct qmi_tlv tlv;
+
+	qmi_tlv_iter_init(&it, msg);
+	while (qmi_tlv_next(&it, &tlv) > 0)
+		if (tlv.type == type) {
+			*data = tlv.data;
+			return tlv.len;
+		}
+	return -ENOENT;
+}
+
+int qmi_status(const struct qmi_msg *msg)
+{
+	const __u8 *data;
+
+	if (qmi_tlv_get(msg, 0x02, &data) < 4)
+		return -ENOENT;
+	return get_le16(data + 2);
+}
+
+/* snprintf appending at buf + *pos, never moving past the end */
+static void append(char *buf, size_t buflen, size_t *pos, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (*pos >= buflen)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(buf + *pos, buflen - *pos, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		*pos += n;
+	if (*pos >= buflen)
+		*pos = buflen - 1;
+}
+
+int qmux_format(char *buf, size_t buflen, const struct qmi_msg *msg)
+{
+	struct qmi_tlv_iter it;
+	struct qmi_tlv tlv;
+	size_t pos = 0;
+	int i, rc;
+
+	if (!buflen)
+		return 0;
+	buf[0] = 0;
+
+	append(buf, buflen, &pos, ".len=%zu\n.ctrl=0x%02x\n.service=0x%02x\n.cid=0x%02x\n",
+	       msg->len - 1, msg->ctrl, msg->service, msg->cid);
+	append(buf, buflen, &pos, ".flags=0x%02x\n.tid=%u\n.msgid=0x%04x\n.tlvlen=%u",
+	       msg->flags, msg->tid, msg->msgid, msg->tlvlen);
+
+	qmi_tlv_iter_init(&it, msg);
+	while ((rc = qmi_tlv_next(&it, &tlv)) > 0) {
+		append(buf, buflen, &pos, "\n[%02x] (%u)", tlv.type, tlv.len);
+		for (i = 0; i < tlv.len; i++)
+			append(buf, buflen, &pos, " %02x", tlv.data[i]);
+		append(buf, buflen, &pos, "\t");
+		for (i = 0; i < tlv.len; i++)
+			append(buf, buflen, &pos, "%c",
+			       tlv.data[i] >= ' ' && tlv.data[i] < 127 ? tlv.data[i] : '.');
+	}
+	if (rc < 0)
+		append(buf, buflen, &pos, "\n(truncated TLV)");
+	append(buf, buflen, &pos, "\n");
+	return pos;
+}
+
+void dump_qmux(const void *buf, size_t len)
+{
+	struct qmi_msg msg;
+	char txt[4096];
+	int rc;
+
+	rc = qmux_decode(&msg, buf, len);
+	if (rc < 0) {
+		fprintf(stderr, "%s: invalid QMUX frame (%zu bytes): %s\n", __func__, len, strerror(-rc));
+		return;
+	}
+	qmux_format(txt, sizeof(txt), &msg);
+	fprintf(stderr, "%s", txt);
+}
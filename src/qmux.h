@@ -0,0 +1,165 @@
+/*
+ * qmux.h - QMUX/QMI message encoding and decoding
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * All functions work on caller provided buffers.  Nothing is
+ * allocated, and every access is checked against the buffer size.
+ * Multi-byte fields are little endian on the wire and must be
+ * accessed using the get_le/put_le helpers.
+ *
+ * A QMUX frame looks like this:
+ *
+ *   tf(1) len(2) ctrl(1) service(1) cid(1)	- QMUX header
+ *   flags(1) tid(1 or 2) msgid(2) tlvlen(2)	- QMI header
+ *   type(1) len(2) data(len) ...		- TLVs
+ *
+ * where the transaction id is 1 byte for QMI_CTL and 2 bytes for
+ * any other service.  "len" is the frame length excluding .tf
+ */
+
+#ifndef _QMUX_H
+#define _QMUX_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#define QMUX_HDR_LEN		6
+#define QMI_CTL_HDR_LEN		6
+#define QMI_SVC_HDR_LEN		7
+#define QMI_TLV_HDR_LEN		3
+#define QMUX_MAX_LEN		(0xffff + 1)
+
+/* QMUX ctrl */
+#define QMUX_CTRL_SERVICE	0x80	/* sent by the modem */
+
+/* QMI flags */
+#define QMI_CTL_FLAG_RESPONSE	0x01
+#define QMI_CTL_FLAG_IND	0x02
+#define QMI_FLAG_RESPONSE	0x02
+#define QMI_FLAG_IND		0x04
+
+/* services */
+#define QMI_CTL			0x00
+#define QMI_WDS			0x01
+#define QMI_DMS			0x02
+#define QMI_NAS			0x03
+
+/* QMI_CTL messages */
+#define QMI_CTL_SET_INSTANCE_ID		0x0020
+#define QMI_CTL_GET_VERSION_INFO	0x0021
+#define QMI_CTL_GET_CLIENT_ID		0x0022
+#define QMI_CTL_RELEASE_CLIENT_ID	0x0023
+#define QMI_CTL_SET_DATA_FORMAT		0x0026
+#define QMI_CTL_SYNC			0x0027
+
+static inline __u16 get_le16(const void *p)
+{
+	const __u8 *b = p;
+
+	return b[0] | b[1] << 8;
+}
+
+static inline __u32 get_le32(const void *p)
+{
+	const __u8 *b = p;
+
+	return b[0] | b[1] << 8 | b[2] << 16 | (__u32)b[3] << 24;
+}
+
+static inline void put_le16(void *p, __u16 val)
+{
+	__u8 *b = p;
+
+	b[0] = val;
+	b[1] = val >> 8;
+}
+
+static inline void put_le32(void *p, __u32 val)
+{
+	__u8 *b = p;
+
+	b[0] = val;
+	b[1] = val >> 8;
+	b[2] = val >> 16;
+	b[3] = val >> 24;
+}
+
+/* decoded frame - tlv points into the original buffer */
+struct qmi_msg {
+	size_t len;		/* frame length, including .tf */
+	__u8 ctrl;
+	__u8 service;
+	__u8 cid;
+	__u8 flags;
+	__u16 tid;
+	__u16 msgid;
+	__u16 tlvlen;
+	const __u8 *tlv;
+};
+
+struct qmi_tlv {
+	__u8 type;
+	__u16 len;
+	const __u8 *data;
+};
+
+struct qmi_tlv_iter {
+	const __u8 *p;
+	const __u8 *end;
+};
+
+/* length of the QMUX + QMI headers for a service */
+static inline size_t qmi_hdr_len(__u8 service)
+{
+	return QMUX_HDR_LEN + (service ? QMI_SVC_HDR_LEN : QMI_CTL_HDR_LEN);
+}
+
+/*
+ * Decode the first frame in buf.  Returns the frame length, which
+ * may be less than len if buf holds more than one frame, -EMSGSIZE
+ * if the frame is truncated, or -EINVAL if it is malformed
+ */
+int qmux_decode(struct qmi_msg *msg, const void *buf, size_t len);
+
+/*
+ * Write the QMUX and QMI headers of msg to buf, with no TLVs.
+ * msg->len, msg->tlvlen and msg->tlv are ignored.  Returns the
+ * header length or -EMSGSIZE
+ */
+int qmux_encode(void *buf, size_t size, const struct qmi_msg *msg);
+
+/*
+ * Append a TLV to the frame in buf, updating the QMUX and QMI
+ * lengths.  Returns the new frame length or -EMSGSIZE
+ */
+int qmux_add_tlv(void *buf, size_t size, __u8 type, const void *data, __u16 len);
+
+/*
+ * Write a QMUX header in front of the len byte QMI SDU starting at
+ * buf + QMUX_HDR_LEN.  Returns the frame length or -EMSGSIZE
+ */
+int qmux_wrap(void *buf, size_t size, __u8 service, __u8 cid, size_t len);
+
+void qmi_tlv_iter_init(struct qmi_tlv_iter *it, const struct qmi_msg *msg);
+
+/* returns 1 and fills in tlv, 0 at the end, or -EINVAL if truncated */
+int qmi_tlv_next(struct qmi_tlv_iter *it, struct qmi_tlv *tlv);
+
+/* returns the TLV length and sets data, or -ENOENT */
+int qmi_tlv_get(const struct qmi_msg *msg, __u8 type, const __u8 **data);
+
+/* returns the QMI error code from the status TLV (0 is success), or -ENOENT */
+int qmi_status(const struct qmi_msg *msg);
+
+/* format a decoded frame as text, returning the formatted length */
+int qmux_format(char *buf, size_t buflen, const struct qmi_msg *msg);
+
+/* decode and print a frame to stderr */
+void dump_qmux(const void *buf, size_t len);
+
+#endif /* _QMUX_H */
@@ -0,0 +1,776 @@
+/*
+ * swi-download - download CWE/SPK firmware images to Sierra Wireless modems
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Talks the QDL download protocol to a modem in boot-and-hold mode
+ * (i.e. after AT!BOOTHOLD), on the serial device it then provides:
+ *
+ *  --device	plays the host, downloading the images
+ *  --simulate	plays the modem on a pty, checking the length and CRC
+ *		of every image it gets.  Nothing is written anywhere
+ *
+ *   swi-download --simulate &
+ *   swi-download --device=/dev/pts/5 9X15C_05.05.16.02.spk
+ *
+ * Requests and responses are HDLC framed, with a CRC-16/X.25 before
+ * the closing 0x7e.  The image data goes unframed: each chunk is a 13
+ * byte header followed by the data as is, which is written straight
+ * from the mapped file.  Up to --window chunks are sent before the
+ * first of them is acknowledged, so the modem is writing one chunk
+ * while the next is on the way.  The window and chunk size are
+ * negotiated when opening an image.
+ *
+ * Every image, nested or not, is verified with the CRC in its CWE
+ * header before anything is sent.  With --state, the images completed
+ * are recorded in a file, and skipped when the download is run again.
+ * Only the outermost images are sent and recorded, as the modem wants
+ * a package as a whole, so a .spk holding a single SPKG image starts
+ * from zero if interrupted.  "make check" runs the host against the
+ * simulator.
+ * Which images a modem is running can be found with
+ * "swi-firmware | cwe-index --modems -".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <termios.h>
+#include <sys/uio.h>
+#include <linux/types.h>
+#include "cwe.h"
+
+/* QDL commands */
+#define QDL_HELLO_REQ		0x01
+#define QDL_HELLO_RSP		0x02
+#define QDL_ERROR		0x0d
+#define QDL_OPEN_UNFRAMED_REQ	0x25
+#define QDL_OPEN_UNFRAMED_RSP	0x26
+#define QDL_WRITE_UNFRAMED_REQ	0x27
+#define QDL_WRITE_UNFRAMED_RSP	0x28
+#define QDL_SESSION_DONE_REQ	0x29
+#define QDL_SESSION_DONE_RSP	0x2a
+#define QDL_SESSION_CLOSE_REQ	0x2d
+
+#define QDL_MAGIC		"QCOM high speed protocol hst"
+#define QDL_VERSION		6
+#define QDL_IMAGE_CWE		0x80
+#define QDL_WRITE_HDR_LEN	13
+
+#define HDLC_FLAG		0x7e
+#define HDLC_ESC		0x7d
+
+#define MAX_CHUNK		(1024 * 1024)
+#define MAX_WINDOW		32
+#define MAX_FRAME		1024
+#define MAX_STATE		256
+
+static int verbose;
+static int fd = -1;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put_le16(__u8 *b, __u16 val)
+{
+	b[0] = val;
+	b[1] = val >> 8;
+}
+
+static void put_le32(__u8 *b, __u32 val)
+{
+	b[0] = val;
+	b[1] = val >> 8;
+	b[2] = val >> 16;
+	b[3] = val >> 24;
+}
+
+static __u16 get_le16(const __u8 *b)
+{
+	return b[0] | b[1] << 8;
+}
+
+static __u32 get_le32(const __u8 *b)
+{
+	return b[0] | b[1] << 8 | b[2] << 16 | (__u32)b[3] << 24;
+}
+
+/* CRC-16/X.25, as used by HDLC */
+static __u16 crc16_tab[256];
+
+static __u16 crc16(const __u8 *buf, size_t len)
+{
+	__u16 crc = 0xffff, c;
+	int i, j;
+
+	if (!crc16_tab[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = c & 1 ? 0x8408 ^ (c >> 1) : c >> 1;
+			crc16_tab[i] = c;
+		}
+	}
+	while (len--)
+		crc = crc16_tab[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+/* write everything, or fail */
+static int write_iov(struct iovec *iov, int n)
+{
+	ssize_t ret;
+
+	while (n) {
+		ret = writev(fd, iov, n);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		for (; n && (size_t)ret >= iov->iov_len; iov++, n--)
+			ret -= iov->iov_len;
+		if (n) {
+			iov->iov_base = (__u8 *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return 0;
+}
+
+/* 0x7e, the escaped message and CRC, 0x7e */
+static int send_frame(const __u8 *msg, size_t len)
+{
+	__u8 buf[2 * MAX_FRAME + 8], tmp[MAX_FRAME + 2];
+	struct iovec iov;
+	size_t i, n = 0;
+
+	if (len > MAX_FRAME)
+		return -EMSGSIZE;
+	memcpy(tmp, msg, len);
+	put_le16(tmp + len, crc16(msg, len));
+
+	buf[n++] = HDLC_FLAG;
+	for (i = 0; i < len + 2; i++) {
+		if (tmp[i] == HDLC_FLAG || tmp[i] == HDLC_ESC) {
+			buf[n++] = HDLC_ESC;
+			buf[n++] = tmp[i] ^ 0x20;
+		} else {
+			buf[n++] = tmp[i];
+		}
+	}
+	buf[n++] = HDLC_FLAG;
+
+	iov.iov_base = buf;
+	iov.iov_len = n;
+	return write_iov(&iov, 1);
+}
+
+/* buffered input */
+static __u8 rbuf[64 * 1024];
+static size_t rlen, rpos;
+
+/* the next byte, waiting up to the deadline.  Returns the byte or -errno */
+static int peek_byte(long long deadline)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	long long left;
+	ssize_t n;
+
+	while (rpos == rlen) {
+		left = deadline - now_ms();
+		if (left <= 0)
+			return -ETIMEDOUT;
+		n = poll(&pfd, 1, left);
+		if (n < 0 && errno != EINTR)
+			return -errno;
+		if (n <= 0)
+			continue;
+		n = read(fd, rbuf, sizeof(rbuf));
+		if (n == 0)
+			return -EPIPE;
+		if (n < 0 && errno != EINTR && errno != EAGAIN)
+			return -errno;
+		rpos = 0;
+		rlen = n > 0 ? n : 0;
+	}
+	return rbuf[rpos];
+}
+
+static int get_byte(long long deadline)
+{
+	int c = peek_byte(deadline);
+
+	if (c >= 0)
+		rpos++;
+	return c;
+}
+
+/* the next HDLC frame, without the CRC.  Returns the length or -errno */
+static int read_frame(__u8 *msg, size_t size, int timeout)
+{
+	long long deadline = now_ms() + timeout;
+	size_t n = 0;
+	int c, esc = 0;
+
+	for (;;) {
+		c = get_byte(deadline);
+		if (c < 0)
+			return c;
+		if (c == HDLC_FLAG) {
+			if (n == 0)		/* the opening flag */
+				continue;
+			if (n < 3 || crc16(msg, n - 2) != get_le16(msg + n - 2))
+				return -EBADMSG;
+			return n - 2;
+		}
+		if (c == HDLC_ESC) {
+			esc = 1;
+			continue;
+		}
+		if (n == size)
+			return -EMSGSIZE;
+		msg[n++] = esc ? c ^ 0x20 : c;
+		esc = 0;
+	}
+}
+
+/* skip anything else, like leftovers from an earlier session */
+static int wait_for(__u8 cmd, __u8 *msg, size_t size, int timeout)
+{
+	long long deadline = now_ms() + timeout;
+	int n;
+
+	for (;;) {
+		n = read_frame(msg, size, deadline - now_ms());
+		if (n == -EBADMSG)
+			continue;
+		if (n < 0)
+			return n;
+		if (n >= 5 && msg[0] == QDL_ERROR) {
+			fprintf(stderr, "modem error %u: %.*s\n", get_le32(msg + 1), n - 5, msg + 5);
+			return -EPROTO;
+		}
+		if (msg[0] == cmd)
+			return n;
+		if (verbose)
+			fprintf(stderr, "ignoring command 0x%02x\n", msg[0]);
+	}
+}
+
+/* -- host -- */
+
+struct state {
+	char file[256];
+	int n;
+	char done[MAX_STATE][128];	/* "<crc> <size> <version>" */
+};
+
+static void state_key(char *buf, size_t size, const struct cwe_image *img)
+{
+	snprintf(buf, size, "%08x %u %s", img->crc, img->size, img->version[0] ? img->version : "-");
+}
+
+static void load_state(struct state *s)
+{
+	char line[128];
+	FILE *f;
+
+	if (!s->file[0] || !(f = fopen(s->file, "r")))
+		return;
+	while (s->n < MAX_STATE && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+		snprintf(s->done[s->n++], sizeof(s->done[0]), "%s", line);
+	}
+	fclose(f);
+}
+
+static int is_done(const struct state *s, const char *key)
+{
+	int i;
+
+	for (i = 0; i < s->n; i++)
+		if (!strcmp(s->done[i], key))
+			return 1;
+	return 0;
+}
+
+static void save_done(struct state *s, const char *key)
+{
+	FILE *f;
+
+	if (!s->file[0])
+		return;
+	f = fopen(s->file, "a");
+	if (!f || fprintf(f, "%s\n", key) < 0 || fclose(f))
+		fprintf(stderr, "%s: %s\n", s->file, strerror(errno));
+}
+
+static int hello(int timeout)
+{
+	__u8 msg[MAX_FRAME];
+	int i, n;
+
+	memset(msg, 0, 36);
+	msg[0] = QDL_HELLO_REQ;
+	memcpy(msg + 1, QDL_MAGIC, strlen(QDL_MAGIC));
+	msg[33] = QDL_VERSION;		/* max */
+	msg[34] = QDL_VERSION;		/* min */
+	msg[35] = 0;			/* features */
+
+	/* the modem may miss the first ones while starting */
+	for (i = 0; i < 5; i++) {
+		n = send_frame(msg, 36);
+		if (n < 0)
+			return n;
+		n = wait_for(QDL_HELLO_RSP, msg + 36, sizeof(msg) - 36, timeout / 5);
+		if (n != -ETIMEDOUT)
+			return n < 0 ? n : 0;
+	}
+	return -ETIMEDOUT;
+}
+
+/* open, stream and close one image.  Returns 0 or -errno */
+static int download(const struct cwe_image *img, int window, __u32 chunk, int timeout)
+{
+	__u8 msg[MAX_FRAME], hdr[MAX_WINDOW][QDL_WRITE_HDR_LEN];
+	struct iovec iov[2];
+	__u32 nchunks, sent = 0, acked = 0, off, len;
+	long long start = now_ms(), ms;
+	int n, rc;
+
+	/* the CWE header goes in the open request */
+	msg[0] = QDL_OPEN_UNFRAMED_REQ;
+	msg[1] = QDL_IMAGE_CWE;
+	put_le32(msg + 2, img->size);
+	msg[6] = window;
+	put_le32(msg + 7, chunk);
+	put_le16(msg + 11, 0);
+	memcpy(msg + 13, img->data - CWE_HDR_LEN, CWE_HDR_LEN);
+	rc = send_frame(msg, 13 + CWE_HDR_LEN);
+	if (rc < 0)
+		return rc;
+	n = wait_for(QDL_OPEN_UNFRAMED_RSP, msg, sizeof(msg), timeout);
+	if (n < 0)
+		return n;
+	if (n < 8 || get_le16(msg + 1)) {
+		fprintf(stderr, "%s: open failed: status %u\n", img->type, n >= 3 ? get_le16(msg + 1) : 0);
+		return -EPROTO;
+	}
+
+	/* the modem may want less */
+	if (msg[3] && msg[3] < window)
+		window = msg[3];
+	if (get_le32(msg + 4) && get_le32(msg + 4) < chunk)
+		chunk = get_le32(msg + 4);
+	nchunks = (img->size + chunk - 1) / chunk;
+	if (verbose)
+		fprintf(stderr, "%s: %u bytes in %u chunks of %u, window %d\n", img->type, img->size, nchunks, chunk, window);
+
+	while (acked < nchunks) {
+		/* fill the window */
+		while (sent < nchunks && sent - acked < (__u32)window) {
+			off = sent * chunk;
+			len = img->size - off < chunk ? img->size - off : chunk;
+			hdr[sent % MAX_WINDOW][0] = QDL_WRITE_UNFRAMED_REQ;
+			put_le16(hdr[sent % MAX_WINDOW] + 1, sent);
+			put_le32(hdr[sent % MAX_WINDOW] + 3, 0);
+			put_le32(hdr[sent % MAX_WINDOW] + 7, len);
+			put_le16(hdr[sent % MAX_WINDOW] + 11, crc16(hdr[sent % MAX_WINDOW], 11));
+			iov[0].iov_base = hdr[sent % MAX_WINDOW];
+			iov[0].iov_len = QDL_WRITE_HDR_LEN;
+			iov[1].iov_base = (void *)(img->data + off);
+			iov[1].iov_len = len;
+			rc = write_iov(iov, 2);
+			if (rc < 0)
+				return rc;
+			sent++;
+		}
+
+		/* the acknowledgements come in order */
+		n = wait_for(QDL_WRITE_UNFRAMED_RSP, msg, sizeof(msg), timeout);
+		if (n < 0)
+			return n;
+		if (n < 9 || get_le16(msg + 1) != (acked & 0xffff) || get_le16(msg + 7)) {
+			fprintf(stderr, "%s: chunk %u failed: sequence %u status %u\n", img->type, acked,
+				n >= 3 ? get_le16(msg + 1) : 0, n >= 9 ? get_le16(msg + 7) : 0);
+			return -EPROTO;
+		}
+		acked++;
+		if (verbose && isatty(STDERR_FILENO))
+			fprintf(stderr, "\r%s: %u%%", img->type, (__u32)((__u64)acked * 100 / nchunks));
+	}
+	if (verbose && isatty(STDERR_FILENO))
+		fprintf(stderr, "\n");
+
+	msg[0] = QDL_SESSION_DONE_REQ;
+	rc = send_frame(msg, 1);
+	if (rc < 0)
+		return rc;
+	n = wait_for(QDL_SESSION_DONE_RSP, msg, sizeof(msg), timeout);
+	if (n < 0)
+		return n;
+	if (n < 3 || get_le16(msg + 1)) {
+		fprintf(stderr, "%s: download failed: status %u\n", img->type, n >= 3 ? get_le16(msg + 1) : 0);
+		return -EPROTO;
+	}
+
+	ms = now_ms() - start;
+	printf("%s %s: %u bytes in %lld ms, %.1f MB/s\n", img->type, img->version[0] ? img->version : "-", img->size, ms,
+	       ms ? img->size / 1000.0 / ms : 0.0);
+	return 0;
+}
+
+/* the outermost images of a file */
+struct images {
+	int n;
+	struct cwe_image img[16];
+	int bad;
+};
+
+static void add_image(const struct cwe_image *img, void *priv)
+{
+	struct images *l = priv;
+
+	if (img->depth == 0 && l->n < 16)
+		l->img[l->n++] = *img;
+	if (!img->crc_ok)
+		l->bad++;
+}
+
+static int run_host(char **files, int nfiles, struct state *s, int window, __u32 chunk,
+		    int timeout, int reset)
+{
+	struct cwe_file f[16];
+	struct images l[16];
+	unsigned long long total = 0;
+	char key[128];
+	long long start;
+	int i, j, rc = 0, helloed = 0;
+
+	if (nfiles > 16) {
+		fprintf(stderr, "too many files\n");
+		return -E2BIG;
+	}
+
+	/* verify everything before touching the modem, nested images too */
+	for (i = 0; i < nfiles; i++) {
+		memset(&l[i], 0, sizeof(l[i]));
+		rc = cwe_map(&f[i], files[i]);
+		if (rc < 0) {
+			fprintf(stderr, "%s: %s\n", files[i], strerror(-rc));
+			nfiles = i;
+			goto out;
+		}
+		if (cwe_walk(f[i].buf, f[i].len, CWE_MAX_DEPTH, add_image, &l[i]) < 0 || l[i].bad) {
+			fprintf(stderr, "%s: %s\n", files[i], l[i].bad ? "CRC error" : "not a CWE image");
+			rc = -EINVAL;
+			nfiles = i + 1;
+			goto out;
+		}
+	}
+
+	start = now_ms();
+	for (i = 0; i < nfiles; i++) {
+		for (j = 0; j < l[i].n; j++) {
+			state_key(key, sizeof(key), &l[i].img[j]);
+			if (is_done(s, key)) {
+				printf("%s %s: done already\n", l[i].img[j].type, l[i].img[j].version);
+				continue;
+			}
+			if (!helloed) {
+				rc = hello(timeout);
+				if (rc < 0) {
+					fprintf(stderr, "no reply to hello: %s\n", strerror(-rc));
+					goto out;
+				}
+				helloed = 1;
+			}
+			rc = download(&l[i].img[j], window, chunk, timeout);
+			if (rc < 0) {
+				fprintf(stderr, "%s: %s\n", files[i], strerror(-rc));
+				goto out;
+			}
+			save_done(s, key);
+			total += l[i].img[j].size;
+		}
+	}
+	if (total)
+		printf("%llu bytes in %lld ms\n", total, now_ms() - start);
+
+	/* boot the new firmware */
+	if (helloed && reset) {
+		__u8 msg = QDL_SESSION_CLOSE_REQ;
+
+		send_frame(&msg, 1);
+	}
+out:
+	for (i = 0; i < nfiles; i++)
+		cwe_unmap(&f[i]);
+	return rc;
+}
+
+/* -- simulated modem -- */
+
+#define SIM_WINDOW	8
+
+struct sim {
+	__u32 size;		/* of the open image */
+	__u32 crc;		/* expected */
+	__u32 got;
+	__u32 crc_got;
+	__u32 chunk;
+	__u16 seq;
+	int open;
+	char type[5];
+};
+
+static void sim_reply(__u8 *msg, size_t len)
+{
+	if (send_frame(msg, len) < 0)
+		fprintf(stderr, "simulator: %s\n", strerror(errno));
+}
+
+static void sim_open(struct sim *s, const __u8 *req, int len)
+{
+	__u8 rsp[8] = { QDL_OPEN_UNFRAMED_RSP };
+	const __u8 *hdr = req + 13;
+
+	memset(s, 0, sizeof(*s));
+	if (len < 13 + CWE_HDR_LEN) {
+		put_le16(rsp + 1, 1);
+		sim_reply(rsp, sizeof(rsp));
+		return;
+	}
+	s->size = get_le32(req + 2);
+	s->crc = (__u32)hdr[0x118] << 24 | hdr[0x119] << 16 | hdr[0x11a] << 8 | hdr[0x11b];
+	s->chunk = get_le32(req + 7) < MAX_CHUNK ? get_le32(req + 7) : MAX_CHUNK;
+	memcpy(s->type, hdr + 0x10c, 4);
+	s->open = 1;
+
+	rsp[3] = req[6] < SIM_WINDOW ? req[6] : SIM_WINDOW;
+	put_le32(rsp + 4, s->chunk);
+	sim_reply(rsp, sizeof(rsp));
+	if (verbose)
+		fprintf(stderr, "simulator: %s, %u bytes, window %d, chunk %u\n", s->type, s->size, rsp[3], s->chunk);
+}
+
+/* an unframed chunk.  The data is checked as it is read */
+static int sim_write(struct sim *s)
+{
+	__u8 hdr[QDL_WRITE_HDR_LEN], rsp[9] = { QDL_WRITE_UNFRAMED_RSP };
+	long long deadline = now_ms() + 10000;
+	__u32 len, n;
+	int i, c, status = 0;
+
+	for (i = 0; i < QDL_WRITE_HDR_LEN; i++) {
+		c = get_byte(deadline);
+		if (c < 0)
+			return c;
+		hdr[i] = c;
+	}
+	len = get_le32(hdr + 7);
+	if (!s->open || crc16(hdr, 11) != get_le16(hdr + 11) || len > s->chunk ||
+	    get_le16(hdr + 1) != s->seq || s->got + len > s->size)
+		status = 1;
+
+	/* whatever the status, the data follows */
+	while (len) {
+		if (peek_byte(deadline) < 0)
+			return -ETIMEDOUT;
+		n = rlen - rpos < len ? rlen - rpos : len;
+		if (!status)
+			s->crc_got = cwe_crc32(s->crc_got, rbuf + rpos, n);
+		rpos += n;
+		len -= n;
+		if (!status)
+			s->got += n;
+	}
+
+	memcpy(rsp + 1, hdr + 1, 2);
+	put_le16(rsp + 7, status);
+	sim_reply(rsp, sizeof(rsp));
+	s->seq++;
+	return 0;
+}
+
+static int simulate(void)
+{
+	__u8 msg[MAX_FRAME];
+	struct termios tio;
+	struct sim s = { 0 };
+	int slave, c, n, status;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+		perror("pty");
+		return -1;
+	}
+
+	/* keep the slave open, so hosts may come and go */
+	slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+		perror(ptsname(fd));
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	printf("%s\n", ptsname(fd));
+	fflush(stdout);
+
+	for (;;) {
+		c = peek_byte(now_ms() + 3600 * 1000);
+		if (c == -ETIMEDOUT)
+			continue;
+		if (c < 0)
+			break;
+		if (c == QDL_WRITE_UNFRAMED_REQ) {
+			if (sim_write(&s) < 0)
+				fprintf(stderr, "simulator: truncated chunk\n");
+			continue;
+		}
+		if (c != HDLC_FLAG) {
+			rpos++;
+			continue;
+		}
+
+		n = read_frame(msg, sizeof(msg), 10000);
+		if (n <= 0)
+			continue;
+		switch (msg[0]) {
+		case QDL_HELLO_REQ:
+			memset(msg, 0, 36);
+			msg[0] = QDL_HELLO_RSP;
+			memcpy(msg + 1, QDL_MAGIC, strlen(QDL_MAGIC));
+			msg[33] = QDL_VERSION;
+			msg[34] = QDL_VERSION;
+			sim_reply(msg, 36);
+			break;
+		case QDL_OPEN_UNFRAMED_REQ:
+			sim_open(&s, msg, n);
+			break;
+		case QDL_SESSION_DONE_REQ:
+			status = !s.open || s.got != s.size || s.crc_got != s.crc;
+			fprintf(stderr, "simulator: %s %u/%u bytes, crc %08x/%08x: %s\n", s.type, s.got, s.size,
+				s.crc_got, s.crc, status ? "failed" : "ok");
+			msg[0] = QDL_SESSION_DONE_RSP;
+			put_le16(msg + 1, status);
+			sim_reply(msg, 3);
+			s.open = 0;
+			break;
+		case QDL_SESSION_CLOSE_REQ:
+			fprintf(stderr, "simulator: reset\n");
+			break;
+		default:
+			msg[0] = QDL_ERROR;
+			put_le32(msg + 1, 1);
+			memcpy(msg + 5, "unknown command", 15);
+			sim_reply(msg, 20);
+		}
+	}
+	close(slave);
+	return 0;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "device",	1, 0, 'd' },
+	{ "simulate",	0, 0, 's' },
+	{ "chunk",	1, 0, 'c' },
+	{ "window",	1, 0, 'w' },
+	{ "state",	1, 0, 'S' },
+	{ "timeout",	1, 0, 't' },
+	{ "no-reset",	0, 0, 'n' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s --simulate|--device=<tty> [--chunk=<bytes>] [--window=<n>] [--state=<file>]\n"
+		"\t[--timeout=<ms>] [--no-reset] [--verbose] <image>...\n\n"
+		"--state skips the outermost images already downloaded.  An interrupted\n"
+		"image starts from zero, so a .spk file with a single package restarts\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct state state;
+	struct termios tio;
+	char *device = NULL;
+	int opt, sim = 0, window = 4, timeout = 30000, reset = 1;
+	__u32 chunk = MAX_CHUNK;
+
+	while ((opt = getopt_long(argc, argv, "hd:sc:w:S:t:nv", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 's':
+			sim = 1;
+			break;
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'S':
+			snprintf(state.file, sizeof(state.file), "%s", optarg);
+			break;
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'n':
+			reset = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+	if (window < 1 || window > MAX_WINDOW || chunk < 1 || chunk > MAX_CHUNK) {
+		fprintf(stderr, "window must be 1..%d and chunk 1..%d\n", MAX_WINDOW, MAX_CHUNK);
+		return 1;
+	}
+
+	if (sim)
+		return simulate() < 0;
+
+	if (!device || optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror(device);
+		return 1;
+	}
+	if (!tcgetattr(fd, &tio)) {
+		cfmakeraw(&tio);
+		tcsetattr(fd, TCSANOW, &tio);
+		tcflush(fd, TCIOFLUSH);
+	}
+
+	load_state(&state);
+	return run_host(argv + optind, argc - optind, &state, window, chunk, timeout, reset) < 0;
+}
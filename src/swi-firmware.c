@@ -0,0 +1,412 @@
+/*
+ * swi-firmware - list the current firmware images of Sierra Wireless modems
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Does what swi-sdk-firmware does with the Sierra SDK, using plain
+ * QMI over cdc-wdm: a DMS client id is allocated, and the vendor
+ * specific DMS SWI_GET_CURRENT_FIRMWARE request returns both the list
+ * of running images and the version strings.  That is two round
+ * trips, and all modems are queried at the same time:
+ *
+ *   $ swi-firmware wwan0
+ *   cdc-wdm0: fw SWI9X15C_05.05.16.02 pri 002.009_000 pkg 05.05.16.02_GENERIC carrier GENERIC
+ *   cdc-wdm0: image 0 (modem) id 05.05.16.02 build SWI9X15C_05.05.16.02
+ *   cdc-wdm0: image 1 (pri) id 002.009_000 build 05.05.16.02_GENERIC
+ *
+ * The modems are the QMI mode cdc-wdm devices given by cdc-wdm or
+ * network device name, or all of them.  Exits with 1 unless every
+ * modem replied.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <linux/types.h>
+#include "qmux.h"
+#include "wdmdev.h"
+
+/* Sierra specific DMS message */
+#define QMI_DMS_SWI_GET_CURRENT_FIRMWARE	0x5556
+
+#define MAX_IMAGES	8
+#define MAX_MODEMS	64
+
+enum fw_state {
+	FW_ALLOC = 0,		/* waiting for QMI_CTL_GET_CLIENT_ID */
+	FW_QUERY,		/* waiting for SWI_GET_CURRENT_FIRMWARE */
+	FW_RELEASE,		/* waiting for QMI_CTL_RELEASE_CLIENT_ID */
+	FW_DONE,
+};
+
+struct fw_image {
+	__u8 type;
+	char id[17];		/* unique id */
+	char build[256];	/* build id */
+};
+
+struct modem {
+	char name[32];
+	int fd;
+	int state;
+	__u8 cid;
+	__u8 tid;		/* QMI_CTL transaction */
+	int err;		/* -errno */
+	int qmierr;		/* QMI error code, if err is -EPROTO */
+	int nimg;
+	struct fw_image img[MAX_IMAGES];
+	char ver[9][128];	/* TLVs 0x10 - 0x18 */
+};
+
+/* the version TLVs, in the SDK order: priver, pkgver, fwvers, carrier first */
+static const struct {
+	__u8 type;
+	const char *name;
+} ver_tlv[] = {
+	{ 0x12, "fw" },		/* AMSS version */
+	{ 0x11, "boot" },
+	{ 0x16, "pri" },
+	{ 0x14, "pkg" },	/* package id */
+	{ 0x17, "carrier" },
+	{ 0x15, "carrier-id" },
+	{ 0x13, "sku" },
+	{ 0x18, "config" },
+	{ 0x10, "model" },
+};
+
+/* from the Sierra SDK */
+static const char *const img_type[] = {
+	[0] = "modem",
+	[1] = "pri",
+	[2] = "cwe",
+	[3] = "nvu",
+	[4] = "spk",
+};
+
+static struct modem modem[MAX_MODEMS];
+static int nmodems;
+static int verbose;
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int send_frame(struct modem *m, const __u8 *buf, int len)
+{
+	if (verbose)
+		dump_qmux(buf, len);
+	if (write(m->fd, buf, len) != len)
+		return errno ? -errno : -EIO;
+	return 0;
+}
+
+/* QMI_CTL_GET_CLIENT_ID or QMI_CTL_RELEASE_CLIENT_ID for DMS */
+static int send_ctl(struct modem *m, __u16 msgid)
+{
+	struct qmi_msg msg = {
+		.service = QMI_CTL,
+		.tid = ++m->tid,
+		.msgid = msgid,
+	};
+	__u8 buf[64], tlv[] = { QMI_DMS, m->cid };
+	int len;
+
+	qmux_encode(buf, sizeof(buf), &msg);
+	len = qmux_add_tlv(buf, sizeof(buf), 0x01, tlv, msgid == QMI_CTL_GET_CLIENT_ID ? 1 : 2);
+	return send_frame(m, buf, len);
+}
+
+static int send_query(struct modem *m)
+{
+	struct qmi_msg msg = {
+		.service = QMI_DMS,
+		.cid = m->cid,
+		.tid = 1,
+		.msgid = QMI_DMS_SWI_GET_CURRENT_FIRMWARE,
+	};
+	__u8 buf[64];
+
+	return send_frame(m, buf, qmux_encode(buf, sizeof(buf), &msg));
+}
+
+/* a length limited string, NUL terminated */
+static void copy_str(char *dst, size_t size, const __u8 *src, size_t len)
+{
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+/*
+ * TLV 0x01 is n, n * (type(1) unique id(16) build id length(1) build id),
+ * as CurrImageInfo in the SDK
+ */
+static void parse_images(struct modem *m, const __u8 *data, int len)
+{
+	int i, off = 1, blen;
+
+	if (len < 1)
+		return;
+	for (i = 0; i < data[0] && m->nimg < MAX_IMAGES; i++) {
+		if (off + 18 > len)
+			break;
+		blen = data[off + 17];
+		if (off + 18 + blen > len)
+			break;
+		m->img[m->nimg].type = data[off];
+		copy_str(m->img[m->nimg].id, sizeof(m->img[0].id), data + off + 1, 16);
+		copy_str(m->img[m->nimg].build, sizeof(m->img[0].build), data + off + 18, blen);
+		m->nimg++;
+		off += 18 + blen;
+	}
+}
+
+static void parse_query(struct modem *m, const struct qmi_msg *msg)
+{
+	const __u8 *data;
+	int i, len;
+
+	len = qmi_tlv_get(msg, 0x01, &data);
+	if (len > 0)
+		parse_images(m, data, len);
+	for (i = 0; i < 9; i++) {
+		len = qmi_tlv_get(msg, 0x10 + i, &data);
+		if (len > 0)
+			copy_str(m->ver[i], sizeof(m->ver[i]), data, len);
+	}
+}
+
+/* done, successfully or not: release the client id if there is one */
+static void finish(struct modem *m, int err)
+{
+	m->err = err;
+	if (m->state == FW_QUERY && !send_ctl(m, QMI_CTL_RELEASE_CLIENT_ID))
+		m->state = FW_RELEASE;
+	else
+		m->state = FW_DONE;
+}
+
+/* advance the state machine on a reply.  Anything else is ignored */
+static void handle_frame(struct modem *m, const __u8 *buf, int len)
+{
+	struct qmi_msg msg;
+	const __u8 *data;
+	int rc;
+
+	if (qmux_decode(&msg, buf, len) < 0)
+		return;
+	if (verbose)
+		dump_qmux(buf, len);
+
+	switch (m->state) {
+	case FW_ALLOC:
+		if (msg.service != QMI_CTL || msg.tid != m->tid || msg.msgid != QMI_CTL_GET_CLIENT_ID)
+			return;
+		rc = qmi_status(&msg);
+		if (rc) {
+			m->qmierr = rc;
+			finish(m, -EPROTO);
+			return;
+		}
+		if (qmi_tlv_get(&msg, 0x01, &data) < 2) {
+			finish(m, -EPROTO);
+			return;
+		}
+		m->cid = data[1];
+		m->state = FW_QUERY;
+		rc = send_query(m);
+		if (rc)
+			finish(m, rc);
+		break;
+	case FW_QUERY:
+		if (msg.service != QMI_DMS || msg.cid != m->cid || !(msg.flags & QMI_FLAG_RESPONSE) ||
+		    msg.msgid != QMI_DMS_SWI_GET_CURRENT_FIRMWARE)
+			return;
+		rc = qmi_status(&msg);
+		if (rc) {
+			m->qmierr = rc;
+			finish(m, -EPROTO);
+			return;
+		}
+		parse_query(m, &msg);
+		finish(m, 0);
+		break;
+	case FW_RELEASE:
+		if (msg.service == QMI_CTL && msg.tid == m->tid && msg.msgid == QMI_CTL_RELEASE_CLIENT_ID)
+			m->state = FW_DONE;
+		break;
+	}
+}
+
+static void open_modem(const char *name)
+{
+	struct modem *m = &modem[nmodems];
+	char path[64];
+	int rc;
+
+	memset(m, 0, sizeof(*m));
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	nmodems++;
+
+	m->fd = open(path, O_RDWR | O_NONBLOCK);
+	if (m->fd < 0) {
+		m->err = -errno;
+		m->state = FW_DONE;
+		return;
+	}
+	rc = send_ctl(m, QMI_CTL_GET_CLIENT_ID);
+	if (rc) {
+		m->err = rc;
+		m->state = FW_DONE;
+	}
+}
+
+/* run every modem to FW_DONE, or until the timeout */
+static void run(int timeout)
+{
+	long long deadline = now_ms() + timeout, left;
+	struct pollfd pfd[MAX_MODEMS];
+	__u8 buf[4096];
+	ssize_t len;
+	int i, n;
+
+	for (;;) {
+		for (i = 0, n = 0; i < nmodems; i++) {
+			pfd[i].fd = modem[i].state == FW_DONE ? -1 : modem[i].fd;
+			pfd[i].events = POLLIN;
+			n += modem[i].state != FW_DONE;
+		}
+		left = deadline - now_ms();
+		if (!n || left <= 0)
+			break;
+		if (poll(pfd, nmodems, left) < 0 && errno != EINTR)
+			break;
+		for (i = 0; i < nmodems; i++) {
+			if (pfd[i].revents & (POLLERR | POLLHUP)) {
+				modem[i].err = -EIO;
+				modem[i].state = FW_DONE;
+				continue;
+			}
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+			len = read(modem[i].fd, buf, sizeof(buf));
+			if (len > 0)
+				handle_frame(&modem[i], buf, len);
+		}
+	}
+
+	/* no reply will be waited for, but do not leak the client id */
+	for (i = 0; i < nmodems; i++) {
+		if (modem[i].state == FW_ALLOC || modem[i].state == FW_QUERY)
+			modem[i].err = -ETIMEDOUT;
+		if (modem[i].state == FW_QUERY)
+			send_ctl(&modem[i], QMI_CTL_RELEASE_CLIENT_ID);
+		if (modem[i].fd >= 0)
+			close(modem[i].fd);
+	}
+}
+
+static int print_modem(const struct modem *m)
+{
+	const struct fw_image *img;
+	int i;
+
+	if (m->err) {
+		if (m->qmierr)
+			printf("%s: QMI error 0x%04x\n", m->name, m->qmierr);
+		else
+			printf("%s: %s\n", m->name, strerror(-m->err));
+		return 1;
+	}
+
+	printf("%s:", m->name);
+	for (i = 0; i < (int)(sizeof(ver_tlv) / sizeof(ver_tlv[0])); i++)
+		if (m->ver[ver_tlv[i].type - 0x10][0])
+			printf(" %s %s", ver_tlv[i].name, m->ver[ver_tlv[i].type - 0x10]);
+	printf("\n");
+	for (i = 0; i < m->nimg; i++) {
+		img = &m->img[i];
+		printf("%s: image %u (%s) id %s build %s\n", m->name, img->type,
+		       img->type < sizeof(img_type) / sizeof(img_type[0]) ? img_type[img->type] : "unknown",
+		       img->id, img->build);
+	}
+	return 0;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "timeout",	1, 0, 't' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--timeout ms] [--verbose] [<cdc-wdm>|<netdev>...]\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct wdmdev_index idx;
+	const struct wdmdev *d;
+	int i, opt, timeout = 2000, rc = 0;
+	long long start;
+
+	while ((opt = getopt_long(argc, argv, "ht:v", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			timeout = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+
+	wdmdev_load(&idx);
+	if (optind == argc) {
+		for (i = 0; i < idx.n && nmodems < MAX_MODEMS; i++)
+			if (!strcmp(idx.dev[i].driver, "qmi_wwan"))
+				open_modem(idx.dev[i].wdm);
+	}
+	for (i = optind; i < argc && nmodems < MAX_MODEMS; i++) {
+		d = wdmdev_find(&idx, argv[i]);
+		if (d) {
+			open_modem(d->wdm);
+		} else {
+			fprintf(stderr, "%s: not a cdc-wdm device\n", argv[i]);
+			rc = 1;
+		}
+	}
+	if (!nmodems) {
+		fprintf(stderr, "no QMI modem found\n");
+		return 1;
+	}
+
+	start = now_ms();
+	run(timeout);
+	for (i = 0; i < nmodems; i++)
+		rc |= print_modem(&modem[i]);
+	if (verbose)
+		fprintf(stderr, "queried %d modems in %lld ms\n", nmodems, now_ms() - start);
+	return rc;
+}
@@ -0,0 +1,264 @@
+/*
+ * usbwdm.c - asynchronous CDC encapsulated command transport over libusb
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <libusb.h>
+#include "usbwdm.h"
+
+/* CDC notification and request codes */
+#define USB_CDC_NOTIFY_RESPONSE_AVAILABLE	0x01
+#define USB_CDC_SEND_ENCAPSULATED_COMMAND	0x00
+#define USB_CDC_GET_ENCAPSULATED_RESPONSE	0x01
+
+int usbwdm_find_ep(const struct libusb_interface_descriptor *alt, int *size)
+{
+	const struct libusb_endpoint_descriptor *ep;
+	int i;
+
+	for (i = 0; i < alt->bNumEndpoints; i++) {
+		ep = &alt->endpoint[i];
+		if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) == LIBUSB_TRANSFER_TYPE_INTERRUPT &&
+		    (ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN) {
+			*size = ep->wMaxPacketSize;
+			return ep->bEndpointAddress;
+		}
+	}
+	return -1;
+}
+
+static int submit_get(struct usbwdm *w, int i)
+{
+	if (libusb_submit_transfer(w->get[i]))
+		return -1;
+	w->get_busy[i] = 1;
+	w->gets_busy++;
+	return 0;
+}
+
+/* a GET for every announced response, as far as there are free slots */
+static void kick(struct usbwdm *w)
+{
+	int i;
+
+	for (i = 0; i < w->max_gets && w->announced > 0 && !w->closing; i++) {
+		if (w->get_busy[i])
+			continue;
+		if (submit_get(w, i) < 0)
+			break;
+		w->announced--;
+	}
+}
+
+static void get_cb(struct libusb_transfer *t)
+{
+	struct usbwdm *w = t->user_data;
+	int i;
+
+	for (i = 0; i < w->max_gets && w->get[i] != t; i++)
+		;
+	w->get_busy[i] = 0;
+	w->gets_busy--;
+	if (t->status == LIBUSB_TRANSFER_CANCELLED || w->closing)
+		return;
+
+	/* an empty reply or an error: this slot is free */
+	if (t->status != LIBUSB_TRANSFER_COMPLETED || !t->actual_length) {
+		w->empty++;
+		kick(w);
+		return;
+	}
+
+	w->responses++;
+	w->rx(w, libusb_control_transfer_get_data(t), t->actual_length);
+
+	/* there may be more than announced */
+	if (!w->closing && submit_get(w, i) < 0)
+		kick(w);
+}
+
+static void irq_cb(struct libusb_transfer *t)
+{
+	struct usbwdm *w = t->user_data;
+
+	w->irq_busy = 0;
+	if (t->status == LIBUSB_TRANSFER_CANCELLED || t->status == LIBUSB_TRANSFER_NO_DEVICE || w->closing)
+		return;
+
+	/* bmRequestType 0xa1, bNotification, wValue, wIndex, wLength */
+	if (t->status == LIBUSB_TRANSFER_COMPLETED && t->actual_length >= 8 &&
+	    w->irqbuf[1] == USB_CDC_NOTIFY_RESPONSE_AVAILABLE) {
+		w->notifications++;
+		w->announced++;
+		kick(w);
+	}
+
+	if (!libusb_submit_transfer(t))
+		w->irq_busy = 1;
+}
+
+static void send_cb(struct libusb_transfer *t)
+{
+	struct usbwdm *w = t->user_data;
+
+	if (w->sent && t->status != LIBUSB_TRANSFER_CANCELLED)
+		w->sent(w, t->status);
+	__sync_sub_and_fetch(&w->sends_busy, 1);
+}
+
+static void free_transfers(struct usbwdm *w)
+{
+	int i;
+
+	for (i = 0; i < USBWDM_MAX_GETS; i++) {
+		if (w->get[i])
+			free(w->get[i]->buffer);
+		libusb_free_transfer(w->get[i]);
+		w->get[i] = NULL;
+	}
+	libusb_free_transfer(w->irq);
+	w->irq = NULL;
+}
+
+int usbwdm_open(struct usbwdm *w, libusb_device_handle *handle, int ifnum, int max_gets,
+		usbwdm_rx_fn rx, void *priv)
+{
+	struct libusb_config_descriptor *cfg;
+	const struct libusb_interface_descriptor *alt = NULL;
+	unsigned char *buf;
+	int i, size = 0, ret;
+
+	memset(w, 0, sizeof(*w));
+	w->handle = handle;
+	w->ifnum = ifnum;
+	w->rx = rx;
+	w->priv = priv;
+	w->max_gets = max_gets < 1 ? 1 : max_gets > USBWDM_MAX_GETS ? USBWDM_MAX_GETS : max_gets;
+
+	ret = libusb_get_active_config_descriptor(libusb_get_device(handle), &cfg);
+	if (ret)
+		return ret;
+	for (i = 0; i < cfg->bNumInterfaces; i++)
+		if (cfg->interface[i].altsetting[0].bInterfaceNumber == ifnum)
+			alt = &cfg->interface[i].altsetting[0];
+	w->ep = alt ? usbwdm_find_ep(alt, &size) : -1;
+	libusb_free_config_descriptor(cfg);
+	if (w->ep < 0)
+		return LIBUSB_ERROR_NOT_FOUND;
+	if (size > (int)sizeof(w->irqbuf))
+		size = sizeof(w->irqbuf);
+
+	ret = libusb_claim_interface(handle, ifnum);
+	if (ret)
+		return ret;
+
+	w->irq = libusb_alloc_transfer(0);
+	if (!w->irq)
+		goto nomem;
+	libusb_fill_interrupt_transfer(w->irq, handle, w->ep, w->irqbuf, size, irq_cb, w, 0);
+	for (i = 0; i < w->max_gets; i++) {
+		w->get[i] = libusb_alloc_transfer(0);
+		buf = malloc(LIBUSB_CONTROL_SETUP_SIZE + USBWDM_MSG_SIZE);
+		if (!w->get[i] || !buf) {
+			free(buf);
+			goto nomem;
+		}
+		libusb_fill_control_setup(buf,
+					LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,  /* 0xa1 */
+					USB_CDC_GET_ENCAPSULATED_RESPONSE,
+					0, /* zero */
+					ifnum, /* wIndex = interface */
+					USBWDM_MSG_SIZE);
+		libusb_fill_control_transfer(w->get[i], handle, buf, get_cb, w, 1000);
+	}
+
+	ret = libusb_submit_transfer(w->irq);
+	if (ret) {
+		free_transfers(w);
+		libusb_release_interface(handle, ifnum);
+		return ret;
+	}
+	w->irq_busy = 1;
+	return 0;
+
+nomem:
+	free_transfers(w);
+	libusb_release_interface(handle, ifnum);
+	return LIBUSB_ERROR_NO_MEM;
+}
+
+int usbwdm_send(struct usbwdm *w, const void *buf, size_t len)
+{
+	struct libusb_transfer *t;
+	unsigned char *data;
+	int ret;
+
+	if (len > 0xffff)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	t = libusb_alloc_transfer(0);
+	data = malloc(LIBUSB_CONTROL_SETUP_SIZE + len);
+	if (!t || !data) {
+		libusb_free_transfer(t);
+		free(data);
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	libusb_fill_control_setup(data,
+				LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_INTERFACE,  /* 0x21 */
+				USB_CDC_SEND_ENCAPSULATED_COMMAND,
+				0, /* zero */
+				w->ifnum, /* wIndex = interface */
+				len);
+	memcpy(data + LIBUSB_CONTROL_SETUP_SIZE, buf, len);
+	libusb_fill_control_transfer(t, w->handle, data, send_cb, w, 1000);
+	t->flags = LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+	__sync_add_and_fetch(&w->sends_busy, 1);
+	ret = libusb_submit_transfer(t);
+	if (ret) {
+		__sync_sub_and_fetch(&w->sends_busy, 1);
+		libusb_free_transfer(t);	/* and the buffer */
+	}
+	return ret;
+}
+
+void usbwdm_fetch(struct usbwdm *w)
+{
+	w->announced++;
+	kick(w);
+}
+
+int usbwdm_idle(const struct usbwdm *w)
+{
+	return !w->gets_busy && !w->sends_busy && !w->announced;
+}
+
+void usbwdm_close(struct usbwdm *w)
+{
+	struct timeval tv;
+	int i;
+
+	w->closing = 1;
+	w->announced = 0;
+	if (w->irq_busy)
+		libusb_cancel_transfer(w->irq);
+	for (i = 0; i < w->max_gets; i++)
+		if (w->get_busy[i])
+			libusb_cancel_transfer(w->get[i]);
+
+	/* sends complete on their own, within their timeout */
+	while (w->irq_busy || w->gets_busy || w->sends_busy) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 100 * 1000;
+		libusb_handle_events_timeout(NULL, &tv);
+	}
+	free_transfers(w);
+	libusb_release_interface(w->handle, w->ifnum);
+}
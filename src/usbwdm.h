@@ -0,0 +1,96 @@
+/*
+ * usbwdm.h - asynchronous CDC encapsulated command transport over libusb
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Talks QMUX or MBIM with a control interface which is not bound to
+ * cdc-wdm, like cdc-wdm does: messages are sent with
+ * SEND_ENCAPSULATED_COMMAND, and fetched with GET_ENCAPSULATED_RESPONSE
+ * when the device sends a RESPONSE_AVAILABLE notification on the
+ * interrupt endpoint.
+ *
+ * Unlike cdc-wdm, up to max_gets GET requests are kept in flight, and
+ * a GET is repeated as long as it returns data.  A notification may
+ * then announce any number of responses.  The control requests of a
+ * device complete in order, so responses are delivered in order.
+ *
+ * Everything is driven by libusb event handling, i.e.
+ * libusb_handle_events(), and the callbacks run from there.
+ * usbwdm_send() may be called from any thread.
+ */
+
+#ifndef _USBWDM_H
+#define _USBWDM_H
+
+#include <stddef.h>
+#include <libusb.h>
+
+#define USBWDM_MAX_GETS		8
+#define USBWDM_MSG_SIZE		4096	/* GET_ENCAPSULATED_RESPONSE buffer */
+
+struct usbwdm;
+
+/* a received message */
+typedef void (*usbwdm_rx_fn)(struct usbwdm *w, const void *buf, size_t len);
+
+/* a sent message.  status is an enum libusb_transfer_status */
+typedef void (*usbwdm_sent_fn)(struct usbwdm *w, int status);
+
+struct usbwdm {
+	libusb_device_handle *handle;
+	int ifnum;
+	usbwdm_rx_fn rx;
+	usbwdm_sent_fn sent;		/* may be NULL */
+	void *priv;
+
+	/* statistics */
+	unsigned long notifications;
+	unsigned long responses;
+	unsigned long empty;		/* GETs returning nothing */
+
+	/* internal */
+	int ep;
+	int max_gets;
+	int announced;			/* responses not yet fetched */
+	int irq_busy;
+	int gets_busy;
+	int sends_busy;
+	int closing;
+	struct libusb_transfer *irq;
+	unsigned char irqbuf[64];
+	struct libusb_transfer *get[USBWDM_MAX_GETS];
+	int get_busy[USBWDM_MAX_GETS];
+};
+
+/* the interrupt IN endpoint address of an interface, or -1 */
+int usbwdm_find_ep(const struct libusb_interface_descriptor *alt, int *size);
+
+/*
+ * Claim the interface and start listening for notifications.
+ * max_gets is limited to 1..USBWDM_MAX_GETS.  Returns 0 or a
+ * LIBUSB_ERROR code
+ */
+int usbwdm_open(struct usbwdm *w, libusb_device_handle *handle, int ifnum, int max_gets,
+		usbwdm_rx_fn rx, void *priv);
+
+/* send a message, copying it.  Returns 0 or a LIBUSB_ERROR code */
+int usbwdm_send(struct usbwdm *w, const void *buf, size_t len);
+
+/*
+ * fetch without a notification, i.e. anything queued before open.
+ * Not thread safe, so call it where the callbacks run, or before
+ * event handling starts
+ */
+void usbwdm_fetch(struct usbwdm *w);
+
+/* nothing in flight or announced, except the notification listener */
+int usbwdm_idle(const struct usbwdm *w);
+
+/* cancel everything, wait for the cancellations and release the interface */
+void usbwdm_close(struct usbwdm *w);
+
+#endif /* _USBWDM_H */
@@ -0,0 +1,271 @@
+/*
+ * wdm-capture - passive capture of cdc-wdm control traffic to pcapng
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Listens to usbmon for the USB control requests used by the cdc-wdm
+ * driver, without getting in the way of whoever is using the device:
+ *
+ *  - SEND_ENCAPSULATED_COMMAND carries a frame to the modem
+ *  - GET_ENCAPSULATED_RESPONSE carries a frame from the modem
+ *
+ * The frames are QMUX or MBIM depending on the driver, and are
+ * written to a pcapng file or stdout.  Needs the usbmon module and
+ * access to /dev/usbmonX.  Examples:
+ *
+ *   wdm-capture -w /var/log/wwan0.pcapng /dev/cdc-wdm0
+ *   wdm-capture /dev/cdc-wdm0 | wireshark -k -i -
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include "pcapng.h"
+
+/* the usbmon binary API, from Documentation/usb/usbmon.txt */
+struct mon_bin_hdr {
+	__u64 id;		/* URB ID - from submission to callback */
+	__u8 type;		/* 'S', 'C' or 'E' */
+	__u8 xfer_type;		/* ISO, Intr, Control, Bulk */
+	__u8 epnum;		/* Endpoint number; 0x80 is IN */
+	__u8 devnum;
+	__u16 busnum;
+	char flag_setup;	/* 0 if setup is valid */
+	char flag_data;
+	__s64 ts_sec;
+	__s32 ts_usec;
+	__s32 status;
+	__u32 len_urb;
+	__u32 len_cap;		/* delivered length */
+	__u8 setup[8];
+	__s32 interval;
+	__s32 start_frame;
+	__u32 xfer_flags;
+	__u32 ndesc;
+};
+
+struct mon_bin_get {
+	struct mon_bin_hdr *hdr;
+	void *data;
+	size_t alloc;
+};
+
+#define MON_IOC_MAGIC		0x92
+#define MON_IOCX_GETX		_IOW(MON_IOC_MAGIC, 10, struct mon_bin_get)
+
+#define XFER_CONTROL		2
+
+/* CDC class requests used by cdc-wdm */
+#define SEND_ENCAPSULATED_COMMAND	0x00
+#define GET_ENCAPSULATED_RESPONSE	0x01
+
+/* outstanding GET_ENCAPSULATED_RESPONSE URBs */
+#define MAX_PENDING		16
+
+static volatile sig_atomic_t done;
+static int verbose;
+
+/* read a number from the sysfs attribute "dir/attr" */
+static int sysfs_int(const char *dir, const char *attr, int base)
+{
+	char path[256], buf[32];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	if (!fgets(buf, sizeof(buf), f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+	return strtol(buf, NULL, base);
+}
+
+/* the USB bus, address and interface number of a cdc-wdm device */
+static int find_device(const char *name, int *bus, int *dev, int *intf, int *mbim)
+{
+	static const char *const class[] = { "usbmisc", "usb" };
+	char dir[256], link[256];
+	const char *base;
+	ssize_t n;
+	int i;
+
+	base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+
+	for (i = 0; i < 2; i++) {
+		snprintf(dir, sizeof(dir), "/sys/class/%s/%s/device", class[i], base);
+		if (!access(dir, F_OK))
+			break;
+	}
+	if (i == 2)
+		return -ENODEV;
+
+	*intf = sysfs_int(dir, "bInterfaceNumber", 16);
+	strncat(dir, "/..", sizeof(dir) - strlen(dir) - 1);
+	*bus = sysfs_int(dir, "busnum", 10);
+	*dev = sysfs_int(dir, "devnum", 10);
+	if (*intf < 0 || *bus < 0 || *dev < 0)
+		return -ENODEV;
+
+	/* guess the protocol from the driver unless told */
+	if (*mbim < 0) {
+		snprintf(dir, sizeof(dir), "/sys/class/%s/%s/device/driver", class[i], base);
+		n = readlink(dir, link, sizeof(link) - 1);
+		link[n < 0 ? 0 : n] = 0;
+		*mbim = strstr(link, "cdc_mbim") != NULL;
+	}
+	return 0;
+}
+
+static void sighandler(int sig)
+{
+	done = 1;
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "write",	1, 0, 'w' },
+	{ "mbim",	0, 0, 'm' },
+	{ "qmi",	0, 0, 'q' },
+	{ "verbose",	0, 0, 'v' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--write=<file>] [--mbim|--qmi] [--verbose] <cdc-wdm device>\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static __u8 data[1 << 16];
+	__u64 pending[MAX_PENDING] = { 0 };
+	struct mon_bin_hdr hdr;
+	struct mon_bin_get get = { &hdr, data, sizeof(data) };
+	struct pcapng *cap;
+	struct pollfd pfd;
+	const char *out = "-";
+	char path[32];
+	unsigned long frames = 0;
+	int opt, bus, dev, intf, mbim = -1, ifid, i, wIndex, rc;
+
+	while ((opt = getopt_long(argc, argv, "hw:mqv", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'w':
+			out = optarg;
+			break;
+		case 'm':
+			mbim = 1;
+			break;
+		case 'q':
+			mbim = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (find_device(argv[optind], &bus, &dev, &intf, &mbim) < 0) {
+		fprintf(stderr, "%s: not a cdc-wdm device\n", argv[optind]);
+		exit(1);
+	}
+	if (verbose)
+		fprintf(stderr, "%s: bus %d device %d interface %d, %s\n",
+			argv[optind], bus, dev, intf, mbim ? "MBIM" : "QMI");
+
+	snprintf(path, sizeof(path), "/dev/usbmon%d", bus);
+	pfd.fd = open(path, O_RDONLY);
+	if (pfd.fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	pfd.events = POLLIN;
+
+	cap = pcapng_open(out);
+	if (!cap) {
+		perror(out);
+		exit(1);
+	}
+	ifid = pcapng_add_interface(cap, argv[optind], mbim ? PCAPNG_LINKTYPE_MBIM : PCAPNG_LINKTYPE_QMUX);
+
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+	signal(SIGPIPE, sighandler);
+
+	while (!done) {
+		/* only flush when idle, to keep up with bursts */
+		rc = poll(&pfd, 1, 1000);
+		if (rc == 0)
+			pcapng_flush(cap);
+		if (rc <= 0)
+			continue;
+
+		if (ioctl(pfd.fd, MON_IOCX_GETX, &get) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("MON_IOCX_GETX");
+			break;
+		}
+		if (hdr.busnum != bus || hdr.devnum != dev || hdr.xfer_type != XFER_CONTROL)
+			continue;
+
+		if (hdr.type == 'S' && !hdr.flag_setup) {
+			wIndex = hdr.setup[4] | hdr.setup[5] << 8;
+			if (wIndex != intf)
+				continue;
+
+			/* commands are complete when submitted */
+			if (hdr.setup[0] == 0x21 && hdr.setup[1] == SEND_ENCAPSULATED_COMMAND && hdr.len_cap) {
+				pcapng_write(cap, ifid, PCAPNG_OUT, data, hdr.len_cap);
+				frames++;
+			}
+
+			/* responses arrive with the completion */
+			if (hdr.setup[0] == 0xa1 && hdr.setup[1] == GET_ENCAPSULATED_RESPONSE) {
+				for (i = 0; i < MAX_PENDING && pending[i]; i++)
+					;
+				pending[i % MAX_PENDING] = hdr.id;
+			}
+		} else if (hdr.type == 'C' || hdr.type == 'E') {
+			for (i = 0; i < MAX_PENDING; i++)
+				if (pending[i] == hdr.id)
+					break;
+			if (i == MAX_PENDING)
+				continue;
+			pending[i] = 0;
+			if (hdr.type == 'C' && !hdr.status && hdr.len_cap) {
+				pcapng_write(cap, ifid, PCAPNG_IN, data, hdr.len_cap);
+				frames++;
+			}
+		}
+	}
+
+	pcapng_close(cap);
+	close(pfd.fd);
+	if (verbose)
+		fprintf(stderr, "%lu frames captured\n", frames);
+	return 0;
+}
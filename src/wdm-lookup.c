@@ -0,0 +1,79 @@
+/*
+ * wdm-lookup - find the cdc-wdm device of a network device, or vice versa
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * Prints one line per device, in the format of the cache described
+ * in wdmdev.h, for each name given or for all devices:
+ *
+ *   $ wdm-lookup wwan0
+ *   cdc-wdm0 wwan0 2-1 8 1199 68a2 qmi_wwan
+ *
+ * Updates the cache if stale, so the scripts can run this when they
+ * find the cache outdated.  Exits with 1 if a name is not found.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "wdmdev.h"
+
+static void print_dev(const struct wdmdev *d)
+{
+	printf("%s %s %s %d %04x %04x %s\n", d->wdm, d->netdev[0] ? d->netdev : "-",
+	       d->usbdev, d->intf, d->vid, d->pid, d->driver[0] ? d->driver : "-");
+}
+
+static struct option main_options[] = {
+	{ "help",	0, 0, 'h' },
+	{ "rescan",	0, 0, 'r' },
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--rescan] [<netdev>|<cdc-wdm>...]\n\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct wdmdev_index idx;
+	const struct wdmdev *d;
+	int opt, rescan = 0, rc = 0, i;
+
+	while ((opt = getopt_long(argc, argv, "hr", main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			rescan = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(opt != 'h');
+		}
+	}
+
+	if (rescan) {
+		if (wdmdev_scan(&idx) >= 0)
+			wdmdev_save(&idx);
+	} else {
+		wdmdev_load(&idx);
+	}
+
+	if (optind == argc)
+		for (i = 0; i < idx.n; i++)
+			print_dev(&idx.dev[i]);
+
+	for (i = optind; i < argc; i++) {
+		d = wdmdev_find(&idx, argv[i]);
+		if (d)
+			print_dev(d);
+		else
+			rc = 1;
+	}
+	return rc;
+}
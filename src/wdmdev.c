@@ -0,0 +1,366 @@
+/*
+ * wdmdev.c - index of cdc-wdm devices, their USB device and netdev
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include "wdmdev.h"
+
+/* the cdc-wdm class was named "usb" before Linux 3.5 */
+static const char *const wdm_class[] = { "usbmisc", "usb" };
+
+struct wdm_found {
+	struct wdmdev dev;
+	char intf[32];		/* "2-1:1.3" - unique on the host */
+	int used;
+};
+
+/* a new zeroed entry at the end, or NULL if out of memory */
+static struct wdmdev *add_dev(struct wdmdev_index *idx)
+{
+	struct wdmdev *dev;
+	int size;
+
+	if (idx->n == idx->size) {
+		size = idx->size ? 2 * idx->size : 16;
+		dev = realloc(idx->dev, size * sizeof(*dev));
+		if (!dev)
+			return NULL;
+		idx->dev = dev;
+		idx->size = size;
+	}
+	dev = &idx->dev[idx->n++];
+	memset(dev, 0, sizeof(*dev));
+	return dev;
+}
+
+void wdmdev_free(struct wdmdev_index *idx)
+{
+	free(idx->dev);
+	memset(idx, 0, sizeof(*idx));
+}
+
+/* empty, keeping the allocation */
+static void reset(struct wdmdev_index *idx)
+{
+	idx->boot_id[0] = 0;
+	idx->seqnum = 0;
+	idx->n = 0;
+}
+
+static int read_line(const char *path, char *buf, size_t size)
+{
+	FILE *f = fopen(path, "r");
+	char *p;
+
+	if (!f)
+		return -errno;
+	if (!fgets(buf, size, f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+	p = strchr(buf, '\n');
+	if (p)
+		*p = 0;
+	return 0;
+}
+
+static int sysfs_hex(const char *dir, const char *attr)
+{
+	char path[PATH_MAX + 32], buf[16];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	if (read_line(path, buf, sizeof(buf)) < 0)
+		return -1;
+	return strtol(buf, NULL, 16);
+}
+
+/* the cache is valid for this boot until the next uevent */
+static int generation(char *boot_id, size_t size, unsigned long *seqnum)
+{
+	char buf[32];
+	int rc;
+
+	rc = read_line("/proc/sys/kernel/random/boot_id", boot_id, size);
+	if (rc < 0)
+		return rc;
+	rc = read_line("/sys/kernel/uevent_seqnum", buf, sizeof(buf));
+	if (rc < 0)
+		return rc;
+	*seqnum = strtoul(buf, NULL, 10);
+	return 0;
+}
+
+/* resolve the USB interface of a class device, i.e. /sys/devices/../2-1/2-1:1.3 */
+static const char *usb_interface(const char *classdir, char *path)
+{
+	char link[PATH_MAX];
+	const char *base;
+
+	snprintf(link, sizeof(link), "%s/device", classdir);
+	if (!realpath(link, path))
+		return NULL;
+	base = strrchr(path, '/');
+	if (!base || !strchr(base, ':'))
+		return NULL;
+	return base + 1;
+}
+
+static void copy_name(char *dst, size_t size, const char *src, size_t len)
+{
+	if (len >= size)
+		len = size - 1;
+	memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+/* all cdc-wdm devices.  Returns the number, or -errno */
+static int scan_wdm(struct wdm_found **found)
+{
+	char classdir[PATH_MAX], path[PATH_MAX], link[PATH_MAX + 16], target[PATH_MAX];
+	struct dirent *de;
+	struct wdm_found *w;
+	const char *intf, *p;
+	DIR *d = NULL;
+	ssize_t len;
+	int i, n = 0, size = 0;
+
+	for (i = 0; i < 2 && !d; i++) {
+		snprintf(classdir, sizeof(classdir), "/sys/class/%s", wdm_class[i]);
+		d = opendir(classdir);
+	}
+	if (!d)
+		return 0;
+
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, "cdc-wdm", 7))
+			continue;
+		snprintf(classdir, sizeof(classdir), "/sys/class/%s/%s", wdm_class[i - 1], de->d_name);
+		intf = usb_interface(classdir, path);
+		if (!intf)
+			continue;
+
+		if (n == size) {
+			size = size ? 2 * size : 16;
+			w = realloc(*found, size * sizeof(*w));
+			if (!w) {
+				closedir(d);
+				return -ENOMEM;
+			}
+			*found = w;
+		}
+		w = &(*found)[n++];
+		memset(w, 0, sizeof(*w));
+		copy_name(w->dev.wdm, sizeof(w->dev.wdm), de->d_name, strlen(de->d_name));
+		copy_name(w->intf, sizeof(w->intf), intf, strlen(intf));
+		copy_name(w->dev.usbdev, sizeof(w->dev.usbdev), intf, strcspn(intf, ":"));
+		w->dev.intf = sysfs_hex(path, "bInterfaceNumber");
+
+		snprintf(link, sizeof(link), "%s/device/driver", classdir);
+		len = readlink(link, target, sizeof(target) - 1);
+		if (len > 0) {
+			target[len] = 0;
+			p = strrchr(target, '/');
+			p = p ? p + 1 : target;
+			copy_name(w->dev.driver, sizeof(w->dev.driver), p, strlen(p));
+		}
+
+		/* vid:pid of the USB device */
+		*strrchr(path, '/') = 0;
+		w->dev.vid = sysfs_hex(path, "idVendor");
+		w->dev.pid = sysfs_hex(path, "idProduct");
+	}
+	closedir(d);
+	return n;
+}
+
+static int cmp_wdmdev(const void *a, const void *b)
+{
+	const struct wdmdev *x = a, *y = b;
+	int rc = strverscmp(x->wdm, y->wdm);
+
+	return rc ? rc : strverscmp(x->netdev, y->netdev);
+}
+
+int wdmdev_scan(struct wdmdev_index *idx)
+{
+	struct wdm_found *found = NULL;
+	char classdir[PATH_MAX], path[PATH_MAX];
+	struct wdmdev *dev;
+	struct dirent *de;
+	const char *intf;
+	size_t ulen;
+	DIR *d;
+	int i, n, match, rc = 0;
+
+	reset(idx);
+
+	/* before scanning, so that changes during the scan are noticed */
+	generation(idx->boot_id, sizeof(idx->boot_id), &idx->seqnum);
+
+	n = scan_wdm(&found);
+	if (n < 0)
+		return n;
+	qsort(found, n, sizeof(found[0]), cmp_wdmdev);
+
+	d = opendir("/sys/class/net");
+	if (!d) {
+		free(found);
+		return -errno;
+	}
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(classdir, sizeof(classdir), "/sys/class/net/%s", de->d_name);
+		intf = usb_interface(classdir, path);
+		if (!intf)
+			continue;
+
+		/* the same interface, or else the same USB device */
+		ulen = strcspn(intf, ":");
+		for (match = 0; match < n; match++)
+			if (!strcmp(found[match].intf, intf))
+				break;
+		if (match == n)
+			for (match = 0; match < n; match++)
+				if (strlen(found[match].dev.usbdev) == ulen &&
+				    !strncmp(found[match].dev.usbdev, intf, ulen))
+					break;
+		if (match == n)
+			continue;
+
+		if (!(dev = add_dev(idx))) {
+			rc = -ENOMEM;
+			break;
+		}
+		*dev = found[match].dev;
+		copy_name(dev->netdev, sizeof(dev->netdev), de->d_name, strlen(de->d_name));
+		found[match].used = 1;
+	}
+	closedir(d);
+
+	/* cdc-wdm devices without a network device */
+	for (i = 0; i < n && !rc; i++) {
+		if (found[i].used)
+			continue;
+		if (!(dev = add_dev(idx)))
+			rc = -ENOMEM;
+		else
+			*dev = found[i].dev;
+	}
+	free(found);
+
+	/* never save a partial index */
+	if (rc < 0) {
+		reset(idx);
+		return rc;
+	}
+	qsort(idx->dev, idx->n, sizeof(idx->dev[0]), cmp_wdmdev);
+	return idx->n;
+}
+
+int wdmdev_save(const struct wdmdev_index *idx)
+{
+	char tmp[sizeof(WDMDEV_CACHE) + 16];
+	const struct wdmdev *d;
+	FILE *f;
+	int i, rc;
+
+	if (!idx->boot_id[0])
+		return -ENOENT;
+
+	/* replace atomically, as readers do not lock */
+	snprintf(tmp, sizeof(tmp), "%s.%d", WDMDEV_CACHE, getpid());
+	f = fopen(tmp, "w");
+	if (!f)
+		return -errno;
+	fprintf(f, "# wdmdev %s %lu\n", idx->boot_id, idx->seqnum);
+	for (i = 0; i < idx->n; i++) {
+		d = &idx->dev[i];
+		fprintf(f, "%s %s %s %d %04x %04x %s\n", d->wdm, d->netdev[0] ? d->netdev : "-",
+			d->usbdev, d->intf, d->vid, d->pid, d->driver[0] ? d->driver : "-");
+	}
+	if (fclose(f) || rename(tmp, WDMDEV_CACHE)) {
+		rc = -errno;
+		unlink(tmp);
+		return rc;
+	}
+	return 0;
+}
+
+int wdmdev_load(struct wdmdev_index *idx)
+{
+	char boot_id[40], hdr[96], line[256];
+	unsigned long seqnum;
+	struct wdmdev *d, tmp;
+	FILE *f;
+	int rc;
+
+	if (generation(boot_id, sizeof(boot_id), &seqnum) < 0)
+		return wdmdev_scan(idx);
+
+	f = fopen(WDMDEV_CACHE, "r");
+	if (f) {
+		snprintf(hdr, sizeof(hdr), "# wdmdev %s %lu\n", boot_id, seqnum);
+		if (fgets(line, sizeof(line), f) && !strcmp(line, hdr)) {
+			reset(idx);
+			strcpy(idx->boot_id, boot_id);
+			idx->seqnum = seqnum;
+			rc = 0;
+			while (!rc && fgets(line, sizeof(line), f)) {
+				memset(&tmp, 0, sizeof(tmp));
+				if (sscanf(line, "%31s %31s %31s %d %hx %hx %31s", tmp.wdm, tmp.netdev,
+					   tmp.usbdev, &tmp.intf, &tmp.vid, &tmp.pid, tmp.driver) != 7)
+					continue;
+				if (!strcmp(tmp.netdev, "-"))
+					tmp.netdev[0] = 0;
+				if (!strcmp(tmp.driver, "-"))
+					tmp.driver[0] = 0;
+				d = add_dev(idx);
+				if (d)
+					*d = tmp;
+				else
+					rc = -ENOMEM;
+			}
+			fclose(f);
+			if (!rc)
+				return idx->n;
+		} else {
+			fclose(f);
+		}
+	}
+
+	rc = wdmdev_scan(idx);
+
+	/* fails unless root, which is fine */
+	if (rc >= 0)
+		wdmdev_save(idx);
+	return rc;
+}
+
+const struct wdmdev *wdmdev_find(const struct wdmdev_index *idx, const char *name)
+{
+	const char *base = strrchr(name, '/');
+	int i;
+
+	base = base ? base + 1 : name;
+	if (!*base)
+		return NULL;
+	for (i = 0; i < idx->n; i++)
+		if (!strcmp(idx->dev[i].wdm, base) || !strcmp(idx->dev[i].netdev, base))
+			return &idx->dev[i];
+	return NULL;
+}
@@ -0,0 +1,67 @@
+/*
+ * wdmdev.h - index of cdc-wdm devices, their USB device and netdev
+ *
+ *  Copyright 2013 Bjørn Mork <bjorn@mork.no>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License.
+ *
+ * The index is built from sysfs in one pass over the cdc-wdm and
+ * network devices.  A network device is paired with the cdc-wdm
+ * device on the same USB interface, as created by qmi_wwan and
+ * cdc_mbim, or else the first cdc-wdm device on the same USB device.
+ *
+ * The index is cached as text, so that wdm-lookup, which the scripts
+ * use, answers without scanning sysfs:
+ *
+ *   # wdmdev <boot_id> <uevent_seqnum>
+ *   <cdc-wdm> <netdev or -> <USB device> <interface> <vid> <pid> <driver>
+ *
+ * Adding or removing a device bumps /sys/kernel/uevent_seqnum, so the
+ * cache is valid as long as the sequence number and boot id match.
+ */
+
+#ifndef _WDMDEV_H
+#define _WDMDEV_H
+
+#include <linux/types.h>
+
+#define WDMDEV_CACHE	"/var/run/wdmdev.cache"
+
+struct wdmdev {
+	char wdm[32];		/* "cdc-wdm0" */
+	char netdev[32];	/* "wwan0", or "" if none */
+	char usbdev[32];	/* "2-1" */
+	int intf;		/* interface number of the cdc-wdm device */
+	__u16 vid;
+	__u16 pid;
+	char driver[32];	/* "qmi_wwan", "cdc_mbim", .. */
+};
+
+/* grows as needed.  A zeroed index is empty */
+struct wdmdev_index {
+	char boot_id[40];
+	unsigned long seqnum;
+	int n;
+	int size;		/* allocated */
+	struct wdmdev *dev;
+};
+
+/* build the index from sysfs.  Returns the number of entries or -errno */
+int wdmdev_scan(struct wdmdev_index *idx);
+
+/*
+ * Read the cache, or scan and try to update the cache if it is stale
+ * or missing.  Returns the number of entries or -errno
+ */
+int wdmdev_load(struct wdmdev_index *idx);
+
+int wdmdev_save(const struct wdmdev_index *idx);
+
+void wdmdev_free(struct wdmdev_index *idx);
+
+/* find by cdc-wdm name or path, or by network device name */
+const struct wdmdev *wdmdev_find(const struct wdmdev_index *idx, const char *name);
+
+#endif /* _WDMDEV_H */
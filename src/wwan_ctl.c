@@ -8,31 +8,40 @@ License: GPLv2
 #include <string.h>
 #include <sys/ioctl.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <termios.h>
+#include <unistd.h>
+#include "atcmd.h"
 
-/* list of supported USB devices (pid:vid) */
-static char *supported[] = {
-	"0bdb:1900",		/* Ericsson Business Mobile Networks BV F3507g Mobile Broadband Module */
-	NULL			/* list terminator */
-};
+static int timeout = 10;	/* per command timeout, in seconds */
+static int net_timeout = 30;	/* network registration and (dis)connect timeout, in seconds */
 
-
-static int timeout = 10;	/* read timeout */
+#define CONNECT_RETRIES	3	/* when reporting *E2NAP: 0 */
 
 /* default values for options */
-static char wwan_apn[] = "";	/* null APN may often Just Work(tm) */
+static const char *wwan_apn = "";	/* null APN may often Just Work(tm) */
 static int wwan_poweroff = 1;	/* power off radio when interface goes down? */
-static char wwan_gpstty[] = "";
 static int wwan_mode = 1;	/* Radio mode 1=auto, 5=GSM, 6=UTRAN */
 static int wwan_roaming_ok = 0;	/* Disallow roaming by default */
 static int wwan_debug = 0;
-static char wwan_cfg_file[] = "/etc/default/wwan_ctl";
 static int wwan_simpin = -1;    /* a 4 digit decimal number between 0000 and 9999 */
 
 /* global variables */
 static struct termios restore_tios;
+static struct at_chan at;
+static int account;		/* the +CGDCONT account number */
+
+/* modem state, as reported by URCs. -1 if unknown */
+static struct {
+	int nap;		/* *E2NAP: 0 disconnected, 1 connected, 2 connecting */
+	int cfun;		/* *E2CFUN power status: 1, 5, 6 on, 4 off */
+	int reg;		/* +CGREG: 1 home, 5 roaming, 0, 2, 4 searching, 3 denied */
+	int sim_ready;		/* +CPIN: READY */
+	int pacsp;		/* +PACSP0 after power up */
+} state = { -1, -1, -1, 0, 0 };
 
 void dbg(const char *str, ...)
 {
@@ -76,12 +85,13 @@ int wwan_getmgmt_fd(const char *device)
 	/* FIXME: don't do any termios things if we use a cdc-wdm device (which is *not* a tty!) */
 
 	/* get current tty settings */
-	if (tcgetattr(fd, &tios) < 0)
-		if (errno = ENOTTY)
+	if (tcgetattr(fd, &tios) < 0) {
+		if (errno == ENOTTY)
 			/* don't do any termios things if we use a cdc-wdm device (which is *not* a tty!) */
 			return fd;
 		else
 			fatal("%s(): tcgetattr: %m\n", __FUNCTION__);
+	}
 
 	/* save'em so we can restor on exit */
 	memcpy(&restore_tios, &tios, sizeof(restore_tios));
@@ -108,9 +118,157 @@ int wwan_getmgmt_fd(const char *device)
 	return fd;
 }
 
+/* the n'th comma separated number of "+XXX: a,b,..", or -1 */
+static int field(const char *line, int n)
+{
+	const char *p = strchr(line, ':');
+
+	if (!p)
+		return -1;
+	p++;
+	while (n-- > 0) {
+		p = strchr(p, ',');
+		if (!p)
+			return -1;
+		p++;
+	}
+	p += strspn(p, " \"");
+	return isdigit(*p) ? atoi(p) : -1;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* update the modem state from a URC */
+static void urc(const char *line)
+{
+	if (wwan_debug)
+		dbg("URC: %s\n", line);
+
+	if (!strncmp(line, "*E2NAP:", 7))
+		state.nap = field(line, 0);
+	else if (!strncmp(line, "*E2CFUN:", 8))	/* "*E2CFUN: 1,4,0" means power status = 4 */
+		state.cfun = field(line, 1);
+	else if (!strncmp(line, "+CGREG:", 7))	/* "+CGREG: 1,"4EE9","00C9A2D6",2" */
+		state.reg = field(line, 0);
+	else if (!strncmp(line, "+CPIN:", 6))
+		state.sim_ready = !strcmp(line, "+CPIN: READY");
+	else if (!strncmp(line, "+PACSP", 6))
+		state.pacsp = 1;
+	else if (!strcmp(line, "*EMRDY: 1"))
+		printf("Card is ready for commands\n");
+}
+
+/*
+ * wait for and handle the next URC.  Returns 1, or 0 if the deadline
+ * passed, or -errno
+ */
+static int event(long long deadline)
+{
+	char line[AT_LINE_MAX];
+	int rc;
+
+	rc = at_urc(&at, line, sizeof(line), deadline - now_ms());
+	if (rc > 0) {
+		urc(line);
+		return 1;
+	}
+	return rc;
+}
+
+/* run an AT command, handling any URCs received meanwhile */
+int cmd(const char *cmd, struct at_resp *resp)
+{
+	char line[AT_LINE_MAX];
+	int rc;
+
+	rc = at_cmd(&at, cmd, resp, timeout * 1000);
+	if (wwan_debug) {
+		if (resp && resp->len)
+			dbg("%s: %s", cmd, resp->buf);
+		dbg("%s: %s\n", cmd, at_result_str(rc));
+	}
+	while (at.urc_n && at_urc(&at, line, sizeof(line), 0) > 0)
+		urc(line);
+	return rc;
+}
+
+/* "+CPIN: SIM PIN\n" => "SIM PIN" */
+static const char *cpin_status(char *buf)
+{
+	char *p = strstr(buf, "+CPIN: ");
+
+	if (!p)
+		return "";
+	p += 7;
+	p[strcspn(p, "\n")] = 0;
+	return p;
+}
+
 int wwan_verify_pin(void)
 {
-	return -1;
+	char buf[256], pin[32];
+	struct at_resp resp = { .buf = buf, .size = sizeof(buf) };
+	long long deadline = now_ms() + timeout * 1000;
+	const char *status;
+	int pinsent = 0, rc;
+
+	while (now_ms() < deadline) {
+		if (cmd("AT+CPIN?", &resp) != AT_OK) {
+			printf("Card did not accept \"AT+CPIN?\" command - bailing out\n");
+			return 1;
+		}
+		status = cpin_status(buf);
+		if (!strcmp(status, "READY"))
+			return 0;
+
+		if (!strcmp(status, "SIM PIN")) {
+			if (pinsent) {
+				printf("Refusing to enter the same PIN code twice!\n");
+				return 4;
+			}
+			if ((wwan_simpin < 0) || (wwan_simpin > 9999)) { /* sane? */
+				printf("SIM PIN code requested, but none configured\n");
+				return 3;
+			}
+			sprintf(pin, "AT+CPIN=\"%04d\"", wwan_simpin);
+			pinsent = 1;
+			state.sim_ready = 0;
+			if (cmd(pin, NULL) != AT_OK) {
+				printf("Yay! I might use the wrong pincode - please fix before SIM is locked\n");
+				return 1;
+			}
+			if (state.sim_ready)
+				return 0;
+			continue;
+		}
+
+		/*
+		 * PH-SIM PIN is reported for a short while after entering
+		 * the PIN code.  Recheck on +PACSP, when the SIM is ready
+		 */
+		if (!strcmp(status, "PH-SIM PIN")) {
+			state.sim_ready = 0;
+			state.pacsp = 0;
+			while (!state.sim_ready && !state.pacsp) {
+				rc = event(deadline);
+				if (rc <= 0)
+					return rc < 0 ? 1 : 2;
+			}
+			if (state.sim_ready)
+				return 0;
+			continue;
+		}
+
+		printf("Card requested \"%s\" - bailing out\n", status);
+		return 4;
+	}
+	return 2; /* timeout */
 }
 
 int wwan_enable_gps(void)
@@ -118,67 +276,325 @@ int wwan_enable_gps(void)
 	return -1;
 }
 
+/* Better just check whether we're already connected before continuing */
 int wwan_connected(void)
 {
-	return -1;
+	char buf[64];
+	struct at_resp resp = { .buf = buf, .size = sizeof(buf) };
+	int rc;
+
+	rc = cmd("AT*ENAP?", &resp);
+	if (rc < 0)
+		return 2;
+
+	/* ERROR is expected at this point if the radio is powered down */
+	if (rc != AT_OK)
+		return 1;
+	state.nap = field(buf, 0);
+	return state.nap == 1 ? 0 : 1;
 }
 
+/*
+ * Use the first account with the configured APN, or else create one
+ * after the highest account number in use
+ */
 int wwan_configure_account(void)
 {
-	return -1;
+	char buf[1024], apn[128], line[160];
+	struct at_resp resp = { .buf = buf, .size = sizeof(buf) };
+	char *p, *next;
+	int num, highest = 0;
+
+	if (cmd("AT+CGDCONT?", &resp) != AT_OK) {
+		printf("Failed to read accounts\n");
+		return 1;
+	}
+
+	snprintf(apn, sizeof(apn), "\"%s\"", wwan_apn);
+	for (p = buf; *p; p = next) {
+		next = p + strcspn(p, "\n");
+		if (*next)
+			*next++ = 0;
+		num = field(p, 0);
+		if (num < 0)
+			continue;
+
+		/* +CGDCONT: <cid>,<PDP_type>,<APN>,... */
+		p = strchr(p, ',');
+		if (p)
+			p = strchr(p + 1, ',');
+		if (p && !strncmp(p + 1, apn, strlen(apn)) && !account) {
+			account = num;
+			return 0;
+		}
+		if (num > highest)
+			highest = num;
+	}
+
+	account = highest + 1;
+	printf("Creating new account number %d for \"%s\"\n", account, wwan_apn);
+	snprintf(line, sizeof(line), "AT+CGDCONT=%d,\"IP\",%s", account, apn);
+	if (cmd(line, NULL) != AT_OK) {
+		printf("Failed to create an account\n");
+		return 1;
+	}
+	return 0;
 }
 
+/* power on the radio and wait for network registration */
 int wwan_power_radio_on(void)
 {
-	return -1;
+	char buf[128], line[32];
+	struct at_resp resp = { .buf = buf, .size = sizeof(buf) };
+	long long deadline;
+	int rc, reg = -1;
+
+	/*
+	 * poll once in case the card was powered on, and turn on power
+	 * status and network registration reporting, making further
+	 * polls unnecessary
+	 */
+	state.cfun = -1;
+	state.reg = -1;
+	if (cmd("AT+CFUN?;*E2CFUN=1;+CGREG=2", &resp) != AT_OK) {
+		printf("Failed to power on radio\n");
+		return 1;
+	}
+	switch (field(buf, 0)) {
+	case 1:
+	case 5:
+	case 6:
+		printf("Already on\n");
+		/* the URC only reports changes */
+		resp.len = 0;
+		if (cmd("AT+CGREG?", &resp) == AT_OK)
+			reg = field(buf, 1);	/* "+CGREG: 2,1,"4EE9","00C9A2D6",2" */
+		break;
+	case 4:
+		printf("Powering on radio\n");
+		sprintf(line, "AT+CFUN=%d", wwan_mode);
+		if (cmd(line, NULL) != AT_OK) {
+			printf("Failed to power on radio\n");
+			return 1;
+		}
+		break;
+	default:
+		printf("Unknown radio status: \"%s\"\n", buf);
+		return 3;
+	}
+
+	/* a URC received meanwhile is newer */
+	if (state.reg < 0)
+		state.reg = reg;
+
+	deadline = now_ms() + net_timeout * 1000;
+	while (1) {
+		switch (state.reg) {
+		case -1:
+		case 0:
+			break;
+		case 1:
+			printf("Registered to home network\n");
+			return 0;
+		case 2:
+			printf("Searching for network...\n");
+			break;
+		case 3:
+			printf("Network registration denied - contact operator\n");
+			return 3;
+		case 4:
+			printf("Registering...\n");
+			break;
+		case 5:
+			if (wwan_roaming_ok) {
+				printf("Roaming.  Be aware that this can be expensive\n");
+				return 0;
+			}
+			printf("Roaming.  Denied by policy.  Please see documentation\n");
+			return 3;
+		default:
+			printf("A rather unexpected +CGREG status code: %d\n", state.reg);
+			return 3;
+		}
+		rc = event(deadline);
+		if (rc < 0)
+			return 1;
+		if (!rc)
+			return 2; /* timeout */
+	}
+}
+
+/* the milliseconds since start, as "1.234" seconds */
+static const char *elapsed(long long start, char *buf, size_t size)
+{
+	long long ms = now_ms() - start;
+
+	snprintf(buf, size, "%lld.%03lld", ms / 1000, ms % 1000);
+	return buf;
 }
 
 int wwan_connect(void)
 {
-	return -1;
+	char line[64], t[32];
+	long long start = now_ms(), deadline = start + net_timeout * 1000;
+	int rc, retries = CONNECT_RETRIES;
+
+	/*
+	 * Turning on status reporting fails if not fully powered up.
+	 * +PACSP0 is reported when ready, so retry then
+	 */
+	state.pacsp = 0;
+	if (cmd("AT*E2NAP=1;+CMEE=2", NULL) != AT_OK) {
+		while (!state.pacsp) {
+			rc = event(deadline);
+			if (rc <= 0)
+				return rc < 0 ? 1 : 2;
+		}
+		if (cmd("AT*E2NAP=1;+CMEE=2", NULL) != AT_OK)
+			return 1;
+	}
+
+	state.nap = -1;
+	sprintf(line, "AT*ENAP=1,%d", account);
+	if (cmd(line, NULL) != AT_OK)
+		return 1;
+
+	while (1) {
+		switch (state.nap) {
+		case 0:
+			if (!retries--) {
+				printf("Not connected after %s seconds\n", elapsed(start, t, sizeof(t)));
+				return 1;
+			}
+			printf("Not connected. Retrying...\n");
+			state.nap = -1;
+			if (cmd(line, NULL) != AT_OK)
+				return 1;
+			break;
+		case 1:
+			printf("Connected in %s seconds\n", elapsed(start, t, sizeof(t)));
+			return 0;
+		case 2:
+			printf("Connection in progress...\n");
+			break;
+		case -1:
+			break;
+		default:
+			printf("Unknown status: %d\n", state.nap);
+		}
+		rc = event(deadline);
+		if (rc < 0)
+			return 1;
+		if (!rc)
+			return 2; /* timeout */
+	}
 }
 
+/*
+ * FIXME:  Should we power down radio here?  What if someone else is using
+ * the GPS or one of the ACM tty's (e.g. a SMS service daemon)?
+ * Let's make it a configuration issue while we're thinking
+ */
 int wwan_disconnect(void)
 {
-	return -1;
+	char t[32];
+	long long start = now_ms(), deadline = start + net_timeout * 1000;
+	int rc;
+
+	state.nap = -1;
+	state.cfun = -1;
+	if (!wwan_connected()) {
+		if (cmd("AT*ENAP=0;*E2NAP=1;*E2CFUN=1", NULL) != AT_OK)
+			return 1;
+		while (state.nap != 0) {
+			rc = event(deadline);
+			if (rc <= 0)
+				return rc < 0 ? 1 : 2;
+		}
+		printf("Disconnected in %s seconds\n", elapsed(start, t, sizeof(t)));
+	}
+	if (!wwan_poweroff)
+		return 0;
+
+	printf("Powering down radio\n");
+	if (cmd("AT+CFUN=4;*E2CFUN=1", NULL) != AT_OK)
+		return 1;
+	while (state.cfun != 4) {
+		rc = event(deadline);
+		if (rc <= 0)
+			return rc < 0 ? 1 : 2;
+	}
+	printf("Radio is off\n");
+	return 0;
 }
 
-int cmd(int fd, const char *cmd, char *buf, ssize_t bufsize)
+static void print_resp(const char *cmd, struct at_resp *resp, int rc)
 {
-	char *p;
-	ssize_t n = 0;
-	int ok = 0;
+	char line[AT_LINE_MAX];
 
-	if (wwan_debug > 1)
-		fprintf(stderr, "%s() called with fd=%d, cmd=%s, buf=%p, bufsize=%d\n", __FUNCTION__, fd, cmd, buf, bufsize);
+	if (resp->len)
+		fprintf(stderr, "%s: %s%s", cmd, resp->buf, resp->truncated ? "...\n" : "");
+	if (rc == AT_CME_ERROR || rc == AT_CMS_ERROR)
+		fprintf(stderr, "%s: %s: %d\n", cmd, at_result_str(rc), resp->err);
+	else
+		fprintf(stderr, "%s: %s\n", cmd, at_result_str(rc));
+	while (at.urc_n && at_urc(&at, line, sizeof(line), 0) > 0)
+		fprintf(stderr, "URC: %s\n", line);
+}
 
-	sprintf(buf, "%s\r\n", cmd);
-	write(fd, buf, strlen(buf));
-	tcdrain(fd);
+/* run commands one at a time, up to the first failure.  Returns the number completed */
+int sequence(const char *const cmds[], int n, struct at_resp resps[])
+{
+	int i, done;
 
-	while (!ok) {
-		p = buf + n;
-		n += read(fd, p, bufsize - n);
-		buf[n] = 0;
-		if (strstr(p, "OK"))
-			ok = 1;
-		else if (strstr(p, "ERROR"))
-			ok = -1;
-	}
-	if (wwan_debug > 1)
-		fprintf(stderr, "ok=%d, n=%d\n", ok, n);
-	return n;
+	done = at_sequence(&at, cmds, n, resps, timeout * 1000);
+	for (i = 0; i < n && i <= done; i++)
+		print_resp(cmds[i], &resps[i], resps[i].result);
+	return done;
 }
 
 int do_up(void)
 {
-	
-	return -1;
+	char t[32];
+	long long start = now_ms();
+
+	if (wwan_verify_pin())
+		return 1;
+	if (!wwan_connected())
+		return 0;
+	if (wwan_configure_account() || wwan_power_radio_on() || wwan_connect())
+		return 1;
+	printf("Interface up in %s seconds\n", elapsed(start, t, sizeof(t)));
+	return 0;
 }
 
 int do_down(void)
 {
-	return -1;
+	if (wwan_verify_pin() || wwan_disconnect())
+		return 1;
+	return 0;
+}
+
+/* print the modem identity and status */
+int do_info(void)
+{
+	static const char *const init[] = { "ATI", "AT+CPIN?" };
+	static const char *const info[] = { "AT+CGSM?", "AT+GGSM?" };
+	char buf[2][1024];
+	struct at_resp resp[2];
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		memset(&resp[i], 0, sizeof(resp[i]));
+		resp[i].buf = buf[i];
+		resp[i].size = sizeof(buf[i]);
+	}
+
+	if (sequence(init, 2, resp) < 2)
+		return 1;
+	if (strstr(buf[1], "+CPIN: SIM PIN") && wwan_verify_pin())
+		return 1;
+	return sequence(info, 2, resp) < 2;
 }
 
 int do_gps(void)
@@ -189,40 +605,47 @@ int do_gps(void)
 
 int main(int argc, char **argv)
 {
-	int mgmt_fd;
-	ssize_t c;
-	char buf[128];
-	struct termios tios, restore_tios;
-
-/*
-	if (argc != 1)
-		fatal("usage: %s gps|start|stop\n", argv[0]);
-*/
-	if (argc == 2)
-		mgmt_fd = wwan_getmgmt_fd(argv[1]);
+	const char *device = "/dev/ttyACM1", *action = "info", *phase, *env;
+	int mgmt_fd, rc;
+
+	if (argc > 3)
+		fatal("usage: %s [<device>] [info|start|stop]\n", argv[0]);
+	if (argc > 1)
+		device = argv[1];
+	if (argc > 2)
+		action = argv[2];
+
+	/* run by ifupdown in the pre-up and post-down phases? */
+	phase = getenv("PHASE");
+	if (argc < 3 && phase && !strcmp(phase, "pre-up"))
+		action = "start";
+	if (argc < 3 && phase && !strcmp(phase, "post-down"))
+		action = "stop";
+
+	/* use interface specific settings if specified */
+	env = getenv("IF_WWAN_APN");
+	if (env)
+		wwan_apn = env;
+	env = getenv("WWAN_PIN");
+	if (env)
+		wwan_simpin = atoi(env);
+	env = getenv("WWAN_DEBUG");
+	if (env)
+		wwan_debug = atoi(env);
+
+	mgmt_fd = wwan_getmgmt_fd(device);
+	at_init(&at, mgmt_fd);
+	at.debug = wwan_debug > 1;
+
+	if (!strcmp(action, "start"))
+		rc = do_up();
+	else if (!strcmp(action, "stop"))
+		rc = do_down();
+	else if (!strcmp(action, "gps"))
+		rc = do_gps();
 	else
-		mgmt_fd = wwan_getmgmt_fd("/dev/ttyACM1");
-
-	c = cmd(mgmt_fd, "ATI", buf, sizeof(buf));
-	fprintf(stderr, "%s", buf);
-
-	c = cmd(mgmt_fd, "AT+CPIN?", buf, sizeof(buf));
-	fprintf(stderr, "%s", buf);
-
-	if (strstr(buf, "+CPIN: SIM PIN")) {
-		if ((wwan_simpin < 0) || (wwan_simpin > 9999)) /* sane? */
-			fatal("SIM PIN required");
-		sprintf(buf, "AT+CPIN=\"%04d\"", wwan_simpin);
-		c = cmd(mgmt_fd, buf, buf, sizeof(buf));
-		fprintf(stderr, "%s", buf);
-	}		
-
-	c = cmd(mgmt_fd, "AT+CGSM?", buf, sizeof(buf));
-	fprintf(stderr, "%s", buf);
-
-	c = cmd(mgmt_fd, "AT+GGSM?", buf, sizeof(buf));
-	fprintf(stderr, "%s", buf);
+		rc = do_info();
 
         close (mgmt_fd);
-        return 0;
+        return rc ? 1 : 0;
 }